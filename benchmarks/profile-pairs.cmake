@@ -0,0 +1,140 @@
+# Copyright (C) 2022 OverMighty
+# SPDX-License-Identifier: GPL-3.0-only
+
+# Regenerates the pair profile from which bytecode superinstructions are
+# selected, by running the example and benchmark programs with an
+# `i-use-arch-btw` executable built with `-DIUAB_BYTECODE_PROFILE_PAIRS=ON` and
+# summing the counts of the pairs of instructions it prints. Usage:
+#
+#     cmake -D IUAB_EXECUTABLE=<path> -D OUTPUT=<path> -P profile-pairs.cmake
+#
+# The programs are compiled into bytecode files before being run so that they
+# are interpreted even if JIT compilation is used.
+
+cmake_minimum_required(VERSION 3.23)
+
+if(NOT IUAB_EXECUTABLE OR NOT OUTPUT)
+    message(FATAL_ERROR "IUAB_EXECUTABLE and OUTPUT must be defined.")
+endif()
+
+get_filename_component(root "${CMAKE_CURRENT_LIST_DIR}/.." ABSOLUTE)
+set(work_dir "${CMAKE_CURRENT_BINARY_DIR}/bytecode-pairs")
+file(MAKE_DIRECTORY "${work_dir}")
+
+# Inputs of the programs, which read lines of text ending with a new line.
+string(REPEAT "The quick brown fox jumps over the lazy dog. " 3 sort_line)
+string(REPEAT "The quick brown fox jumps over the lazy dog. " 60 reverse_line)
+string(REPEAT "The quick brown fox jumps over the lazy dog. " 1000 shift_line)
+file(WRITE "${work_dir}/empty.txt" "")
+file(WRITE "${work_dir}/character.txt" "x\n")
+file(WRITE "${work_dir}/sort.txt" "${sort_line}\n")
+file(WRITE "${work_dir}/reverse.txt" "${reverse_line}\n")
+file(WRITE "${work_dir}/shift.txt" "${shift_line}\n")
+
+# `echo.archbtw`, which only stops at a null character, and
+# `i-use-arch-btw-forever.archbtw`, which never stops, are left out.
+set(
+    programs
+    examples/alphabet.archbtw
+    examples/debug-info.archbtw
+    examples/hello-world.archbtw
+    examples/print-null-char.archbtw
+    examples/reverse.archbtw
+    benchmarks/bubble-sort.archbtw
+    benchmarks/nested-loops.archbtw
+    benchmarks/shift.archbtw
+    benchmarks/triangle.archbtw
+)
+set(
+    inputs
+    empty.txt
+    character.txt
+    empty.txt
+    empty.txt
+    reverse.txt
+    sort.txt
+    character.txt
+    shift.txt
+    character.txt
+)
+
+set(pairs "")
+
+foreach(program input IN ZIP_LISTS programs inputs)
+    get_filename_component(name "${program}" NAME_WE)
+    set(bytecode "${work_dir}/${name}.iuabc")
+
+    execute_process(
+        COMMAND "${IUAB_EXECUTABLE}" -c "${bytecode}" "${root}/${program}"
+        RESULT_VARIABLE result
+    )
+
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "Failed to compile ${program}.")
+    endif()
+
+    execute_process(
+        COMMAND "${IUAB_EXECUTABLE}" "${bytecode}"
+        INPUT_FILE "${work_dir}/${input}"
+        OUTPUT_QUIET
+        ERROR_VARIABLE errors
+        RESULT_VARIABLE result
+    )
+
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "Failed to run ${program}:\n${errors}")
+    endif()
+
+    string(REPLACE "\n" ";" lines "${errors}")
+
+    foreach(line IN LISTS lines)
+        if(NOT line MATCHES "^([0-9]+) ([a-z0-9]+) ([a-z0-9]+)$")
+            continue()
+        endif()
+
+        set(pair "${CMAKE_MATCH_2} ${CMAKE_MATCH_3}")
+        set(count "count_${CMAKE_MATCH_2}_${CMAKE_MATCH_3}")
+
+        if(NOT DEFINED ${count})
+            list(APPEND pairs "${pair}")
+            set(${count} 0)
+        endif()
+
+        math(EXPR ${count} "${${count}} + ${CMAKE_MATCH_1}")
+    endforeach()
+endforeach()
+
+if(NOT pairs)
+    message(
+        FATAL_ERROR
+        "No pairs were printed. ${IUAB_EXECUTABLE} must be built with "
+        "-DIUAB_BYTECODE_PROFILE_PAIRS=ON."
+    )
+endif()
+
+set(lines "")
+
+foreach(pair IN LISTS pairs)
+    string(REPLACE " " "_" count "count_${pair}")
+    list(APPEND lines "${${count}} ${pair}")
+endforeach()
+
+list(SORT lines COMPARE NATURAL ORDER DESCENDING)
+list(JOIN lines "\n" lines)
+
+file(
+    WRITE "${OUTPUT}"
+    "# Profile of the pairs of I use Arch btw bytecode instructions run in a row, as
+# `<count> <first> <second>` lines, from which the most frequent ones become
+# superinstructions.
+#
+# Generated by `benchmarks/profile-pairs.cmake` from runs of the example and
+# benchmark programs at the default optimization level. Regenerate it by
+# building the `bytecode-pairs` target with libiuab configured with
+# `-DIUAB_BYTECODE_PROFILE_PAIRS=ON`, which makes it print the pairs it runs to
+# stderr. Only pairs that may be fused are printed: jumps, which the next
+# instruction is the target of, are only second, and `ret`, `debug`, `store`
+# and `writes` are never part of one.
+${lines}
+"
+)
@@ -1,13 +1,16 @@
 // Copyright (C) 2022 OverMighty
 // SPDX-License-Identifier: GPL-3.0-only
 
+#include "compile_and_run.h"
 #include "debug_handler.h"
 #include "log.h"
 
 #include "iuab/buffer.h"
 #include "iuab/context.h"
 #include "iuab/errors.h"
+#include "iuab/ir.h"
 #include "iuab/targets.h"
+#include "iuab/targets/bytecode.h"
 #include "iuab/token.h"
 
 #include <errno.h>
@@ -23,9 +26,58 @@
     #define COMPILE_AND_RUN_TARGET IUAB_TARGET_BYTECODE
 #endif
 
-int compile(enum iuab_target target, FILE *src, struct iuab_buffer *dst) {
+// The number of loops printed from the profile of a program.
+#define PROFILE_MAX_LOOPS 10
+
+void print_stats(
+    enum iuab_target target,
+    const struct iuab_compile_stats *stats
+) {
+    LOG_INFO(
+        "evaluated %zu nodes at compile time\n",
+        stats->ir.evaluated_nodes
+    );
+    LOG_INFO(
+        "removed %zu bounds checks\n",
+        stats->ir.removed_bounds_checks
+    );
+    LOG_INFO("compiled to %zu bytes of code\n", stats->code_size);
+
+    if (iuab_target_is_jit(target)) {
+        LOG_INFO(
+            "saved %zu bytes with branch relaxation\n",
+            stats->relaxation_saved_size
+        );
+        LOG_INFO(
+            "added %zu bytes of padding aligning loops\n",
+            stats->alignment_padding_size
+        );
+        LOG_INFO(
+            "saved %zu bytes and %zu instructions with peephole optimization\n",
+            stats->peephole_saved_size,
+            stats->peephole_saved_instructions
+        );
+    }
+}
+
+int compile(
+    enum iuab_target target,
+    FILE *src,
+    const struct compile_and_run_options *opts,
+    struct iuab_buffer *dst,
+    struct iuab_buffer *source_map_dst
+) {
+    struct iuab_compile_stats stats;
+    struct iuab_compile_options compile_opts;
+    iuab_compile_options_init(&compile_opts);
+    compile_opts.opt_level = opts->opt_level;
+    compile_opts.is_memory_guarded = iuab_target_is_jit(target);
+    compile_opts.stats_dst = &stats;
+    compile_opts.source_map_dst = source_map_dst;
+
     struct iuab_token last_token;
-    enum iuab_error error = iuab_compile(target, src, dst, &last_token);
+    enum iuab_error error =
+        iuab_compile(target, src, &compile_opts, dst, &last_token);
 
     if (error != IUAB_ERROR_SUCCESS) {
         LOG_ERROR(
@@ -37,13 +89,52 @@ int compile(enum iuab_target target, FILE *src, struct iuab_buffer *dst) {
         return EXIT_FAILURE;
     }
 
+    if (opts->print_stats) {
+        print_stats(target, &stats);
+    }
+
     return EXIT_SUCCESS;
 }
 
-int run(enum iuab_target target, const struct iuab_buffer *program) {
+int run(
+    enum iuab_target target,
+    const uint8_t *program,
+    const struct iuab_bytecode_prepared *prepared,
+    struct iuab_bytecode_profile *profile
+) {
     struct iuab_context ctx;
-    iuab_context_init(&ctx, program->data, stdin, stdout, debug_handler);
-    enum iuab_error error = iuab_run(target, &ctx);
+    enum iuab_error error = IUAB_ERROR_SUCCESS;
+
+    // JIT-compiled programs rely on guard regions instead of bounds checks.
+    if (iuab_target_is_jit(target)) {
+        error = iuab_context_init_guarded(
+            &ctx,
+            program,
+            stdin,
+            stdout,
+            debug_handler
+        );
+    } else {
+        iuab_context_init(&ctx, program, stdin, stdout, debug_handler);
+    }
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        LOG_ERROR("failed to init context: %s\n", iuab_strerror(error));
+        return EXIT_FAILURE;
+    }
+
+    // Bytecode programs are either compiled or verified when loaded.
+    if (profile) {
+        error = iuab_run_profiled_bytecode(&ctx, profile);
+    } else if (prepared) {
+        error = iuab_run_prepared_bytecode(&ctx, prepared);
+    } else if (target == IUAB_TARGET_BYTECODE) {
+        error = iuab_run_verified_bytecode(&ctx);
+    } else {
+        error = iuab_run(target, &ctx);
+    }
+
+    int status = EXIT_SUCCESS;
 
     if (error != IUAB_ERROR_SUCCESS) {
         LOG_ERROR(
@@ -52,21 +143,184 @@ int run(enum iuab_target target, const struct iuab_buffer *program) {
             (void *) ctx.ip,
             (void *) (ctx.ip - ctx.program)
         );
+        status = EXIT_FAILURE;
+    }
+
+    iuab_context_fini(&ctx);
+    return status;
+}
+
+int save_profile(
+    const struct iuab_bytecode_profile *profile,
+    const uint8_t *program,
+    const struct iuab_bytecode_source_map_entry *source_map,
+    size_t source_map_size,
+    const char *filename
+) {
+    FILE *out = fopen(filename, "we");
+
+    if (!out) {
+        LOG_ERROR("failed to open profile file: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    enum iuab_error error = iuab_bytecode_profile_save(
+        profile,
+        program,
+        source_map,
+        source_map_size,
+        out
+    );
+
+    if (fclose(out) != 0 && error == IUAB_ERROR_SUCCESS) {
+        error = IUAB_ERROR_IO;
+    }
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        LOG_ERROR("failed to save profile: %s\n", iuab_strerror(error));
         return EXIT_FAILURE;
     }
 
     return EXIT_SUCCESS;
 }
 
-int compile_and_run(const char *filename) {
-    FILE *src = fopen(filename, "rbe");
+// Runs the given bytecode program of `program_size` bytes while profiling it,
+// then writes its profile to the file with the given name and prints its
+// hottest loops.
+int profile_and_run(
+    const uint8_t *program,
+    size_t program_size,
+    const struct iuab_bytecode_source_map_entry *source_map,
+    size_t source_map_size,
+    const char *filename
+) {
+    struct iuab_bytecode_profile profile;
+    enum iuab_error error = iuab_bytecode_profile_init(&profile, program_size);
 
-    if (!src) {
-        LOG_ERROR("failed to open source file: %s\n", strerror(errno));
+    if (error != IUAB_ERROR_SUCCESS) {
+        LOG_ERROR("failed to init profile: %s\n", iuab_strerror(error));
+        return EXIT_FAILURE;
+    }
+
+    int status = run(IUAB_TARGET_BYTECODE, program, NULL, &profile);
+
+    if (save_profile(&profile, program, source_map, source_map_size, filename)
+        == EXIT_SUCCESS) {
+        LOG_INFO("wrote profile to %s\n", filename);
+    } else {
+        status = EXIT_FAILURE;
+    }
+
+    error = iuab_bytecode_profile_print(
+        &profile,
+        program,
+        source_map,
+        source_map_size,
+        PROFILE_MAX_LOOPS,
+        stderr
+    );
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        LOG_ERROR("failed to print profile: %s\n", iuab_strerror(error));
+        status = EXIT_FAILURE;
+    }
+
+    iuab_bytecode_profile_fini(&profile);
+    return status;
+}
+
+int disassemble(const uint8_t *program) {
+    enum iuab_error error = iuab_bytecode_disassemble(program, stdout);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        LOG_ERROR("failed to disassemble program: %s\n", iuab_strerror(error));
         return EXIT_FAILURE;
     }
 
+    return EXIT_SUCCESS;
+}
+
+int save(
+    const struct iuab_buffer *program,
+    const struct iuab_buffer *source_map,
+    const char *filename
+) {
+    FILE *out = fopen(filename, "wbe");
+
+    if (!out) {
+        LOG_ERROR("failed to open output file: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    enum iuab_error error = iuab_bytecode_save(program, source_map, out);
+
+    if (fclose(out) != 0 && error == IUAB_ERROR_SUCCESS) {
+        error = IUAB_ERROR_IO;
+    }
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        LOG_ERROR("failed to save bytecode: %s\n", iuab_strerror(error));
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Returns true if the file with the given name is a bytecode file, going by
+// its extension, otherwise false.
+bool is_bytecode_file(const char *filename) {
+    static const char extension[] = ".iuabc";
+    size_t length = strlen(filename);
+    return length >= sizeof(extension) - 1
+           && strcmp(&filename[length - (sizeof(extension) - 1)], extension)
+                  == 0;
+}
+
+int load_and_run(FILE *in, const struct compile_and_run_options *opts) {
+    struct iuab_bytecode_file file;
+    enum iuab_error error = iuab_bytecode_load(&file, in);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        LOG_ERROR("failed to load bytecode: %s\n", iuab_strerror(error));
+        return EXIT_FAILURE;
+    }
+
+    int status;
+
+    if (opts->disassemble) {
+        status = disassemble(file.program);
+    } else if (opts->profile) {
+        status = profile_and_run(
+            file.program,
+            file.program_size,
+            file.source_map,
+            file.source_map_size,
+            opts->profile
+        );
+    } else if (opts->tiered) {
+        status = run(IUAB_TARGET_TIERED, file.program, NULL, NULL);
+    } else {
+        status = run(IUAB_TARGET_BYTECODE, file.program, &file.prepared, NULL);
+    }
+
+    iuab_bytecode_unload(&file);
+    return status;
+}
+
+int compile_and_save_or_run(
+    FILE *src,
+    const struct compile_and_run_options *opts
+) {
+    bool is_bytecode_target =
+        opts->disassemble || opts->output || opts->profile;
     enum iuab_target target = COMPILE_AND_RUN_TARGET;
+
+    if (is_bytecode_target) {
+        target = IUAB_TARGET_BYTECODE;
+    } else if (opts->tiered) {
+        target = IUAB_TARGET_TIERED;
+    }
+
     bool is_jit_target = iuab_target_is_jit(target);
 
     struct iuab_buffer program;
@@ -74,17 +328,66 @@ int compile_and_run(const char *filename) {
 
     if (error != IUAB_ERROR_SUCCESS) {
         LOG_ERROR("failed to init program buffer: %s\n", iuab_strerror(error));
-        fclose(src);
         return EXIT_FAILURE;
     }
 
-    int status = compile(target, src, &program);
-    fclose(src);
+    struct iuab_buffer source_map;
+    error = iuab_buffer_init(&source_map);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        LOG_ERROR(
+            "failed to init source map buffer: %s\n",
+            iuab_strerror(error)
+        );
+        iuab_buffer_fini_maybe_jit(&program, is_jit_target);
+        return EXIT_FAILURE;
+    }
+
+    int status = compile(
+        target,
+        src,
+        opts,
+        &program,
+        opts->output || opts->profile ? &source_map : NULL
+    );
 
     if (status == EXIT_SUCCESS) {
-        status = run(target, &program);
+        if (opts->output) {
+            status = save(&program, &source_map, opts->output);
+        } else if (opts->disassemble) {
+            status = disassemble(program.data);
+        } else if (opts->profile) {
+            status = profile_and_run(
+                program.data,
+                program.size,
+                (const struct iuab_bytecode_source_map_entry *) source_map.data,
+                source_map.size / sizeof(struct iuab_bytecode_source_map_entry),
+                opts->profile
+            );
+        } else {
+            status = run(target, program.data, NULL, NULL);
+        }
     }
 
+    iuab_buffer_fini(&source_map);
     iuab_buffer_fini_maybe_jit(&program, is_jit_target);
     return status;
 }
+
+int compile_and_run(
+    const char *filename,
+    const struct compile_and_run_options *opts
+) {
+    FILE *src = fopen(filename, "rbe");
+
+    if (!src) {
+        LOG_ERROR("failed to open source file: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    int status = is_bytecode_file(filename)
+                     ? load_and_run(src, opts)
+                     : compile_and_save_or_run(src, opts);
+    fclose(src);
+    return status;
+}
@@ -4,6 +4,27 @@
 #ifndef COMPILE_AND_RUN_H
 #define COMPILE_AND_RUN_H
 
-int compile_and_run(const char *filename);
+#include "iuab/ir.h"
+
+#include <stdbool.h>
+
+struct compile_and_run_options {
+    enum iuab_opt_level opt_level;
+    bool print_stats;
+    bool disassemble;
+    // The bytecode file the program is written to instead of being run, unless
+    // it is null.
+    const char *output;
+    // The file the profile of the bytecode program is written to, unless it is
+    // null.
+    const char *profile;
+    // Whether the bytecode program is run with its hot loops JIT-compiled.
+    bool tiered;
+};
+
+int compile_and_run(
+    const char *filename,
+    const struct compile_and_run_options *opts
+);
 
 #endif // COMPILE_AND_RUN_H
@@ -9,6 +9,7 @@
 #define C_RESET "\033[0m"
 #define C_ERROR "\033[1;31m"
 #define C_DEBUG "\033[1;34m"
+#define C_INFO "\033[1;32m"
 
 #define LOG_ERROR(format, ...) \
     fprintf(stderr, C_ERROR "error: " C_RESET format, __VA_ARGS__)
@@ -16,4 +17,7 @@
 #define LOG_DEBUG(format, ...) \
     printf(C_DEBUG "debug: " C_RESET format, __VA_ARGS__)
 
+#define LOG_INFO(format, ...) \
+    fprintf(stderr, C_INFO "info: " C_RESET format, __VA_ARGS__)
+
 #endif // LOG_H
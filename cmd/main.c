@@ -2,8 +2,11 @@
 // SPDX-License-Identifier: GPL-3.0-only
 
 #include "compile_and_run.h"
+#include "log.h"
 #include "version.h"
 
+#include "iuab/ir.h"
+
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,11 +15,20 @@
 void print_help(FILE *file, const char *argv0) {
     fprintf(
         file,
-        "Usage: %s [options] <source file>\n"
+        "Usage: %s [options] <source or .iuabc bytecode file>\n"
         "\n"
         "Options:\n"
-        "  -h  Display this help information then exit.\n"
-        "  -V  Display version information then exit.\n",
+        "  -c <file>   Write the bytecode to a file instead of running the\n"
+        "              program.\n"
+        "  -d          Print the bytecode instead of running the program.\n"
+        "  -h          Display this help information then exit.\n"
+        "  -O <level>  Set the optimization level to 0, 1 or 2 (default: 2).\n"
+        "  -p <file>   Profile the bytecode, write the profile to a file and\n"
+        "              print the hottest loops to stderr.\n"
+        "  -s          Print compilation statistics to stderr.\n"
+        "  -t          Interpret the bytecode, JIT-compiling its hot loops if\n"
+        "              available.\n"
+        "  -V          Display version information then exit.\n",
         argv0
     );
 }
@@ -28,17 +40,48 @@ void print_version(void) {
 struct options {
     bool help;
     bool version;
+    struct compile_and_run_options compile_and_run;
 };
 
+int parse_opt_level(enum iuab_opt_level *dst, const char *arg) {
+    if (arg[0] < '0' || arg[0] > '2' || arg[1] != '\0') {
+        LOG_ERROR("invalid optimization level: %s\n", arg);
+        return EXIT_FAILURE;
+    }
+
+    *dst = IUAB_OPT_LEVEL_0 + (arg[0] - '0');
+    return EXIT_SUCCESS;
+}
+
 int options_init(struct options *opts, int argc, char *argv[]) {
     opts->help = false;
     opts->version = false;
+    opts->compile_and_run.opt_level = IUAB_OPT_LEVEL_2;
+    opts->compile_and_run.print_stats = false;
+    opts->compile_and_run.disassemble = false;
+    opts->compile_and_run.output = NULL;
+    opts->compile_and_run.profile = NULL;
+    opts->compile_and_run.tiered = false;
 
     int opt;
+    int status;
 
-    while ((opt = getopt(argc, argv, "h?V")) != -1) {
+    while ((opt = getopt(argc, argv, "c:dh?O:p:stV")) != -1) {
         switch (opt) {
+        case 'c': opts->compile_and_run.output = optarg; break;
+        case 'd': opts->compile_and_run.disassemble = true; break;
         case 'h': opts->help = true; break;
+        case 'O':
+            status = parse_opt_level(&opts->compile_and_run.opt_level, optarg);
+
+            if (status != EXIT_SUCCESS) {
+                return status;
+            }
+
+            break;
+        case 'p': opts->compile_and_run.profile = optarg; break;
+        case 's': opts->compile_and_run.print_stats = true; break;
+        case 't': opts->compile_and_run.tiered = true; break;
         case 'V': opts->version = true; break;
         default: return EXIT_FAILURE;
         }
@@ -70,5 +113,10 @@ int main(int argc, char *argv[]) {
         return EXIT_SUCCESS;
     }
 
-    return compile_and_run(argv[1]);
+    if (optind >= argc) {
+        print_help(stderr, argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    return compile_and_run(argv[optind], &opts.compile_and_run);
 }
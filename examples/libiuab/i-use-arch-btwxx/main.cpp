@@ -20,7 +20,7 @@ struct FileDeleter {
 
 int compile(iuab_target target, std::FILE *src, iuab_buffer *dst) {
     iuab_token last_token;
-    iuab_error error = iuab_compile(target, src, dst, &last_token);
+    iuab_error error = iuab_compile(target, src, nullptr, dst, &last_token);
 
     if (error != IUAB_ERROR_SUCCESS) {
         std::cerr << "compile-time error: " << iuab_strerror(error)
@@ -40,15 +40,17 @@ int run(iuab_target target, iuab_buffer *program) {
     iuab_context ctx;
     iuab_context_init(&ctx, program->data, stdin, stdout, debug_handler);
     iuab_error error = iuab_run(target, &ctx);
+    int status = EXIT_SUCCESS;
 
     if (error != IUAB_ERROR_SUCCESS) {
         std::cerr << "run-time error: " << iuab_strerror(error) << " at "
                   << std::hex << std::showbase
                   << reinterpret_cast<uintptr_t>(ctx.ip - 1) << "\n";
-        return EXIT_FAILURE;
+        status = EXIT_FAILURE;
     }
 
-    return EXIT_SUCCESS;
+    iuab_context_fini(&ctx);
+    return status;
 }
 
 int compile_and_run(const char *filename) {
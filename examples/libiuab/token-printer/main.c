@@ -1,6 +1,7 @@
 // Copyright (C) 2022 OverMighty
 // SPDX-License-Identifier: GPL-3.0-only
 
+#include "iuab/errors.h"
 #include "iuab/lexer.h"
 #include "iuab/token.h"
 
@@ -17,7 +18,17 @@ int print_tokens(const char *filename) {
     }
 
     struct iuab_lexer lexer;
-    iuab_lexer_init(&lexer, src);
+    enum iuab_error error = iuab_lexer_init(&lexer, src);
+    fclose(src);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        fprintf(
+            stderr,
+            "error: failed to read source file: %s\n",
+            iuab_strerror(error)
+        );
+        return EXIT_FAILURE;
+    }
 
     size_t last_line = 1;
     size_t last_end_col = 1;
@@ -31,7 +42,7 @@ int print_tokens(const char *filename) {
                 token.line,
                 token.col
             );
-            fclose(src);
+            iuab_lexer_fini(&lexer);
             return EXIT_FAILURE;
         }
 
@@ -46,7 +57,7 @@ int print_tokens(const char *filename) {
         last_end_col = token.col + strlen(str);
     }
 
-    fclose(src);
+    iuab_lexer_fini(&lexer);
     putchar('\n');
     return EXIT_SUCCESS;
 }
@@ -25,8 +25,9 @@ struct iuab_buffer {
 // that occurred in the process.
 enum iuab_error iuab_buffer_init(struct iuab_buffer *buffer);
 
-// Initializes the given buffer to store executable code. Returns the error that
-// occurred in the process.
+// Initializes the given buffer to store executable code, which is never
+// writable and executable at the same time. Returns the error that occurred in
+// the process.
 enum iuab_error iuab_buffer_init_jit(struct iuab_buffer *buffer);
 
 // Initializes the given buffer to store executable code if `is_jit` is true,
@@ -66,10 +67,13 @@ iuab_buffer_write_size(struct iuab_buffer *buffer, size_t value) {
 #define IUAB_BUFFER_WRITE(buffer, data) \
     iuab_buffer_write((buffer), (data), sizeof(data))
 
-// Writes `n` bytes from `data` at the end of the given buffer. Returns the
-// error that occurred in the process.
+// Writes `n` bytes from `data` at the end of the given buffer, which is then
+// resized to the exact number of pages it needs and made read-only and
+// executable. Returns the error that occurred in the process.
 //
-// The buffer must have been initialized with `iuab_buffer_init_jit()`.
+// The buffer must have been initialized with `iuab_buffer_init_jit()`. Code
+// should be written to it at once, after being emitted into a buffer
+// initialized with `iuab_buffer_init()`.
 enum iuab_error
 iuab_buffer_write_jit(struct iuab_buffer *buffer, const void *data, size_t n);
 
@@ -78,6 +82,9 @@ iuab_buffer_write_jit(struct iuab_buffer *buffer, const void *data, size_t n);
 #define IUAB_BUFFER_WRITE_JIT(buffer, data) \
     iuab_buffer_write_jit((buffer), (data), sizeof(data))
 
+// Returns the `size_t` value at the end of the given buffer.
+size_t iuab_buffer_peek_size(const struct iuab_buffer *buffer);
+
 // Returns and removes the `size_t` value at the end of the given buffer.
 size_t iuab_buffer_pop_size(struct iuab_buffer *buffer);
 
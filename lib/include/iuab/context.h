@@ -8,12 +8,26 @@
 extern "C" {
 #endif
 
+#include "errors.h"
+
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 
 // The size of the working memory stored in an I use Arch btw program context.
 #define IUAB_CONTEXT_MEMORY_SIZE (1U << 16U)
 
+// The size of each of the inaccessible guard regions surrounding guarded
+// memory, larger than the largest data pointer movement.
+#define IUAB_CONTEXT_GUARD_SIZE IUAB_CONTEXT_MEMORY_SIZE
+
+// The size of the input buffer stored in an I use Arch btw program context.
+#define IUAB_CONTEXT_INPUT_BUFFER_SIZE 65536
+
+// The size of the output buffer stored in an I use Arch btw program context.
+#define IUAB_CONTEXT_OUTPUT_BUFFER_SIZE 4096
+
 // An I use Arch btw program context.
 struct iuab_context {
     const uint8_t *ip;
@@ -22,13 +36,42 @@ struct iuab_context {
     FILE *out;
     void (*debug_handler)(struct iuab_context *);
     const uint8_t *program;
-    uint8_t memory[IUAB_CONTEXT_MEMORY_SIZE];
+    // The working memory: either `inline_memory`, or guarded memory placed in
+    // its own mapping.
+    uint8_t *memory;
+    // The input read from the input file but not yet by the program: the bytes
+    // from `in_cursor` to `in_end`, in `in_buffer` or `in_mapping`.
+    // JIT-compiled code accesses both with 8-bit displacements.
+    const uint8_t *in_cursor;
+    const uint8_t *in_end;
+    // The output not yet written to the output file: the first `out_size`
+    // bytes of `out_buffer`, fewer than `IUAB_CONTEXT_OUTPUT_BUFFER_SIZE`
+    // between instructions. JIT-compiled code accesses both with 8-bit
+    // displacements.
+    size_t out_size;
+    uint8_t out_buffer[IUAB_CONTEXT_OUTPUT_BUFFER_SIZE];
+    // The mapping of the input file, if it is a regular file, or a null
+    // pointer.
+    const uint8_t *in_mapping;
+    size_t in_mapping_size;
+    // Whether the input in `in_buffer` was read through the stream of the
+    // input file rather than from its file descriptor.
+    bool is_in_from_stream;
+    uint8_t in_buffer[IUAB_CONTEXT_INPUT_BUFFER_SIZE];
+    uint8_t inline_memory[IUAB_CONTEXT_MEMORY_SIZE];
 };
 
 // Initializes the given context for execution of the code stored at `program`,
 // with the files pointed to by `in` and `out` as input and output files
 // respectively, and the function pointed to by `debug_handler` as debugging
 // event handler.
+//
+// The input file is read from its file descriptor, bypassing its stream, once
+// the input buffered in its stream is read. It is only read through its stream
+// if it has no file descriptor, in which case reads wait for a full buffer of
+// input or the end of the file. Input buffered in the stream of a file that
+// cannot be positioned, like a pipe, is not read. The context must be finalized
+// with `iuab_context_fini()`.
 void iuab_context_init(
     struct iuab_context *ctx,
     const uint8_t *program,
@@ -37,6 +80,102 @@ void iuab_context_init(
     void (*debug_handler)(struct iuab_context *)
 );
 
+// Initializes the given context like `iuab_context_init()`, but with guarded
+// memory: its memory is placed in its own mapping, between inaccessible guard
+// regions of `IUAB_CONTEXT_GUARD_SIZE` bytes, so that accesses out of its
+// bounds by at most this size fault. Returns the error that occurred in the
+// process.
+//
+// The context must be finalized with `iuab_context_fini()`.
+enum iuab_error iuab_context_init_guarded(
+    struct iuab_context *ctx,
+    const uint8_t *program,
+    FILE *in,
+    FILE *out,
+    void (*debug_handler)(struct iuab_context *)
+);
+
+// Returns true if the memory of the given context is guarded, otherwise false.
+bool iuab_context_is_guarded(const struct iuab_context *ctx);
+
+// Returns true if the given address is in one of the guard regions surrounding
+// the memory of the given context, otherwise false.
+bool iuab_context_is_guard_address(
+    const struct iuab_context *ctx,
+    const void *address
+);
+
+// Finalizes the given context. Unmaps its memory if it is guarded, and its
+// input file if it was mapped.
+void iuab_context_fini(struct iuab_context *ctx);
+
+// Writes the output buffered in the given context to its output file and
+// empties the buffer. Returns the error that occurred in the process.
+enum iuab_error iuab_context_flush(struct iuab_context *ctx);
+
+// Flushes the output buffered in the given context at the end of a run that
+// returned `error`, and gives back the input it read ahead to its input file if
+// it is seekable. Returns `error`, or the error that occurred in the process if
+// `error` is `IUAB_ERROR_SUCCESS`.
+enum iuab_error
+iuab_context_end_run(struct iuab_context *ctx, enum iuab_error error);
+
+// Refills the empty input buffer of the given context by reading from its input
+// file, after flushing its output, or maps the input file if it is a regular
+// file read for the first time. Returns the error that occurred in the process,
+// which is `IUAB_ERROR_RUNTIME_END_OF_INPUT_FILE` if no input is left.
+enum iuab_error iuab_context_read_input(struct iuab_context *ctx);
+
+// Reads a character of input of the given context to the location pointed to
+// by `dst`, refilling its input buffer if empty. Returns the error that
+// occurred in the process.
+static inline enum iuab_error
+iuab_context_read(struct iuab_context *ctx, uint8_t *dst) {
+    if (ctx->in_cursor == ctx->in_end) {
+        enum iuab_error error = iuab_context_read_input(ctx);
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
+    }
+
+    *dst = *ctx->in_cursor++;
+    return IUAB_ERROR_SUCCESS;
+}
+
+// Buffers the given character as output of the given context, flushing the
+// buffer once full. Returns the error that occurred in the process.
+static inline enum iuab_error
+iuab_context_write(struct iuab_context *ctx, uint8_t c) {
+    ctx->out_buffer[ctx->out_size++] = c;
+
+    if (ctx->out_size == IUAB_CONTEXT_OUTPUT_BUFFER_SIZE) {
+        return iuab_context_flush(ctx);
+    }
+
+    return IUAB_ERROR_SUCCESS;
+}
+
+// Buffers the `size` bytes of data pointed to by `data` as output of the given
+// context, or writes them to its output file after flushing the buffer if they
+// do not fit. Returns the error that occurred in the process.
+enum iuab_error iuab_context_write_data(
+    struct iuab_context *ctx,
+    const void *data,
+    size_t size
+);
+
+// Flushes the output buffered in the given context, then calls its debugging
+// event handler. Returns the error that occurred in the process.
+enum iuab_error iuab_context_debug(struct iuab_context *ctx);
+
+// Returns a pointer to the first zero value found in the memory of the given
+// context from the value pointed to by `dp`, by steps of `stride` values, or a
+// null pointer if a step would go out of the bounds of the memory before one is
+// found. The absolute value of `stride` must be a power of two.
+uint8_t *
+iuab_context_scan(struct iuab_context *ctx, uint8_t *dp, int32_t stride);
+
 #ifdef __cplusplus
 }
 #endif
@@ -38,6 +38,18 @@ enum iuab_error {
 
     // Invalid bytecode opcode.
     IUAB_ERROR_BYTECODE_INVALID_OP,
+    // Invalid bytecode jump.
+    IUAB_ERROR_BYTECODE_INVALID_JUMP,
+    // Invalid bytecode operand.
+    IUAB_ERROR_BYTECODE_INVALID_OPERAND,
+    // Bytecode memory access not proven within the bounds of the memory.
+    IUAB_ERROR_BYTECODE_UNCHECKED_ACCESS,
+    // Unterminated bytecode program.
+    IUAB_ERROR_BYTECODE_UNTERMINATED,
+    // Invalid bytecode file.
+    IUAB_ERROR_BYTECODE_INVALID_FILE,
+    // Unsupported bytecode version.
+    IUAB_ERROR_BYTECODE_UNSUPPORTED_VERSION,
 
     // Jump too large.
     IUAB_ERROR_JIT_JUMP_TOO_LARGE,
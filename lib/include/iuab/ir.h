@@ -0,0 +1,194 @@
+// Copyright (C) 2022 OverMighty
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef IUAB_IR_H
+#define IUAB_IR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "buffer.h"
+#include "errors.h"
+#include "lexer.h"
+#include "token.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// An optimization level.
+enum iuab_opt_level {
+    // No optimization passes.
+    IUAB_OPT_LEVEL_0,
+    // Cheap local optimization passes.
+    IUAB_OPT_LEVEL_1,
+    // All optimization passes.
+    IUAB_OPT_LEVEL_2,
+};
+
+// I use Arch btw intermediate representation operations.
+enum iuab_ir_op {
+    // Add `value` to the data pointer, which must stay within the bounds of the
+    // memory.
+    IUAB_IR_OP_MOVE,
+    // Add `value` to the data pointer without checking the bounds of the
+    // memory.
+    IUAB_IR_OP_MOVE_UNCHECKED,
+    // Check that the values at offsets from `offset` to `value` from the data
+    // pointer are within the bounds of the memory.
+    IUAB_IR_OP_CHECK,
+    // Add `value` to the value at `offset` from the data pointer.
+    IUAB_IR_OP_ADD,
+    // Set the value at `offset` from the data pointer to `value`.
+    IUAB_IR_OP_SET,
+    // Add `value` times the value pointed to by the data pointer to the value
+    // at `offset` from it, without checking the bounds of the memory.
+    IUAB_IR_OP_MULADD,
+    // Add `value`, whose absolute value is a power of two, to the data pointer
+    // until the value it points to is zero, staying within the bounds of the
+    // memory.
+    IUAB_IR_OP_SCAN,
+    // Write the value pointed to by the data pointer as character to the output
+    // file.
+    IUAB_IR_OP_WRITE,
+    // Read a character from the input file into the value pointed to by the
+    // data pointer.
+    IUAB_IR_OP_READ,
+    // Start a loop running while the value pointed to by the data pointer is
+    // not zero. `link` is the index of the matching `IUAB_IR_OP_END_LOOP`
+    // node.
+    IUAB_IR_OP_LOOP,
+    // End a loop. `link` is the index of the matching `IUAB_IR_OP_LOOP` node.
+    IUAB_IR_OP_END_LOOP,
+    // Call the debugging event handler.
+    IUAB_IR_OP_DEBUG,
+    // Copy the `value` bytes of data at index `link` of the data of the
+    // intermediate representation to the values from `offset` from the data
+    // pointer, without checking the bounds of the memory.
+    IUAB_IR_OP_STORE_DATA,
+    // Write the `value` bytes of data at index `link` of the data of the
+    // intermediate representation to the output file.
+    IUAB_IR_OP_WRITE_DATA,
+};
+
+// Returns the name of the given I use Arch btw intermediate representation
+// operation as a string.
+const char *iuab_ir_op_name(enum iuab_ir_op op);
+
+// An I use Arch btw intermediate representation node.
+struct iuab_ir_node {
+    enum iuab_ir_op op;
+    int32_t offset;
+    int32_t value;
+    size_t link;
+    // The first source code token the node was built from.
+    struct iuab_token token;
+};
+
+// An I use Arch btw program in intermediate representation: a sequence of
+// nodes, and the constant data they refer to.
+struct iuab_ir {
+    struct iuab_buffer nodes;
+    struct iuab_buffer data;
+};
+
+// Initializes the given intermediate representation with no nodes and no data.
+// Returns the error that occurred in the process.
+enum iuab_error iuab_ir_init(struct iuab_ir *ir);
+
+// Returns the number of nodes of the given intermediate representation.
+static inline size_t iuab_ir_size(const struct iuab_ir *ir) {
+    return ir->nodes.size / sizeof(struct iuab_ir_node);
+}
+
+// Returns a pointer to the nodes of the given intermediate representation.
+static inline struct iuab_ir_node *iuab_ir_nodes(const struct iuab_ir *ir) {
+    return (struct iuab_ir_node *) ir->nodes.data;
+}
+
+// Returns true if the loop ending at the given `IUAB_IR_OP_END_LOOP` node runs
+// at most once because it ends with a store of zero.
+static inline bool iuab_ir_is_loop_once(const struct iuab_ir_node *end_loop) {
+    return end_loop[-1].op == IUAB_IR_OP_SET && end_loop[-1].offset == 0
+           && end_loop[-1].value == 0;
+}
+
+// Statistics about the optimization of an intermediate representation.
+struct iuab_ir_stats {
+    // The number of data pointer bounds checks proven redundant and removed.
+    size_t removed_bounds_checks;
+    // The number of nodes of the prefix of the program evaluated at compile
+    // time.
+    size_t evaluated_nodes;
+};
+
+// Appends a copy of the node pointed to by `node` to the given intermediate
+// representation. Returns the error that occurred in the process.
+enum iuab_error
+iuab_ir_append(struct iuab_ir *ir, const struct iuab_ir_node *node);
+
+// Appends `size` bytes of data from `data` to the data of the given
+// intermediate representation and writes their index at the location pointed to
+// by `index_dst`. Returns the error that occurred in the process.
+enum iuab_error iuab_ir_append_data(
+    struct iuab_ir *ir,
+    const void *data,
+    size_t size,
+    size_t *index_dst
+);
+
+// Moves the data of the intermediate representation `src` to the one pointed to
+// by `dst`, which has no data, so that the nodes built into `dst` from those of
+// `src` can keep referring to it.
+void iuab_ir_move_data(struct iuab_ir *dst, struct iuab_ir *src);
+
+// Sets the `link` of the loop nodes of the given intermediate representation.
+// Returns the error that occurred in the process.
+enum iuab_error iuab_ir_link_loops(struct iuab_ir *ir);
+
+// Builds into the given empty intermediate representation the program from the
+// tokens returned by the given lexer and writes the last token processed at the
+// location pointed to by `last_token_dst`. Returns the error that occurred in
+// the process.
+enum iuab_error iuab_ir_build(
+    struct iuab_ir *ir,
+    struct iuab_lexer *lexer,
+    struct iuab_token *last_token_dst
+);
+
+// Runs on the given intermediate representation the optimization passes enabled
+// at the given optimization level, in order, and writes statistics about them
+// at the location pointed to by `stats_dst`. Returns the error that occurred in
+// the process.
+enum iuab_error iuab_ir_optimize(
+    struct iuab_ir *ir,
+    enum iuab_opt_level opt_level,
+    struct iuab_ir_stats *stats_dst
+);
+
+// Evaluates at compile time the nodes of the given intermediate representation
+// that run before the first input, call of the debugging event handler or
+// runtime error, within a limited number of steps, and replaces them with nodes
+// writing their output and setting up the memory and data pointer they leave.
+// Writes the number of nodes replaced at the location pointed to by
+// `evaluated_dst`. Returns the error that occurred in the process.
+enum iuab_error
+iuab_ir_evaluate_prefix(struct iuab_ir *ir, size_t *evaluated_dst);
+
+// Removes from the given intermediate representation the data pointer bounds
+// checks proven redundant by an analysis of the range of indices the data
+// pointer may have at each node, and writes the number of checks removed at the
+// location pointed to by `removed_dst`. Returns the error that occurred in the
+// process.
+enum iuab_error
+iuab_ir_remove_bounds_checks(struct iuab_ir *ir, size_t *removed_dst);
+
+// Finalizes the given intermediate representation. Frees its nodes and data.
+void iuab_ir_fini(struct iuab_ir *ir);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IUAB_IR_H
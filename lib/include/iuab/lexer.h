@@ -8,24 +8,89 @@
 extern "C" {
 #endif
 
+#include "errors.h"
 #include "token.h"
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 
+// The size of the blocks of source code scanned at once by a lexer.
+#define IUAB_LEXER_BLOCK_SIZE 64
+
+// The maximum number of tokens in a block of source code scanned by a lexer.
+#define IUAB_LEXER_MAX_BLOCK_TOKENS (IUAB_LEXER_BLOCK_SIZE / 2)
+
+// An instruction set used by a lexer to scan source code.
+enum iuab_lexer_isa {
+    // Portable C code.
+    IUAB_LEXER_ISA_SCALAR,
+    // x86-64 SSE2 instructions.
+    IUAB_LEXER_ISA_SSE2,
+    // x86-64 AVX2 instructions.
+    IUAB_LEXER_ISA_AVX2,
+};
+
 // An I use Arch btw source code lexer.
+//
+// The lexer scans source code straight from memory: regular files are
+// memory-mapped, other files are read into memory in large blocks. Source code
+// is scanned in blocks of `IUAB_LEXER_BLOCK_SIZE` bytes, with vector
+// instructions if available, and the tokens of each block are queued.
 struct iuab_lexer {
-    FILE *src;
+    const char *cur;
+    const char *end;
+    const char *line_start;
     size_t line;
-    size_t col;
+    void *storage;
+    size_t storage_size;
+    bool is_storage_mapped;
+    enum iuab_lexer_isa isa;
+    size_t queue_start;
+    size_t queue_end;
+    struct iuab_token queue[IUAB_LEXER_MAX_BLOCK_TOKENS];
 };
 
 // Initializes the given lexer for lexing of the source file pointed to by
-// `src`.
-void iuab_lexer_init(struct iuab_lexer *lexer, FILE *src);
+// `src`, from its current position to its end. Returns the error that occurred
+// in the process.
+enum iuab_error iuab_lexer_init(struct iuab_lexer *lexer, FILE *src);
+
+// Initializes the given lexer for lexing of the `src_size` bytes of source code
+// pointed to by `src`. The source code is not copied and must outlive the
+// lexer.
+void iuab_lexer_init_mem(
+    struct iuab_lexer *lexer,
+    const char *src,
+    size_t src_size
+);
+
+// Returns the most capable instruction set supported by the running CPU for
+// scanning source code. Lexers use it by default.
+enum iuab_lexer_isa iuab_lexer_best_isa(void);
+
+// Sets the instruction set used by the given lexer to scan source code. Returns
+// false without changing it if the running CPU does not support it.
+//
+// All instruction sets produce the same tokens.
+bool iuab_lexer_set_isa(struct iuab_lexer *lexer, enum iuab_lexer_isa isa);
 
 // Returns the next token from the given lexer.
 struct iuab_token iuab_lexer_next_token(struct iuab_lexer *lexer);
 
+// Returns the next run of at most `max_count` tokens of the same type from the
+// given lexer.
+//
+// `the` and `way` tokens each start or end a different loop, so they are never
+// merged into a run, and neither are invalid and end of file tokens.
+struct iuab_token_run iuab_lexer_next_run(
+    struct iuab_lexer *lexer,
+    size_t max_count
+);
+
+// Finalizes the given lexer. Frees the storage of the source code.
+void iuab_lexer_fini(struct iuab_lexer *lexer);
+
 #ifdef __cplusplus
 }
 #endif
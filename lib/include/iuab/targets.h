@@ -11,9 +11,11 @@ extern "C" {
 #include "buffer.h"
 #include "context.h"
 #include "errors.h"
+#include "ir.h"
 #include "token.h"
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 
 // An I use Arch btw compilation target.
@@ -23,6 +25,9 @@ enum iuab_target {
     // JIT-compiled x86-64 code following the System V AMD64/x86-64 ABI's
     // calling convention.
     IUAB_TARGET_JIT_X86_64,
+    // I use Arch btw bytecode, interpreted with its hot loops JIT-compiled into
+    // x86-64 code when available for the target system.
+    IUAB_TARGET_TIERED,
 };
 
 // Returns the name of the given target as a string.
@@ -32,8 +37,46 @@ const char *iuab_target_name(enum iuab_target target);
 // false.
 bool iuab_target_is_jit(enum iuab_target target);
 
-// Compiles for the given target the source file pointed to by `src` into
-// code to write to the buffer pointed to by `dst` and writes the last token
+// Statistics about the compilation of an I use Arch btw program.
+struct iuab_compile_stats {
+    // Statistics about the optimization of the program in intermediate
+    // representation.
+    struct iuab_ir_stats ir;
+    // The size in bytes of the compiled code.
+    size_t code_size;
+    // The number of bytes branch relaxation saved in the compiled code, and of
+    // bytes of padding loop alignment added to it, for JIT compilation
+    // targets.
+    size_t relaxation_saved_size;
+    size_t alignment_padding_size;
+    // The number of bytes and of instructions peephole optimizations saved in
+    // the compiled code, for JIT compilation targets.
+    size_t peephole_saved_size;
+    size_t peephole_saved_instructions;
+};
+
+// I use Arch btw compilation options.
+struct iuab_compile_options {
+    // The level of optimization of the program in intermediate representation.
+    enum iuab_opt_level opt_level;
+    // Whether the program is run from a context with guarded memory, in which
+    // case JIT compilation targets replace bounds checks with memory accesses
+    // faulting in the guard regions.
+    bool is_memory_guarded;
+    // The location where statistics about the compilation are written, unless
+    // it is null.
+    struct iuab_compile_stats *stats_dst;
+    // The buffer the source map of the program is written to, unless it is
+    // null, if the target is `IUAB_TARGET_BYTECODE` or `IUAB_TARGET_TIERED`.
+    struct iuab_buffer *source_map_dst;
+};
+
+// Initializes the given compilation options with their default values.
+void iuab_compile_options_init(struct iuab_compile_options *opts);
+
+// Compiles for the given target with the options pointed to by `opts`, or the
+// default options if it is null, the source file pointed to by `src` into code
+// to write to the buffer pointed to by `dst` and writes the last token
 // processed at the location pointed to by `last_token_dst`. Returns the error
 // that occurred in the process.
 //
@@ -42,6 +85,24 @@ bool iuab_target_is_jit(enum iuab_target target);
 enum iuab_error iuab_compile(
     enum iuab_target target,
     FILE *src,
+    const struct iuab_compile_options *opts,
+    struct iuab_buffer *dst,
+    struct iuab_token *last_token_dst
+);
+
+// Compiles for the given target with the options pointed to by `opts`, or the
+// default options if it is null, the `src_size` bytes of source code pointed to
+// by `src` into code to write to the buffer pointed to by `dst` and writes the
+// last token processed at the location pointed to by `last_token_dst`. Returns
+// the error that occurred in the process.
+//
+// The buffer must have been initialized with `iuab_buffer_init_jit()` if the
+// target is a JIT compilation target, otherwise with `iuab_buffer_init()`.
+enum iuab_error iuab_compile_mem(
+    enum iuab_target target,
+    const char *src,
+    size_t src_size,
+    const struct iuab_compile_options *opts,
     struct iuab_buffer *dst,
     struct iuab_token *last_token_dst
 );
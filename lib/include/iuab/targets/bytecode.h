@@ -11,11 +11,25 @@ extern "C" {
 #include "../buffer.h"
 #include "../context.h"
 #include "../errors.h"
+#include "../ir.h"
 #include "../token.h"
 
+#include "iuab/targets/bytecode_superinstrs.h"
+
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 
+// The version of the I use Arch btw bytecode encoding, changed with each
+// incompatible change.
+#define IUAB_BYTECODE_VERSION 4
+
+// The alignment of the address of I use Arch btw bytecode programs. Operands
+// wider than a byte follow the opcode and its `uint8_t` operands after padding
+// aligning them to their size from the start of the program.
+#define IUAB_BYTECODE_ALIGNMENT 4
+
 // I use Arch btw bytecode opcodes.
 enum {
     // Return from the program.
@@ -36,33 +50,326 @@ enum {
     // Read a character from the input file into the value pointed to by the
     // data pointer.
     IUAB_BYTECODE_OP_READ,
-    // Jump if the value pointed to by the data pointer is zero to the following
-    // `size_t` program offset.
+    // Jump if the value pointed to by the data pointer is zero by the following
+    // `int32_t` offset from the end of the instruction.
     IUAB_BYTECODE_OP_JMPZ,
-    // Jump if the value pointed to by the data pointer is not zero to the
-    // following `size_t` program offset.
+    // Jump if the value pointed to by the data pointer is not zero by the
+    // following `int32_t` offset from the end of the instruction.
     IUAB_BYTECODE_OP_JMPNZ,
     // Call the debugging event handler.
     IUAB_BYTECODE_OP_DEBUG,
+    // Set the value pointed to by the data pointer to the following `uint8_t`
+    // value.
+    IUAB_BYTECODE_OP_SET,
+    // Add the following `uint8_t` factor times the value pointed to by the data
+    // pointer to the value at the next `int16_t` offset from it, without
+    // checking the bounds of the memory.
+    IUAB_BYTECODE_OP_MULADD,
+    // Add to the data pointer the following `int32_t` value until the value it
+    // points to is zero.
+    IUAB_BYTECODE_OP_SCAN,
+    // Add the following `uint8_t` value to the value at the next `int16_t`
+    // offset from the data pointer.
+    IUAB_BYTECODE_OP_ADDVO,
+    // Set the value at the next `int16_t` offset from the data pointer to the
+    // following `uint8_t` value.
+    IUAB_BYTECODE_OP_SETO,
+    // Check that the values from the following `int16_t` offset to the next
+    // `int16_t` offset from the data pointer are within the bounds of the
+    // memory.
+    IUAB_BYTECODE_OP_CHECK,
+    // Add to the data pointer the following `int32_t` value without checking
+    // the bounds of the memory.
+    IUAB_BYTECODE_OP_MOVP,
+    // Copy the number of bytes given by the next `uint32_t` value, which
+    // follow it, to the values from the following `int32_t` offset from the
+    // data pointer, without checking the bounds of the memory.
+    IUAB_BYTECODE_OP_STORE,
+    // Write the number of bytes given by the following `uint32_t` value, which
+    // follow it, to the output file.
+    IUAB_BYTECODE_OP_WRITES,
+    // Short form of `IUAB_BYTECODE_OP_JMPZ` with an `int8_t` offset.
+    IUAB_BYTECODE_OP_JMPZ8,
+    // Short form of `IUAB_BYTECODE_OP_JMPNZ` with an `int8_t` offset.
+    IUAB_BYTECODE_OP_JMPNZ8,
+    // Superinstructions running a pair of the instructions above without
+    // dispatching the second one, followed by the operands of both.
+#define IUAB_BYTECODE_SUPERINSTR(first, second, name) \
+    IUAB_BYTECODE_OP_##first##_##second,
+    IUAB_BYTECODE_SUPERINSTRS(IUAB_BYTECODE_SUPERINSTR)
+#undef IUAB_BYTECODE_SUPERINSTR
+
+    IUAB_BYTECODE_NUM_OPS,
 };
 
 // Returns the name of the given I use Arch btw bytecode opcode as a string.
 const char *iuab_bytecode_op_name(uint8_t op);
 
-// Compiles the source file pointed to by `src` into I use Arch btw bytecode to
-// write to the buffer pointed to by `dst` and writes the last token
-// processed at the location pointed to by `last_token_dst`. Returns the error
-// that occurred in the process.
+// Returns the number of operands of the instructions with the given opcode.
+size_t iuab_bytecode_operand_count(uint8_t op);
+
+// Writes the opcodes of the pair of instructions run by the superinstructions
+// with the given opcode at the locations pointed to by `first_dst` and
+// `second_dst`. Returns false if the opcode is not that of a superinstruction,
+// otherwise true.
+bool iuab_bytecode_split(uint8_t op, uint8_t *first_dst, uint8_t *second_dst);
+
+// A decoded I use Arch btw bytecode instruction.
+struct iuab_bytecode_instr {
+    uint8_t op;
+    // The operands in the order of the description of the opcode, or those of
+    // the pair of instructions of a superinstruction in turn, with the offsets
+    // of jumps resolved to the offset of their target in the program, and the
+    // number of bytes of data following the instruction last.
+    int32_t operands[4];
+    // The data following the instruction, if any.
+    const uint8_t *data;
+    // The size of the instruction, including its padding and data.
+    size_t size;
+};
+
+// Decodes into the instruction pointed to by `dst` the instruction at `offset`
+// in the I use Arch btw bytecode program pointed to by `program`. Returns
+// false if its opcode is invalid, otherwise true.
+bool iuab_bytecode_decode(
+    const uint8_t *program,
+    size_t offset,
+    struct iuab_bytecode_instr *dst
+);
+
+// Writes to the file pointed to by `out` a listing of the I use Arch btw
+// bytecode program pointed to by `program`, up to its first
+// `IUAB_BYTECODE_OP_RET` instruction. Returns the error that occurred in the
+// process.
+enum iuab_error
+iuab_bytecode_disassemble(const uint8_t *program, FILE *out);
+
+// Verifies that the `size` bytes pointed to by `program` are a valid I use Arch
+// btw bytecode program: a sequence of instructions with valid opcodes ending
+// with its only `IUAB_BYTECODE_OP_RET` instruction, whose jumps form loops
+// nested within each other. A loop starts with a jump to its end if the value
+// pointed to by the data pointer is zero, and either ends with a jump back to
+// the start of its body if it is not zero or runs at most once. The strides of
+// `IUAB_BYTECODE_OP_SCAN` instructions are plus or minus powers of two no
+// greater than `IUAB_CONTEXT_MEMORY_SIZE`, and the offsets of
+// `IUAB_BYTECODE_OP_CHECK` instructions are in order. The memory accesses and
+// moves of the data pointer not checking the bounds of the memory are proven
+// within them by the instructions before them in their basic block, which
+// starts at the start of the program, with the data pointer at the start of the
+// memory, after a jump or at its target, or after an instruction that may move
+// the data pointer anywhere. Returns the error in the program, if any.
+//
+// The instruction at the end of an invalid program may be decoded up to
+// `IUAB_BYTECODE_FILE_PADDING` bytes past it. Programs compiled with
+// `iuab_compile_bytecode()` are valid.
+enum iuab_error iuab_bytecode_verify(const uint8_t *program, size_t size);
+
+// An entry of the source map of an I use Arch btw bytecode program: the
+// position in the source code of the first token of the instruction at
+// `offset` in the program. Superinstructions have an entry for each
+// instruction of their pair, in turn.
+struct iuab_bytecode_source_map_entry {
+    uint32_t offset;
+    uint32_t line;
+    uint32_t col;
+};
+
+// Compiles the program in intermediate representation pointed to by `ir` into
+// I use Arch btw bytecode to write to the buffer pointed to by `dst`, which
+// must be empty, and writes the source map of the bytecode, in order of
+// offset, to the buffer pointed to by `source_map_dst` unless it is null.
+// Returns the error that occurred in the process and, if it occurred while
+// compiling a node, writes the source code token of the node at the location
+// pointed to by `last_token_dst`.
 enum iuab_error iuab_compile_bytecode(
-    FILE *src,
+    const struct iuab_ir *ir,
     struct iuab_buffer *dst,
+    struct iuab_buffer *source_map_dst,
     struct iuab_token *last_token_dst
 );
 
-// Runs the I use Arch btw bytecode program from the context pointed to by
-// `ctx`. Returns the error that occurred in the process.
+// A cell of direct-threaded code, private to libiuab.
+union iuab_bytecode_cell;
+
+// A valid I use Arch btw bytecode program prepared to be run any number of
+// times: its direct-threaded code, if libiuab runs programs with direct
+// threading, built once instead of before each run.
+struct iuab_bytecode_prepared {
+    // The cells of the threaded code, or null.
+    union iuab_bytecode_cell *cells;
+    // The index in `cells` of the threaded code of the instruction at each
+    // offset of the program, or `SIZE_MAX` if no instruction starts there.
+    size_t *cell_indices;
+    size_t program_size;
+};
+
+// Initializes the given prepared program with the valid I use Arch btw
+// bytecode program pointed to by `program`. Returns the error that occurred in
+// the process.
+//
+// The prepared program must be finalized with `iuab_bytecode_prepared_fini()`.
+enum iuab_error iuab_bytecode_prepare(
+    struct iuab_bytecode_prepared *prepared,
+    const uint8_t *program
+);
+
+// Finalizes the given prepared program. Frees its threaded code.
+void iuab_bytecode_prepared_fini(struct iuab_bytecode_prepared *prepared);
+
+// The magic number at the start of I use Arch btw bytecode files.
+#define IUAB_BYTECODE_FILE_MAGIC "IUABC\r\n\x1A"
+
+// The number of bytes of padding following the program in I use Arch btw
+// bytecode files, at least as many as an instruction without data may span
+// beyond the end of the program if it is truncated.
+#define IUAB_BYTECODE_FILE_PADDING 32
+
+// The header of an I use Arch btw bytecode file, whose values are stored in the
+// byte order of the system that wrote it. The program and its source map follow
+// it, at offsets aligned to `IUAB_BYTECODE_ALIGNMENT`.
+struct iuab_bytecode_file_header {
+    char magic[8];
+    // `IUAB_BYTECODE_VERSION`.
+    uint32_t version;
+    // A checksum of the opcodes, which depend on the superinstructions libiuab
+    // was built with.
+    uint32_t ops_checksum;
+    // `IUAB_TARGET_BYTECODE`.
+    uint32_t target;
+    // The FNV-1a checksum of the rest of the file.
+    uint32_t checksum;
+    uint64_t program_offset;
+    uint64_t program_size;
+    uint64_t source_map_offset;
+    // The number of entries of the source map.
+    uint64_t source_map_size;
+};
+
+// An I use Arch btw bytecode file mapped into memory.
+struct iuab_bytecode_file {
+    // The program, which can be run in place.
+    const uint8_t *program;
+    size_t program_size;
+    // The program prepared to be run with `iuab_run_prepared_bytecode()`.
+    struct iuab_bytecode_prepared prepared;
+    const struct iuab_bytecode_source_map_entry *source_map;
+    // The number of entries of the source map.
+    size_t source_map_size;
+    void *mapping;
+    size_t mapping_size;
+};
+
+// Writes to the file pointed to by `out` an I use Arch btw bytecode file
+// storing the program in the buffer pointed to by `program` and the source map
+// in the buffer pointed to by `source_map`, or an empty one if it is null.
+// Returns the error that occurred in the process.
+enum iuab_error iuab_bytecode_save(
+    const struct iuab_buffer *program,
+    const struct iuab_buffer *source_map,
+    FILE *out
+);
+
+// Maps into memory, read-only, the I use Arch btw bytecode file open as the
+// file pointed to by `in`, and initializes the given file with it after
+// verifying its program with `iuab_bytecode_verify()` and preparing it with
+// `iuab_bytecode_prepare()`. Returns the error that occurred in the process.
+//
+// The file must be finalized with `iuab_bytecode_unload()`.
+enum iuab_error iuab_bytecode_load(struct iuab_bytecode_file *file, FILE *in);
+
+// Finalizes the given file. Frees its prepared program and unmaps it from
+// memory.
+void iuab_bytecode_unload(struct iuab_bytecode_file *file);
+
+// Runs the I use Arch btw bytecode program, stored at an address aligned to
+// `IUAB_BYTECODE_ALIGNMENT`, from the context pointed to by `ctx` after
+// verifying it up to its first `IUAB_BYTECODE_OP_RET` instruction with
+// `iuab_bytecode_verify()`. Returns the error that occurred in the process.
 enum iuab_error iuab_run_bytecode(struct iuab_context *ctx);
 
+// Runs like `iuab_run_bytecode()` the I use Arch btw bytecode program, which
+// must be valid, without verifying it first. Prepares it with
+// `iuab_bytecode_prepare()` for this run only.
+enum iuab_error iuab_run_verified_bytecode(struct iuab_context *ctx);
+
+// Runs like `iuab_run_verified_bytecode()` the program of the context pointed
+// to by `ctx`, which the prepared program pointed to by `prepared` must have
+// been prepared from.
+enum iuab_error iuab_run_prepared_bytecode(
+    struct iuab_context *ctx,
+    const struct iuab_bytecode_prepared *prepared
+);
+
+// Returns false if the valid I use Arch btw bytecode program of the context
+// pointed to by `ctx` is to be run from its start without the data pointer at
+// the start of the memory, as `iuab_bytecode_verify()` assumes, in which case
+// runs return `IUAB_ERROR_DP_OUT_OF_BOUNDS`, otherwise true.
+bool iuab_bytecode_can_run(const struct iuab_context *ctx);
+
+// Returns the size of the I use Arch btw bytecode program pointed to by
+// `program` up to the end of its first `IUAB_BYTECODE_OP_RET` instruction or
+// its first invalid opcode.
+size_t iuab_bytecode_measure(const uint8_t *program);
+
+// Runs the instruction at the instruction pointer of the context pointed to by
+// `ctx` in its valid I use Arch btw bytecode program, which must not be an
+// `IUAB_BYTECODE_OP_RET` instruction, and moves the instruction pointer to the
+// next instruction to run. Returns the error that occurred in the process.
+enum iuab_error iuab_bytecode_step(struct iuab_context *ctx);
+
+// A profile of the runs of an I use Arch btw bytecode program.
+struct iuab_bytecode_profile {
+    // The number of times the instruction at each offset of the program ran.
+    uint64_t *counts;
+    size_t program_size;
+};
+
+// Initializes the given profile for a program of `program_size` bytes, with
+// no runs. Returns the error that occurred in the process.
+enum iuab_error iuab_bytecode_profile_init(
+    struct iuab_bytecode_profile *profile,
+    size_t program_size
+);
+
+// Finalizes the given profile. Frees its counts.
+void iuab_bytecode_profile_fini(struct iuab_bytecode_profile *profile);
+
+// Runs like `iuab_run_verified_bytecode()` the valid I use Arch btw bytecode
+// program, counting the runs of each of its instructions in the profile
+// pointed to by `profile`. Only the instructions run pay for the counting.
+enum iuab_error iuab_run_profiled_bytecode(
+    struct iuab_context *ctx,
+    struct iuab_bytecode_profile *profile
+);
+
+// Writes to the file pointed to by `out` a table of the at most `max_loops`
+// loops of the program pointed to by `program` that ran the most instructions
+// according to the given profile, with their position in the source code from
+// the `source_map_size` entries of the source map pointed to by `source_map`.
+// Returns the error that occurred in the process.
+enum iuab_error iuab_bytecode_profile_print(
+    const struct iuab_bytecode_profile *profile,
+    const uint8_t *program,
+    const struct iuab_bytecode_source_map_entry *source_map,
+    size_t source_map_size,
+    size_t max_loops,
+    FILE *out
+);
+
+// Writes to the file pointed to by `out` the given profile of the program
+// pointed to by `program`, as a line for each instruction that ran with the
+// number of times it ran, its offset, its position in the source code from the
+// `source_map_size` entries of the source map pointed to by `source_map`, or
+// zeros if it has none, and its opcode name. Returns the error that occurred in
+// the process.
+enum iuab_error iuab_bytecode_profile_save(
+    const struct iuab_bytecode_profile *profile,
+    const uint8_t *program,
+    const struct iuab_bytecode_source_map_entry *source_map,
+    size_t source_map_size,
+    FILE *out
+);
+
 #ifdef __cplusplus
 }
 #endif
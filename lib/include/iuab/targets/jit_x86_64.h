@@ -11,27 +11,62 @@ extern "C" {
 #include "../buffer.h"
 #include "../context.h"
 #include "../errors.h"
+#include "../ir.h"
 #include "../token.h"
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
-#include <stdio.h>
 
-// JIT-compiles the source file pointed to by `src` into x86-64 code
-// following the System V AMD64/x86-64 ABI's calling convention to write to the
-// buffer pointed to by `dst` and writes the last token processed at the
-// location pointed to by `last_token_dst`. Returns the error that occurred in
-// the process.
+// Statistics about the JIT compilation of a program into x86-64 code.
+struct iuab_jit_x86_64_stats {
+    // The number of bytes jumps with an 8-bit displacement saved in the code,
+    // and of bytes of padding aligning loops added to it.
+    size_t relaxation_saved_size;
+    size_t alignment_padding_size;
+    // The number of bytes and of instructions the peephole optimizations of
+    // the code removed, reusing values left in registers by earlier code.
+    // Choosing shorter encodings of instructions does not count.
+    size_t peephole_saved_size;
+    size_t peephole_saved_instructions;
+};
+
+// JIT-compiles the program in intermediate representation pointed to by `ir`
+// into x86-64 code following the System V AMD64/x86-64 ABI's calling
+// convention to write to the buffer pointed to by `dst`, and writes statistics
+// about the compilation at the location pointed to by `stats_dst`. Returns the
+// error that occurred in the process and, if it occurred while compiling a
+// node, writes the source code token of the node at the location pointed to by
+// `last_token_dst`.
+//
+// Jumps use an 8-bit displacement wherever it fits, and the bodies of
+// innermost loops are aligned to 16 bytes. The code of each node is emitted
+// knowing what the code before it left in registers, which avoids redundant
+// compares, reloads and stores, and with the shortest encoding of immediates
+// and displacements.
+//
+// If `is_memory_guarded` is true, bounds checks are replaced with memory
+// accesses faulting in the guard regions, and the program must be run from a
+// context with guarded memory.
 enum iuab_error iuab_compile_jit_x86_64(
-    FILE *src,
+    const struct iuab_ir *ir,
+    bool is_memory_guarded,
     struct iuab_buffer *dst,
+    struct iuab_jit_x86_64_stats *stats_dst,
     struct iuab_token *last_token_dst
 );
 
 // Runs the JIT-compiled x86-64 program from the context pointed to by `ctx`.
 // Returns the error that occurred in the process.
 //
-// The `ip` and `dp` members of the context are only updated when calling the
-// debugging event handler.
+// The `dp` member of the context is updated when calling the debugging event
+// handler and when the program returns, but not when an access out of the
+// bounds of guarded memory faults. The `ip` member is only updated when calling
+// the debugging event handler, and set to the faulting instruction when such an
+// access faults. Faults are caught by a `SIGSEGV` handler installed for all
+// threads at the first run from a context with guarded memory, which passes
+// the faults it does not handle on to the action it replaced, so that such
+// runs may be concurrent.
 enum iuab_error iuab_run_jit_x86_64(struct iuab_context *ctx);
 
 #ifdef __cplusplus
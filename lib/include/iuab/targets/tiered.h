@@ -0,0 +1,35 @@
+// Copyright (C) 2022 OverMighty
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef IUAB_TARGETS_TIERED_H
+#define IUAB_TARGETS_TIERED_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "../context.h"
+#include "../errors.h"
+
+// The number of times a loop of a program run with `iuab_run_tiered()` jumps
+// back to the start of its body before it is JIT-compiled.
+#define IUAB_TIERED_HOT_LOOP_THRESHOLD 1000
+
+// Runs like `iuab_run_bytecode()` the I use Arch btw bytecode program from the
+// context pointed to by `ctx`, but JIT-compiles into x86-64 code each loop
+// once it jumps back to the start of its body `IUAB_TIERED_HOT_LOOP_THRESHOLD`
+// times, and runs its code instead of interpreting it whenever its body starts
+// from then on. Returns the error that occurred in the process.
+//
+// The code of a loop shares the data pointer and memory of the context, and
+// the instruction pointer is set to the start of the body of the loop when an
+// error occurs in it. Loops calling the debugging event handler or failing to
+// compile, and all loops if JIT compilation is not available for the target
+// system, are only interpreted.
+enum iuab_error iuab_run_tiered(struct iuab_context *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IUAB_TARGETS_TIERED_H
@@ -48,6 +48,14 @@ struct iuab_token {
     size_t col;
 };
 
+// A run of consecutive I use Arch btw source code tokens of the same type.
+struct iuab_token_run {
+    // The first token of the run.
+    struct iuab_token token;
+    // The number of tokens in the run.
+    size_t count;
+};
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,6 +1,9 @@
 // Copyright (C) 2022 OverMighty
 // SPDX-License-Identifier: GPL-3.0-only
 
+// Needed for `mremap()`.
+#define _GNU_SOURCE
+
 #include "iuab/buffer.h"
 
 #include "iuab/errors.h"
@@ -29,21 +32,11 @@ enum iuab_error iuab_buffer_init(struct iuab_buffer *buffer) {
 }
 
 enum iuab_error iuab_buffer_init_jit(struct iuab_buffer *buffer) {
+    // The code is mapped when first written, to the exact number of pages it
+    // needs.
     buffer->size = 0;
-    buffer->cap = sysconf(_SC_PAGESIZE);
-    buffer->data = mmap(
-        NULL,
-        buffer->cap,
-        PROT_READ | PROT_WRITE | PROT_EXEC,
-        MAP_PRIVATE | MAP_ANON,
-        -1,
-        0
-    );
-
-    if (buffer->data == MAP_FAILED) {
-        return IUAB_ERROR_MALLOC;
-    }
-
+    buffer->cap = 0;
+    buffer->data = NULL;
     return IUAB_ERROR_SUCCESS;
 }
 
@@ -66,37 +59,81 @@ iuab_buffer_write(struct iuab_buffer *buffer, const void *data, size_t n) {
     return IUAB_ERROR_SUCCESS;
 }
 
-enum iuab_error
-iuab_buffer_write_jit(struct iuab_buffer *buffer, const void *data, size_t n) {
-    if (buffer->size + n > buffer->cap) {
-        size_t prev_cap = buffer->cap;
-        buffer->cap *=
-            (buffer->cap + n - 1) / buffer->cap * IUAB_BUFFER_GROWTH_FACTOR;
-        uint8_t *new_data = mmap(
+// Returns `size` rounded up to a multiple of the page size.
+static size_t iuab_buffer_page_align(size_t size) {
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    return (size + page_size - 1) / page_size * page_size;
+}
+
+// Makes the given buffer initialized with `iuab_buffer_init_jit()` writable
+// with a storage capacity of at least `cap` bytes. Returns the error that
+// occurred in the process.
+static enum iuab_error
+iuab_buffer_reserve_jit(struct iuab_buffer *buffer, size_t cap) {
+    if (buffer->cap == 0) {
+        uint8_t *data = mmap(
             NULL,
-            buffer->cap,
-            PROT_READ | PROT_WRITE | PROT_EXEC,
+            cap,
+            PROT_READ | PROT_WRITE,
             MAP_PRIVATE | MAP_ANON,
             -1,
             0
         );
 
-        if (new_data == MAP_FAILED) {
+        if (data == MAP_FAILED) {
             return IUAB_ERROR_MALLOC;
         }
 
-        memcpy(new_data, buffer->data, buffer->size);
-        munmap(buffer->data, prev_cap);
-        buffer->data = new_data;
+        buffer->cap = cap;
+        buffer->data = data;
+        return IUAB_ERROR_SUCCESS;
+    }
+
+    // The code is never writable and executable at the same time.
+    if (mprotect(buffer->data, buffer->cap, PROT_READ | PROT_WRITE) != 0) {
+        return IUAB_ERROR_MALLOC;
+    }
+
+    if (cap > buffer->cap) {
+        uint8_t *data = mremap(buffer->data, buffer->cap, cap, MREMAP_MAYMOVE);
+
+        if (data == MAP_FAILED) {
+            mprotect(buffer->data, buffer->cap, PROT_READ | PROT_EXEC);
+            return IUAB_ERROR_MALLOC;
+        }
+
+        buffer->cap = cap;
+        buffer->data = data;
+    }
+
+    return IUAB_ERROR_SUCCESS;
+}
+
+enum iuab_error
+iuab_buffer_write_jit(struct iuab_buffer *buffer, const void *data, size_t n) {
+    size_t cap = iuab_buffer_page_align(buffer->size + n);
+    enum iuab_error error = iuab_buffer_reserve_jit(buffer, cap);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
     }
 
     memcpy(&buffer->data[buffer->size], data, n);
     buffer->size += n;
+
+    if (mprotect(buffer->data, buffer->cap, PROT_READ | PROT_EXEC) != 0) {
+        return IUAB_ERROR_MALLOC;
+    }
+
     return IUAB_ERROR_SUCCESS;
 }
 
+size_t iuab_buffer_peek_size(const struct iuab_buffer *buffer) {
+    return ((const size_t *) &buffer->data[buffer->size])[-1];
+}
+
 size_t iuab_buffer_pop_size(struct iuab_buffer *buffer) {
-    size_t top = ((size_t *) &buffer->data[buffer->size])[-1];
+    size_t top = iuab_buffer_peek_size(buffer);
     buffer->size -= sizeof(top);
     return top;
 }
@@ -106,5 +143,7 @@ void iuab_buffer_fini(struct iuab_buffer *buffer) {
 }
 
 void iuab_buffer_fini_jit(struct iuab_buffer *buffer) {
-    munmap(buffer->data, buffer->cap);
+    if (buffer->cap != 0) {
+        munmap(buffer->data, buffer->cap);
+    }
 }
@@ -3,8 +3,33 @@
 
 #include "iuab/context.h"
 
+#include "iuab/errors.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 
+#if defined(__x86_64__) && defined(__GNUC__)
+    #define IUAB_CONTEXT_HAVE_X86_64_SIMD
+    #include <immintrin.h>
+#endif
+
+// The size of the blocks of memory searched at once for zero values.
+#define IUAB_CONTEXT_SCAN_BLOCK_SIZE 64
+
+// The size of the mapping of guarded memory and its guard regions.
+#define IUAB_CONTEXT_GUARDED_MAPPING_SIZE                \
+    (IUAB_CONTEXT_GUARD_SIZE + IUAB_CONTEXT_MEMORY_SIZE \
+     + IUAB_CONTEXT_GUARD_SIZE)
+
 void iuab_context_init(
     struct iuab_context *ctx,
     const uint8_t *program,
@@ -13,10 +38,358 @@ void iuab_context_init(
     void (*debug_handler)(struct iuab_context *)
 ) {
     ctx->ip = program;
-    ctx->dp = ctx->memory;
     ctx->in = in;
     ctx->out = out;
     ctx->debug_handler = debug_handler;
     ctx->program = program;
+    ctx->in_cursor = NULL;
+    ctx->in_end = NULL;
+    ctx->out_size = 0;
+    ctx->in_mapping = NULL;
+    ctx->in_mapping_size = 0;
+    ctx->is_in_from_stream = false;
+    ctx->memory = ctx->inline_memory;
+    ctx->dp = ctx->memory;
     memset(ctx->memory, 0, IUAB_CONTEXT_MEMORY_SIZE);
 }
+
+enum iuab_error iuab_context_init_guarded(
+    struct iuab_context *ctx,
+    const uint8_t *program,
+    FILE *in,
+    FILE *out,
+    void (*debug_handler)(struct iuab_context *)
+) {
+    uint8_t *mapping = mmap(
+        NULL,
+        IUAB_CONTEXT_GUARDED_MAPPING_SIZE,
+        PROT_NONE,
+        MAP_PRIVATE | MAP_ANON,
+        -1,
+        0
+    );
+
+    if (mapping == MAP_FAILED) {
+        return IUAB_ERROR_MALLOC;
+    }
+
+    uint8_t *memory = mapping + IUAB_CONTEXT_GUARD_SIZE;
+
+    if (mprotect(memory, IUAB_CONTEXT_MEMORY_SIZE, PROT_READ | PROT_WRITE)
+        != 0) {
+        munmap(mapping, IUAB_CONTEXT_GUARDED_MAPPING_SIZE);
+        return IUAB_ERROR_MALLOC;
+    }
+
+    ctx->ip = program;
+    ctx->in = in;
+    ctx->out = out;
+    ctx->debug_handler = debug_handler;
+    ctx->program = program;
+    ctx->in_cursor = NULL;
+    ctx->in_end = NULL;
+    ctx->out_size = 0;
+    ctx->in_mapping = NULL;
+    ctx->in_mapping_size = 0;
+    ctx->is_in_from_stream = false;
+    // Anonymous mappings are zero-filled.
+    ctx->memory = memory;
+    ctx->dp = ctx->memory;
+    return IUAB_ERROR_SUCCESS;
+}
+
+bool iuab_context_is_guarded(const struct iuab_context *ctx) {
+    return ctx->memory != ctx->inline_memory;
+}
+
+bool iuab_context_is_guard_address(
+    const struct iuab_context *ctx,
+    const void *address
+) {
+    if (!iuab_context_is_guarded(ctx)) {
+        return false;
+    }
+
+    uintptr_t mapping = (uintptr_t) ctx->memory - IUAB_CONTEXT_GUARD_SIZE;
+    uintptr_t offset = (uintptr_t) address - mapping;
+    return offset < IUAB_CONTEXT_GUARD_SIZE
+           || (offset >= IUAB_CONTEXT_GUARD_SIZE + IUAB_CONTEXT_MEMORY_SIZE
+               && offset < IUAB_CONTEXT_GUARDED_MAPPING_SIZE);
+}
+
+void iuab_context_fini(struct iuab_context *ctx) {
+    if (ctx->in_mapping) {
+        munmap((void *) ctx->in_mapping, ctx->in_mapping_size);
+        ctx->in_mapping = NULL;
+        ctx->in_cursor = NULL;
+        ctx->in_end = NULL;
+    }
+
+    if (!iuab_context_is_guarded(ctx)) {
+        return;
+    }
+
+    munmap(
+        ctx->memory - IUAB_CONTEXT_GUARD_SIZE,
+        IUAB_CONTEXT_GUARDED_MAPPING_SIZE
+    );
+    ctx->memory = ctx->inline_memory;
+}
+
+enum iuab_error iuab_context_flush(struct iuab_context *ctx) {
+    size_t size = ctx->out_size;
+    ctx->out_size = 0;
+
+    if (fwrite(ctx->out_buffer, 1, size, ctx->out) != size) {
+        return IUAB_ERROR_IO;
+    }
+
+    return IUAB_ERROR_SUCCESS;
+}
+
+enum iuab_error
+iuab_context_end_run(struct iuab_context *ctx, enum iuab_error error) {
+    enum iuab_error flush_error = iuab_context_flush(ctx);
+    // The position of the input file is that of `in_end`.
+    off_t unread = (off_t) (ctx->in_end - ctx->in_cursor);
+
+    if (unread != 0
+        && (ctx->is_in_from_stream
+                ? fseeko(ctx->in, -unread, SEEK_CUR) == 0
+                : lseek(fileno(ctx->in), -unread, SEEK_CUR) != -1)) {
+        ctx->in_cursor = ctx->in_end;
+    }
+
+    return error != IUAB_ERROR_SUCCESS ? error : flush_error;
+}
+
+// Maps the input file of the given context, whose file descriptor is `fd`, if
+// it is a regular file with input left. Returns true if it was mapped,
+// otherwise false.
+static bool iuab_context_map_input(struct iuab_context *ctx, int fd) {
+    struct stat st;
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+
+    if (offset == -1 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)
+        || offset >= st.st_size) {
+        return false;
+    }
+
+    size_t size = (size_t) st.st_size;
+    uint8_t *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+
+    // The mapped input is consumed, so that unread input can be given back.
+    if (lseek(fd, st.st_size, SEEK_SET) == -1) {
+        munmap(mapping, size);
+        return false;
+    }
+
+    ctx->in_mapping = mapping;
+    ctx->in_mapping_size = size;
+    ctx->in_cursor = mapping + offset;
+    ctx->in_end = mapping + size;
+    return true;
+}
+
+// Returns the number of bytes of input to read through the stream of the input
+// file of the given context, whose file descriptor is `fd`: those buffered in
+// the stream ahead of the file descriptor, or a full buffer if there is no
+// file descriptor. Streams of files that cannot be positioned are assumed to
+// have none buffered.
+static size_t
+iuab_context_stream_input_size(const struct iuab_context *ctx, int fd) {
+    if (fd == -1) {
+        return IUAB_CONTEXT_INPUT_BUFFER_SIZE;
+    }
+
+    off_t stream_offset = ftello(ctx->in);
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+
+    if (stream_offset == -1 || offset == -1 || offset <= stream_offset) {
+        return 0;
+    }
+
+    return offset - stream_offset < IUAB_CONTEXT_INPUT_BUFFER_SIZE
+               ? (size_t) (offset - stream_offset)
+               : IUAB_CONTEXT_INPUT_BUFFER_SIZE;
+}
+
+enum iuab_error iuab_context_read_input(struct iuab_context *ctx) {
+    int fd = fileno(ctx->in);
+    size_t stream_size = iuab_context_stream_input_size(ctx, fd);
+
+    // Only input files never read from are mapped.
+    if (!ctx->in_end && stream_size == 0 && iuab_context_map_input(ctx, fd)) {
+        return IUAB_ERROR_SUCCESS;
+    }
+
+    // Output is written before waiting for input, which may depend on it.
+    enum iuab_error error = iuab_context_flush(ctx);
+
+    if (error != IUAB_ERROR_SUCCESS || fflush(ctx->out) != 0) {
+        return IUAB_ERROR_IO;
+    }
+
+    ssize_t size;
+
+    if (stream_size != 0) {
+        size = (ssize_t) fread(ctx->in_buffer, 1, stream_size, ctx->in);
+
+        if (size == 0 && ferror(ctx->in)) {
+            return IUAB_ERROR_IO;
+        }
+    } else {
+        do {
+            size = read(fd, ctx->in_buffer, IUAB_CONTEXT_INPUT_BUFFER_SIZE);
+        } while (size == -1 && errno == EINTR);
+
+        if (size == -1) {
+            return IUAB_ERROR_IO;
+        }
+    }
+
+    if (size == 0) {
+        return IUAB_ERROR_RUNTIME_END_OF_INPUT_FILE;
+    }
+
+    ctx->in_cursor = ctx->in_buffer;
+    ctx->in_end = ctx->in_buffer + size;
+    ctx->is_in_from_stream = stream_size != 0;
+    return IUAB_ERROR_SUCCESS;
+}
+
+enum iuab_error iuab_context_write_data(
+    struct iuab_context *ctx,
+    const void *data,
+    size_t size
+) {
+    if (size >= IUAB_CONTEXT_OUTPUT_BUFFER_SIZE - ctx->out_size) {
+        enum iuab_error error = iuab_context_flush(ctx);
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
+
+        if (size >= IUAB_CONTEXT_OUTPUT_BUFFER_SIZE) {
+            return fwrite(data, 1, size, ctx->out) == size ? IUAB_ERROR_SUCCESS
+                                                           : IUAB_ERROR_IO;
+        }
+    }
+
+    memcpy(&ctx->out_buffer[ctx->out_size], data, size);
+    ctx->out_size += size;
+    return IUAB_ERROR_SUCCESS;
+}
+
+enum iuab_error iuab_context_debug(struct iuab_context *ctx) {
+    enum iuab_error error = iuab_context_flush(ctx);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    ctx->debug_handler(ctx);
+    return IUAB_ERROR_SUCCESS;
+}
+
+// Returns a mask of the zero values of the block of
+// `IUAB_CONTEXT_SCAN_BLOCK_SIZE` values pointed to by `block`.
+static uint64_t iuab_context_zero_mask(const uint8_t *block) {
+#ifdef IUAB_CONTEXT_HAVE_X86_64_SIMD
+    __m128i zero = _mm_setzero_si128();
+    uint64_t mask = 0;
+
+    for (size_t i = 0; i < IUAB_CONTEXT_SCAN_BLOCK_SIZE; i += 16) {
+        __m128i values = _mm_loadu_si128((const __m128i *) &block[i]);
+        __m128i zeros = _mm_cmpeq_epi8(values, zero);
+        mask |= (uint64_t) (uint16_t) _mm_movemask_epi8(zeros) << i;
+    }
+
+    return mask;
+#else
+    uint64_t mask = 0;
+
+    for (size_t i = 0; i < IUAB_CONTEXT_SCAN_BLOCK_SIZE; i++) {
+        mask |= (uint64_t) (block[i] == 0) << i;
+    }
+
+    return mask;
+#endif
+}
+
+// Returns a mask of the values of a block at an index congruent to `index`
+// modulo `step`, which must divide `IUAB_CONTEXT_SCAN_BLOCK_SIZE`.
+static uint64_t iuab_context_step_mask(size_t index, size_t step) {
+    uint64_t mask = 0;
+
+    for (size_t i = index % step; i < IUAB_CONTEXT_SCAN_BLOCK_SIZE; i += step) {
+        mask |= UINT64_C(1) << i;
+    }
+
+    return mask;
+}
+
+static uint8_t *
+iuab_context_scan_slow(struct iuab_context *ctx, size_t index, int32_t stride) {
+    size_t step = (size_t) (stride < 0 ? -stride : stride);
+
+    while (ctx->memory[index] != 0) {
+        if (stride > 0 ? index >= IUAB_CONTEXT_MEMORY_SIZE - step
+                       : index < step) {
+            return NULL;
+        }
+
+        index = stride > 0 ? index + step : index - step;
+    }
+
+    return &ctx->memory[index];
+}
+
+uint8_t *
+iuab_context_scan(struct iuab_context *ctx, uint8_t *dp, int32_t stride) {
+    size_t index = (size_t) (dp - ctx->memory);
+    size_t step = (size_t) (stride < 0 ? -stride : stride);
+
+    // Blocks with few values to check are not worth searching at once.
+    if (step > IUAB_CONTEXT_SCAN_BLOCK_SIZE / 4) {
+        return iuab_context_scan_slow(ctx, index, stride);
+    }
+
+    uint64_t step_mask = iuab_context_step_mask(index, step);
+    size_t first = index % IUAB_CONTEXT_SCAN_BLOCK_SIZE;
+    size_t block = index - first;
+    uint64_t mask = iuab_context_zero_mask(&ctx->memory[block]) & step_mask;
+
+    if (stride > 0) {
+        mask &= ~UINT64_C(0) << first;
+
+        while (mask == 0) {
+            block += IUAB_CONTEXT_SCAN_BLOCK_SIZE;
+
+            if (block == IUAB_CONTEXT_MEMORY_SIZE) {
+                return NULL;
+            }
+
+            mask = iuab_context_zero_mask(&ctx->memory[block]) & step_mask;
+        }
+
+        return &ctx->memory[block + (size_t) __builtin_ctzll(mask)];
+    }
+
+    mask &= (UINT64_C(2) << first) - 1;
+
+    while (mask == 0) {
+        if (block == 0) {
+            return NULL;
+        }
+
+        block -= IUAB_CONTEXT_SCAN_BLOCK_SIZE;
+        mask = iuab_context_zero_mask(&ctx->memory[block]) & step_mask;
+    }
+
+    return &ctx->memory[block + 63 - (size_t) __builtin_clzll(mask)];
+}
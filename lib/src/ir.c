@@ -0,0 +1,237 @@
+// Copyright (C) 2022 OverMighty
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "iuab/ir.h"
+
+#include "iuab/buffer.h"
+#include "iuab/errors.h"
+#include "iuab/lexer.h"
+#include "iuab/token.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+const char *iuab_ir_op_name(enum iuab_ir_op op) {
+    switch (op) {
+    case IUAB_IR_OP_MOVE: return "move";
+    case IUAB_IR_OP_MOVE_UNCHECKED: return "move_unchecked";
+    case IUAB_IR_OP_CHECK: return "check";
+    case IUAB_IR_OP_ADD: return "add";
+    case IUAB_IR_OP_SET: return "set";
+    case IUAB_IR_OP_MULADD: return "muladd";
+    case IUAB_IR_OP_SCAN: return "scan";
+    case IUAB_IR_OP_WRITE: return "write";
+    case IUAB_IR_OP_READ: return "read";
+    case IUAB_IR_OP_LOOP: return "loop";
+    case IUAB_IR_OP_END_LOOP: return "end_loop";
+    case IUAB_IR_OP_DEBUG: return "debug";
+    case IUAB_IR_OP_STORE_DATA: return "store_data";
+    case IUAB_IR_OP_WRITE_DATA: return "write_data";
+    default: return "???";
+    }
+}
+
+enum iuab_error iuab_ir_init(struct iuab_ir *ir) {
+    enum iuab_error error = iuab_buffer_init(&ir->nodes);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    error = iuab_buffer_init(&ir->data);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        iuab_buffer_fini(&ir->nodes);
+    }
+
+    return error;
+}
+
+enum iuab_error
+iuab_ir_append(struct iuab_ir *ir, const struct iuab_ir_node *node) {
+    return iuab_buffer_write(&ir->nodes, node, sizeof(*node));
+}
+
+enum iuab_error iuab_ir_append_data(
+    struct iuab_ir *ir,
+    const void *data,
+    size_t size,
+    size_t *index_dst
+) {
+    *index_dst = ir->data.size;
+    return iuab_buffer_write(&ir->data, data, size);
+}
+
+void iuab_ir_move_data(struct iuab_ir *dst, struct iuab_ir *src) {
+    struct iuab_buffer data = dst->data;
+    dst->data = src->data;
+    src->data = data;
+}
+
+enum iuab_error iuab_ir_link_loops(struct iuab_ir *ir) {
+    struct iuab_buffer loop_stack;
+    enum iuab_error error = iuab_buffer_init(&loop_stack);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    struct iuab_ir_node *nodes = iuab_ir_nodes(ir);
+    size_t size = iuab_ir_size(ir);
+
+    for (size_t i = 0; i < size && error == IUAB_ERROR_SUCCESS; i++) {
+        switch (nodes[i].op) {
+        case IUAB_IR_OP_LOOP:
+            error = iuab_buffer_write_size(&loop_stack, i);
+            break;
+        case IUAB_IR_OP_END_LOOP:
+            if (loop_stack.size == 0) {
+                error = IUAB_ERROR_COMPILER_INTERNAL;
+                break;
+            }
+
+            nodes[i].link = iuab_buffer_pop_size(&loop_stack);
+            nodes[nodes[i].link].link = i;
+            break;
+        default: break;
+        }
+    }
+
+    if (error == IUAB_ERROR_SUCCESS && loop_stack.size != 0) {
+        error = IUAB_ERROR_COMPILER_INTERNAL;
+    }
+
+    iuab_buffer_fini(&loop_stack);
+    return error;
+}
+
+struct iuab_ir_builder {
+    struct iuab_ir *ir;
+    struct iuab_lexer *lexer;
+    struct iuab_token_run run;
+    size_t loop_depth;
+};
+
+static enum iuab_error iuab_ir_build_move(struct iuab_ir_builder *builder) {
+    enum iuab_token_type token_type = builder->run.token.type;
+    struct iuab_ir_node node = {
+        .op = IUAB_IR_OP_MOVE,
+        .value = (int32_t) builder->run.count,
+        .token = builder->run.token,
+    };
+
+    if (token_type == IUAB_TOKEN_USE) {
+        node.value = -node.value;
+    }
+
+    builder->run = iuab_lexer_next_run(builder->lexer, UINT16_MAX);
+
+    // Runs are only split when they are longer than `UINT16_MAX` tokens.
+    if (builder->run.token.type == token_type) {
+        return IUAB_ERROR_DP_OUT_OF_BOUNDS;
+    }
+
+    return iuab_ir_append(builder->ir, &node);
+}
+
+static enum iuab_error iuab_ir_build_add(struct iuab_ir_builder *builder) {
+    enum iuab_token_type token_type = builder->run.token.type;
+    struct iuab_ir_node node = {
+        .op = IUAB_IR_OP_ADD,
+        .token = builder->run.token,
+    };
+    uint8_t operand = 0;
+
+    do {
+        operand += (uint8_t) builder->run.count;
+        builder->run = iuab_lexer_next_run(builder->lexer, UINT16_MAX);
+    } while (builder->run.token.type == token_type);
+
+    if (operand == 0) {
+        return IUAB_ERROR_SUCCESS;
+    }
+
+    node.value = token_type == IUAB_TOKEN_ARCH ? operand : -operand;
+    return iuab_ir_append(builder->ir, &node);
+}
+
+static enum iuab_error iuab_ir_build_single(struct iuab_ir_builder *builder) {
+    struct iuab_ir_node node = { .token = builder->run.token };
+
+    switch (builder->run.token.type) {
+    case IUAB_TOKEN_BTW: node.op = IUAB_IR_OP_WRITE; break;
+    case IUAB_TOKEN_BY: node.op = IUAB_IR_OP_READ; break;
+    case IUAB_TOKEN_THE:
+        node.op = IUAB_IR_OP_LOOP;
+        builder->loop_depth++;
+        break;
+    case IUAB_TOKEN_WAY:
+        if (builder->loop_depth == 0) {
+            return IUAB_ERROR_COMPILER_UNEXPECTED_LOOP_END;
+        }
+
+        node.op = IUAB_IR_OP_END_LOOP;
+        builder->loop_depth--;
+        break;
+    case IUAB_TOKEN_GENTOO: node.op = IUAB_IR_OP_DEBUG; break;
+    default: return IUAB_ERROR_COMPILER_INVALID_TOKEN;
+    }
+
+    return iuab_ir_append(builder->ir, &node);
+}
+
+static enum iuab_error iuab_ir_build_run(struct iuab_ir_builder *builder) {
+    switch (builder->run.token.type) {
+    case IUAB_TOKEN_I:
+    case IUAB_TOKEN_USE: return iuab_ir_build_move(builder);
+    case IUAB_TOKEN_ARCH:
+    case IUAB_TOKEN_LINUX: return iuab_ir_build_add(builder);
+    default: break;
+    }
+
+    for (size_t i = 0; i < builder->run.count; i++) {
+        enum iuab_error error = iuab_ir_build_single(builder);
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
+    }
+
+    builder->run = iuab_lexer_next_run(builder->lexer, UINT16_MAX);
+    return IUAB_ERROR_SUCCESS;
+}
+
+enum iuab_error iuab_ir_build(
+    struct iuab_ir *ir,
+    struct iuab_lexer *lexer,
+    struct iuab_token *last_token_dst
+) {
+    struct iuab_ir_builder builder = {
+        .ir = ir,
+        .lexer = lexer,
+        .run = iuab_lexer_next_run(lexer, UINT16_MAX),
+        .loop_depth = 0,
+    };
+
+    while (builder.run.token.type != IUAB_TOKEN_EOF) {
+        enum iuab_error error = iuab_ir_build_run(&builder);
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            *last_token_dst = builder.run.token;
+            return error;
+        }
+    }
+
+    *last_token_dst = builder.run.token;
+
+    if (builder.loop_depth != 0) {
+        return IUAB_ERROR_COMPILER_UNCLOSED_LOOPS;
+    }
+
+    return iuab_ir_link_loops(ir);
+}
+
+void iuab_ir_fini(struct iuab_ir *ir) {
+    iuab_buffer_fini(&ir->nodes);
+    iuab_buffer_fini(&ir->data);
+}
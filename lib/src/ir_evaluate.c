@@ -0,0 +1,352 @@
+// Copyright (C) 2022 OverMighty
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "iuab/ir.h"
+
+#include "iuab/buffer.h"
+#include "iuab/context.h"
+#include "iuab/errors.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The maximum number of steps the evaluator runs.
+#define IUAB_IR_EVALUATOR_FUEL ((size_t) 1 << 22)
+
+// The number of steps a copy of the memory costs.
+#define IUAB_IR_EVALUATOR_SAVE_COST ((size_t) 1024)
+
+// An evaluator of the prefix of a program in intermediate representation.
+struct iuab_ir_evaluator {
+    uint8_t memory[IUAB_CONTEXT_MEMORY_SIZE];
+    size_t dp;
+    struct iuab_buffer output;
+    size_t fuel;
+    // The state before the top-level loop being run, to go back to if the
+    // evaluation stops inside it.
+    uint8_t saved_memory[IUAB_CONTEXT_MEMORY_SIZE];
+    size_t saved_dp;
+    size_t saved_output_size;
+};
+
+// Returns true if the values at offsets from `min` to `max` from the data
+// pointer of the given evaluator are within the bounds of the memory.
+static bool iuab_ir_evaluator_is_in_bounds(
+    const struct iuab_ir_evaluator *evaluator,
+    int32_t min,
+    int32_t max
+) {
+    int64_t dp = (int64_t) evaluator->dp;
+    return dp + min >= 0 && dp + max < IUAB_CONTEXT_MEMORY_SIZE;
+}
+
+// Runs the given scan node, entirely or not at all. Returns false if it cannot
+// be run at compile time.
+static bool iuab_ir_evaluator_scan(
+    struct iuab_ir_evaluator *evaluator,
+    const struct iuab_ir_node *node
+) {
+    size_t dp = evaluator->dp;
+
+    while (evaluator->memory[dp] != 0) {
+        int64_t next_dp = (int64_t) dp + node->value;
+
+        if (evaluator->fuel == 0 || next_dp < 0
+            || next_dp >= IUAB_CONTEXT_MEMORY_SIZE) {
+            return false;
+        }
+
+        evaluator->fuel--;
+        dp = (size_t) next_dp;
+    }
+
+    evaluator->dp = dp;
+    return true;
+}
+
+// Runs the node at index `*index` of the given nodes and writes the index of
+// the next node to run at the location pointed to by `index`. Returns false,
+// leaving the state untouched, if the node cannot be run at compile time.
+static bool iuab_ir_evaluator_step(
+    struct iuab_ir_evaluator *evaluator,
+    const struct iuab_ir_node *nodes,
+    size_t *index
+) {
+    const struct iuab_ir_node *node = &nodes[*index];
+    uint8_t *memory = evaluator->memory;
+    size_t dp = evaluator->dp;
+    int32_t offset = node->offset;
+    int32_t value = node->value;
+
+    switch (node->op) {
+    case IUAB_IR_OP_MOVE:
+    case IUAB_IR_OP_MOVE_UNCHECKED:
+        if (!iuab_ir_evaluator_is_in_bounds(evaluator, value, value)) {
+            return false;
+        }
+
+        evaluator->dp = dp + value;
+        break;
+    case IUAB_IR_OP_CHECK:
+        if (!iuab_ir_evaluator_is_in_bounds(evaluator, offset, value)) {
+            return false;
+        }
+
+        break;
+    case IUAB_IR_OP_ADD:
+    case IUAB_IR_OP_SET:
+    case IUAB_IR_OP_MULADD:
+        if (!iuab_ir_evaluator_is_in_bounds(evaluator, offset, offset)) {
+            return false;
+        }
+
+        if (node->op == IUAB_IR_OP_ADD) {
+            memory[dp + offset] += (uint8_t) value;
+        } else if (node->op == IUAB_IR_OP_SET) {
+            memory[dp + offset] = (uint8_t) value;
+        } else {
+            memory[dp + offset] += (uint8_t) value * memory[dp];
+        }
+
+        break;
+    case IUAB_IR_OP_SCAN:
+        if (!iuab_ir_evaluator_scan(evaluator, node)) {
+            return false;
+        }
+
+        break;
+    case IUAB_IR_OP_WRITE:
+        if (iuab_buffer_write_u8(&evaluator->output, memory[dp])
+            != IUAB_ERROR_SUCCESS) {
+            return false;
+        }
+
+        break;
+    case IUAB_IR_OP_LOOP:
+        if (memory[dp] == 0) {
+            *index = node->link + 1;
+            return true;
+        }
+
+        break;
+    case IUAB_IR_OP_END_LOOP:
+        if (memory[dp] != 0) {
+            *index = node->link + 1;
+            return true;
+        }
+
+        break;
+    // Input and the debugging event handler are only known at run time.
+    default: return false;
+    }
+
+    ++*index;
+    return true;
+}
+
+// Runs the given evaluator over the given nodes until it runs out of fuel or
+// reaches a node it cannot run. Returns the index of the node to resume at
+// from its state, which is at the top level of the program.
+static size_t iuab_ir_evaluator_run(
+    struct iuab_ir_evaluator *evaluator,
+    const struct iuab_ir_node *nodes,
+    size_t size
+) {
+    size_t index = 0;
+    size_t resume_index = 0;
+    // The index of the end of the top-level loop being run, if any.
+    size_t loop_end = SIZE_MAX;
+
+    while (index < size) {
+        if (loop_end == SIZE_MAX || index > loop_end) {
+            loop_end = SIZE_MAX;
+            resume_index = index;
+
+            if (nodes[index].op == IUAB_IR_OP_LOOP
+                && evaluator->memory[evaluator->dp] != 0) {
+                if (evaluator->fuel < IUAB_IR_EVALUATOR_SAVE_COST) {
+                    break;
+                }
+
+                evaluator->fuel -= IUAB_IR_EVALUATOR_SAVE_COST;
+                memcpy(
+                    evaluator->saved_memory,
+                    evaluator->memory,
+                    sizeof(evaluator->memory)
+                );
+                evaluator->saved_dp = evaluator->dp;
+                evaluator->saved_output_size = evaluator->output.size;
+                loop_end = nodes[index].link;
+            }
+        }
+
+        if (evaluator->fuel == 0
+            || !iuab_ir_evaluator_step(evaluator, nodes, &index)) {
+            break;
+        }
+
+        evaluator->fuel--;
+    }
+
+    if (index >= size) {
+        return size;
+    }
+
+    if (loop_end != SIZE_MAX) {
+        memcpy(
+            evaluator->memory,
+            evaluator->saved_memory,
+            sizeof(evaluator->memory)
+        );
+        evaluator->dp = evaluator->saved_dp;
+        evaluator->output.size = evaluator->saved_output_size;
+    }
+
+    return resume_index;
+}
+
+// Writes to the intermediate representation pointed to by `dst` the nodes
+// setting up the state of the given evaluator from the initial state of a
+// program, and the nodes from index `resume_index` of the given nodes.
+static enum iuab_error iuab_ir_evaluator_emit(
+    const struct iuab_ir_evaluator *evaluator,
+    const struct iuab_ir_node *nodes,
+    size_t size,
+    size_t resume_index,
+    struct iuab_ir *dst
+) {
+    struct iuab_ir_node node = { .token = nodes[0].token };
+    enum iuab_error error = IUAB_ERROR_SUCCESS;
+
+    if (evaluator->output.size != 0) {
+        node.op = IUAB_IR_OP_WRITE_DATA;
+        node.value = (int32_t) evaluator->output.size;
+        error = iuab_ir_append_data(
+            dst,
+            evaluator->output.data,
+            evaluator->output.size,
+            &node.link
+        );
+
+        if (error == IUAB_ERROR_SUCCESS) {
+            error = iuab_ir_append(dst, &node);
+        }
+    }
+
+    if (resume_index == size || error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    // Only the values that are not zero, as they are initially, are stored.
+    size_t lo = 0;
+    size_t hi = IUAB_CONTEXT_MEMORY_SIZE;
+
+    while (lo < hi && evaluator->memory[lo] == 0) {
+        lo++;
+    }
+
+    while (hi > lo && evaluator->memory[hi - 1] == 0) {
+        hi--;
+    }
+
+    if (lo < hi) {
+        node.op = IUAB_IR_OP_STORE_DATA;
+        node.offset = (int32_t) lo;
+        node.value = (int32_t) (hi - lo);
+        error = iuab_ir_append_data(
+            dst,
+            &evaluator->memory[lo],
+            hi - lo,
+            &node.link
+        );
+
+        if (error == IUAB_ERROR_SUCCESS) {
+            error = iuab_ir_append(dst, &node);
+        }
+    }
+
+    if (evaluator->dp != 0 && error == IUAB_ERROR_SUCCESS) {
+        node.op = IUAB_IR_OP_MOVE_UNCHECKED;
+        node.offset = 0;
+        node.value = (int32_t) evaluator->dp;
+        node.link = 0;
+        error = iuab_ir_append(dst, &node);
+    }
+
+    for (size_t i = resume_index; i < size && error == IUAB_ERROR_SUCCESS;
+         i++) {
+        error = iuab_ir_append(dst, &nodes[i]);
+    }
+
+    return error;
+}
+
+// Replaces the nodes of the given intermediate representation with those
+// setting up the state of the given evaluator and the nodes from index
+// `resume_index`. Returns the error that occurred in the process.
+static enum iuab_error iuab_ir_evaluator_replace(
+    const struct iuab_ir_evaluator *evaluator,
+    struct iuab_ir *ir,
+    size_t resume_index
+) {
+    struct iuab_ir optimized;
+    enum iuab_error error = iuab_ir_init(&optimized);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    iuab_ir_move_data(&optimized, ir);
+    error = iuab_ir_evaluator_emit(
+        evaluator,
+        iuab_ir_nodes(ir),
+        iuab_ir_size(ir),
+        resume_index,
+        &optimized
+    );
+
+    if (error == IUAB_ERROR_SUCCESS) {
+        error = iuab_ir_link_loops(&optimized);
+    }
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        iuab_ir_fini(&optimized);
+        return error;
+    }
+
+    iuab_ir_fini(ir);
+    *ir = optimized;
+    return IUAB_ERROR_SUCCESS;
+}
+
+enum iuab_error
+iuab_ir_evaluate_prefix(struct iuab_ir *ir, size_t *evaluated_dst) {
+    struct iuab_ir_evaluator *evaluator = calloc(1, sizeof(*evaluator));
+
+    if (!evaluator) {
+        return IUAB_ERROR_MALLOC;
+    }
+
+    enum iuab_error error = iuab_buffer_init(&evaluator->output);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        free(evaluator);
+        return error;
+    }
+
+    evaluator->fuel = IUAB_IR_EVALUATOR_FUEL;
+    size_t resume_index =
+        iuab_ir_evaluator_run(evaluator, iuab_ir_nodes(ir), iuab_ir_size(ir));
+
+    if (resume_index != 0) {
+        error = iuab_ir_evaluator_replace(evaluator, ir, resume_index);
+    }
+
+    iuab_buffer_fini(&evaluator->output);
+    free(evaluator);
+    *evaluated_dst = error == IUAB_ERROR_SUCCESS ? resume_index : 0;
+    return error;
+}
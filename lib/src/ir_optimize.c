@@ -0,0 +1,608 @@
+// Copyright (C) 2022 OverMighty
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "iuab/ir.h"
+
+#include "iuab/errors.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// An optimization pass. Writes to the empty intermediate representation
+// pointed to by `dst` the optimized nodes of the one pointed to by `src`, whose
+// loop nodes are linked.
+struct iuab_ir_pass {
+    enum iuab_opt_level opt_level;
+    enum iuab_error (*run)(const struct iuab_ir *src, struct iuab_ir *dst);
+};
+
+// Replaces with a single store of zero the loops only adding an odd value to
+// the value pointed to by the data pointer, which always reach zero.
+static enum iuab_error
+iuab_ir_recognize_clear_loops(const struct iuab_ir *src, struct iuab_ir *dst) {
+    const struct iuab_ir_node *nodes = iuab_ir_nodes(src);
+    size_t size = iuab_ir_size(src);
+
+    for (size_t i = 0; i < size; i++) {
+        struct iuab_ir_node node = nodes[i];
+
+        if (node.op == IUAB_IR_OP_LOOP && node.link == i + 2
+            && nodes[i + 1].op == IUAB_IR_OP_ADD && nodes[i + 1].offset == 0
+            && nodes[i + 1].value % 2 != 0) {
+            node.op = IUAB_IR_OP_SET;
+            node.value = 0;
+            node.link = 0;
+            i += 2;
+        }
+
+        enum iuab_error error = iuab_ir_append(dst, &node);
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
+    }
+
+    return IUAB_ERROR_SUCCESS;
+}
+
+// Replaces with a single search the loops only moving the data pointer by a
+// power of two, which look for a zero value.
+static enum iuab_error
+iuab_ir_recognize_scan_loops(const struct iuab_ir *src, struct iuab_ir *dst) {
+    const struct iuab_ir_node *nodes = iuab_ir_nodes(src);
+    size_t size = iuab_ir_size(src);
+
+    for (size_t i = 0; i < size; i++) {
+        struct iuab_ir_node node = nodes[i];
+
+        if (node.op == IUAB_IR_OP_LOOP && node.link == i + 2
+            && nodes[i + 1].op == IUAB_IR_OP_MOVE) {
+            int32_t value = nodes[i + 1].value;
+            int32_t step = value < 0 ? -value : value;
+
+            if ((step & (step - 1)) == 0) {
+                node.op = IUAB_IR_OP_SCAN;
+                node.value = value;
+                node.link = 0;
+                i += 2;
+            }
+        }
+
+        enum iuab_error error = iuab_ir_append(dst, &node);
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
+    }
+
+    return IUAB_ERROR_SUCCESS;
+}
+
+// Returns true if the body of the loop starting at the node at index `loop` of
+// the given intermediate representation only adds to values and moves the data
+// pointer, with an offset from the loop's data pointer fitting in an `int16_t`,
+// and moves it back to where it was at the end. Writes the lowest and highest
+// offsets at the locations pointed to by `min_dst` and `max_dst`, and the value
+// added to the value pointed to by the loop's data pointer at the location
+// pointed to by `step_dst`.
+static bool iuab_ir_is_balanced_loop(
+    const struct iuab_ir *ir,
+    size_t loop,
+    int32_t *min_dst,
+    int32_t *max_dst,
+    int32_t *step_dst
+) {
+    const struct iuab_ir_node *nodes = iuab_ir_nodes(ir);
+    int32_t offset = 0;
+    int32_t min = 0;
+    int32_t max = 0;
+    int32_t step = 0;
+
+    for (size_t i = loop + 1; i < nodes[loop].link; i++) {
+        switch (nodes[i].op) {
+        case IUAB_IR_OP_MOVE: offset += nodes[i].value; break;
+        case IUAB_IR_OP_ADD:
+            if (offset + nodes[i].offset == 0) {
+                step = (step + nodes[i].value) % 256;
+            }
+
+            break;
+        default: return false;
+        }
+
+        if (offset < INT16_MIN || offset > INT16_MAX) {
+            return false;
+        }
+
+        min = offset < min ? offset : min;
+        max = offset > max ? offset : max;
+    }
+
+    *min_dst = min;
+    *max_dst = max;
+    *step_dst = step;
+    return offset == 0;
+}
+
+// Appends to the given intermediate representation a node adding `factor`
+// times the value pointed to by the data pointer to the value at `offset` from
+// it, or adds `factor` to the factor of the one appended since the node at
+// index `start` if there is one for this offset. Returns the error that
+// occurred in the process.
+static enum iuab_error iuab_ir_append_muladd(
+    struct iuab_ir *ir,
+    size_t start,
+    int32_t offset,
+    int32_t factor,
+    struct iuab_token token
+) {
+    struct iuab_ir_node *nodes = iuab_ir_nodes(ir);
+
+    for (size_t i = start; i < iuab_ir_size(ir); i++) {
+        if (nodes[i].offset == offset) {
+            nodes[i].value = (nodes[i].value + factor) & 0xFF;
+            return IUAB_ERROR_SUCCESS;
+        }
+    }
+
+    struct iuab_ir_node node = {
+        .op = IUAB_IR_OP_MULADD,
+        .offset = offset,
+        .value = factor & 0xFF,
+        .token = token,
+    };
+    return iuab_ir_append(ir, &node);
+}
+
+// Replaces the body of the balanced loops adding 1 or -1 to the value pointed
+// to by the data pointer, which run as many times as it or its negation, with
+// multiplications of this value added to the other values then a store of zero.
+// The loops then run at most once.
+//
+// The offsets between the lowest and highest offset reached by the data pointer
+// in the loop are checked once at the start of the loop.
+static enum iuab_error iuab_ir_recognize_multiply_loops(
+    const struct iuab_ir *src,
+    struct iuab_ir *dst
+) {
+    const struct iuab_ir_node *nodes = iuab_ir_nodes(src);
+    size_t size = iuab_ir_size(src);
+
+    for (size_t i = 0; i < size; i++) {
+        enum iuab_error error = iuab_ir_append(dst, &nodes[i]);
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
+
+        int32_t min;
+        int32_t max;
+        int32_t step;
+
+        if (nodes[i].op != IUAB_IR_OP_LOOP
+            || !iuab_ir_is_balanced_loop(src, i, &min, &max, &step)
+            || (step != 1 && step != -1 && step != 255 && step != -255)) {
+            continue;
+        }
+
+        // The number of iterations is the value if it is decremented, or its
+        // negation if it is incremented.
+        int32_t sign = step == -1 || step == 255 ? 1 : -1;
+        struct iuab_ir_node check = {
+            .op = IUAB_IR_OP_CHECK,
+            .offset = min,
+            .value = max,
+            .token = nodes[i].token,
+        };
+        error = iuab_ir_append(dst, &check);
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
+
+        size_t start = iuab_ir_size(dst);
+        int32_t offset = 0;
+
+        for (size_t j = i + 1; j < nodes[i].link; j++) {
+            if (nodes[j].op == IUAB_IR_OP_MOVE) {
+                offset += nodes[j].value;
+            } else if (offset + nodes[j].offset != 0) {
+                error = iuab_ir_append_muladd(
+                    dst,
+                    start,
+                    offset + nodes[j].offset,
+                    sign * nodes[j].value,
+                    nodes[j].token
+                );
+            }
+
+            if (error != IUAB_ERROR_SUCCESS) {
+                return error;
+            }
+        }
+
+        i = nodes[i].link;
+        struct iuab_ir_node set = {
+            .op = IUAB_IR_OP_SET,
+            .value = 0,
+            .token = nodes[i].token,
+        };
+        error = iuab_ir_append(dst, &set);
+
+        if (error == IUAB_ERROR_SUCCESS) {
+            error = iuab_ir_append(dst, &nodes[i]);
+        }
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
+    }
+
+    return IUAB_ERROR_SUCCESS;
+}
+
+// Returns true if the given node can be part of a block whose data pointer
+// movements are deferred: a movement by an offset fitting in an `int16_t`, or
+// an addition to or store of the value pointed to by the data pointer.
+static bool iuab_ir_is_deferrable(const struct iuab_ir_node *node) {
+    switch (node->op) {
+    case IUAB_IR_OP_MOVE:
+        return node->value >= INT16_MIN && node->value <= INT16_MAX;
+    case IUAB_IR_OP_ADD:
+    case IUAB_IR_OP_SET: return node->offset == 0;
+    default: return false;
+    }
+}
+
+// Appends to the given intermediate representation the given addition or store
+// node, or merges it into the one appended since the node at index `start` if
+// there is one for the same offset. Returns the error that occurred in the
+// process.
+static enum iuab_error iuab_ir_append_deferred(
+    struct iuab_ir *ir,
+    size_t start,
+    const struct iuab_ir_node *node
+) {
+    struct iuab_ir_node *nodes = iuab_ir_nodes(ir);
+
+    for (size_t i = start; i < iuab_ir_size(ir); i++) {
+        if (nodes[i].offset != node->offset) {
+            continue;
+        }
+
+        if (node->op == IUAB_IR_OP_SET) {
+            nodes[i] = *node;
+        } else if (nodes[i].op == IUAB_IR_OP_SET) {
+            nodes[i].value = (nodes[i].value + node->value) & 0xFF;
+        } else {
+            nodes[i].value = (nodes[i].value + node->value) % 256;
+        }
+
+        return IUAB_ERROR_SUCCESS;
+    }
+
+    return iuab_ir_append(ir, node);
+}
+
+// Appends to the given intermediate representation the block of deferrable
+// nodes of `src` from index `start` to index `end`, whose data pointer offsets
+// fit in an `int16_t`: a single check of the offsets reached by the data
+// pointer, the additions and stores at their offset, then a single unchecked
+// movement. Returns the error that occurred in the process.
+static enum iuab_error iuab_ir_defer_block(
+    const struct iuab_ir *src,
+    size_t start,
+    size_t end,
+    struct iuab_ir *dst
+) {
+    const struct iuab_ir_node *nodes = iuab_ir_nodes(src);
+    const struct iuab_ir_node *first_move = NULL;
+    const struct iuab_ir_node *last_move = NULL;
+    int32_t offset = 0;
+    int32_t min = 0;
+    int32_t max = 0;
+
+    for (size_t i = start; i < end; i++) {
+        if (nodes[i].op == IUAB_IR_OP_MOVE) {
+            first_move = first_move ? first_move : &nodes[i];
+            last_move = &nodes[i];
+            offset += nodes[i].value;
+            min = offset < min ? offset : min;
+            max = offset > max ? offset : max;
+        }
+    }
+
+    if (!first_move) {
+        for (size_t i = start; i < end; i++) {
+            enum iuab_error error = iuab_ir_append(dst, &nodes[i]);
+
+            if (error != IUAB_ERROR_SUCCESS) {
+                return error;
+            }
+        }
+
+        return IUAB_ERROR_SUCCESS;
+    }
+
+    struct iuab_ir_node check = {
+        .op = IUAB_IR_OP_CHECK,
+        .offset = min,
+        .value = max,
+        .token = first_move->token,
+    };
+    enum iuab_error error = iuab_ir_append(dst, &check);
+    size_t ops_start = iuab_ir_size(dst);
+    offset = 0;
+
+    for (size_t i = start; i < end && error == IUAB_ERROR_SUCCESS; i++) {
+        if (nodes[i].op == IUAB_IR_OP_MOVE) {
+            offset += nodes[i].value;
+            continue;
+        }
+
+        struct iuab_ir_node node = nodes[i];
+        node.offset = offset;
+        error = iuab_ir_append_deferred(dst, ops_start, &node);
+    }
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    // Remove the additions of zero left by merging.
+    struct iuab_ir_node *ops = iuab_ir_nodes(dst);
+    size_t ops_end = ops_start;
+
+    for (size_t i = ops_start; i < iuab_ir_size(dst); i++) {
+        if (ops[i].op != IUAB_IR_OP_ADD || ops[i].value != 0) {
+            ops[ops_end++] = ops[i];
+        }
+    }
+
+    dst->nodes.size = ops_end * sizeof(*ops);
+
+    if (offset == 0) {
+        return IUAB_ERROR_SUCCESS;
+    }
+
+    struct iuab_ir_node move = {
+        .op = IUAB_IR_OP_MOVE_UNCHECKED,
+        .value = offset,
+        .token = last_move->token,
+    };
+    return iuab_ir_append(dst, &move);
+}
+
+// Defers the data pointer movements of the blocks of movements, additions and
+// stores between loops, I/O and debugging events: the additions and stores are
+// made at an offset from the data pointer, whose range is checked once at the
+// start of the block, and the data pointer is only moved once at its end.
+//
+// Blocks are split where the offset would not fit in an `int16_t`.
+static enum iuab_error
+iuab_ir_defer_moves(const struct iuab_ir *src, struct iuab_ir *dst) {
+    const struct iuab_ir_node *nodes = iuab_ir_nodes(src);
+    size_t size = iuab_ir_size(src);
+    size_t i = 0;
+
+    while (i < size) {
+        size_t end = i;
+        int32_t offset = 0;
+
+        while (end < size && iuab_ir_is_deferrable(&nodes[end])) {
+            if (nodes[end].op == IUAB_IR_OP_MOVE) {
+                int32_t next_offset = offset + nodes[end].value;
+
+                if (next_offset < INT16_MIN || next_offset > INT16_MAX) {
+                    break;
+                }
+
+                offset = next_offset;
+            }
+
+            end++;
+        }
+
+        enum iuab_error error;
+
+        if (end == i) {
+            error = iuab_ir_append(dst, &nodes[i]);
+            i++;
+        } else {
+            error = iuab_ir_defer_block(src, i, end, dst);
+            i = end;
+        }
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
+    }
+
+    return IUAB_ERROR_SUCCESS;
+}
+
+// Removes the loops that are never entered because the value pointed to by the
+// data pointer is known to be zero: loops at the start of the program, when the
+// whole memory is zero, and loops right after the end of another loop, a store
+// of zero or a search for a zero value.
+static enum iuab_error
+iuab_ir_remove_dead_loops(const struct iuab_ir *src, struct iuab_ir *dst) {
+    const struct iuab_ir_node *nodes = iuab_ir_nodes(src);
+    size_t size = iuab_ir_size(src);
+    bool is_memory_zero = true;
+    bool is_cell_zero = true;
+
+    for (size_t i = 0; i < size; i++) {
+        switch (nodes[i].op) {
+        case IUAB_IR_OP_MOVE:
+        case IUAB_IR_OP_MOVE_UNCHECKED: is_cell_zero = is_memory_zero; break;
+        case IUAB_IR_OP_ADD:
+            is_memory_zero = false;
+            is_cell_zero = is_cell_zero && nodes[i].offset != 0;
+            break;
+        case IUAB_IR_OP_SET:
+            is_memory_zero = is_memory_zero && nodes[i].value == 0;
+
+            if (nodes[i].offset == 0) {
+                is_cell_zero = nodes[i].value == 0;
+            }
+
+            break;
+        // The debugging event handler may change the memory and the data
+        // pointer, like input changes the value pointed to by it.
+        case IUAB_IR_OP_READ:
+        case IUAB_IR_OP_DEBUG:
+            is_memory_zero = false;
+            is_cell_zero = false;
+            break;
+        case IUAB_IR_OP_LOOP:
+            if (is_cell_zero) {
+                i = nodes[i].link;
+                continue;
+            }
+
+            is_memory_zero = false;
+            is_cell_zero = false;
+            break;
+        case IUAB_IR_OP_SCAN:
+        case IUAB_IR_OP_END_LOOP: is_cell_zero = true; break;
+        default: break;
+        }
+
+        enum iuab_error error = iuab_ir_append(dst, &nodes[i]);
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
+    }
+
+    return IUAB_ERROR_SUCCESS;
+}
+
+// Merges adjacent additions to and stores of the same value, removing additions
+// of zero, and adjacent checked data pointer movements in the same direction.
+static enum iuab_error
+iuab_ir_fold(const struct iuab_ir *src, struct iuab_ir *dst) {
+    const struct iuab_ir_node *nodes = iuab_ir_nodes(src);
+    size_t size = iuab_ir_size(src);
+
+    for (size_t i = 0; i < size; i++) {
+        struct iuab_ir_node *last = NULL;
+
+        if (iuab_ir_size(dst) != 0) {
+            last = &iuab_ir_nodes(dst)[iuab_ir_size(dst) - 1];
+        }
+
+        bool is_same_value = last && last->offset == nodes[i].offset;
+
+        if (is_same_value && last->op == IUAB_IR_OP_ADD
+            && nodes[i].op == IUAB_IR_OP_ADD) {
+            last->value = (last->value + nodes[i].value) % 256;
+
+            if (last->value == 0) {
+                dst->nodes.size -= sizeof(*last);
+            }
+
+            continue;
+        }
+
+        if (is_same_value && last->op == IUAB_IR_OP_SET
+            && nodes[i].op == IUAB_IR_OP_ADD) {
+            last->value = (last->value + nodes[i].value) & 0xFF;
+            continue;
+        }
+
+        if (is_same_value
+            && (last->op == IUAB_IR_OP_ADD || last->op == IUAB_IR_OP_SET)
+            && nodes[i].op == IUAB_IR_OP_SET) {
+            *last = nodes[i];
+            continue;
+        }
+
+        // Moving the data pointer in one direction twice goes out of bounds if
+        // and only if moving it once by the sum does.
+        if (last && last->op == IUAB_IR_OP_MOVE
+            && nodes[i].op == IUAB_IR_OP_MOVE
+            && (last->value < 0) == (nodes[i].value < 0)) {
+            int32_t value = last->value + nodes[i].value;
+
+            if (value >= -UINT16_MAX && value <= UINT16_MAX) {
+                last->value = value;
+                continue;
+            }
+        }
+
+        enum iuab_error error = iuab_ir_append(dst, &nodes[i]);
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
+    }
+
+    return IUAB_ERROR_SUCCESS;
+}
+
+static const struct iuab_ir_pass iuab_ir_passes[] = {
+    { IUAB_OPT_LEVEL_1, iuab_ir_fold },
+    { IUAB_OPT_LEVEL_1, iuab_ir_recognize_clear_loops },
+    { IUAB_OPT_LEVEL_1, iuab_ir_recognize_scan_loops },
+    { IUAB_OPT_LEVEL_2, iuab_ir_recognize_multiply_loops },
+    { IUAB_OPT_LEVEL_2, iuab_ir_defer_moves },
+    { IUAB_OPT_LEVEL_1, iuab_ir_remove_dead_loops },
+    { IUAB_OPT_LEVEL_1, iuab_ir_fold },
+};
+
+enum iuab_error iuab_ir_optimize(
+    struct iuab_ir *ir,
+    enum iuab_opt_level opt_level,
+    struct iuab_ir_stats *stats_dst
+) {
+    stats_dst->removed_bounds_checks = 0;
+    stats_dst->evaluated_nodes = 0;
+    size_t pass_count = sizeof(iuab_ir_passes) / sizeof(iuab_ir_passes[0]);
+
+    for (size_t i = 0; i < pass_count; i++) {
+        if (iuab_ir_passes[i].opt_level > opt_level) {
+            continue;
+        }
+
+        struct iuab_ir optimized;
+        enum iuab_error error = iuab_ir_init(&optimized);
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
+
+        iuab_ir_move_data(&optimized, ir);
+        error = iuab_ir_passes[i].run(ir, &optimized);
+
+        if (error == IUAB_ERROR_SUCCESS) {
+            error = iuab_ir_link_loops(&optimized);
+        }
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            iuab_ir_fini(&optimized);
+            return error;
+        }
+
+        iuab_ir_fini(ir);
+        *ir = optimized;
+    }
+
+    if (opt_level < IUAB_OPT_LEVEL_2) {
+        return IUAB_ERROR_SUCCESS;
+    }
+
+    enum iuab_error error =
+        iuab_ir_evaluate_prefix(ir, &stats_dst->evaluated_nodes);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    return iuab_ir_remove_bounds_checks(
+        ir,
+        &stats_dst->removed_bounds_checks
+    );
+}
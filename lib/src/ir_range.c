@@ -0,0 +1,266 @@
+// Copyright (C) 2022 OverMighty
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "iuab/ir.h"
+
+#include "iuab/context.h"
+#include "iuab/errors.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// The highest index of the memory.
+#define IUAB_IR_RANGE_MAX_INDEX ((int32_t) IUAB_CONTEXT_MEMORY_SIZE - 1)
+
+// A range of possible indices of the value pointed to by the data pointer. The
+// range is empty, for code that is never reached, if `min` is greater than
+// `max`.
+struct iuab_ir_range {
+    int32_t min;
+    int32_t max;
+};
+
+static const struct iuab_ir_range iuab_ir_range_empty = { 1, 0 };
+static const struct iuab_ir_range iuab_ir_range_full = {
+    0,
+    IUAB_IR_RANGE_MAX_INDEX,
+};
+
+static bool iuab_ir_range_is_empty(struct iuab_ir_range range) {
+    return range.min > range.max;
+}
+
+static bool
+iuab_ir_range_equals(struct iuab_ir_range range1, struct iuab_ir_range range2) {
+    if (iuab_ir_range_is_empty(range1) || iuab_ir_range_is_empty(range2)) {
+        return iuab_ir_range_is_empty(range1) == iuab_ir_range_is_empty(range2);
+    }
+
+    return range1.min == range2.min && range1.max == range2.max;
+}
+
+// Returns the smallest range containing both given ranges.
+static struct iuab_ir_range
+iuab_ir_range_join(struct iuab_ir_range range1, struct iuab_ir_range range2) {
+    if (iuab_ir_range_is_empty(range1)) {
+        return range2;
+    }
+
+    if (iuab_ir_range_is_empty(range2)) {
+        return range1;
+    }
+
+    return (struct iuab_ir_range){
+        range1.min < range2.min ? range1.min : range2.min,
+        range1.max > range2.max ? range1.max : range2.max,
+    };
+}
+
+// Returns the range `range` grown to contain `joined`, with the bounds that
+// grew moved to the bounds of the memory so that loops reach a fixed point
+// quickly.
+static struct iuab_ir_range
+iuab_ir_range_widen(struct iuab_ir_range range, struct iuab_ir_range joined) {
+    if (iuab_ir_range_is_empty(range)) {
+        return joined;
+    }
+
+    if (joined.min < range.min) {
+        range.min = 0;
+    }
+
+    if (joined.max > range.max) {
+        range.max = IUAB_IR_RANGE_MAX_INDEX;
+    }
+
+    return range;
+}
+
+// Returns true if the values at offsets from `min` to `max` from the data
+// pointer are within the bounds of the memory for every index in the given
+// range.
+static bool iuab_ir_range_is_in_bounds(
+    struct iuab_ir_range range,
+    int32_t min,
+    int32_t max
+) {
+    return range.min + min >= 0 && range.max + max <= IUAB_IR_RANGE_MAX_INDEX;
+}
+
+// Returns the given range restricted to the indices from which the values at
+// offsets from `min` to `max` are within the bounds of the memory, which are
+// the only ones from which a bounds check succeeds.
+static struct iuab_ir_range iuab_ir_range_restrict(
+    struct iuab_ir_range range,
+    int32_t min,
+    int32_t max
+) {
+    if (range.min < -min) {
+        range.min = -min;
+    }
+
+    if (range.max > IUAB_IR_RANGE_MAX_INDEX - max) {
+        range.max = IUAB_IR_RANGE_MAX_INDEX - max;
+    }
+
+    return range;
+}
+
+// The state of the range analysis of a node.
+struct iuab_ir_range_node {
+    // The range at the start of each iteration, if the node is a loop.
+    struct iuab_ir_range loop_range;
+    bool is_check_redundant;
+};
+
+// The range analysis of an intermediate representation.
+struct iuab_ir_range_analysis {
+    const struct iuab_ir *ir;
+    struct iuab_ir_range_node *nodes;
+};
+
+// Updates the given range after the given node, whose state is pointed to by
+// `state`, and records whether its bounds check is redundant.
+static void iuab_ir_range_analyze_node(
+    const struct iuab_ir_node *node,
+    struct iuab_ir_range_node *state,
+    struct iuab_ir_range *range
+) {
+    switch (node->op) {
+    case IUAB_IR_OP_MOVE:
+        state->is_check_redundant =
+            iuab_ir_range_is_in_bounds(*range, node->value, node->value);
+        *range = iuab_ir_range_restrict(*range, node->value, node->value);
+        range->min += node->value;
+        range->max += node->value;
+        break;
+    case IUAB_IR_OP_MOVE_UNCHECKED:
+        range->min += node->value;
+        range->max += node->value;
+        break;
+    case IUAB_IR_OP_CHECK:
+        state->is_check_redundant =
+            iuab_ir_range_is_in_bounds(*range, node->offset, node->value);
+        *range = iuab_ir_range_restrict(*range, node->offset, node->value);
+        break;
+    case IUAB_IR_OP_SCAN:
+        if (node->value > 0) {
+            range->max = IUAB_IR_RANGE_MAX_INDEX;
+        } else {
+            range->min = 0;
+        }
+
+        break;
+    // The debugging event handler may move the data pointer.
+    case IUAB_IR_OP_DEBUG: *range = iuab_ir_range_full; break;
+    default: break;
+    }
+}
+
+// Runs a pass of the given range analysis over the whole program. Returns true
+// if the range at the start of a loop grew from the range at its end, in which
+// case another pass is needed.
+static bool iuab_ir_range_analyze(struct iuab_ir_range_analysis *analysis) {
+    const struct iuab_ir_node *nodes = iuab_ir_nodes(analysis->ir);
+    size_t size = iuab_ir_size(analysis->ir);
+    struct iuab_ir_range range = { 0, 0 };
+    bool has_changed = false;
+
+    for (size_t i = 0; i < size; i++) {
+        struct iuab_ir_range_node *state = &analysis->nodes[i];
+
+        if (nodes[i].op == IUAB_IR_OP_LOOP) {
+            struct iuab_ir_range joined =
+                iuab_ir_range_join(state->loop_range, range);
+            state->loop_range = iuab_ir_range_widen(state->loop_range, joined);
+            range = state->loop_range;
+        } else if (nodes[i].op == IUAB_IR_OP_END_LOOP) {
+            struct iuab_ir_range *loop_range =
+                &analysis->nodes[nodes[i].link].loop_range;
+            struct iuab_ir_range widened = iuab_ir_range_widen(
+                *loop_range,
+                iuab_ir_range_join(*loop_range, range)
+            );
+
+            if (!iuab_ir_range_equals(widened, *loop_range)) {
+                *loop_range = widened;
+                has_changed = true;
+            }
+
+            // The loop is exited either from its start or from its end.
+            range = *loop_range;
+        } else {
+            iuab_ir_range_analyze_node(&nodes[i], state, &range);
+        }
+    }
+
+    return has_changed;
+}
+
+enum iuab_error
+iuab_ir_remove_bounds_checks(struct iuab_ir *ir, size_t *removed_dst) {
+    size_t size = iuab_ir_size(ir);
+    struct iuab_ir_range_analysis analysis = {
+        .ir = ir,
+        // One more node so that the allocation is never empty.
+        .nodes = calloc(size + 1, sizeof(struct iuab_ir_range_node)),
+    };
+
+    if (!analysis.nodes) {
+        return IUAB_ERROR_MALLOC;
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        analysis.nodes[i].loop_range = iuab_ir_range_empty;
+    }
+
+    // Widening makes each loop range grow at most twice.
+    while (iuab_ir_range_analyze(&analysis)) {}
+
+    struct iuab_ir optimized;
+    enum iuab_error error = iuab_ir_init(&optimized);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        free(analysis.nodes);
+        return error;
+    }
+
+    iuab_ir_move_data(&optimized, ir);
+    const struct iuab_ir_node *nodes = iuab_ir_nodes(ir);
+    size_t removed = 0;
+
+    for (size_t i = 0; i < size && error == IUAB_ERROR_SUCCESS; i++) {
+        struct iuab_ir_node node = nodes[i];
+
+        // Checked movements proven redundant become unchecked ones.
+        if (analysis.nodes[i].is_check_redundant) {
+            removed++;
+
+            if (node.op == IUAB_IR_OP_CHECK) {
+                continue;
+            }
+
+            node.op = IUAB_IR_OP_MOVE_UNCHECKED;
+        }
+
+        error = iuab_ir_append(&optimized, &node);
+    }
+
+    free(analysis.nodes);
+
+    if (error == IUAB_ERROR_SUCCESS) {
+        error = iuab_ir_link_loops(&optimized);
+    }
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        iuab_ir_fini(&optimized);
+        return error;
+    }
+
+    iuab_ir_fini(ir);
+    *ir = optimized;
+    *removed_dst = removed;
+    return IUAB_ERROR_SUCCESS;
+}
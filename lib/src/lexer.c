@@ -3,114 +3,562 @@
 
 #include "iuab/lexer.h"
 
+#include "iuab/errors.h"
 #include "iuab/token.h"
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#if defined(__x86_64__) && defined(__GNUC__)
+    #define IUAB_LEXER_HAVE_X86_64_SIMD
+    #include <immintrin.h>
+#endif
+
 #define IUAB_LEXER_COMMENT_CHAR ';'
+#define IUAB_LEXER_READ_BLOCK_SIZE (1U << 16U)
 
-static bool iuab_is_space(int ch) {
+static bool iuab_is_space(char ch) {
     return ch == '\t' || ch == '\n' || ch == '\r' || ch == ' ';
 }
 
-static bool iuab_is_token_char(int ch) {
-    return !iuab_is_space(ch) && ch != IUAB_LEXER_COMMENT_CHAR && ch != EOF;
+static bool iuab_is_token_char(char ch) {
+    return !iuab_is_space(ch) && ch != IUAB_LEXER_COMMENT_CHAR;
 }
 
-void iuab_lexer_init(struct iuab_lexer *lexer, FILE *src) {
-    lexer->src = src;
+static void iuab_lexer_init_storage(
+    struct iuab_lexer *lexer,
+    void *storage,
+    size_t storage_size,
+    bool is_storage_mapped,
+    size_t offset
+) {
+    lexer->storage = storage;
+    lexer->storage_size = storage_size;
+    lexer->is_storage_mapped = is_storage_mapped;
+    lexer->cur = (const char *) storage + offset;
+    lexer->end = (const char *) storage + storage_size;
+    lexer->line_start = lexer->cur;
     lexer->line = 1;
-    lexer->col = 0;
+    lexer->isa = iuab_lexer_best_isa();
+    lexer->queue_start = 0;
+    lexer->queue_end = 0;
 }
 
-static int iuab_lexer_next_char(struct iuab_lexer *lexer) {
-    lexer->col++;
-    // FIXME: on I/O error, propagate IUAB_ERROR_IO to the library consumer.
-    return fgetc(lexer->src);
+static bool iuab_lexer_map(struct iuab_lexer *lexer, FILE *src) {
+    struct stat st;
+    int fd = fileno(src);
+
+    if (fd == -1 || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+
+    off_t offset = ftello(src);
+
+    if (offset == -1 || offset > st.st_size) {
+        return false;
+    }
+
+    if (offset == st.st_size) {
+        iuab_lexer_init_storage(lexer, NULL, 0, false, 0);
+        return true;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    iuab_lexer_init_storage(lexer, map, st.st_size, true, offset);
+    return true;
 }
 
-static int iuab_lexer_peek_char(struct iuab_lexer *lexer) {
-    int ch = fgetc(lexer->src);
-    ungetc(ch, lexer->src);
-    return ch;
+static enum iuab_error iuab_lexer_read(struct iuab_lexer *lexer, FILE *src) {
+    size_t size = 0;
+    size_t cap = IUAB_LEXER_READ_BLOCK_SIZE;
+    char *data = malloc(cap);
+
+    if (!data) {
+        return IUAB_ERROR_MALLOC;
+    }
+
+    size_t n;
+
+    while ((n = fread(&data[size], 1, cap - size, src)) != 0) {
+        size += n;
+
+        if (size == cap) {
+            cap *= 2;
+            char *new_data = realloc(data, cap);
+
+            if (!new_data) {
+                free(data);
+                return IUAB_ERROR_MALLOC;
+            }
+
+            data = new_data;
+        }
+    }
+
+    if (ferror(src)) {
+        free(data);
+        return IUAB_ERROR_IO;
+    }
+
+    iuab_lexer_init_storage(lexer, data, size, false, 0);
+    return IUAB_ERROR_SUCCESS;
 }
 
-static void iuab_lexer_skip_line(struct iuab_lexer *lexer) {
-    int ch;
+enum iuab_error iuab_lexer_init(struct iuab_lexer *lexer, FILE *src) {
+    if (iuab_lexer_map(lexer, src)) {
+        return IUAB_ERROR_SUCCESS;
+    }
 
-    do {
-        ch = iuab_lexer_next_char(lexer);
-    } while (ch != '\n' && ch != EOF);
+    return iuab_lexer_read(lexer, src);
+}
 
-    ungetc('\n', lexer->src);
+void iuab_lexer_init_mem(
+    struct iuab_lexer *lexer,
+    const char *src,
+    size_t src_size
+) {
+    iuab_lexer_init_storage(lexer, NULL, 0, false, 0);
+    lexer->cur = src;
+    lexer->end = src + src_size;
+    lexer->line_start = src;
 }
 
-static void iuab_lexer_consume_new_line(struct iuab_lexer *lexer) {
+static void iuab_lexer_skip_line(struct iuab_lexer *lexer) {
+    const char *new_line = memchr(lexer->cur, '\n', lexer->end - lexer->cur);
+
+    if (new_line) {
+        lexer->cur = new_line;
+        return;
+    }
+
+    // A comment ending the source code ends its last line.
+    lexer->cur = lexer->end;
+    lexer->line_start = lexer->end;
     lexer->line++;
-    lexer->col = 0;
 }
 
-static enum iuab_token_type iuab_lexer_match_token(
-    struct iuab_lexer *lexer,
-    const char *end,
-    size_t end_len,
-    enum iuab_token_type type
+// The keywords, indexed by token type and padded with null characters.
+static const char iuab_keywords[][sizeof(uint64_t)] = {
+    [IUAB_TOKEN_I] = "i",         [IUAB_TOKEN_USE] = "use",
+    [IUAB_TOKEN_ARCH] = "arch",   [IUAB_TOKEN_LINUX] = "linux",
+    [IUAB_TOKEN_BTW] = "btw",     [IUAB_TOKEN_BY] = "by",
+    [IUAB_TOKEN_THE] = "the",     [IUAB_TOKEN_WAY] = "way",
+    [IUAB_TOKEN_GENTOO] = "gentoo",
+};
+
+// The lengths of the keywords, indexed by token type.
+static const uint8_t iuab_keyword_lens[] = {
+    [IUAB_TOKEN_I] = 1,     [IUAB_TOKEN_USE] = 3, [IUAB_TOKEN_ARCH] = 4,
+    [IUAB_TOKEN_LINUX] = 5, [IUAB_TOKEN_BTW] = 3, [IUAB_TOKEN_BY] = 2,
+    [IUAB_TOKEN_THE] = 3,   [IUAB_TOKEN_WAY] = 3, [IUAB_TOKEN_GENTOO] = 6,
+};
+
+// Returns the type of the only keyword that can start with the given character
+// and have the given length, or `IUAB_TOKEN_INVALID` if there is none.
+static enum iuab_token_type
+iuab_lexer_keyword_candidate(unsigned char first_char, size_t len) {
+    switch (first_char) {
+    case 'i': return IUAB_TOKEN_I;
+    case 'u': return IUAB_TOKEN_USE;
+    case 'a': return IUAB_TOKEN_ARCH;
+    case 'l': return IUAB_TOKEN_LINUX;
+    case 'b': return len == 2 ? IUAB_TOKEN_BY : IUAB_TOKEN_BTW;
+    case 't': return IUAB_TOKEN_THE;
+    case 'w': return IUAB_TOKEN_WAY;
+    case 'g': return IUAB_TOKEN_GENTOO;
+    default: return IUAB_TOKEN_INVALID;
+    }
+}
+
+// Bytes masking the first `n` bytes of a `uint64_t` value when copied from
+// index `sizeof(uint64_t) - n`.
+static const unsigned char iuab_keyword_mask_bytes[2 * sizeof(uint64_t)] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+// Returns the type of the `len`-character word pointed to by `word`, in source
+// code ending at `end`.
+static enum iuab_token_type
+iuab_lexer_classify(const char *word, size_t len, const char *end) {
+    enum iuab_token_type type =
+        iuab_lexer_keyword_candidate((unsigned char) word[0], len);
+
+    if (type == IUAB_TOKEN_INVALID || len != iuab_keyword_lens[type]) {
+        return IUAB_TOKEN_INVALID;
+    }
+
+    // Compare all characters at once.
+    uint64_t chars = 0;
+    uint64_t keyword;
+    uint64_t mask;
+
+    if (end - word >= (ptrdiff_t) sizeof(chars)) {
+        memcpy(&chars, word, sizeof(chars));
+    } else {
+        memcpy(&chars, word, len);
+    }
+
+    memcpy(&keyword, iuab_keywords[type], sizeof(keyword));
+    memcpy(
+        &mask,
+        &iuab_keyword_mask_bytes[sizeof(mask) - len],
+        sizeof(mask)
+    );
+
+    return (chars & mask) == keyword ? type : IUAB_TOKEN_INVALID;
+}
+
+// Bit masks of the characters of a block of source code, where bit `i` stands
+// for the character at index `i` in the block.
+struct iuab_lexer_masks {
+    // Whitespace characters and comment characters, and characters past the
+    // end of the source code.
+    uint64_t separators;
+    // New line characters.
+    uint64_t new_lines;
+    // Comment characters.
+    uint64_t comments;
+};
+
+static void iuab_lexer_scan_block_scalar(
+    const char *block,
+    size_t size,
+    struct iuab_lexer_masks *masks
 ) {
-    for (size_t i = 0; i < end_len; i++) {
-        if (iuab_lexer_next_char(lexer) != end[i]) {
-            return IUAB_TOKEN_INVALID;
+    masks->separators = 0;
+    masks->new_lines = 0;
+    masks->comments = 0;
+
+    for (size_t i = 0; i < IUAB_LEXER_BLOCK_SIZE; i++) {
+        uint64_t bit = (uint64_t) 1 << i;
+
+        if (i >= size) {
+            masks->separators |= bit;
+        } else if (block[i] == IUAB_LEXER_COMMENT_CHAR) {
+            masks->separators |= bit;
+            masks->comments |= bit;
+        } else if (iuab_is_space(block[i])) {
+            masks->separators |= bit;
+
+            if (block[i] == '\n') {
+                masks->new_lines |= bit;
+            }
         }
     }
+}
+
+#ifdef IUAB_LEXER_HAVE_X86_64_SIMD
+static void
+iuab_lexer_scan_block_sse2(const char *block, struct iuab_lexer_masks *masks) {
+    masks->separators = 0;
+    masks->new_lines = 0;
+    masks->comments = 0;
+
+    for (size_t i = 0; i < IUAB_LEXER_BLOCK_SIZE; i += 16) {
+        __m128i chars = _mm_loadu_si128((const __m128i *) &block[i]);
+        __m128i new_lines = _mm_cmpeq_epi8(chars, _mm_set1_epi8('\n'));
+        __m128i comments =
+            _mm_cmpeq_epi8(chars, _mm_set1_epi8(IUAB_LEXER_COMMENT_CHAR));
+        __m128i separators = _mm_or_si128(
+            _mm_or_si128(
+                _mm_cmpeq_epi8(chars, _mm_set1_epi8(' ')),
+                _mm_cmpeq_epi8(chars, _mm_set1_epi8('\t'))
+            ),
+            _mm_or_si128(
+                _mm_cmpeq_epi8(chars, _mm_set1_epi8('\r')),
+                _mm_or_si128(new_lines, comments)
+            )
+        );
+
+        uint64_t separator_bits = (uint16_t) _mm_movemask_epi8(separators);
+        uint64_t new_line_bits = (uint16_t) _mm_movemask_epi8(new_lines);
+        uint64_t comment_bits = (uint16_t) _mm_movemask_epi8(comments);
+        masks->separators |= separator_bits << i;
+        masks->new_lines |= new_line_bits << i;
+        masks->comments |= comment_bits << i;
+    }
+}
 
-    if (iuab_is_token_char(iuab_lexer_peek_char(lexer))) {
-        return IUAB_TOKEN_INVALID;
+__attribute__((target("avx2"))) static void
+iuab_lexer_scan_block_avx2(const char *block, struct iuab_lexer_masks *masks) {
+    masks->separators = 0;
+    masks->new_lines = 0;
+    masks->comments = 0;
+
+    for (size_t i = 0; i < IUAB_LEXER_BLOCK_SIZE; i += 32) {
+        __m256i chars = _mm256_loadu_si256((const __m256i *) &block[i]);
+        __m256i new_lines = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('\n'));
+        __m256i comments = _mm256_cmpeq_epi8(
+            chars,
+            _mm256_set1_epi8(IUAB_LEXER_COMMENT_CHAR)
+        );
+        __m256i separators = _mm256_or_si256(
+            _mm256_or_si256(
+                _mm256_cmpeq_epi8(chars, _mm256_set1_epi8(' ')),
+                _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('\t'))
+            ),
+            _mm256_or_si256(
+                _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('\r')),
+                _mm256_or_si256(new_lines, comments)
+            )
+        );
+
+        uint64_t separator_bits = (uint32_t) _mm256_movemask_epi8(separators);
+        uint64_t new_line_bits = (uint32_t) _mm256_movemask_epi8(new_lines);
+        uint64_t comment_bits = (uint32_t) _mm256_movemask_epi8(comments);
+        masks->separators |= separator_bits << i;
+        masks->new_lines |= new_line_bits << i;
+        masks->comments |= comment_bits << i;
+    }
+}
+#endif
+
+static void iuab_lexer_scan_block(
+    const struct iuab_lexer *lexer,
+    const char *block,
+    size_t size,
+    struct iuab_lexer_masks *masks
+) {
+#ifdef IUAB_LEXER_HAVE_X86_64_SIMD
+    if (size == IUAB_LEXER_BLOCK_SIZE) {
+        switch (lexer->isa) {
+        case IUAB_LEXER_ISA_SSE2:
+            iuab_lexer_scan_block_sse2(block, masks);
+            return;
+        case IUAB_LEXER_ISA_AVX2:
+            iuab_lexer_scan_block_avx2(block, masks);
+            return;
+        default: break;
+        }
     }
+#else
+    (void) lexer;
+#endif
 
-    return type;
+    iuab_lexer_scan_block_scalar(block, size, masks);
 }
 
-#define IUAB_LEXER_MATCH_TOKEN(lexer, end, type) \
-    iuab_lexer_match_token(lexer, end, strlen(end), type)
+enum iuab_lexer_isa iuab_lexer_best_isa(void) {
+#ifdef IUAB_LEXER_HAVE_X86_64_SIMD
+    if (__builtin_cpu_supports("avx2")) {
+        return IUAB_LEXER_ISA_AVX2;
+    }
 
-static enum iuab_token_type
-iuab_lexer_next_token_type(struct iuab_lexer *lexer, int ch) {
-    switch (ch) {
-    case 'i': return IUAB_LEXER_MATCH_TOKEN(lexer, "", IUAB_TOKEN_I);
-    case 'u': return IUAB_LEXER_MATCH_TOKEN(lexer, "se", IUAB_TOKEN_USE);
-    case 'a': return IUAB_LEXER_MATCH_TOKEN(lexer, "rch", IUAB_TOKEN_ARCH);
-    case 'l': return IUAB_LEXER_MATCH_TOKEN(lexer, "inux", IUAB_TOKEN_LINUX);
-    case 'b':
-        switch (iuab_lexer_next_char(lexer)) {
-        case 't': return IUAB_LEXER_MATCH_TOKEN(lexer, "w", IUAB_TOKEN_BTW);
-        case 'y': return IUAB_LEXER_MATCH_TOKEN(lexer, "", IUAB_TOKEN_BY);
-        default: return IUAB_TOKEN_INVALID;
+    return IUAB_LEXER_ISA_SSE2;
+#else
+    return IUAB_LEXER_ISA_SCALAR;
+#endif
+}
+
+bool iuab_lexer_set_isa(struct iuab_lexer *lexer, enum iuab_lexer_isa isa) {
+    if (isa > iuab_lexer_best_isa()) {
+        return false;
+    }
+
+    lexer->isa = isa;
+    return true;
+}
+
+// Returns a mask of the bits of a block mask standing for the first `n`
+// characters of the block.
+static uint64_t iuab_lexer_mask_first(size_t n) {
+    return n >= IUAB_LEXER_BLOCK_SIZE ? ~(uint64_t) 0
+                                      : ((uint64_t) 1 << n) - 1;
+}
+
+static size_t iuab_lexer_ctz(uint64_t mask) {
+    return (size_t) __builtin_ctzll(mask);
+}
+
+// Consumes the new line characters among the first `n` characters of the
+// current block.
+static void iuab_lexer_consume_new_lines(
+    struct iuab_lexer *lexer,
+    uint64_t new_lines,
+    size_t n
+) {
+    new_lines &= iuab_lexer_mask_first(n);
+
+    if (new_lines != 0) {
+        size_t last_new_line = 63 - (size_t) __builtin_clzll(new_lines);
+        lexer->line += (size_t) __builtin_popcountll(new_lines);
+        lexer->line_start = &lexer->cur[last_new_line + 1];
+    }
+}
+
+// Queues the token made of the characters of the current block from index
+// `start` to index `end`.
+static void iuab_lexer_queue_token(
+    struct iuab_lexer *lexer,
+    uint64_t new_lines,
+    size_t start,
+    size_t end
+) {
+    const char *word = &lexer->cur[start];
+    size_t line = lexer->line;
+    const char *line_start = lexer->line_start;
+    new_lines &= iuab_lexer_mask_first(start);
+
+    if (new_lines != 0) {
+        size_t last_new_line = 63 - (size_t) __builtin_clzll(new_lines);
+        line += (size_t) __builtin_popcountll(new_lines);
+        line_start = &lexer->cur[last_new_line + 1];
+    }
+
+    lexer->queue[lexer->queue_end++] = (struct iuab_token){
+        iuab_lexer_classify(word, end - start, lexer->end),
+        line,
+        (size_t) (word - line_start) + 1,
+    };
+}
+
+// Queues the token starting at the current position, of unknown length.
+static void iuab_lexer_queue_long_token(struct iuab_lexer *lexer) {
+    const char *word = lexer->cur;
+
+    while (lexer->cur != lexer->end && iuab_is_token_char(*lexer->cur)) {
+        lexer->cur++;
+    }
+
+    lexer->queue[lexer->queue_end++] = (struct iuab_token){
+        iuab_lexer_classify(word, (size_t) (lexer->cur - word), lexer->end),
+        lexer->line,
+        (size_t) (word - lexer->line_start) + 1,
+    };
+}
+
+// Scans the block of source code at the current position and queues its
+// tokens.
+static void iuab_lexer_scan(struct iuab_lexer *lexer) {
+    size_t size = (size_t) (lexer->end - lexer->cur);
+
+    if (size > IUAB_LEXER_BLOCK_SIZE) {
+        size = IUAB_LEXER_BLOCK_SIZE;
+    }
+
+    struct iuab_lexer_masks masks;
+    iuab_lexer_scan_block(lexer, lexer->cur, size, &masks);
+
+    // Only scan the characters before the first comment of the block.
+    size_t limit = masks.comments != 0 ? iuab_lexer_ctz(masks.comments)
+                                       : IUAB_LEXER_BLOCK_SIZE;
+    uint64_t starts = ~masks.separators & (masks.separators << 1 | 1) &
+        iuab_lexer_mask_first(limit);
+    size_t consumed = limit < size ? limit : size;
+
+    while (starts != 0) {
+        size_t start = iuab_lexer_ctz(starts);
+        uint64_t ends = masks.separators & ~iuab_lexer_mask_first(start);
+
+        if (ends == 0) {
+            // The token does not end in the block: scan it with the next one.
+            consumed = start;
+            break;
         }
-    case 't': return IUAB_LEXER_MATCH_TOKEN(lexer, "he", IUAB_TOKEN_THE);
-    case 'w': return IUAB_LEXER_MATCH_TOKEN(lexer, "ay", IUAB_TOKEN_WAY);
-    case 'g': return IUAB_LEXER_MATCH_TOKEN(lexer, "entoo", IUAB_TOKEN_GENTOO);
-    default: return IUAB_TOKEN_INVALID;
+
+        size_t end = iuab_lexer_ctz(ends);
+        iuab_lexer_queue_token(lexer, masks.new_lines, start, end);
+        starts &= starts - 1;
+    }
+
+    iuab_lexer_consume_new_lines(lexer, masks.new_lines, consumed);
+    lexer->cur += consumed;
+
+    if (consumed == 0 && limit != 0) {
+        iuab_lexer_queue_long_token(lexer);
+    } else if (masks.comments != 0 && consumed == limit) {
+        iuab_lexer_skip_line(lexer);
     }
 }
 
+// Fills the token queue of the given lexer if it is empty. Returns false if
+// there are no tokens left.
+static bool iuab_lexer_fill_queue(struct iuab_lexer *lexer) {
+    while (lexer->queue_start == lexer->queue_end) {
+        if (lexer->cur == lexer->end) {
+            return false;
+        }
+
+        lexer->queue_start = 0;
+        lexer->queue_end = 0;
+        iuab_lexer_scan(lexer);
+    }
+
+    return true;
+}
+
+static struct iuab_token iuab_lexer_eof_token(const struct iuab_lexer *lexer) {
+    size_t col = (size_t) (lexer->end - lexer->line_start) + 1;
+    return (struct iuab_token){ IUAB_TOKEN_EOF, lexer->line, col };
+}
+
 struct iuab_token iuab_lexer_next_token(struct iuab_lexer *lexer) {
-    int ch;
-
-    while ((ch = iuab_lexer_next_char(lexer)) != EOF) {
-        switch (ch) {
-        case IUAB_LEXER_COMMENT_CHAR: iuab_lexer_skip_line(lexer); break;
-        case '\n': iuab_lexer_consume_new_line(lexer); break;
-        default:
-            if (iuab_is_space(ch)) {
-                continue;
-            }
+    if (!iuab_lexer_fill_queue(lexer)) {
+        return iuab_lexer_eof_token(lexer);
+    }
+
+    return lexer->queue[lexer->queue_start++];
+}
+
+struct iuab_token_run iuab_lexer_next_run(
+    struct iuab_lexer *lexer,
+    size_t max_count
+) {
+    struct iuab_token_run run = { iuab_lexer_next_token(lexer), 1 };
+
+    switch (run.token.type) {
+    case IUAB_TOKEN_EOF:
+    case IUAB_TOKEN_THE:
+    case IUAB_TOKEN_WAY:
+    case IUAB_TOKEN_INVALID:
+        return run;
+    default:
+        break;
+    }
+
+    while (run.count < max_count && iuab_lexer_fill_queue(lexer)) {
+        size_t start = lexer->queue_start;
+        size_t end = lexer->queue_end;
 
-            size_t col = lexer->col;
-            enum iuab_token_type type = iuab_lexer_next_token_type(lexer, ch);
-            return (struct iuab_token){ type, lexer->line, col };
+        if (end - start > max_count - run.count) {
+            end = start + (max_count - run.count);
+        }
+
+        size_t i = start;
+
+        while (i < end && lexer->queue[i].type == run.token.type) {
+            i++;
+        }
+
+        run.count += i - start;
+        lexer->queue_start = i;
+
+        if (i < lexer->queue_end) {
+            break;
         }
     }
 
-    return (struct iuab_token){ IUAB_TOKEN_EOF, lexer->line, lexer->col };
+    return run;
+}
+
+void iuab_lexer_fini(struct iuab_lexer *lexer) {
+    if (lexer->is_storage_mapped) {
+        munmap(lexer->storage, lexer->storage_size);
+    } else {
+        free(lexer->storage);
+    }
 }
@@ -6,16 +6,21 @@
 #include "iuab/buffer.h"
 #include "iuab/context.h"
 #include "iuab/errors.h"
+#include "iuab/ir.h"
+#include "iuab/lexer.h"
 #include "iuab/targets/bytecode.h"
 #include "iuab/targets/jit_x86_64.h"
+#include "iuab/targets/tiered.h"
 #include "iuab/token.h"
 
+#include <stddef.h>
 #include <stdio.h>
 
 const char *iuab_target_name(enum iuab_target target) {
     switch (target) {
     case IUAB_TARGET_BYTECODE: return "bytecode";
     case IUAB_TARGET_JIT_X86_64: return "JIT x86-64";
+    case IUAB_TARGET_TIERED: return "tiered";
     default: return "???";
     }
 }
@@ -24,25 +29,130 @@ bool iuab_target_is_jit(enum iuab_target target) {
     return target == IUAB_TARGET_JIT_X86_64;
 }
 
-enum iuab_error iuab_compile(
+void iuab_compile_options_init(struct iuab_compile_options *opts) {
+    opts->opt_level = IUAB_OPT_LEVEL_2;
+    opts->is_memory_guarded = false;
+    opts->stats_dst = NULL;
+    opts->source_map_dst = NULL;
+}
+
+static enum iuab_error iuab_compile_ir(
     enum iuab_target target,
-    FILE *src,
+    const struct iuab_ir *ir,
+    const struct iuab_compile_options *opts,
     struct iuab_buffer *dst,
+    struct iuab_compile_stats *stats_dst,
     struct iuab_token *last_token_dst
 ) {
     switch (target) {
     case IUAB_TARGET_BYTECODE:
-        return iuab_compile_bytecode(src, dst, last_token_dst);
-    case IUAB_TARGET_JIT_X86_64:
-        return iuab_compile_jit_x86_64(src, dst, last_token_dst);
+    case IUAB_TARGET_TIERED:
+        return iuab_compile_bytecode(
+            ir,
+            dst,
+            opts->source_map_dst,
+            last_token_dst
+        );
+    case IUAB_TARGET_JIT_X86_64: {
+        struct iuab_jit_x86_64_stats jit_stats = { 0 };
+        enum iuab_error error = iuab_compile_jit_x86_64(
+            ir,
+            opts->is_memory_guarded,
+            dst,
+            &jit_stats,
+            last_token_dst
+        );
+        stats_dst->relaxation_saved_size = jit_stats.relaxation_saved_size;
+        stats_dst->alignment_padding_size = jit_stats.alignment_padding_size;
+        stats_dst->peephole_saved_size = jit_stats.peephole_saved_size;
+        stats_dst->peephole_saved_instructions =
+            jit_stats.peephole_saved_instructions;
+        return error;
+    }
     default: return IUAB_ERROR_INVALID_TARGET;
     }
 }
 
+static enum iuab_error iuab_compile_lexer(
+    enum iuab_target target,
+    struct iuab_lexer *lexer,
+    const struct iuab_compile_options *opts,
+    struct iuab_buffer *dst,
+    struct iuab_token *last_token_dst
+) {
+    struct iuab_compile_options default_opts;
+
+    if (!opts) {
+        iuab_compile_options_init(&default_opts);
+        opts = &default_opts;
+    }
+
+    struct iuab_compile_stats stats = { 0 };
+    struct iuab_ir ir;
+    enum iuab_error error = iuab_ir_init(&ir);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        *last_token_dst = (struct iuab_token){ IUAB_TOKEN_EOF, 1, 1 };
+        return error;
+    }
+
+    error = iuab_ir_build(&ir, lexer, last_token_dst);
+
+    if (error == IUAB_ERROR_SUCCESS) {
+        error = iuab_ir_optimize(&ir, opts->opt_level, &stats.ir);
+    }
+
+    if (error == IUAB_ERROR_SUCCESS) {
+        error = iuab_compile_ir(target, &ir, opts, dst, &stats, last_token_dst);
+    }
+
+    if (error == IUAB_ERROR_SUCCESS && opts->stats_dst) {
+        stats.code_size = dst->size;
+        *opts->stats_dst = stats;
+    }
+
+    iuab_ir_fini(&ir);
+    return error;
+}
+
+enum iuab_error iuab_compile(
+    enum iuab_target target,
+    FILE *src,
+    const struct iuab_compile_options *opts,
+    struct iuab_buffer *dst,
+    struct iuab_token *last_token_dst
+) {
+    struct iuab_lexer lexer;
+    enum iuab_error error = iuab_lexer_init(&lexer, src);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        *last_token_dst = (struct iuab_token){ IUAB_TOKEN_EOF, 1, 1 };
+        return error;
+    }
+
+    error = iuab_compile_lexer(target, &lexer, opts, dst, last_token_dst);
+    iuab_lexer_fini(&lexer);
+    return error;
+}
+
+enum iuab_error iuab_compile_mem(
+    enum iuab_target target,
+    const char *src,
+    size_t src_size,
+    const struct iuab_compile_options *opts,
+    struct iuab_buffer *dst,
+    struct iuab_token *last_token_dst
+) {
+    struct iuab_lexer lexer;
+    iuab_lexer_init_mem(&lexer, src, src_size);
+    return iuab_compile_lexer(target, &lexer, opts, dst, last_token_dst);
+}
+
 enum iuab_error iuab_run(enum iuab_target target, struct iuab_context *ctx) {
     switch (target) {
     case IUAB_TARGET_BYTECODE: return iuab_run_bytecode(ctx);
     case IUAB_TARGET_JIT_X86_64: return iuab_run_jit_x86_64(ctx);
+    case IUAB_TARGET_TIERED: return iuab_run_tiered(ctx);
     default: return IUAB_ERROR_INVALID_TARGET;
     }
 }
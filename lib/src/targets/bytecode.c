@@ -3,7 +3,14 @@
 
 #include "iuab/targets/bytecode.h"
 
+#include "iuab/errors.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 
 const char *iuab_bytecode_op_name(uint8_t op) {
     switch (op) {
@@ -17,6 +24,245 @@ const char *iuab_bytecode_op_name(uint8_t op) {
     case IUAB_BYTECODE_OP_JMPZ: return "jmpz";
     case IUAB_BYTECODE_OP_JMPNZ: return "jmpnz";
     case IUAB_BYTECODE_OP_DEBUG: return "debug";
+    case IUAB_BYTECODE_OP_SET: return "set";
+    case IUAB_BYTECODE_OP_MULADD: return "muladd";
+    case IUAB_BYTECODE_OP_SCAN: return "scan";
+    case IUAB_BYTECODE_OP_ADDVO: return "addvo";
+    case IUAB_BYTECODE_OP_SETO: return "seto";
+    case IUAB_BYTECODE_OP_CHECK: return "check";
+    case IUAB_BYTECODE_OP_MOVP: return "movp";
+    case IUAB_BYTECODE_OP_STORE: return "store";
+    case IUAB_BYTECODE_OP_WRITES: return "writes";
+    case IUAB_BYTECODE_OP_JMPZ8: return "jmpz8";
+    case IUAB_BYTECODE_OP_JMPNZ8: return "jmpnz8";
+#define IUAB_BYTECODE_SUPERINSTR(first, second, name) \
+    case IUAB_BYTECODE_OP_##first##_##second: return #name;
+        IUAB_BYTECODE_SUPERINSTRS(IUAB_BYTECODE_SUPERINSTR)
+#undef IUAB_BYTECODE_SUPERINSTR
     default: return "???";
     }
 }
+
+// Returns the offset of the operand of `size` bytes at or after `offset` in a
+// program.
+static size_t iuab_bytecode_align(size_t offset, size_t size) {
+    return (offset + size - 1) & ~(size - 1);
+}
+
+// Decodes into `operands` the operands of the instruction with opcode `op`
+// following offset `*end` in the given program, and moves `*end` past them.
+// Returns false if the opcode is invalid, otherwise true.
+static bool iuab_bytecode_decode_operands(
+    const uint8_t *program,
+    uint8_t op,
+    size_t *end,
+    int32_t *operands,
+    const uint8_t **data_dst
+) {
+    size_t offset = *end;
+
+    switch (op) {
+    case IUAB_BYTECODE_OP_RET:
+    case IUAB_BYTECODE_OP_WRITE:
+    case IUAB_BYTECODE_OP_READ:
+    case IUAB_BYTECODE_OP_DEBUG: break;
+    case IUAB_BYTECODE_OP_ADDP:
+    case IUAB_BYTECODE_OP_SUBP:
+        offset = iuab_bytecode_align(offset, sizeof(uint16_t));
+        operands[0] = *(const uint16_t *) &program[offset];
+        offset += sizeof(uint16_t);
+        break;
+    case IUAB_BYTECODE_OP_ADDV:
+    case IUAB_BYTECODE_OP_SUBV:
+    case IUAB_BYTECODE_OP_SET: operands[0] = program[offset++]; break;
+    case IUAB_BYTECODE_OP_JMPZ:
+    case IUAB_BYTECODE_OP_JMPNZ:
+        offset = iuab_bytecode_align(offset, sizeof(int32_t));
+        operands[0] = *(const int32_t *) &program[offset];
+        offset += sizeof(int32_t);
+        operands[0] += (int32_t) offset;
+        break;
+    case IUAB_BYTECODE_OP_JMPZ8:
+    case IUAB_BYTECODE_OP_JMPNZ8:
+        operands[0] = (int8_t) program[offset++];
+        operands[0] += (int32_t) offset;
+        break;
+    case IUAB_BYTECODE_OP_MULADD:
+    case IUAB_BYTECODE_OP_ADDVO:
+    case IUAB_BYTECODE_OP_SETO:
+        operands[0] = program[offset++];
+        offset = iuab_bytecode_align(offset, sizeof(int16_t));
+        operands[1] = *(const int16_t *) &program[offset];
+        offset += sizeof(int16_t);
+        break;
+    case IUAB_BYTECODE_OP_SCAN:
+    case IUAB_BYTECODE_OP_MOVP:
+        offset = iuab_bytecode_align(offset, sizeof(int32_t));
+        operands[0] = *(const int32_t *) &program[offset];
+        offset += sizeof(int32_t);
+        break;
+    case IUAB_BYTECODE_OP_CHECK:
+        offset = iuab_bytecode_align(offset, sizeof(int16_t));
+        operands[0] = *(const int16_t *) &program[offset];
+        operands[1] = *(const int16_t *) &program[offset + sizeof(int16_t)];
+        offset += 2 * sizeof(int16_t);
+        break;
+    case IUAB_BYTECODE_OP_STORE:
+        offset = iuab_bytecode_align(offset, sizeof(int32_t));
+        operands[0] = *(const int32_t *) &program[offset];
+        operands[1] = *(const int32_t *) &program[offset + sizeof(int32_t)];
+        offset += sizeof(int32_t) + sizeof(uint32_t);
+        *data_dst = &program[offset];
+        offset += (uint32_t) operands[1];
+        break;
+    case IUAB_BYTECODE_OP_WRITES:
+        offset = iuab_bytecode_align(offset, sizeof(uint32_t));
+        operands[0] = *(const int32_t *) &program[offset];
+        offset += sizeof(uint32_t);
+        *data_dst = &program[offset];
+        offset += (uint32_t) operands[0];
+        break;
+    default: return false;
+    }
+
+    *end = offset;
+    return true;
+}
+
+bool iuab_bytecode_decode(
+    const uint8_t *program,
+    size_t offset,
+    struct iuab_bytecode_instr *dst
+) {
+    size_t end = offset + 1;
+    uint8_t first;
+    uint8_t second;
+    dst->op = program[offset];
+    memset(dst->operands, 0, sizeof(dst->operands));
+    dst->data = NULL;
+
+    if (iuab_bytecode_split(dst->op, &first, &second)) {
+        int32_t *second_operands =
+            &dst->operands[iuab_bytecode_operand_count(first)];
+        iuab_bytecode_decode_operands(
+            program,
+            first,
+            &end,
+            dst->operands,
+            &dst->data
+        );
+        iuab_bytecode_decode_operands(
+            program,
+            second,
+            &end,
+            second_operands,
+            &dst->data
+        );
+    } else if (!iuab_bytecode_decode_operands(
+                   program,
+                   dst->op,
+                   &end,
+                   dst->operands,
+                   &dst->data
+               )) {
+        return false;
+    }
+
+    dst->size = end - offset;
+    return true;
+}
+
+size_t iuab_bytecode_operand_count(uint8_t op) {
+    uint8_t first;
+    uint8_t second;
+
+    if (iuab_bytecode_split(op, &first, &second)) {
+        return iuab_bytecode_operand_count(first)
+               + iuab_bytecode_operand_count(second);
+    }
+
+    switch (op) {
+    case IUAB_BYTECODE_OP_RET:
+    case IUAB_BYTECODE_OP_WRITE:
+    case IUAB_BYTECODE_OP_READ:
+    case IUAB_BYTECODE_OP_DEBUG: return 0;
+    case IUAB_BYTECODE_OP_MULADD:
+    case IUAB_BYTECODE_OP_ADDVO:
+    case IUAB_BYTECODE_OP_SETO:
+    case IUAB_BYTECODE_OP_CHECK:
+    case IUAB_BYTECODE_OP_STORE: return 2;
+    default: return 1;
+    }
+}
+
+bool iuab_bytecode_split(uint8_t op, uint8_t *first_dst, uint8_t *second_dst) {
+    (void) first_dst;
+    (void) second_dst;
+
+    switch (op) {
+#define IUAB_BYTECODE_SUPERINSTR(first, second, name) \
+    case IUAB_BYTECODE_OP_##first##_##second:         \
+        *first_dst = IUAB_BYTECODE_OP_##first;        \
+        *second_dst = IUAB_BYTECODE_OP_##second;      \
+        return true;
+        IUAB_BYTECODE_SUPERINSTRS(IUAB_BYTECODE_SUPERINSTR)
+#undef IUAB_BYTECODE_SUPERINSTR
+    default: return false;
+    }
+}
+
+// Returns true if operand `index` of the given opcode is the target of a jump,
+// otherwise false.
+static bool iuab_bytecode_is_jump_target(uint8_t op, size_t index) {
+    uint8_t first;
+    uint8_t second;
+
+    if (iuab_bytecode_split(op, &first, &second)) {
+        size_t first_count = iuab_bytecode_operand_count(first);
+        return index < first_count
+                   ? iuab_bytecode_is_jump_target(first, index)
+                   : iuab_bytecode_is_jump_target(second, index - first_count);
+    }
+
+    return op == IUAB_BYTECODE_OP_JMPZ || op == IUAB_BYTECODE_OP_JMPNZ
+           || op == IUAB_BYTECODE_OP_JMPZ8 || op == IUAB_BYTECODE_OP_JMPNZ8;
+}
+
+enum iuab_error
+iuab_bytecode_disassemble(const uint8_t *program, FILE *out) {
+    struct iuab_bytecode_instr instr = { .op = IUAB_BYTECODE_NUM_OPS };
+
+    for (size_t offset = 0; instr.op != IUAB_BYTECODE_OP_RET;
+         offset += instr.size) {
+        if (!iuab_bytecode_decode(program, offset, &instr)) {
+            return IUAB_ERROR_BYTECODE_INVALID_OP;
+        }
+
+        const char *name = iuab_bytecode_op_name(instr.op);
+        size_t operand_count = iuab_bytecode_operand_count(instr.op);
+        fprintf(out, "%08zx  %s", offset, name);
+
+        for (size_t i = 0; i < operand_count; i++) {
+            // Operands are aligned in a column after the names of base
+            // instructions.
+            if (i == 0) {
+                size_t length = strlen(name);
+                fprintf(out, "%*s", length < 8 ? (int) (8 - length) : 1, "");
+            } else {
+                fputs(", ", out);
+            }
+
+            if (iuab_bytecode_is_jump_target(instr.op, i)) {
+                fprintf(out, "%08" PRIx32, (uint32_t) instr.operands[i]);
+            } else {
+                fprintf(out, "%" PRId32, instr.operands[i]);
+            }
+        }
+
+        if (fputc('\n', out) == EOF) {
+            return IUAB_ERROR_IO;
+        }
+    }
+
+    return IUAB_ERROR_SUCCESS;
+}
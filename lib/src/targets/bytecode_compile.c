@@ -2,42 +2,51 @@
 // SPDX-License-Identifier: GPL-3.0-only
 
 #include "iuab/buffer.h"
+#include "iuab/context.h"
 #include "iuab/errors.h"
-#include "iuab/lexer.h"
+#include "iuab/ir.h"
 #include "iuab/targets/bytecode.h"
 #include "iuab/token.h"
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
-#include <stdio.h>
 #include <string.h>
 
-#define DEFINE_IUAB_BYTECODE_INSTR_TYPE_WITH_OPERAND(name, operand_type) \
-    typedef uint8_t name[1 + sizeof(operand_type)];                      \
-                                                                         \
-    void name##_init(name instr, uint8_t op, operand_type operand) {     \
-        instr[0] = op;                                                   \
-        memcpy(&instr[1], &operand, sizeof(operand));                    \
-    }
-
-DEFINE_IUAB_BYTECODE_INSTR_TYPE_WITH_OPERAND(iuab_bytecode_instr_u8, uint8_t)
-DEFINE_IUAB_BYTECODE_INSTR_TYPE_WITH_OPERAND(iuab_bytecode_instr_u16, uint16_t)
-DEFINE_IUAB_BYTECODE_INSTR_TYPE_WITH_OPERAND(iuab_bytecode_instr_size, size_t)
-
 struct iuab_bytecode_compiler {
-    struct iuab_lexer lexer;
-    struct iuab_token token;
+    const struct iuab_ir *ir;
+    const struct iuab_ir_node *node;
     struct iuab_buffer loop_stack;
     struct iuab_buffer *dst;
+    // The buffer the source map is written to, unless it is null.
+    struct iuab_buffer *source_map;
+    // The opcode of the last instruction written and its offset, or
+    // `IUAB_BYTECODE_OP_RET` if the next instruction cannot be fused with it.
+    uint8_t last_op;
+    size_t last_op_offset;
+    // The offsets from the data pointer of the values proven to be within the
+    // bounds of the memory since the start of the basic block being compiled,
+    // as tracked by `iuab_bytecode_verify()`, from `checked_min` to
+    // `checked_max`.
+    int64_t checked_min;
+    int64_t checked_max;
 };
 
 static enum iuab_error iuab_bytecode_compiler_init(
     struct iuab_bytecode_compiler *compiler,
-    FILE *src,
-    struct iuab_buffer *dst
+    const struct iuab_ir *ir,
+    struct iuab_buffer *dst,
+    struct iuab_buffer *source_map
 ) {
+    compiler->ir = ir;
+    compiler->node = NULL;
     compiler->dst = dst;
-    iuab_lexer_init(&compiler->lexer, src);
-    compiler->token = iuab_lexer_next_token(&compiler->lexer);
+    compiler->source_map = source_map;
+    compiler->last_op = IUAB_BYTECODE_OP_RET;
+    compiler->last_op_offset = 0;
+    // Programs start with the data pointer at the start of the memory.
+    compiler->checked_min = 0;
+    compiler->checked_max = IUAB_CONTEXT_MEMORY_SIZE - 1;
     return iuab_buffer_init(&compiler->loop_stack);
 }
 
@@ -46,89 +55,511 @@ static void iuab_bytecode_compiler_fini(struct iuab_bytecode_compiler *compiler
     iuab_buffer_fini(&compiler->loop_stack);
 }
 
+// Forgets the values proven to be within the bounds of the memory, except the
+// one pointed to by the data pointer, at the start of a basic block.
+static void iuab_bytecode_compiler_reset(struct iuab_bytecode_compiler *compiler
+) {
+    compiler->checked_min = 0;
+    compiler->checked_max = 0;
+}
+
+// Marks the values from offset `min` to offset `max` from the data pointer as
+// proven to be within the bounds of the memory.
+static void iuab_bytecode_compiler_check(
+    struct iuab_bytecode_compiler *compiler,
+    int64_t min,
+    int64_t max
+) {
+    if (min < compiler->checked_min) {
+        compiler->checked_min = min;
+    }
+
+    if (max > compiler->checked_max) {
+        compiler->checked_max = max;
+    }
+}
+
+// Moves the data pointer by `value` to a value within the bounds of the memory.
+static void iuab_bytecode_compiler_move(
+    struct iuab_bytecode_compiler *compiler,
+    int64_t value
+) {
+    compiler->checked_min -= value;
+    compiler->checked_max -= value;
+    iuab_bytecode_compiler_check(compiler, 0, 0);
+}
+
+// Returns the opcode of the superinstruction running the given pair of
+// instructions, or `IUAB_BYTECODE_OP_RET` if there is none.
+static uint8_t iuab_bytecode_fuse(uint8_t first, uint8_t second) {
+#define IUAB_BYTECODE_SUPERINSTR(first_op, second_op, name) \
+    if (first == IUAB_BYTECODE_OP_##first_op                \
+        && second == IUAB_BYTECODE_OP_##second_op) {        \
+        return IUAB_BYTECODE_OP_##first_op##_##second_op;   \
+    }
+    IUAB_BYTECODE_SUPERINSTRS(IUAB_BYTECODE_SUPERINSTR)
+#undef IUAB_BYTECODE_SUPERINSTR
+    (void) first;
+    (void) second;
+    return IUAB_BYTECODE_OP_RET;
+}
+
+// Writes to the source map, if any, the entry of an instruction from the
+// current node written at `offset`.
+static enum iuab_error iuab_bytecode_write_source_map(
+    struct iuab_bytecode_compiler *compiler,
+    size_t offset
+) {
+    if (!compiler->source_map || !compiler->node) {
+        return IUAB_ERROR_SUCCESS;
+    }
+
+    struct iuab_bytecode_source_map_entry entry = {
+        .offset = (uint32_t) offset,
+        .line = (uint32_t) compiler->node->token.line,
+        .col = (uint32_t) compiler->node->token.col,
+    };
+    return iuab_buffer_write(compiler->source_map, &entry, sizeof(entry));
+}
+
+// Writes an opcode, or turns the last instruction written into the
+// superinstruction also running the instruction with that opcode, whose
+// operands then follow those of the last instruction.
 static enum iuab_error
-iuab_bytecode_emit_additive_p(struct iuab_bytecode_compiler *compiler) {
-    enum iuab_token_type token_type = compiler->token.type;
-    struct iuab_lexer *lexer = &compiler->lexer;
+iuab_bytecode_write_op(struct iuab_bytecode_compiler *compiler, uint8_t op) {
+    uint8_t superinstr = iuab_bytecode_fuse(compiler->last_op, op);
+
+    if (superinstr != IUAB_BYTECODE_OP_RET) {
+        compiler->dst->data[compiler->last_op_offset] = superinstr;
+        compiler->last_op = IUAB_BYTECODE_OP_RET;
+        return iuab_bytecode_write_source_map(
+            compiler,
+            compiler->last_op_offset
+        );
+    }
 
-    uint8_t op;
+    enum iuab_error error =
+        iuab_bytecode_write_source_map(compiler, compiler->dst->size);
 
-    switch (token_type) {
-    case IUAB_TOKEN_I: op = IUAB_BYTECODE_OP_ADDP; break;
-    case IUAB_TOKEN_USE: op = IUAB_BYTECODE_OP_SUBP; break;
-    default: return IUAB_ERROR_COMPILER_INTERNAL;
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
     }
 
-    uint16_t operand = 1;
-    struct iuab_token next_token;
+    compiler->last_op = op;
+    compiler->last_op_offset = compiler->dst->size;
+    return iuab_buffer_write_u8(compiler->dst, op);
+}
+
+// Writes an opcode followed by a `uint8_t` operand.
+static enum iuab_error iuab_bytecode_write_op_u8(
+    struct iuab_bytecode_compiler *compiler,
+    uint8_t op,
+    uint8_t operand
+) {
+    enum iuab_error error = iuab_bytecode_write_op(compiler, op);
 
-    while ((next_token = iuab_lexer_next_token(lexer)).type == token_type) {
-        if (operand == UINT16_MAX) {
-            compiler->token = next_token;
-            return IUAB_ERROR_DP_OUT_OF_BOUNDS;
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    return iuab_buffer_write_u8(compiler->dst, operand);
+}
+
+// Writes the `size` bytes of the given operand after padding aligning it to
+// its size.
+static enum iuab_error iuab_bytecode_write_operand(
+    struct iuab_bytecode_compiler *compiler,
+    const void *operand,
+    size_t size
+) {
+    while (compiler->dst->size % size != 0) {
+        enum iuab_error error = iuab_buffer_write_u8(compiler->dst, 0);
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
         }
+    }
+
+    return iuab_buffer_write(compiler->dst, operand, size);
+}
 
-        operand++;
+// Writes an opcode, optionally followed by a `uint8_t` operand if `u8` is not
+// null, and by the `size` bytes of the aligned operand `operand`.
+static enum iuab_error iuab_bytecode_write_instr(
+    struct iuab_bytecode_compiler *compiler,
+    uint8_t op,
+    const uint8_t *u8,
+    const void *operand,
+    size_t size
+) {
+    enum iuab_error error = iuab_bytecode_write_op(compiler, op);
+
+    if (error == IUAB_ERROR_SUCCESS && u8) {
+        error = iuab_buffer_write_u8(compiler->dst, *u8);
     }
 
-    compiler->token = next_token;
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
 
-    iuab_bytecode_instr_u16 instr;
-    iuab_bytecode_instr_u16_init(instr, op, operand);
-    return IUAB_BUFFER_WRITE(compiler->dst, instr);
+    return iuab_bytecode_write_operand(compiler, operand, size);
 }
 
 static enum iuab_error
-iuab_bytecode_emit_additive_v(struct iuab_bytecode_compiler *compiler) {
-    enum iuab_token_type token_type = compiler->token.type;
-    struct iuab_lexer *lexer = &compiler->lexer;
+iuab_bytecode_emit_move(struct iuab_bytecode_compiler *compiler) {
+    int32_t value = compiler->node->value;
+    uint8_t op = value < 0 ? IUAB_BYTECODE_OP_SUBP : IUAB_BYTECODE_OP_ADDP;
+    uint16_t operand = (uint16_t) (value < 0 ? -value : value);
+    iuab_bytecode_compiler_move(compiler, value);
+    return iuab_bytecode_write_instr(
+        compiler,
+        op,
+        NULL,
+        &operand,
+        sizeof(operand)
+    );
+}
 
-    uint8_t op;
+// Writes a check that the values from offset `min` to offset `max` from the
+// data pointer are within the bounds of the memory.
+static enum iuab_error iuab_bytecode_write_check(
+    struct iuab_bytecode_compiler *compiler,
+    int16_t min,
+    int16_t max
+) {
+    enum iuab_error error = iuab_bytecode_write_instr(
+        compiler,
+        IUAB_BYTECODE_OP_CHECK,
+        NULL,
+        &min,
+        sizeof(min)
+    );
 
-    switch (token_type) {
-    case IUAB_TOKEN_ARCH: op = IUAB_BYTECODE_OP_ADDV; break;
-    case IUAB_TOKEN_LINUX: op = IUAB_BYTECODE_OP_SUBV; break;
-    default: return IUAB_ERROR_COMPILER_INTERNAL;
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
     }
 
-    uint8_t operand = 1;
-    struct iuab_token next_token;
+    iuab_bytecode_compiler_check(compiler, min, max);
+    return iuab_buffer_write(compiler->dst, &max, sizeof(max));
+}
 
-    while ((next_token = iuab_lexer_next_token(lexer)).type == token_type) {
-        operand++;
-    }
+// Returns true if the values from offset `min` to offset `max` from the data
+// pointer are proven to be within the bounds of the memory, otherwise false.
+static bool iuab_bytecode_is_checked(
+    const struct iuab_bytecode_compiler *compiler,
+    int64_t min,
+    int64_t max
+) {
+    return min >= compiler->checked_min && max <= compiler->checked_max;
+}
+
+// Returns true if the values from offset `min` to offset `max` from the data
+// pointer may be checked by a single instruction, otherwise false.
+static bool iuab_bytecode_is_checkable(int64_t min, int64_t max) {
+    return min >= INT16_MIN && max <= INT16_MAX;
+}
+
+// Extends the offsets from the data pointer from `*min` to `*max` with those of
+// the values accessed without checking the bounds of the memory by the nodes
+// from the current one up to the first that may move the data pointer
+// otherwise, fail or be jumped over, as long as they may be checked by a single
+// instruction.
+static void iuab_bytecode_extend_check(
+    const struct iuab_bytecode_compiler *compiler,
+    int64_t *min,
+    int64_t *max
+) {
+    const struct iuab_ir_node *end =
+        &iuab_ir_nodes(compiler->ir)[iuab_ir_size(compiler->ir)];
+    int64_t delta = 0;
+
+    for (const struct iuab_ir_node *node = compiler->node; node != end;
+         node++) {
+        int64_t access_min = delta;
+        int64_t access_max = delta;
+
+        switch (node->op) {
+        case IUAB_IR_OP_MOVE_UNCHECKED:
+            delta += node->value;
+            access_min = delta;
+            access_max = delta;
+            break;
+        case IUAB_IR_OP_ADD:
+        case IUAB_IR_OP_SET:
+        case IUAB_IR_OP_MULADD:
+            access_min = delta + node->offset;
+            access_max = access_min;
+            break;
+        case IUAB_IR_OP_STORE_DATA:
+            if (node->value != 0) {
+                access_min = delta + node->offset;
+                access_max = access_min + node->value - 1;
+            }
+
+            break;
+        case IUAB_IR_OP_WRITE:
+        case IUAB_IR_OP_READ:
+        case IUAB_IR_OP_WRITE_DATA: break;
+        default: return;
+        }
+
+        access_min = access_min < *min ? access_min : *min;
+        access_max = access_max > *max ? access_max : *max;
 
-    compiler->token = next_token;
+        if (!iuab_bytecode_is_checkable(access_min, access_max)) {
+            return;
+        }
 
-    if (operand == 0) {
+        *min = access_min;
+        *max = access_max;
+    }
+}
+
+// Proves to `iuab_bytecode_verify()` that the values from offset `min` to
+// offset `max` from the data pointer, which the current node accesses without
+// checking the bounds of the memory, are within them. Its bounds checks may
+// have been removed from the intermediate representation as redundant with
+// those of previous basic blocks, in which case one is written, also covering
+// the unchecked accesses of the next nodes. Returns the error that occurred in
+// the process.
+static enum iuab_error iuab_bytecode_prove_access(
+    struct iuab_bytecode_compiler *compiler,
+    int64_t min,
+    int64_t max
+) {
+    if (iuab_bytecode_is_checked(compiler, min, max)) {
         return IUAB_ERROR_SUCCESS;
     }
 
-    iuab_bytecode_instr_u8 instr;
-    iuab_bytecode_instr_u8_init(instr, op, operand);
-    return IUAB_BUFFER_WRITE(compiler->dst, instr);
+    if (!iuab_bytecode_is_checkable(min, max)) {
+        return IUAB_ERROR_COMPILER_INTERNAL;
+    }
+
+    iuab_bytecode_extend_check(compiler, &min, &max);
+    return iuab_bytecode_write_check(compiler, (int16_t) min, (int16_t) max);
 }
 
 static enum iuab_error
-iuab_bytecode_emit_no_operand(struct iuab_bytecode_compiler *compiler) {
-    uint8_t op;
+iuab_bytecode_emit_move_unchecked(struct iuab_bytecode_compiler *compiler) {
+    int32_t operand = compiler->node->value;
+
+    // Moves too far to be proven within bounds are checked instead.
+    if (!iuab_bytecode_is_checked(compiler, operand, operand)
+        && !iuab_bytecode_is_checkable(operand, operand)
+        && operand >= -UINT16_MAX && operand <= UINT16_MAX) {
+        return iuab_bytecode_emit_move(compiler);
+    }
 
-    switch (compiler->token.type) {
-    case IUAB_TOKEN_BTW: op = IUAB_BYTECODE_OP_WRITE; break;
-    case IUAB_TOKEN_BY: op = IUAB_BYTECODE_OP_READ; break;
-    case IUAB_TOKEN_GENTOO: op = IUAB_BYTECODE_OP_DEBUG; break;
-    default: return IUAB_ERROR_COMPILER_INTERNAL;
+    enum iuab_error error =
+        iuab_bytecode_prove_access(compiler, operand, operand);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
     }
 
-    return iuab_buffer_write_u8(compiler->dst, op);
+    iuab_bytecode_compiler_move(compiler, operand);
+    return iuab_bytecode_write_instr(
+        compiler,
+        IUAB_BYTECODE_OP_MOVP,
+        NULL,
+        &operand,
+        sizeof(operand)
+    );
+}
+
+static enum iuab_error
+iuab_bytecode_emit_check(struct iuab_bytecode_compiler *compiler) {
+    return iuab_bytecode_write_check(
+        compiler,
+        (int16_t) compiler->node->offset,
+        (int16_t) compiler->node->value
+    );
+}
+
+// Writes an opcode followed by the `uint8_t` value and the `int16_t` offset of
+// the current node.
+static enum iuab_error iuab_bytecode_write_offset_instr(
+    struct iuab_bytecode_compiler *compiler,
+    uint8_t op
+) {
+    uint8_t value = (uint8_t) compiler->node->value;
+    int16_t offset = (int16_t) compiler->node->offset;
+    enum iuab_error error =
+        iuab_bytecode_prove_access(compiler, offset, offset);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    return iuab_bytecode_write_instr(
+        compiler,
+        op,
+        &value,
+        &offset,
+        sizeof(offset)
+    );
+}
+
+static enum iuab_error
+iuab_bytecode_emit_add(struct iuab_bytecode_compiler *compiler) {
+    int32_t value = compiler->node->value;
+
+    if (compiler->node->offset != 0) {
+        return iuab_bytecode_write_offset_instr(
+            compiler,
+            IUAB_BYTECODE_OP_ADDVO
+        );
+    }
+
+    uint8_t op = value < 0 ? IUAB_BYTECODE_OP_SUBV : IUAB_BYTECODE_OP_ADDV;
+    uint8_t operand = (uint8_t) (value < 0 ? -value : value);
+    return iuab_bytecode_write_op_u8(compiler, op, operand);
+}
+
+static enum iuab_error
+iuab_bytecode_emit_set(struct iuab_bytecode_compiler *compiler) {
+    if (compiler->node->offset != 0) {
+        return iuab_bytecode_write_offset_instr(
+            compiler,
+            IUAB_BYTECODE_OP_SETO
+        );
+    }
+
+    return iuab_bytecode_write_op_u8(
+        compiler,
+        IUAB_BYTECODE_OP_SET,
+        (uint8_t) compiler->node->value
+    );
+}
+
+static enum iuab_error
+iuab_bytecode_emit_scan(struct iuab_bytecode_compiler *compiler) {
+    int32_t operand = compiler->node->value;
+    iuab_bytecode_compiler_reset(compiler);
+    return iuab_bytecode_write_instr(
+        compiler,
+        IUAB_BYTECODE_OP_SCAN,
+        NULL,
+        &operand,
+        sizeof(operand)
+    );
+}
+
+// Writes the data of the current node.
+static enum iuab_error
+iuab_bytecode_write_data(struct iuab_bytecode_compiler *compiler) {
+    const uint8_t *data = &compiler->ir->data.data[compiler->node->link];
+    return iuab_buffer_write(
+        compiler->dst,
+        data,
+        (size_t) compiler->node->value
+    );
+}
+
+static enum iuab_error
+iuab_bytecode_emit_store_data(struct iuab_bytecode_compiler *compiler) {
+    int32_t offset = compiler->node->offset;
+    uint32_t size = (uint32_t) compiler->node->value;
+    enum iuab_error error = IUAB_ERROR_SUCCESS;
+
+    if (size != 0) {
+        error = iuab_bytecode_prove_access(
+            compiler,
+            offset,
+            (int64_t) offset + size - 1
+        );
+    }
+
+    if (error == IUAB_ERROR_SUCCESS) {
+        error = iuab_bytecode_write_instr(
+            compiler,
+            IUAB_BYTECODE_OP_STORE,
+            NULL,
+            &offset,
+            sizeof(offset)
+        );
+    }
+
+    if (error == IUAB_ERROR_SUCCESS) {
+        error = iuab_buffer_write(compiler->dst, &size, sizeof(size));
+    }
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    return iuab_bytecode_write_data(compiler);
+}
+
+static enum iuab_error
+iuab_bytecode_emit_write_data(struct iuab_bytecode_compiler *compiler) {
+    uint32_t size = (uint32_t) compiler->node->value;
+    enum iuab_error error = iuab_bytecode_write_instr(
+        compiler,
+        IUAB_BYTECODE_OP_WRITES,
+        NULL,
+        &size,
+        sizeof(size)
+    );
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    return iuab_bytecode_write_data(compiler);
 }
 
 static enum iuab_error
 iuab_bytecode_begin_loop(struct iuab_bytecode_compiler *compiler) {
-    compiler->dst->size += sizeof(iuab_bytecode_instr_size);
+    // Offset written later.
+    int32_t offset = 0;
+    enum iuab_error error = iuab_bytecode_write_instr(
+        compiler,
+        IUAB_BYTECODE_OP_JMPZ,
+        NULL,
+        &offset,
+        sizeof(offset)
+    );
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    iuab_bytecode_compiler_reset(compiler);
     return iuab_buffer_write_size(&compiler->loop_stack, compiler->dst->size);
 }
 
+// Writes a jump if the value pointed to by the data pointer is not zero to the
+// given offset in the program, in short form if possible and if it cannot be
+// fused with the last instruction written instead.
+static enum iuab_error
+iuab_bytecode_write_jmpnz(struct iuab_bytecode_compiler *compiler, size_t to) {
+    ptrdiff_t rel8 = (ptrdiff_t) to - (ptrdiff_t) (compiler->dst->size + 2);
+    uint8_t superinstr =
+        iuab_bytecode_fuse(compiler->last_op, IUAB_BYTECODE_OP_JMPNZ);
+
+    if (rel8 >= INT8_MIN && superinstr == IUAB_BYTECODE_OP_RET) {
+        return iuab_bytecode_write_op_u8(
+            compiler,
+            IUAB_BYTECODE_OP_JMPNZ8,
+            (uint8_t) (int8_t) rel8
+        );
+    }
+
+    enum iuab_error error =
+        iuab_bytecode_write_op(compiler, IUAB_BYTECODE_OP_JMPNZ);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    // The instruction ends with the offset, after padding aligning it.
+    size_t end = compiler->dst->size + sizeof(int32_t) - 1;
+    end = (end & ~(sizeof(int32_t) - 1)) + sizeof(int32_t);
+    int32_t offset = (int32_t) ((ptrdiff_t) to - (ptrdiff_t) end);
+    return iuab_bytecode_write_operand(compiler, &offset, sizeof(offset));
+}
+
 static enum iuab_error
 iuab_bytecode_end_loop(struct iuab_bytecode_compiler *compiler) {
     if (compiler->loop_stack.size == 0) {
@@ -136,75 +567,89 @@ iuab_bytecode_end_loop(struct iuab_bytecode_compiler *compiler) {
     }
 
     size_t loop_start = iuab_buffer_pop_size(&compiler->loop_stack);
-    iuab_bytecode_instr_size instr;
-    iuab_bytecode_instr_size_init(instr, IUAB_BYTECODE_OP_JMPNZ, loop_start);
-    enum iuab_error error = IUAB_BUFFER_WRITE(compiler->dst, instr);
+    enum iuab_error error = IUAB_ERROR_SUCCESS;
 
-    size_t loop_end = compiler->dst->size;
-    iuab_bytecode_instr_size_init(instr, IUAB_BYTECODE_OP_JMPZ, loop_end);
-    size_t jmpz_instr_offset = loop_start - sizeof(iuab_bytecode_instr_size);
-    memcpy(&compiler->dst->data[jmpz_instr_offset], instr, sizeof(instr));
+    if (!iuab_ir_is_loop_once(compiler->node)) {
+        error = iuab_bytecode_write_jmpnz(compiler, loop_start);
+    }
 
+    int32_t offset = (int32_t) (compiler->dst->size - loop_start);
+    memcpy(
+        &compiler->dst->data[loop_start - sizeof(offset)],
+        &offset,
+        sizeof(offset)
+    );
+
+    // The next instruction is the target of the jump past the loop.
+    compiler->last_op = IUAB_BYTECODE_OP_RET;
+    iuab_bytecode_compiler_reset(compiler);
     return error;
 }
 
 static enum iuab_error
 iuab_bytecode_emit(struct iuab_bytecode_compiler *compiler) {
-    enum iuab_error error;
-
-    switch (compiler->token.type) {
-    case IUAB_TOKEN_I:
-    case IUAB_TOKEN_USE: return iuab_bytecode_emit_additive_p(compiler);
-    case IUAB_TOKEN_ARCH:
-    case IUAB_TOKEN_LINUX: return iuab_bytecode_emit_additive_v(compiler);
-    case IUAB_TOKEN_BTW:
-    case IUAB_TOKEN_BY:
-    case IUAB_TOKEN_GENTOO:
-        error = iuab_bytecode_emit_no_operand(compiler);
-        break;
-    case IUAB_TOKEN_THE: error = iuab_bytecode_begin_loop(compiler); break;
-    case IUAB_TOKEN_WAY: error = iuab_bytecode_end_loop(compiler); break;
-    default: return IUAB_ERROR_COMPILER_INVALID_TOKEN;
-    }
-
-    if (error == IUAB_ERROR_SUCCESS) {
-        compiler->token = iuab_lexer_next_token(&compiler->lexer);
+    switch (compiler->node->op) {
+    case IUAB_IR_OP_MOVE: return iuab_bytecode_emit_move(compiler);
+    case IUAB_IR_OP_MOVE_UNCHECKED:
+        return iuab_bytecode_emit_move_unchecked(compiler);
+    case IUAB_IR_OP_CHECK: return iuab_bytecode_emit_check(compiler);
+    case IUAB_IR_OP_ADD: return iuab_bytecode_emit_add(compiler);
+    case IUAB_IR_OP_SET: return iuab_bytecode_emit_set(compiler);
+    case IUAB_IR_OP_MULADD:
+        return iuab_bytecode_write_offset_instr(
+            compiler,
+            IUAB_BYTECODE_OP_MULADD
+        );
+    case IUAB_IR_OP_SCAN: return iuab_bytecode_emit_scan(compiler);
+    case IUAB_IR_OP_WRITE:
+        return iuab_bytecode_write_op(compiler, IUAB_BYTECODE_OP_WRITE);
+    case IUAB_IR_OP_READ:
+        return iuab_bytecode_write_op(compiler, IUAB_BYTECODE_OP_READ);
+    case IUAB_IR_OP_LOOP: return iuab_bytecode_begin_loop(compiler);
+    case IUAB_IR_OP_END_LOOP: return iuab_bytecode_end_loop(compiler);
+    case IUAB_IR_OP_DEBUG:
+        // The debugging event handler may move the data pointer.
+        iuab_bytecode_compiler_reset(compiler);
+        return iuab_bytecode_write_op(compiler, IUAB_BYTECODE_OP_DEBUG);
+    case IUAB_IR_OP_STORE_DATA:
+        return iuab_bytecode_emit_store_data(compiler);
+    case IUAB_IR_OP_WRITE_DATA:
+        return iuab_bytecode_emit_write_data(compiler);
+    default: return IUAB_ERROR_COMPILER_INTERNAL;
     }
-
-    return error;
 }
 
 enum iuab_error iuab_compile_bytecode(
-    FILE *src,
+    const struct iuab_ir *ir,
     struct iuab_buffer *dst,
+    struct iuab_buffer *source_map_dst,
     struct iuab_token *last_token_dst
 ) {
     struct iuab_bytecode_compiler compiler;
-    enum iuab_error error = iuab_bytecode_compiler_init(&compiler, src, dst);
+    enum iuab_error error =
+        iuab_bytecode_compiler_init(&compiler, ir, dst, source_map_dst);
 
     if (error != IUAB_ERROR_SUCCESS) {
-        *last_token_dst = compiler.token;
         return error;
     }
 
-    while (compiler.token.type != IUAB_TOKEN_EOF) {
+    const struct iuab_ir_node *nodes = iuab_ir_nodes(ir);
+    size_t size = iuab_ir_size(ir);
+
+    for (size_t i = 0; i < size; i++) {
+        compiler.node = &nodes[i];
         error = iuab_bytecode_emit(&compiler);
 
         if (error != IUAB_ERROR_SUCCESS) {
-            *last_token_dst = compiler.token;
+            *last_token_dst = nodes[i].token;
             iuab_bytecode_compiler_fini(&compiler);
             return error;
         }
     }
 
-    *last_token_dst = compiler.token;
-    size_t loop_stack_size = compiler.loop_stack.size;
+    // The final instruction has no source code token.
+    compiler.node = NULL;
+    error = iuab_bytecode_write_op(&compiler, IUAB_BYTECODE_OP_RET);
     iuab_bytecode_compiler_fini(&compiler);
-
-    if (loop_stack_size != 0) {
-        return IUAB_ERROR_COMPILER_UNCLOSED_LOOPS;
-    }
-
-    uint8_t ret[] = { IUAB_BYTECODE_OP_RET };
-    return IUAB_BUFFER_WRITE(dst, ret);
+    return error;
 }
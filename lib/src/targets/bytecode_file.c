@@ -0,0 +1,228 @@
+// Copyright (C) 2022 OverMighty
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "iuab/buffer.h"
+#include "iuab/errors.h"
+#include "iuab/targets.h"
+#include "iuab/targets/bytecode.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define IUAB_BYTECODE_FNV_OFFSET_BASIS 0x811C9DC5U
+#define IUAB_BYTECODE_FNV_PRIME 0x01000193U
+
+// Returns the FNV-1a checksum `checksum` updated with the given `size` bytes.
+static uint32_t
+iuab_bytecode_fnv1a(uint32_t checksum, const void *data, size_t size) {
+    const uint8_t *bytes = data;
+
+    for (size_t i = 0; i < size; i++) {
+        checksum = (checksum ^ bytes[i]) * IUAB_BYTECODE_FNV_PRIME;
+    }
+
+    return checksum;
+}
+
+// Returns a checksum of the names of the opcodes, which identifies them.
+static uint32_t iuab_bytecode_ops_checksum(void) {
+    uint32_t checksum = IUAB_BYTECODE_FNV_OFFSET_BASIS;
+
+    for (unsigned op = 0; op < IUAB_BYTECODE_NUM_OPS; op++) {
+        const char *name = iuab_bytecode_op_name((uint8_t) op);
+        checksum = iuab_bytecode_fnv1a(checksum, name, strlen(name) + 1);
+    }
+
+    return checksum;
+}
+
+// Returns `offset` rounded up to the alignment of bytecode programs.
+static uint64_t iuab_bytecode_file_align(uint64_t offset) {
+    return (offset + IUAB_BYTECODE_ALIGNMENT - 1)
+           & ~(uint64_t) (IUAB_BYTECODE_ALIGNMENT - 1);
+}
+
+enum iuab_error iuab_bytecode_save(
+    const struct iuab_buffer *program,
+    const struct iuab_buffer *source_map,
+    FILE *out
+) {
+    size_t source_map_bytes = source_map ? source_map->size : 0;
+    struct iuab_bytecode_file_header header = {
+        .version = IUAB_BYTECODE_VERSION,
+        .ops_checksum = iuab_bytecode_ops_checksum(),
+        .target = IUAB_TARGET_BYTECODE,
+        .program_offset = iuab_bytecode_file_align(sizeof(header)),
+        .program_size = program->size,
+        .source_map_size =
+            source_map_bytes / sizeof(struct iuab_bytecode_source_map_entry),
+    };
+    memcpy(header.magic, IUAB_BYTECODE_FILE_MAGIC, sizeof(header.magic));
+    header.source_map_offset = iuab_bytecode_file_align(
+        header.program_offset + header.program_size + IUAB_BYTECODE_FILE_PADDING
+    );
+
+    // Each section follows the padding aligning it.
+    static const uint8_t zeros[IUAB_BYTECODE_FILE_PADDING
+                               + IUAB_BYTECODE_ALIGNMENT] = { 0 };
+    size_t paddings[] = {
+        header.program_offset - sizeof(header),
+        header.source_map_offset - header.program_offset - header.program_size,
+    };
+    const void *sections[] = {
+        program->data,
+        source_map ? source_map->data : NULL,
+    };
+    size_t section_sizes[] = { program->size, source_map_bytes };
+    header.checksum = IUAB_BYTECODE_FNV_OFFSET_BASIS;
+
+    for (size_t i = 0; i < 2; i++) {
+        header.checksum =
+            iuab_bytecode_fnv1a(header.checksum, zeros, paddings[i]);
+        header.checksum = iuab_bytecode_fnv1a(
+            header.checksum,
+            sections[i],
+            section_sizes[i]
+        );
+    }
+
+    if (fwrite(&header, sizeof(header), 1, out) != 1) {
+        return IUAB_ERROR_IO;
+    }
+
+    for (size_t i = 0; i < 2; i++) {
+        if (fwrite(zeros, 1, paddings[i], out) != paddings[i]
+            || fwrite(sections[i], 1, section_sizes[i], out)
+                   != section_sizes[i]) {
+            return IUAB_ERROR_IO;
+        }
+    }
+
+    return fflush(out) == 0 ? IUAB_ERROR_SUCCESS : IUAB_ERROR_IO;
+}
+
+// Returns true if the `size` bytes at `offset` are within a file of
+// `file_size` bytes, otherwise false.
+static bool iuab_bytecode_file_contains(
+    uint64_t file_size,
+    uint64_t offset,
+    uint64_t size
+) {
+    return offset <= file_size && size <= file_size - offset;
+}
+
+// Returns the error in the header pointed to by `header` of a bytecode file of
+// `file_size` bytes, if any.
+static enum iuab_error iuab_bytecode_check_header(
+    const struct iuab_bytecode_file_header *header,
+    uint64_t file_size
+) {
+    if (memcmp(header->magic, IUAB_BYTECODE_FILE_MAGIC, sizeof(header->magic))
+        != 0) {
+        return IUAB_ERROR_BYTECODE_INVALID_FILE;
+    }
+
+    if (header->version != IUAB_BYTECODE_VERSION
+        || header->ops_checksum != iuab_bytecode_ops_checksum()) {
+        return IUAB_ERROR_BYTECODE_UNSUPPORTED_VERSION;
+    }
+
+    uint64_t source_map_bytes = header->source_map_size
+                                * sizeof(struct iuab_bytecode_source_map_entry);
+
+    if (header->target != IUAB_TARGET_BYTECODE || header->program_size == 0
+        || header->program_offset < sizeof(*header)
+        || header->program_offset % IUAB_BYTECODE_ALIGNMENT != 0
+        || header->source_map_offset % IUAB_BYTECODE_ALIGNMENT != 0
+        || header->source_map_size > UINT32_MAX
+        // Adding the padding to a program size of at most the file size, from
+        // `off_t`, cannot wrap around.
+        || header->program_offset > file_size
+        || header->program_size > file_size
+        || header->program_size + IUAB_BYTECODE_FILE_PADDING
+               > file_size - header->program_offset
+        || !iuab_bytecode_file_contains(
+            file_size,
+            header->source_map_offset,
+            source_map_bytes
+        )) {
+        return IUAB_ERROR_BYTECODE_INVALID_FILE;
+    }
+
+    return IUAB_ERROR_SUCCESS;
+}
+
+enum iuab_error iuab_bytecode_load(struct iuab_bytecode_file *file, FILE *in) {
+    struct stat st;
+
+    if (fstat(fileno(in), &st) != 0) {
+        return IUAB_ERROR_IO;
+    }
+
+    uint64_t file_size = (uint64_t) st.st_size;
+
+    if (file_size < sizeof(struct iuab_bytecode_file_header)) {
+        return IUAB_ERROR_BYTECODE_INVALID_FILE;
+    }
+
+    uint8_t *mapping =
+        mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fileno(in), 0);
+
+    if (mapping == MAP_FAILED) {
+        return IUAB_ERROR_IO;
+    }
+
+    const struct iuab_bytecode_file_header *header =
+        (const struct iuab_bytecode_file_header *) mapping;
+    enum iuab_error error = iuab_bytecode_check_header(header, file_size);
+    size_t rest_size = file_size - sizeof(*header);
+
+    if (error == IUAB_ERROR_SUCCESS
+        && iuab_bytecode_fnv1a(
+               IUAB_BYTECODE_FNV_OFFSET_BASIS,
+               mapping + sizeof(*header),
+               rest_size
+           ) != header->checksum) {
+        error = IUAB_ERROR_BYTECODE_INVALID_FILE;
+    }
+
+    // The padding following the program keeps verification within the file.
+    if (error == IUAB_ERROR_SUCCESS) {
+        error = iuab_bytecode_verify(
+            mapping + header->program_offset,
+            header->program_size
+        );
+    }
+
+    if (error == IUAB_ERROR_SUCCESS) {
+        error = iuab_bytecode_prepare(
+            &file->prepared,
+            mapping + header->program_offset
+        );
+    }
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        munmap(mapping, file_size);
+        return error;
+    }
+
+    file->program = mapping + header->program_offset;
+    file->program_size = header->program_size;
+    file->source_map = (const struct iuab_bytecode_source_map_entry *) &mapping
+        [header->source_map_offset];
+    file->source_map_size = header->source_map_size;
+    file->mapping = mapping;
+    file->mapping_size = file_size;
+    return IUAB_ERROR_SUCCESS;
+}
+
+void iuab_bytecode_unload(struct iuab_bytecode_file *file) {
+    iuab_bytecode_prepared_fini(&file->prepared);
+    munmap(file->mapping, file->mapping_size);
+}
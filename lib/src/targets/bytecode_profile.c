@@ -0,0 +1,302 @@
+// Copyright (C) 2022 OverMighty
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "iuab/buffer.h"
+#include "iuab/errors.h"
+#include "iuab/targets/bytecode.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+enum iuab_error iuab_bytecode_profile_init(
+    struct iuab_bytecode_profile *profile,
+    size_t program_size
+) {
+    profile->counts = calloc(program_size, sizeof(uint64_t));
+    profile->program_size = program_size;
+    return profile->counts ? IUAB_ERROR_SUCCESS : IUAB_ERROR_MALLOC;
+}
+
+void iuab_bytecode_profile_fini(struct iuab_bytecode_profile *profile) {
+    free(profile->counts);
+}
+
+// Returns the index of the first of the given entries of a source map whose
+// offset is not less than `offset`.
+static size_t iuab_bytecode_source_map_find(
+    const struct iuab_bytecode_source_map_entry *source_map,
+    size_t source_map_size,
+    size_t offset
+) {
+    size_t lo = 0;
+    size_t hi = source_map_size;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (source_map[mid].offset < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+// Returns a pointer to the entry of the given source map of the instruction,
+// or instruction `part` of the superinstruction, at `offset`, or null if it
+// has none.
+static const struct iuab_bytecode_source_map_entry *
+iuab_bytecode_source_map_get(
+    const struct iuab_bytecode_source_map_entry *source_map,
+    size_t source_map_size,
+    size_t offset,
+    size_t part
+) {
+    size_t index =
+        iuab_bytecode_source_map_find(source_map, source_map_size, offset)
+        + part;
+
+    if (index >= source_map_size || source_map[index].offset != offset) {
+        return NULL;
+    }
+
+    return &source_map[index];
+}
+
+// A loop of a profiled program.
+struct iuab_bytecode_loop_profile {
+    // The offset of the instruction starting the loop.
+    size_t offset;
+    // Whether the jump starting the loop is the second instruction of a
+    // superinstruction.
+    bool is_fused;
+    // The number of times its body started running.
+    uint64_t iterations;
+    // The number of instructions run in its body, including its nested loops.
+    uint64_t instructions;
+};
+
+// Returns true if the given instruction starts a loop, in which case the
+// offset of its end is written at the location pointed to by `end_dst` and
+// whether its jump is the second instruction of a superinstruction at the
+// location pointed to by `is_fused_dst`, otherwise false.
+static bool iuab_bytecode_is_loop_start(
+    const struct iuab_bytecode_instr *instr,
+    size_t *end_dst,
+    bool *is_fused_dst
+) {
+    uint8_t op = instr->op;
+    size_t index = 0;
+    uint8_t first;
+    uint8_t second;
+    *is_fused_dst = iuab_bytecode_split(instr->op, &first, &second);
+
+    // Jumps are only ever the second instruction of superinstructions.
+    if (*is_fused_dst) {
+        op = second;
+        index = iuab_bytecode_operand_count(first);
+    }
+
+    *end_dst = (size_t) instr->operands[index];
+    return op == IUAB_BYTECODE_OP_JMPZ || op == IUAB_BYTECODE_OP_JMPZ8;
+}
+
+// Writes to the buffer pointed to by `loops` the profile of the loops of the
+// given program from the given profile, in order of offset, and the total
+// number of instructions run at the location pointed to by `total_dst`.
+// Returns the error that occurred in the process.
+static enum iuab_error iuab_bytecode_profile_loops(
+    const struct iuab_bytecode_profile *profile,
+    const uint8_t *program,
+    struct iuab_buffer *loops,
+    uint64_t *total_dst
+) {
+    struct iuab_buffer stack;
+    enum iuab_error error = iuab_buffer_init(&stack);
+    struct iuab_bytecode_instr instr = { .op = IUAB_BYTECODE_NUM_OPS };
+    // The number of instructions run before the current one.
+    uint64_t total = 0;
+
+    for (size_t offset = 0;
+         instr.op != IUAB_BYTECODE_OP_RET && error == IUAB_ERROR_SUCCESS;
+         offset += instr.size) {
+        // The stack holds the index and the end of each loop the instruction
+        // is in, innermost last.
+        while (stack.size != 0 && iuab_buffer_peek_size(&stack) <= offset) {
+            iuab_buffer_pop_size(&stack);
+            size_t index = iuab_buffer_pop_size(&stack);
+            struct iuab_bytecode_loop_profile *loop =
+                &((struct iuab_bytecode_loop_profile *) loops->data)[index];
+            loop->instructions = total - loop->instructions;
+        }
+
+        iuab_bytecode_decode(program, offset, &instr);
+        total += profile->counts[offset];
+        struct iuab_bytecode_loop_profile loop = { .offset = offset };
+        size_t end;
+
+        if (!iuab_bytecode_is_loop_start(&instr, &end, &loop.is_fused)) {
+            continue;
+        }
+
+        // The number of instructions run so far is kept until the end of the
+        // loop is reached.
+        loop.iterations = profile->counts[offset + instr.size];
+        loop.instructions = total;
+        error = iuab_buffer_write_size(
+            &stack,
+            loops->size / sizeof(struct iuab_bytecode_loop_profile)
+        );
+
+        if (error == IUAB_ERROR_SUCCESS) {
+            error = iuab_buffer_write_size(&stack, end);
+        }
+
+        if (error == IUAB_ERROR_SUCCESS) {
+            error = iuab_buffer_write(loops, &loop, sizeof(loop));
+        }
+    }
+
+    iuab_buffer_fini(&stack);
+    *total_dst = total;
+    return error;
+}
+
+// Compares the loops pointed to by `a` and `b` by decreasing number of
+// instructions run, then by offset.
+static int iuab_bytecode_compare_loops(const void *a, const void *b) {
+    const struct iuab_bytecode_loop_profile *loop1 = a;
+    const struct iuab_bytecode_loop_profile *loop2 = b;
+
+    if (loop1->instructions != loop2->instructions) {
+        return loop1->instructions > loop2->instructions ? -1 : 1;
+    }
+
+    return loop1->offset < loop2->offset ? -1 : loop1->offset > loop2->offset;
+}
+
+enum iuab_error iuab_bytecode_profile_print(
+    const struct iuab_bytecode_profile *profile,
+    const uint8_t *program,
+    const struct iuab_bytecode_source_map_entry *source_map,
+    size_t source_map_size,
+    size_t max_loops,
+    FILE *out
+) {
+    struct iuab_buffer loops;
+    enum iuab_error error = iuab_buffer_init(&loops);
+    uint64_t total;
+
+    if (error == IUAB_ERROR_SUCCESS) {
+        error = iuab_bytecode_profile_loops(profile, program, &loops, &total);
+    }
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        iuab_buffer_fini(&loops);
+        return error;
+    }
+
+    struct iuab_bytecode_loop_profile *loop_profiles =
+        (struct iuab_bytecode_loop_profile *) loops.data;
+    size_t loop_count = loops.size / sizeof(*loop_profiles);
+    qsort(
+        loop_profiles,
+        loop_count,
+        sizeof(*loop_profiles),
+        iuab_bytecode_compare_loops
+    );
+    fprintf(
+        out,
+        "%" PRIu64 " instructions run\n%-8s  %12s  %6s  %12s  %s\n",
+        total,
+        "offset",
+        "instructions",
+        "share",
+        "iterations",
+        "position"
+    );
+
+    for (size_t i = 0; i < loop_count && i < max_loops; i++) {
+        const struct iuab_bytecode_loop_profile *loop = &loop_profiles[i];
+        // Loops are found at the position of the jump starting them.
+        const struct iuab_bytecode_source_map_entry *entry =
+            iuab_bytecode_source_map_get(
+                source_map,
+                source_map_size,
+                loop->offset,
+                loop->is_fused
+            );
+        fprintf(
+            out,
+            "%08zx  %12" PRIu64 "  %5.1f%%  %12" PRIu64,
+            loop->offset,
+            loop->instructions,
+            total != 0 ? 100.0 * (double) loop->instructions / (double) total
+                       : 0.0,
+            loop->iterations
+        );
+
+        if (entry) {
+            fprintf(
+                out,
+                "  line %" PRIu32 ", col %" PRIu32,
+                entry->line,
+                entry->col
+            );
+        }
+
+        fputc('\n', out);
+    }
+
+    iuab_buffer_fini(&loops);
+    return ferror(out) ? IUAB_ERROR_IO : IUAB_ERROR_SUCCESS;
+}
+
+enum iuab_error iuab_bytecode_profile_save(
+    const struct iuab_bytecode_profile *profile,
+    const uint8_t *program,
+    const struct iuab_bytecode_source_map_entry *source_map,
+    size_t source_map_size,
+    FILE *out
+) {
+    struct iuab_bytecode_instr instr = { .op = IUAB_BYTECODE_NUM_OPS };
+    fputs(
+        "# Profile of a run of an I use Arch btw bytecode program, as\n"
+        "# `<count> <offset> <line> <col> <op>` lines.\n",
+        out
+    );
+
+    for (size_t offset = 0; instr.op != IUAB_BYTECODE_OP_RET;
+         offset += instr.size) {
+        iuab_bytecode_decode(program, offset, &instr);
+
+        if (profile->counts[offset] == 0) {
+            continue;
+        }
+
+        const struct iuab_bytecode_source_map_entry *entry =
+            iuab_bytecode_source_map_get(
+                source_map,
+                source_map_size,
+                offset,
+                0
+            );
+        fprintf(
+            out,
+            "%" PRIu64 " %zu %" PRIu32 " %" PRIu32 " %s\n",
+            profile->counts[offset],
+            offset,
+            entry ? entry->line : 0,
+            entry ? entry->col : 0,
+            iuab_bytecode_op_name(instr.op)
+        );
+    }
+
+    return ferror(out) ? IUAB_ERROR_IO : IUAB_ERROR_SUCCESS;
+}
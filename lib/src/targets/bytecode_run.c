@@ -5,103 +5,315 @@
 #include "iuab/errors.h"
 #include "iuab/targets/bytecode.h"
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+// Direct threading requires the labels as values GNU extension. Pairs of
+// instructions are only profiled with a `switch`.
+#if defined(__GNUC__) && !defined(IUAB_BYTECODE_PROFILE_PAIRS)
+    #define IUAB_BYTECODE_THREADED
+#endif
+
+// Marks code only reached when running invalid programs, which are verified
+// not to be run.
+#ifdef __GNUC__
+    #define IUAB_BYTECODE_UNREACHABLE() __builtin_unreachable()
+#else
+    #define IUAB_BYTECODE_UNREACHABLE() ((void) 0)
+#endif
+
+// Moves the instruction pointer of the given context past the operand of
+// `size` bytes following it, after the padding aligning it, and returns a
+// pointer to the operand.
+static const void *
+iuab_bytecode_next_operand(struct iuab_context *ctx, size_t size) {
+    uintptr_t operand = (uintptr_t) ctx->ip + size - 1;
+    operand &= ~(uintptr_t) (size - 1);
+    ctx->ip = (const uint8_t *) operand + size;
+    return (const void *) operand;
+}
+
+// Returns the operand of the given type following the instruction pointer of
+// the given context, and moves it past the operand.
+#define IUAB_BYTECODE_NEXT_OPERAND(ctx, type) \
+    (*(const type *) iuab_bytecode_next_operand((ctx), sizeof(type)))
+
 static enum iuab_error iuab_bytecode_run_addp(struct iuab_context *ctx) {
-    uint16_t operand;
-    memcpy(&operand, ctx->ip, sizeof(operand));
+    uint16_t operand = IUAB_BYTECODE_NEXT_OPERAND(ctx, uint16_t);
 
     if (ctx->dp - ctx->memory >= IUAB_CONTEXT_MEMORY_SIZE - operand) {
         return IUAB_ERROR_DP_OUT_OF_BOUNDS;
     }
 
-    ctx->ip += sizeof(operand);
     ctx->dp += operand;
     return IUAB_ERROR_SUCCESS;
 }
 
 static enum iuab_error iuab_bytecode_run_subp(struct iuab_context *ctx) {
-    uint16_t operand;
-    memcpy(&operand, ctx->ip, sizeof(operand));
+    uint16_t operand = IUAB_BYTECODE_NEXT_OPERAND(ctx, uint16_t);
 
     if (ctx->dp - ctx->memory < operand) {
         return IUAB_ERROR_DP_OUT_OF_BOUNDS;
     }
 
-    ctx->ip += sizeof(operand);
     ctx->dp -= operand;
     return IUAB_ERROR_SUCCESS;
 }
 
-static enum iuab_error iuab_bytecode_run_write(struct iuab_context *ctx) {
-    int result = fputc(*ctx->dp, ctx->out);
+static enum iuab_error iuab_bytecode_run_check(struct iuab_context *ctx) {
+    int16_t min = IUAB_BYTECODE_NEXT_OPERAND(ctx, int16_t);
+    int16_t max = IUAB_BYTECODE_NEXT_OPERAND(ctx, int16_t);
+    ptrdiff_t index = ctx->dp - ctx->memory;
 
-    if (result == EOF) {
-        return IUAB_ERROR_IO;
+    if (index + min < 0 || index + max >= IUAB_CONTEXT_MEMORY_SIZE) {
+        return IUAB_ERROR_DP_OUT_OF_BOUNDS;
     }
 
     return IUAB_ERROR_SUCCESS;
 }
 
-static enum iuab_error iuab_bytecode_run_read(struct iuab_context *ctx) {
-    int result = fgetc(ctx->in);
+static void iuab_bytecode_run_movp(struct iuab_context *ctx) {
+    ctx->dp += IUAB_BYTECODE_NEXT_OPERAND(ctx, int32_t);
+}
 
-    if (result == EOF) {
-        if (ferror(ctx->in)) {
-            return IUAB_ERROR_IO;
-        }
+static void iuab_bytecode_run_addvo(struct iuab_context *ctx) {
+    uint8_t value = *ctx->ip++;
+    ctx->dp[IUAB_BYTECODE_NEXT_OPERAND(ctx, int16_t)] += value;
+}
 
-        return IUAB_ERROR_RUNTIME_END_OF_INPUT_FILE;
+static void iuab_bytecode_run_seto(struct iuab_context *ctx) {
+    uint8_t value = *ctx->ip++;
+    ctx->dp[IUAB_BYTECODE_NEXT_OPERAND(ctx, int16_t)] = value;
+}
+
+static void iuab_bytecode_run_muladd(struct iuab_context *ctx) {
+    uint8_t factor = *ctx->ip++;
+    ctx->dp[IUAB_BYTECODE_NEXT_OPERAND(ctx, int16_t)] += factor * *ctx->dp;
+}
+
+static enum iuab_error iuab_bytecode_run_scan(struct iuab_context *ctx) {
+    int32_t stride = IUAB_BYTECODE_NEXT_OPERAND(ctx, int32_t);
+    uint8_t *dp = iuab_context_scan(ctx, ctx->dp, stride);
+
+    if (!dp) {
+        return IUAB_ERROR_DP_OUT_OF_BOUNDS;
     }
 
-    *ctx->dp = result;
+    ctx->dp = dp;
     return IUAB_ERROR_SUCCESS;
 }
 
+static enum iuab_error iuab_bytecode_run_write(struct iuab_context *ctx) {
+    return iuab_context_write(ctx, *ctx->dp);
+}
+
+static enum iuab_error iuab_bytecode_run_read(struct iuab_context *ctx) {
+    return iuab_context_read(ctx, ctx->dp);
+}
+
+static void iuab_bytecode_run_store(struct iuab_context *ctx) {
+    int32_t offset = IUAB_BYTECODE_NEXT_OPERAND(ctx, int32_t);
+    uint32_t size = IUAB_BYTECODE_NEXT_OPERAND(ctx, uint32_t);
+    memcpy(ctx->dp + offset, ctx->ip, size);
+    ctx->ip += size;
+}
+
+static enum iuab_error iuab_bytecode_run_writes(struct iuab_context *ctx) {
+    uint32_t size = IUAB_BYTECODE_NEXT_OPERAND(ctx, uint32_t);
+    const uint8_t *data = ctx->ip;
+    ctx->ip += size;
+    return iuab_context_write_data(ctx, data, size);
+}
+
 static void iuab_bytecode_run_jmpz(struct iuab_context *ctx) {
-    size_t offset;
+    int32_t offset = IUAB_BYTECODE_NEXT_OPERAND(ctx, int32_t);
 
-    if (*ctx->dp != 0) {
-        ctx->ip += sizeof(offset);
-        return;
+    if (*ctx->dp == 0) {
+        ctx->ip += offset;
     }
-
-    memcpy(&offset, ctx->ip, sizeof(offset));
-    ctx->ip = ctx->program + offset;
 }
 
 static void iuab_bytecode_run_jmpnz(struct iuab_context *ctx) {
-    size_t offset;
+    int32_t offset = IUAB_BYTECODE_NEXT_OPERAND(ctx, int32_t);
+
+    if (*ctx->dp != 0) {
+        ctx->ip += offset;
+    }
+}
+
+static void iuab_bytecode_run_jmpz8(struct iuab_context *ctx) {
+    int8_t offset = (int8_t) *ctx->ip++;
 
     if (*ctx->dp == 0) {
-        ctx->ip += sizeof(offset);
-        return;
+        ctx->ip += offset;
     }
+}
+
+static void iuab_bytecode_run_jmpnz8(struct iuab_context *ctx) {
+    int8_t offset = (int8_t) *ctx->ip++;
 
-    memcpy(&offset, ctx->ip, sizeof(offset));
-    ctx->ip = ctx->program + offset;
+    if (*ctx->dp != 0) {
+        ctx->ip += offset;
+    }
 }
 
-enum iuab_error iuab_run_bytecode(struct iuab_context *ctx) {
+#ifdef IUAB_BYTECODE_PROFILE_PAIRS
+
+// The number of times each pair of instructions that may be fused into a
+// superinstruction ran in a row, by opcode.
+static unsigned long long
+    iuab_bytecode_pair_counts[IUAB_BYTECODE_NUM_OPS][IUAB_BYTECODE_NUM_OPS];
+
+// Returns true if instructions with the given opcode may run second in a
+// superinstruction, otherwise false.
+static bool iuab_bytecode_can_fuse_second(uint8_t op) {
+    switch (op) {
+    case IUAB_BYTECODE_OP_RET:
+    case IUAB_BYTECODE_OP_DEBUG:
+    case IUAB_BYTECODE_OP_STORE:
+    case IUAB_BYTECODE_OP_WRITES: return false;
+    default: return true;
+    }
+}
+
+// Returns true if instructions with the given opcode may run first in a
+// superinstruction, otherwise false. Jumps may not since the instruction after
+// them is the target of another one.
+static bool iuab_bytecode_can_fuse_first(uint8_t op) {
+    switch (op) {
+    case IUAB_BYTECODE_OP_JMPZ:
+    case IUAB_BYTECODE_OP_JMPNZ:
+    case IUAB_BYTECODE_OP_JMPZ8:
+    case IUAB_BYTECODE_OP_JMPNZ8: return false;
+    default: return iuab_bytecode_can_fuse_second(op);
+    }
+}
+
+// Counts a run of the given pair of instructions. Short jumps are counted as
+// long ones, which superinstructions use.
+static void iuab_bytecode_count_pair(uint8_t first, uint8_t second) {
+    if (second == IUAB_BYTECODE_OP_JMPZ8) {
+        second = IUAB_BYTECODE_OP_JMPZ;
+    } else if (second == IUAB_BYTECODE_OP_JMPNZ8) {
+        second = IUAB_BYTECODE_OP_JMPNZ;
+    }
+
+    if (iuab_bytecode_can_fuse_first(first)
+        && iuab_bytecode_can_fuse_second(second)) {
+        iuab_bytecode_pair_counts[first][second]++;
+    }
+}
+
+// Prints the pairs of instructions counted to `stderr` in the format of
+// `bytecode_pairs.txt`, and resets their counts.
+static void iuab_bytecode_print_pairs(void) {
+    for (uint8_t first = 0; first < IUAB_BYTECODE_NUM_OPS; first++) {
+        for (uint8_t second = 0; second < IUAB_BYTECODE_NUM_OPS; second++) {
+            unsigned long long *count =
+                &iuab_bytecode_pair_counts[first][second];
+
+            if (*count != 0) {
+                fprintf(
+                    stderr,
+                    "%llu %s %s\n",
+                    *count,
+                    iuab_bytecode_op_name(first),
+                    iuab_bytecode_op_name(second)
+                );
+                *count = 0;
+            }
+        }
+    }
+}
+
+#endif
+
+#if IUAB_BYTECODE_HAVE_SUPERINSTRS
+static enum iuab_error
+iuab_bytecode_run_op(struct iuab_context *ctx, uint8_t op);
+
+// Runs the given pair of instructions of a superinstruction, whose opcode
+// precedes the instruction pointer of the given context.
+static enum iuab_error iuab_bytecode_run_superinstr(
+    struct iuab_context *ctx,
+    uint8_t first,
+    uint8_t second
+) {
+    const uint8_t *start = ctx->ip - 1;
+    enum iuab_error err = iuab_bytecode_run_op(ctx, first);
+
+    // Errors are reported at the end of the whole superinstruction.
+    if (err != IUAB_ERROR_SUCCESS) {
+        struct iuab_bytecode_instr instr;
+        iuab_bytecode_decode(ctx->program, start - ctx->program, &instr);
+        ctx->ip = start + instr.size;
+        return err;
+    }
+
+    return iuab_bytecode_run_op(ctx, second);
+}
+#endif
+
+// Runs the instruction with the given opcode, which precedes the instruction
+// pointer of the given context.
+static enum iuab_error
+iuab_bytecode_run_op(struct iuab_context *ctx, uint8_t op) {
+    enum iuab_error err = IUAB_ERROR_SUCCESS;
+
+    switch (op) {
+    case IUAB_BYTECODE_OP_ADDP: err = iuab_bytecode_run_addp(ctx); break;
+    case IUAB_BYTECODE_OP_SUBP: err = iuab_bytecode_run_subp(ctx); break;
+    case IUAB_BYTECODE_OP_ADDV: *ctx->dp += *ctx->ip++; break;
+    case IUAB_BYTECODE_OP_SUBV: *ctx->dp -= *ctx->ip++; break;
+    case IUAB_BYTECODE_OP_WRITE: err = iuab_bytecode_run_write(ctx); break;
+    case IUAB_BYTECODE_OP_READ: err = iuab_bytecode_run_read(ctx); break;
+    case IUAB_BYTECODE_OP_JMPZ: iuab_bytecode_run_jmpz(ctx); break;
+    case IUAB_BYTECODE_OP_JMPNZ: iuab_bytecode_run_jmpnz(ctx); break;
+    case IUAB_BYTECODE_OP_DEBUG: err = iuab_context_debug(ctx); break;
+    case IUAB_BYTECODE_OP_SET: *ctx->dp = *ctx->ip++; break;
+    case IUAB_BYTECODE_OP_MULADD: iuab_bytecode_run_muladd(ctx); break;
+    case IUAB_BYTECODE_OP_SCAN: err = iuab_bytecode_run_scan(ctx); break;
+    case IUAB_BYTECODE_OP_ADDVO: iuab_bytecode_run_addvo(ctx); break;
+    case IUAB_BYTECODE_OP_SETO: iuab_bytecode_run_seto(ctx); break;
+    case IUAB_BYTECODE_OP_CHECK: err = iuab_bytecode_run_check(ctx); break;
+    case IUAB_BYTECODE_OP_MOVP: iuab_bytecode_run_movp(ctx); break;
+    case IUAB_BYTECODE_OP_STORE: iuab_bytecode_run_store(ctx); break;
+    case IUAB_BYTECODE_OP_WRITES: err = iuab_bytecode_run_writes(ctx); break;
+    case IUAB_BYTECODE_OP_JMPZ8: iuab_bytecode_run_jmpz8(ctx); break;
+    case IUAB_BYTECODE_OP_JMPNZ8: iuab_bytecode_run_jmpnz8(ctx); break;
+#define IUAB_BYTECODE_SUPERINSTR(first, second, name) \
+    case IUAB_BYTECODE_OP_##first##_##second:         \
+        err = iuab_bytecode_run_superinstr(           \
+            ctx,                                      \
+            IUAB_BYTECODE_OP_##first,                 \
+            IUAB_BYTECODE_OP_##second                 \
+        );                                            \
+        break;
+        IUAB_BYTECODE_SUPERINSTRS(IUAB_BYTECODE_SUPERINSTR)
+#undef IUAB_BYTECODE_SUPERINSTR
+    default: IUAB_BYTECODE_UNREACHABLE();
+    }
+
+    return err;
+}
+
+// Runs the program with a `switch` dispatching each instruction in turn.
+static enum iuab_error iuab_bytecode_run_switch(struct iuab_context *ctx) {
     uint8_t op;
+#ifdef IUAB_BYTECODE_PROFILE_PAIRS
+    uint8_t last_op = IUAB_BYTECODE_OP_RET;
+#endif
 
     while ((op = *ctx->ip++) != IUAB_BYTECODE_OP_RET) {
-        enum iuab_error err = IUAB_ERROR_SUCCESS;
-
-        switch (op) {
-        case IUAB_BYTECODE_OP_ADDP: err = iuab_bytecode_run_addp(ctx); break;
-        case IUAB_BYTECODE_OP_SUBP: err = iuab_bytecode_run_subp(ctx); break;
-        case IUAB_BYTECODE_OP_ADDV: *ctx->dp += *ctx->ip++; break;
-        case IUAB_BYTECODE_OP_SUBV: *ctx->dp -= *ctx->ip++; break;
-        case IUAB_BYTECODE_OP_WRITE: err = iuab_bytecode_run_write(ctx); break;
-        case IUAB_BYTECODE_OP_READ: err = iuab_bytecode_run_read(ctx); break;
-        case IUAB_BYTECODE_OP_JMPZ: iuab_bytecode_run_jmpz(ctx); break;
-        case IUAB_BYTECODE_OP_JMPNZ: iuab_bytecode_run_jmpnz(ctx); break;
-        case IUAB_BYTECODE_OP_DEBUG: ctx->debug_handler(ctx); break;
-        default: return IUAB_ERROR_BYTECODE_INVALID_OP;
-        }
+#ifdef IUAB_BYTECODE_PROFILE_PAIRS
+        iuab_bytecode_count_pair(last_op, op);
+        last_op = op;
+#endif
+        enum iuab_error err = iuab_bytecode_run_op(ctx, op);
 
         if (err != IUAB_ERROR_SUCCESS) {
             return err;
@@ -110,3 +322,549 @@ enum iuab_error iuab_run_bytecode(struct iuab_context *ctx) {
 
     return IUAB_ERROR_SUCCESS;
 }
+
+bool iuab_bytecode_can_run(const struct iuab_context *ctx) {
+    return ctx->ip != ctx->program || ctx->dp == ctx->memory;
+}
+
+enum iuab_error iuab_bytecode_step(struct iuab_context *ctx) {
+    return iuab_bytecode_run_op(ctx, *ctx->ip++);
+}
+
+enum iuab_error iuab_run_profiled_bytecode(
+    struct iuab_context *ctx,
+    struct iuab_bytecode_profile *profile
+) {
+    uint8_t op;
+
+    if (!iuab_bytecode_can_run(ctx)) {
+        return IUAB_ERROR_DP_OUT_OF_BOUNDS;
+    }
+
+    while (profile->counts[ctx->ip - ctx->program]++,
+           (op = *ctx->ip++) != IUAB_BYTECODE_OP_RET) {
+        enum iuab_error err = iuab_bytecode_run_op(ctx, op);
+
+        if (err != IUAB_ERROR_SUCCESS) {
+            return iuab_context_end_run(ctx, err);
+        }
+    }
+
+    return iuab_context_end_run(ctx, IUAB_ERROR_SUCCESS);
+}
+
+#ifdef IUAB_BYTECODE_THREADED
+
+// A cell of direct-threaded code: the address of the code running an
+// instruction, or one of its operands.
+union iuab_bytecode_cell {
+    const void *code;
+    const union iuab_bytecode_cell *target;
+    const uint8_t *address;
+    intptr_t value;
+};
+
+// The threaded code of an instruction is the address of the code running it
+// followed by its operand cells: the address of its end in the program if it
+// may stop the program or call the debugging event handler, then its operands,
+// with jump targets resolved to the threaded code of their instruction. The
+// operand cells of a superinstruction are those of its pair of instructions.
+
+// The number of operand cells of each instruction.
+    #define IUAB_BYTECODE_CELLS_RET 1
+    #define IUAB_BYTECODE_CELLS_ADDP 2
+    #define IUAB_BYTECODE_CELLS_SUBP 2
+    #define IUAB_BYTECODE_CELLS_ADDV 1
+    #define IUAB_BYTECODE_CELLS_SUBV 1
+    #define IUAB_BYTECODE_CELLS_WRITE 1
+    #define IUAB_BYTECODE_CELLS_READ 1
+    #define IUAB_BYTECODE_CELLS_JMPZ 1
+    #define IUAB_BYTECODE_CELLS_JMPNZ 1
+    #define IUAB_BYTECODE_CELLS_DEBUG 1
+    #define IUAB_BYTECODE_CELLS_SET 1
+    #define IUAB_BYTECODE_CELLS_MULADD 2
+    #define IUAB_BYTECODE_CELLS_SCAN 2
+    #define IUAB_BYTECODE_CELLS_ADDVO 2
+    #define IUAB_BYTECODE_CELLS_SETO 2
+    #define IUAB_BYTECODE_CELLS_CHECK 3
+    #define IUAB_BYTECODE_CELLS_MOVP 1
+    #define IUAB_BYTECODE_CELLS_STORE 3
+    #define IUAB_BYTECODE_CELLS_WRITES 3
+
+// Returns the number of operand cells of the instructions with the given
+// opcode.
+static size_t iuab_bytecode_cell_count(uint8_t op) {
+    uint8_t first;
+    uint8_t second;
+
+    if (iuab_bytecode_split(op, &first, &second)) {
+        return iuab_bytecode_cell_count(first)
+               + iuab_bytecode_cell_count(second);
+    }
+
+    switch (op) {
+    case IUAB_BYTECODE_OP_ADDP: return IUAB_BYTECODE_CELLS_ADDP;
+    case IUAB_BYTECODE_OP_SUBP: return IUAB_BYTECODE_CELLS_SUBP;
+    case IUAB_BYTECODE_OP_MULADD: return IUAB_BYTECODE_CELLS_MULADD;
+    case IUAB_BYTECODE_OP_SCAN: return IUAB_BYTECODE_CELLS_SCAN;
+    case IUAB_BYTECODE_OP_ADDVO: return IUAB_BYTECODE_CELLS_ADDVO;
+    case IUAB_BYTECODE_OP_SETO: return IUAB_BYTECODE_CELLS_SETO;
+    case IUAB_BYTECODE_OP_CHECK: return IUAB_BYTECODE_CELLS_CHECK;
+    case IUAB_BYTECODE_OP_STORE: return IUAB_BYTECODE_CELLS_STORE;
+    case IUAB_BYTECODE_OP_WRITES: return IUAB_BYTECODE_CELLS_WRITES;
+    default: return 1;
+    }
+}
+
+// Writes to `dst` the operand cells of the instruction with opcode `op` and
+// the given operands, which ends at `end` in the program whose threaded code
+// is being written to `prepared`.
+static void iuab_bytecode_thread_operands(
+    const struct iuab_bytecode_prepared *prepared,
+    uint8_t op,
+    const int32_t *operands,
+    const uint8_t *data,
+    const uint8_t *end,
+    union iuab_bytecode_cell *dst
+) {
+    dst[0].address = end;
+
+    switch (op) {
+    case IUAB_BYTECODE_OP_ADDP:
+    case IUAB_BYTECODE_OP_SUBP:
+    case IUAB_BYTECODE_OP_SCAN: dst[1].value = operands[0]; break;
+    case IUAB_BYTECODE_OP_ADDV:
+    case IUAB_BYTECODE_OP_SUBV:
+    case IUAB_BYTECODE_OP_SET:
+    case IUAB_BYTECODE_OP_MOVP: dst[0].value = operands[0]; break;
+    case IUAB_BYTECODE_OP_JMPZ:
+    case IUAB_BYTECODE_OP_JMPNZ:
+    case IUAB_BYTECODE_OP_JMPZ8:
+    case IUAB_BYTECODE_OP_JMPNZ8:
+        dst[0].target = &prepared->cells[prepared->cell_indices[operands[0]]];
+        break;
+    case IUAB_BYTECODE_OP_MULADD:
+    case IUAB_BYTECODE_OP_ADDVO:
+    case IUAB_BYTECODE_OP_SETO:
+        dst[0].value = operands[1];
+        dst[1].value = operands[0];
+        break;
+    case IUAB_BYTECODE_OP_CHECK:
+        dst[1].value = operands[0];
+        dst[2].value = operands[1];
+        break;
+    case IUAB_BYTECODE_OP_STORE:
+        dst[0].value = operands[0];
+        dst[1].value = (intptr_t) (uint32_t) operands[1];
+        dst[2].address = data;
+        break;
+    case IUAB_BYTECODE_OP_WRITES:
+        dst[1].value = (intptr_t) (uint32_t) operands[0];
+        dst[2].address = data;
+        break;
+    default: break;
+    }
+}
+
+// Writes to `dst` the threaded code of the given instruction at `offset` in the
+// program pointed to by `program`, whose threaded code is being written to
+// `prepared`. `codes` are the addresses of the code running each opcode.
+static void iuab_bytecode_thread_instr(
+    const struct iuab_bytecode_prepared *prepared,
+    const uint8_t *program,
+    size_t offset,
+    const struct iuab_bytecode_instr *instr,
+    const void *const *codes,
+    union iuab_bytecode_cell *dst
+) {
+    const uint8_t *end = &program[offset + instr->size];
+    uint8_t first;
+    uint8_t second;
+    dst[0].code = codes[instr->op];
+
+    if (!iuab_bytecode_split(instr->op, &first, &second)) {
+        iuab_bytecode_thread_operands(
+            prepared,
+            instr->op,
+            instr->operands,
+            instr->data,
+            end,
+            &dst[1]
+        );
+        return;
+    }
+
+    const int32_t *second_operands =
+        &instr->operands[iuab_bytecode_operand_count(first)];
+    union iuab_bytecode_cell *second_dst =
+        &dst[1 + iuab_bytecode_cell_count(first)];
+    iuab_bytecode_thread_operands(
+        prepared,
+        first,
+        instr->operands,
+        instr->data,
+        end,
+        &dst[1]
+    );
+    iuab_bytecode_thread_operands(
+        prepared,
+        second,
+        second_operands,
+        instr->data,
+        end,
+        second_dst
+    );
+}
+
+// Initializes the given prepared program with the threaded code of the given
+// valid program. `codes` are as in `iuab_bytecode_thread_instr()`. Returns the
+// error that occurred in the process.
+static enum iuab_error iuab_bytecode_thread(
+    struct iuab_bytecode_prepared *prepared,
+    const uint8_t *program,
+    const void *const *codes
+) {
+    struct iuab_bytecode_instr instr;
+    size_t program_size = 0;
+    size_t cell_count = 0;
+
+    do {
+        iuab_bytecode_decode(program, program_size, &instr);
+        program_size += instr.size;
+        cell_count += 1 + iuab_bytecode_cell_count(instr.op);
+    } while (instr.op != IUAB_BYTECODE_OP_RET);
+
+    prepared->cells = malloc(cell_count * sizeof(union iuab_bytecode_cell));
+    prepared->cell_indices = malloc(program_size * sizeof(size_t));
+    prepared->program_size = program_size;
+
+    if (!prepared->cells || !prepared->cell_indices) {
+        iuab_bytecode_prepared_fini(prepared);
+        return IUAB_ERROR_MALLOC;
+    }
+
+    for (size_t i = 0; i < program_size; i++) {
+        prepared->cell_indices[i] = SIZE_MAX;
+    }
+
+    size_t cell_index = 0;
+
+    for (size_t offset = 0; offset < program_size; offset += instr.size) {
+        iuab_bytecode_decode(program, offset, &instr);
+        prepared->cell_indices[offset] = cell_index;
+        cell_index += 1 + iuab_bytecode_cell_count(instr.op);
+    }
+
+    for (size_t offset = 0; offset < program_size; offset += instr.size) {
+        iuab_bytecode_decode(program, offset, &instr);
+        iuab_bytecode_thread_instr(
+            prepared,
+            program,
+            offset,
+            &instr,
+            codes,
+            &prepared->cells[prepared->cell_indices[offset]]
+        );
+    }
+
+    return IUAB_ERROR_SUCCESS;
+}
+
+// Jumps to the code running the next instruction.
+    #define IUAB_BYTECODE_DISPATCH() goto *(ip++)->code
+
+// Stops the program with the given error, leaving the instruction pointer of
+// the context at the end of the instruction given by the address cell `cell`.
+    #define IUAB_BYTECODE_STOP(err, cell) \
+        do {                              \
+            error = (err);                \
+            end = (cell).address;         \
+            goto stop;                    \
+        } while (0)
+
+// The code running the instruction with each opcode from its operand cells
+// `cells`.
+    #define IUAB_BYTECODE_EXEC_RET(cells) \
+        IUAB_BYTECODE_STOP(IUAB_ERROR_SUCCESS, (cells)[0])
+    #define IUAB_BYTECODE_EXEC_ADDP(cells)                                \
+        if (dp - memory >= IUAB_CONTEXT_MEMORY_SIZE - (cells)[1].value) { \
+            IUAB_BYTECODE_STOP(IUAB_ERROR_DP_OUT_OF_BOUNDS, (cells)[0]);  \
+        }                                                                 \
+                                                                          \
+        dp += (cells)[1].value;
+    #define IUAB_BYTECODE_EXEC_SUBP(cells)                               \
+        if (dp - memory < (cells)[1].value) {                            \
+            IUAB_BYTECODE_STOP(IUAB_ERROR_DP_OUT_OF_BOUNDS, (cells)[0]); \
+        }                                                                \
+                                                                         \
+        dp -= (cells)[1].value;
+    #define IUAB_BYTECODE_EXEC_ADDV(cells) *dp += (uint8_t) (cells)[0].value;
+    #define IUAB_BYTECODE_EXEC_SUBV(cells) *dp -= (uint8_t) (cells)[0].value;
+    #define IUAB_BYTECODE_EXEC_WRITE(cells)                       \
+        if (iuab_context_write(ctx, *dp) != IUAB_ERROR_SUCCESS) { \
+            IUAB_BYTECODE_STOP(IUAB_ERROR_IO, (cells)[0]);        \
+        }
+    #define IUAB_BYTECODE_EXEC_READ(cells)         \
+        error = iuab_context_read(ctx, dp);        \
+                                                   \
+        if (error != IUAB_ERROR_SUCCESS) {         \
+            IUAB_BYTECODE_STOP(error, (cells)[0]); \
+        }
+    #define IUAB_BYTECODE_EXEC_JMPZ(cells) \
+        if (*dp == 0) {                    \
+            ip = (cells)[0].target;        \
+            IUAB_BYTECODE_DISPATCH();      \
+        }
+    #define IUAB_BYTECODE_EXEC_JMPNZ(cells) \
+        if (*dp != 0) {                     \
+            ip = (cells)[0].target;         \
+            IUAB_BYTECODE_DISPATCH();       \
+        }
+    #define IUAB_BYTECODE_EXEC_DEBUG(cells)                  \
+        ctx->ip = (cells)[0].address;                        \
+        ctx->dp = dp;                                        \
+                                                             \
+        if (iuab_context_debug(ctx) != IUAB_ERROR_SUCCESS) { \
+            IUAB_BYTECODE_STOP(IUAB_ERROR_IO, (cells)[0]);   \
+        }                                                    \
+                                                             \
+        dp = ctx->dp;
+    #define IUAB_BYTECODE_EXEC_SET(cells) *dp = (uint8_t) (cells)[0].value;
+    #define IUAB_BYTECODE_EXEC_MULADD(cells) \
+        dp[(cells)[0].value] += (uint8_t) (cells)[1].value * *dp;
+    #define IUAB_BYTECODE_EXEC_SCAN(cells)                                \
+        scan_dp = iuab_context_scan(ctx, dp, (int32_t) (cells)[1].value); \
+                                                                          \
+        if (!scan_dp) {                                                   \
+            IUAB_BYTECODE_STOP(IUAB_ERROR_DP_OUT_OF_BOUNDS, (cells)[0]);  \
+        }                                                                 \
+                                                                          \
+        dp = scan_dp;
+    #define IUAB_BYTECODE_EXEC_ADDVO(cells) \
+        dp[(cells)[0].value] += (uint8_t) (cells)[1].value;
+    #define IUAB_BYTECODE_EXEC_SETO(cells) \
+        dp[(cells)[0].value] = (uint8_t) (cells)[1].value;
+    #define IUAB_BYTECODE_EXEC_CHECK(cells)                                  \
+        if (dp - memory + (cells)[1].value < 0                               \
+            || dp - memory + (cells)[2].value >= IUAB_CONTEXT_MEMORY_SIZE) { \
+            IUAB_BYTECODE_STOP(IUAB_ERROR_DP_OUT_OF_BOUNDS, (cells)[0]);     \
+        }
+    #define IUAB_BYTECODE_EXEC_MOVP(cells) dp += (cells)[0].value;
+    #define IUAB_BYTECODE_EXEC_STORE(cells) \
+        memcpy(                             \
+            dp + (cells)[0].value,          \
+            (cells)[2].address,             \
+            (size_t) (cells)[1].value       \
+        );
+    #define IUAB_BYTECODE_EXEC_WRITES(cells)               \
+        if (iuab_context_write_data(                       \
+                ctx,                                       \
+                (cells)[2].address,                        \
+                (size_t) (cells)[1].value                  \
+            )                                              \
+            != IUAB_ERROR_SUCCESS) {                       \
+            IUAB_BYTECODE_STOP(IUAB_ERROR_IO, (cells)[0]); \
+        }
+
+// Runs the instruction with the opcode `IUAB_BYTECODE_OP_<op>` at `label` and
+// dispatches the next one.
+    #define IUAB_BYTECODE_INSTR(label, op) \
+        label:                             \
+        IUAB_BYTECODE_EXEC_##op(ip);       \
+        ip += IUAB_BYTECODE_CELLS_##op;    \
+        IUAB_BYTECODE_DISPATCH();
+
+// Runs the given superinstruction at the label `name` and dispatches the next
+// instruction.
+    #define IUAB_BYTECODE_SUPERINSTR(first, second, name)                 \
+        name:                                                             \
+        IUAB_BYTECODE_EXEC_##first(ip);                                   \
+        IUAB_BYTECODE_EXEC_##second(ip + IUAB_BYTECODE_CELLS_##first);    \
+        ip += IUAB_BYTECODE_CELLS_##first + IUAB_BYTECODE_CELLS_##second; \
+        IUAB_BYTECODE_DISPATCH();
+
+// The address of the code running each superinstruction, in `codes`.
+    #define IUAB_BYTECODE_SUPERINSTR_CODE(first, second, name) \
+        [IUAB_BYTECODE_OP_##first##_##second] = &&name,
+
+// Runs the program with direct threading from the given threaded code, from
+// the data pointer and instruction pointer kept in locals, and writes the error
+// that occurred in the process at the location pointed to by `error_dst`.
+// Returns false, without running it, if no instruction starts at the
+// instruction pointer. If `ctx` is null, only writes the addresses of the code
+// running each opcode, which threaded code is made of, at the location pointed
+// to by `codes_dst`.
+static bool iuab_bytecode_run_threaded(
+    struct iuab_context *ctx,
+    const struct iuab_bytecode_prepared *prepared,
+    enum iuab_error *error_dst,
+    const void *const **codes_dst
+) {
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wpedantic"
+    static const void *const codes[] = {
+        [IUAB_BYTECODE_OP_RET] = &&ret,
+        [IUAB_BYTECODE_OP_ADDP] = &&addp,
+        [IUAB_BYTECODE_OP_SUBP] = &&subp,
+        [IUAB_BYTECODE_OP_ADDV] = &&addv,
+        [IUAB_BYTECODE_OP_SUBV] = &&subv,
+        [IUAB_BYTECODE_OP_WRITE] = &&write,
+        [IUAB_BYTECODE_OP_READ] = &&read,
+        [IUAB_BYTECODE_OP_JMPZ] = &&jmpz,
+        [IUAB_BYTECODE_OP_JMPNZ] = &&jmpnz,
+        [IUAB_BYTECODE_OP_DEBUG] = &&debug,
+        [IUAB_BYTECODE_OP_SET] = &&set,
+        [IUAB_BYTECODE_OP_MULADD] = &&muladd,
+        [IUAB_BYTECODE_OP_SCAN] = &&scan,
+        [IUAB_BYTECODE_OP_ADDVO] = &&addvo,
+        [IUAB_BYTECODE_OP_SETO] = &&seto,
+        [IUAB_BYTECODE_OP_CHECK] = &&check,
+        [IUAB_BYTECODE_OP_MOVP] = &&movp,
+        [IUAB_BYTECODE_OP_STORE] = &&store,
+        [IUAB_BYTECODE_OP_WRITES] = &&writes,
+        [IUAB_BYTECODE_OP_JMPZ8] = &&jmpz,
+        [IUAB_BYTECODE_OP_JMPNZ8] = &&jmpnz,
+        IUAB_BYTECODE_SUPERINSTRS(IUAB_BYTECODE_SUPERINSTR_CODE)
+    };
+
+    if (!ctx) {
+        *codes_dst = codes;
+        return false;
+    }
+
+    size_t start = (size_t) (ctx->ip - ctx->program);
+
+    if (start >= prepared->program_size
+        || prepared->cell_indices[start] == SIZE_MAX) {
+        return false;
+    }
+
+    const union iuab_bytecode_cell *ip =
+        &prepared->cells[prepared->cell_indices[start]];
+    uint8_t *dp = ctx->dp;
+    const uint8_t *memory = ctx->memory;
+    const uint8_t *end;
+    uint8_t *scan_dp;
+    enum iuab_error error;
+    IUAB_BYTECODE_DISPATCH();
+
+    IUAB_BYTECODE_INSTR(ret, RET)
+    IUAB_BYTECODE_INSTR(addp, ADDP)
+    IUAB_BYTECODE_INSTR(subp, SUBP)
+    IUAB_BYTECODE_INSTR(addv, ADDV)
+    IUAB_BYTECODE_INSTR(subv, SUBV)
+    IUAB_BYTECODE_INSTR(write, WRITE)
+    IUAB_BYTECODE_INSTR(read, READ)
+    IUAB_BYTECODE_INSTR(jmpz, JMPZ)
+    IUAB_BYTECODE_INSTR(jmpnz, JMPNZ)
+    IUAB_BYTECODE_INSTR(debug, DEBUG)
+    IUAB_BYTECODE_INSTR(set, SET)
+    IUAB_BYTECODE_INSTR(muladd, MULADD)
+    IUAB_BYTECODE_INSTR(scan, SCAN)
+    IUAB_BYTECODE_INSTR(addvo, ADDVO)
+    IUAB_BYTECODE_INSTR(seto, SETO)
+    IUAB_BYTECODE_INSTR(check, CHECK)
+    IUAB_BYTECODE_INSTR(movp, MOVP)
+    IUAB_BYTECODE_INSTR(store, STORE)
+    IUAB_BYTECODE_INSTR(writes, WRITES)
+    IUAB_BYTECODE_SUPERINSTRS(IUAB_BYTECODE_SUPERINSTR)
+    #pragma GCC diagnostic pop
+
+stop:
+    ctx->ip = end;
+    ctx->dp = dp;
+    *error_dst = error;
+    return true;
+}
+
+#endif
+
+size_t iuab_bytecode_measure(const uint8_t *program) {
+    struct iuab_bytecode_instr instr = { .op = IUAB_BYTECODE_NUM_OPS };
+    size_t size = 0;
+
+    while (instr.op != IUAB_BYTECODE_OP_RET) {
+        if (!iuab_bytecode_decode(program, size, &instr)) {
+            return size + 1;
+        }
+
+        size += instr.size;
+    }
+
+    return size;
+}
+
+enum iuab_error iuab_run_bytecode(struct iuab_context *ctx) {
+    enum iuab_error error = iuab_bytecode_verify(
+        ctx->program,
+        iuab_bytecode_measure(ctx->program)
+    );
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    return iuab_run_verified_bytecode(ctx);
+}
+
+enum iuab_error iuab_run_verified_bytecode(struct iuab_context *ctx) {
+    struct iuab_bytecode_prepared prepared;
+    enum iuab_error error = iuab_bytecode_prepare(&prepared, ctx->program);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    error = iuab_run_prepared_bytecode(ctx, &prepared);
+    iuab_bytecode_prepared_fini(&prepared);
+    return error;
+}
+
+enum iuab_error iuab_bytecode_prepare(
+    struct iuab_bytecode_prepared *prepared,
+    const uint8_t *program
+) {
+#ifdef IUAB_BYTECODE_THREADED
+    const void *const *codes;
+    iuab_bytecode_run_threaded(NULL, NULL, NULL, &codes);
+    return iuab_bytecode_thread(prepared, program, codes);
+#else
+    (void) program;
+    prepared->cells = NULL;
+    prepared->cell_indices = NULL;
+    prepared->program_size = 0;
+    return IUAB_ERROR_SUCCESS;
+#endif
+}
+
+void iuab_bytecode_prepared_fini(struct iuab_bytecode_prepared *prepared) {
+    free(prepared->cells);
+    free(prepared->cell_indices);
+}
+
+enum iuab_error iuab_run_prepared_bytecode(
+    struct iuab_context *ctx,
+    const struct iuab_bytecode_prepared *prepared
+) {
+    if (!iuab_bytecode_can_run(ctx)) {
+        return IUAB_ERROR_DP_OUT_OF_BOUNDS;
+    }
+
+#ifdef IUAB_BYTECODE_THREADED
+    enum iuab_error error;
+
+    if (iuab_bytecode_run_threaded(ctx, prepared, &error, NULL)) {
+        return iuab_context_end_run(ctx, error);
+    }
+#else
+    (void) prepared;
+#endif
+
+#ifdef IUAB_BYTECODE_PROFILE_PAIRS
+    enum iuab_error error = iuab_bytecode_run_switch(ctx);
+    iuab_bytecode_print_pairs();
+    return iuab_context_end_run(ctx, error);
+#else
+    return iuab_context_end_run(ctx, iuab_bytecode_run_switch(ctx));
+#endif
+}
@@ -0,0 +1,329 @@
+// Copyright (C) 2022 OverMighty
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "iuab/buffer.h"
+#include "iuab/context.h"
+#include "iuab/errors.h"
+#include "iuab/targets/bytecode.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A verifier of an I use Arch btw bytecode program.
+struct iuab_bytecode_verifier {
+    size_t program_size;
+    // The loops the instructions being verified are in, innermost last, each
+    // as the offset of the start of its body followed by that of its end.
+    struct iuab_buffer loops;
+    // The offsets from the data pointer of the values proven to be within the
+    // bounds of the memory since the start of the basic block being verified,
+    // from `checked_min` to `checked_max`, which include 0.
+    int64_t checked_min;
+    int64_t checked_max;
+};
+
+// Forgets the values proven to be within the bounds of the memory, except the
+// one pointed to by the data pointer, at the start of a basic block.
+static void iuab_bytecode_verifier_reset(struct iuab_bytecode_verifier *verifier
+) {
+    verifier->checked_min = 0;
+    verifier->checked_max = 0;
+}
+
+// Verifies that the values from offset `min` to offset `max` from the data
+// pointer, which are accessed without checking the bounds of the memory, are
+// proven to be within them. Returns the error in the access, if any.
+static enum iuab_error iuab_bytecode_verifier_access(
+    const struct iuab_bytecode_verifier *verifier,
+    int64_t min,
+    int64_t max
+) {
+    return min >= verifier->checked_min && max <= verifier->checked_max
+               ? IUAB_ERROR_SUCCESS
+               : IUAB_ERROR_BYTECODE_UNCHECKED_ACCESS;
+}
+
+// Marks the values from offset `min` to offset `max` from the data pointer as
+// proven to be within the bounds of the memory.
+static void iuab_bytecode_verifier_check(
+    struct iuab_bytecode_verifier *verifier,
+    int64_t min,
+    int64_t max
+) {
+    if (min < verifier->checked_min) {
+        verifier->checked_min = min;
+    }
+
+    if (max > verifier->checked_max) {
+        verifier->checked_max = max;
+    }
+}
+
+// Moves the data pointer by `value` to a value within the bounds of the memory.
+static void iuab_bytecode_verifier_move(
+    struct iuab_bytecode_verifier *verifier,
+    int64_t value
+) {
+    verifier->checked_min -= value;
+    verifier->checked_max -= value;
+    iuab_bytecode_verifier_check(verifier, 0, 0);
+}
+
+// Returns the offset of the end of the innermost loop being verified, or
+// `SIZE_MAX` if there is none.
+static size_t
+iuab_bytecode_verifier_loop_end(const struct iuab_bytecode_verifier *verifier) {
+    return verifier->loops.size != 0
+               ? iuab_buffer_peek_size(&verifier->loops)
+               : SIZE_MAX;
+}
+
+// Starts a loop from the instruction ending at `end`, whose body starts there,
+// to `target`. Returns the error in the jump, if any.
+static enum iuab_error iuab_bytecode_verifier_begin_loop(
+    struct iuab_bytecode_verifier *verifier,
+    size_t end,
+    int32_t target
+) {
+    // Loops are within the program and the loop they are in.
+    if (target < 0 || (size_t) target < end
+        || (size_t) target >= verifier->program_size
+        || (size_t) target >= iuab_bytecode_verifier_loop_end(verifier)) {
+        return IUAB_ERROR_BYTECODE_INVALID_JUMP;
+    }
+
+    enum iuab_error error = iuab_buffer_write_size(&verifier->loops, end);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    return iuab_buffer_write_size(&verifier->loops, (size_t) target);
+}
+
+// Ends the innermost loop at the instruction ending at `end` and jumping to
+// `target`, the start of its body. Returns the error in the jump, if any.
+static enum iuab_error iuab_bytecode_verifier_end_loop(
+    struct iuab_bytecode_verifier *verifier,
+    size_t end,
+    int32_t target
+) {
+    if (iuab_bytecode_verifier_loop_end(verifier) != end) {
+        return IUAB_ERROR_BYTECODE_INVALID_JUMP;
+    }
+
+    iuab_buffer_pop_size(&verifier->loops);
+
+    if (target < 0
+        || iuab_buffer_pop_size(&verifier->loops) != (size_t) target) {
+        return IUAB_ERROR_BYTECODE_INVALID_JUMP;
+    }
+
+    return IUAB_ERROR_SUCCESS;
+}
+
+// Returns true if the data pointer may be moved by the given stride by a
+// `IUAB_BYTECODE_OP_SCAN` instruction, whose values are searched in blocks a
+// whole number of strides long, otherwise false.
+static bool iuab_bytecode_is_valid_stride(int32_t stride) {
+    if (stride == 0 || stride == INT32_MIN) {
+        return false;
+    }
+
+    uint32_t step = (uint32_t) (stride < 0 ? -stride : stride);
+    return step <= IUAB_CONTEXT_MEMORY_SIZE && (step & (step - 1)) == 0;
+}
+
+// Verifies the instruction with the given opcode and operands, which is part of
+// an instruction ending at `end`, and updates the loops being verified and the
+// values proven to be within the bounds of the memory. Returns the error in the
+// instruction, if any.
+static enum iuab_error iuab_bytecode_verify_op(
+    struct iuab_bytecode_verifier *verifier,
+    uint8_t op,
+    size_t end,
+    const int32_t *operands
+) {
+    switch (op) {
+    case IUAB_BYTECODE_OP_JMPZ:
+    case IUAB_BYTECODE_OP_JMPZ8:
+        iuab_bytecode_verifier_reset(verifier);
+        return iuab_bytecode_verifier_begin_loop(verifier, end, operands[0]);
+    case IUAB_BYTECODE_OP_JMPNZ:
+    case IUAB_BYTECODE_OP_JMPNZ8:
+        iuab_bytecode_verifier_reset(verifier);
+        return iuab_bytecode_verifier_end_loop(verifier, end, operands[0]);
+    case IUAB_BYTECODE_OP_ADDP:
+        iuab_bytecode_verifier_move(verifier, operands[0]);
+        return IUAB_ERROR_SUCCESS;
+    case IUAB_BYTECODE_OP_SUBP:
+        iuab_bytecode_verifier_move(verifier, -(int64_t) operands[0]);
+        return IUAB_ERROR_SUCCESS;
+    case IUAB_BYTECODE_OP_DEBUG:
+        // The debugging event handler may move the data pointer.
+        iuab_bytecode_verifier_reset(verifier);
+        return IUAB_ERROR_SUCCESS;
+    case IUAB_BYTECODE_OP_MULADD:
+    case IUAB_BYTECODE_OP_ADDVO:
+    case IUAB_BYTECODE_OP_SETO:
+        return iuab_bytecode_verifier_access(
+            verifier,
+            operands[1],
+            operands[1]
+        );
+    case IUAB_BYTECODE_OP_SCAN:
+        if (!iuab_bytecode_is_valid_stride(operands[0])) {
+            return IUAB_ERROR_BYTECODE_INVALID_OPERAND;
+        }
+
+        iuab_bytecode_verifier_reset(verifier);
+        return IUAB_ERROR_SUCCESS;
+    case IUAB_BYTECODE_OP_CHECK:
+        if (operands[0] > operands[1]) {
+            return IUAB_ERROR_BYTECODE_INVALID_OPERAND;
+        }
+
+        iuab_bytecode_verifier_check(verifier, operands[0], operands[1]);
+        return IUAB_ERROR_SUCCESS;
+    case IUAB_BYTECODE_OP_MOVP: {
+        enum iuab_error error = iuab_bytecode_verifier_access(
+            verifier,
+            operands[0],
+            operands[0]
+        );
+
+        if (error == IUAB_ERROR_SUCCESS) {
+            iuab_bytecode_verifier_move(verifier, operands[0]);
+        }
+
+        return error;
+    }
+    case IUAB_BYTECODE_OP_STORE: {
+        // Stores of no values access none.
+        int64_t size = (uint32_t) operands[1];
+        return size != 0 ? iuab_bytecode_verifier_access(
+                               verifier,
+                               operands[0],
+                               operands[0] + size - 1
+                           )
+                         : IUAB_ERROR_SUCCESS;
+    }
+    default: return IUAB_ERROR_SUCCESS;
+    }
+}
+
+// Returns true if the given opcode is that of a jump, otherwise false.
+static bool iuab_bytecode_is_jump(uint8_t op) {
+    return op == IUAB_BYTECODE_OP_JMPZ || op == IUAB_BYTECODE_OP_JMPNZ
+           || op == IUAB_BYTECODE_OP_JMPZ8 || op == IUAB_BYTECODE_OP_JMPNZ8;
+}
+
+// Verifies the given instruction, which ends at `end`, and updates the loops
+// being verified. Returns the error in the instruction, if any.
+static enum iuab_error iuab_bytecode_verify_instr(
+    struct iuab_bytecode_verifier *verifier,
+    const struct iuab_bytecode_instr *instr,
+    size_t end
+) {
+    uint8_t first;
+    uint8_t second;
+
+    if (!iuab_bytecode_split(instr->op, &first, &second)) {
+        return iuab_bytecode_verify_op(
+            verifier,
+            instr->op,
+            end,
+            instr->operands
+        );
+    }
+
+    // The second instruction of a superinstruction is not run after a jump.
+    if (iuab_bytecode_is_jump(first)) {
+        return IUAB_ERROR_BYTECODE_INVALID_JUMP;
+    }
+
+    enum iuab_error error =
+        iuab_bytecode_verify_op(verifier, first, end, instr->operands);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    return iuab_bytecode_verify_op(
+        verifier,
+        second,
+        end,
+        &instr->operands[iuab_bytecode_operand_count(first)]
+    );
+}
+
+// Verifies the instructions of the program pointed to by `program` with the
+// given verifier. Returns the error in the program, if any.
+static enum iuab_error iuab_bytecode_verifier_run(
+    struct iuab_bytecode_verifier *verifier,
+    const uint8_t *program
+) {
+    struct iuab_bytecode_instr instr = { .op = IUAB_BYTECODE_NUM_OPS };
+    size_t size = verifier->program_size;
+    size_t offset = 0;
+
+    while (instr.op != IUAB_BYTECODE_OP_RET) {
+        // Loops without a jump back to their start, which run at most once,
+        // end without an instruction.
+        while (iuab_bytecode_verifier_loop_end(verifier) == offset) {
+            iuab_buffer_pop_size(&verifier->loops);
+            iuab_buffer_pop_size(&verifier->loops);
+            iuab_bytecode_verifier_reset(verifier);
+        }
+
+        if (iuab_bytecode_verifier_loop_end(verifier) < offset) {
+            return IUAB_ERROR_BYTECODE_INVALID_JUMP;
+        }
+
+        if (offset >= size) {
+            return IUAB_ERROR_BYTECODE_UNTERMINATED;
+        }
+
+        if (!iuab_bytecode_decode(program, offset, &instr)) {
+            return IUAB_ERROR_BYTECODE_INVALID_OP;
+        }
+
+        if (instr.size > size - offset) {
+            return IUAB_ERROR_BYTECODE_UNTERMINATED;
+        }
+
+        offset += instr.size;
+        enum iuab_error error =
+            iuab_bytecode_verify_instr(verifier, &instr, offset);
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
+    }
+
+    if (offset != size) {
+        return IUAB_ERROR_BYTECODE_UNTERMINATED;
+    }
+
+    return verifier->loops.size == 0 ? IUAB_ERROR_SUCCESS
+                                     : IUAB_ERROR_BYTECODE_INVALID_JUMP;
+}
+
+enum iuab_error iuab_bytecode_verify(const uint8_t *program, size_t size) {
+    // Programs start with the data pointer at the start of the memory.
+    struct iuab_bytecode_verifier verifier = {
+        .program_size = size,
+        .checked_min = 0,
+        .checked_max = IUAB_CONTEXT_MEMORY_SIZE - 1,
+    };
+    enum iuab_error error = iuab_buffer_init(&verifier.loops);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    error = iuab_bytecode_verifier_run(&verifier, program);
+    iuab_buffer_fini(&verifier.loops);
+    return error;
+}
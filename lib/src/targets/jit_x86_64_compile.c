@@ -4,12 +4,16 @@
 #include "iuab/buffer.h"
 #include "iuab/context.h"
 #include "iuab/errors.h"
-#include "iuab/lexer.h"
+#include "iuab/ir.h"
+#include "iuab/targets/jit_x86_64.h"
 #include "iuab/token.h"
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 // Transforms a 2-byte opcode into a big-endian list of bytes.
 #define IUAB_OP2_TO_BYTES(op2) (((op2) >> 8) & 0xFF), ((op2) &0xFF)
@@ -26,6 +30,10 @@
         (((dword) >> 40) & 0xFF), (((dword) >> 48) & 0xFF),             \
         (((dword) >> 56) & 0xFF)
 
+// The alignment of the start of the body of innermost loops, which are the
+// hottest code.
+#define IUAB_JIT_X86_64_LOOP_ALIGNMENT 16
+
 // REX prefixes.
 enum {
     IUAB_REX_W = 0x48,
@@ -33,48 +41,80 @@ enum {
     IUAB_REX_B = 0x41,
 };
 
+// Instruction prefixes.
+enum {
+    IUAB_PREFIX_OPERAND_SIZE = 0x66,
+    IUAB_PREFIX_REP = 0xF3,
+};
+
 // Instruction primary opcodes.
 enum {
     IUAB_OP_ADD_RM8_IMM8 = 0x80 /* /0 ib */,
+    IUAB_OP_ADD_RM8_R8 = 0x00 /* /r */,
+    IUAB_OP_ADD_RM64_IMM8 = /* REX.W */ 0x83 /* /0 ib */,
     IUAB_OP_ADD_RM64_IMM32 = /* REX.W */ 0x81 /* /0 id */,
     IUAB_OP_CALL_REL32 = 0xE8 /* cd */,
     IUAB_OP_CALL_RM64 = 0xFF /* /2 */,
     IUAB_OP_CMP_EAX_IMM32 = 0x3D /* id */,
     IUAB_OP_CMP_RAX_IMM32 = /* REX.W */ 0x3D /* id */,
     IUAB_OP_CMP_RM8_IMM8 = 0x80 /* /7 ib */,
+    IUAB_OP_CMP_RM64_IMM8 = /* REX.W */ 0x83 /* /7 ib */,
+    IUAB_OP_CMP_R64_RM64 = /* REX.W */ 0x3B /* /r */,
+    IUAB_OP_IMUL_R32_RM32_IMM8 = 0x6B /* /r ib */,
+    IUAB_OP_INC_RM64 = /* REX.W */ 0xFF /* /0 */,
+    IUAB_OP_JCC_REL8 = 0x70 /* +cc cb */,
+    IUAB_OP_JB_REL8 = 0x72 /* cb */,
+    IUAB_OP_JE_REL8 = 0x74 /* cb */,
+    IUAB_OP_JNE_REL8 = 0x75 /* cb */,
     IUAB_OP_JMP_REL8 = 0xEB /* cb */,
+    IUAB_OP_JMP_REL32 = 0xE9 /* cd */,
     IUAB_OP_JMP_RM64 = 0xFF /* /4 */,
+    IUAB_OP_LEA_R32_M = 0x8D /* /r */,
     IUAB_OP_LEA_R64_M = /* REX.W */ 0x8D /* /r */,
+    IUAB_OP_MOV_RM8_IMM8 = 0xC6 /* /0 ib */,
     IUAB_OP_MOV_RM8_R8 = 0x88 /* /r */,
     IUAB_OP_MOV_RM64_R64 = /* REX.W */ 0x89 /* /r */,
     IUAB_OP_MOV_R64_RM64 = /* REX.W */ 0x8B /* /r */,
+    IUAB_OP_MOV_R8_IMM8 = 0xB0 /* +rb ib */,
     IUAB_OP_MOV_R32_IMM32 = 0xB8 /* +rd id */,
     IUAB_OP_MOV_R64_IMM64 = /* REX.W */ 0xB8 /* +rq iq */,
+    IUAB_OP_MOVS_M8_M8 = 0xA4,
+    IUAB_OP_NOP = 0x90,
     IUAB_OP_POP_R64 = 0x58 /* +rq */,
     IUAB_OP_POP_RM64 = 0x8F /* /0 */,
     IUAB_OP_PUSH_R64 = 0x50 /* +rq */,
     IUAB_OP_RET_NEAR = 0xC3,
     IUAB_OP_SUB_RM8_IMM8 = 0x80 /* /5 ib */,
+    IUAB_OP_SUB_RM64_IMM8 = /* REX.W */ 0x83 /* /5 ib */,
     IUAB_OP_SUB_RM64_IMM32 = /* REX.W */ 0x81 /* /5 id */,
     IUAB_OP_SUB_RM64_R64 = /* REX.W */ 0x29 /* /r */,
+    IUAB_OP_TEST_RM8_R8 = 0x84 /* /r */,
+    IUAB_OP_TEST_RM32_R32 = 0x85 /* /r */,
+    IUAB_OP_TEST_RM64_R64 = /* REX.W */ 0x85 /* /r */,
     IUAB_OP_XOR_RM32_R32 = 0x31 /* /r */,
 
     IUAB_OP2_JAE_REL32 = 0x0F83 /* cd */,
     IUAB_OP2_JB_REL32 = 0x0F82 /* cd */,
     IUAB_OP2_JE_REL32 = 0x0F84 /* cd */,
-    IUAB_OP2_JNE_REL8 = 0x0F75 /* cb */,
     IUAB_OP2_JNE_REL32 = 0x0F85 /* cd */,
     IUAB_OP2_MOVZX_R32_RM8 = 0x0FB6 /* /r */,
+    IUAB_OP2_NOP_RM32 = 0x0F1F /* /0 */,
 };
 
 // Register IDs.
 enum {
     IUAB_REG_AL = 0x0,
+    IUAB_REG_CL = 0x1,
+    IUAB_REG_DL = 0x2,
 
     IUAB_REG_EAX = 0x0,
+    IUAB_REG_ECX = 0x1,
+    IUAB_REG_EDX = 0x2,
+    IUAB_REG_ESI = 0x6,
     IUAB_REG_EDI = 0x7,
 
     IUAB_REG_RAX = 0x0,
+    IUAB_REG_RCX = 0x1,
     IUAB_REG_RBX = 0x3,
     IUAB_REG_RSI = 0x6,
     IUAB_REG_RDI = 0x7,
@@ -88,6 +128,7 @@ enum {
 enum {
     IUAB_MODRM_MOD_DISP0 = 0x0 << 6,
     IUAB_MODRM_MOD_DISP8 = 0x1 << 6,
+    IUAB_MODRM_MOD_DISP32 = 0x2 << 6,
     IUAB_MODRM_MOD_DIRECT = 0x3 << 6,
 };
 
@@ -96,15 +137,24 @@ enum {
     IUAB_MODRM_REG_OP_ADD_RM_IMM = 0x0 << 3,
     IUAB_MODRM_REG_OP_CALL_RM = 0x2 << 3,
     IUAB_MODRM_REG_OP_CMP_RM_IMM = 0x7 << 3,
+    IUAB_MODRM_REG_OP_INC_RM = 0x0 << 3,
     IUAB_MODRM_REG_OP_SUB_RM_IMM = 0x5 << 3,
     IUAB_MODRM_REG_OP_JMP_RM = 0x4 << 3,
+    IUAB_MODRM_REG_OP_MOV_RM_IMM = 0x0 << 3,
+    IUAB_MODRM_REG_OP_NOP_RM = 0x0 << 3,
     IUAB_MODRM_REG_OP_POP_RM = 0x0 << 3,
 
     IUAB_MODRM_REG_AL = IUAB_REG_AL << 3,
+    IUAB_MODRM_REG_CL = IUAB_REG_CL << 3,
+    IUAB_MODRM_REG_DL = IUAB_REG_DL << 3,
 
     IUAB_MODRM_REG_EAX = IUAB_REG_EAX << 3,
+    IUAB_MODRM_REG_ECX = IUAB_REG_ECX << 3,
+    IUAB_MODRM_REG_EDX = IUAB_REG_EDX << 3,
     IUAB_MODRM_REG_EDI = IUAB_REG_EDI << 3,
 
+    IUAB_MODRM_REG_RAX = IUAB_REG_RAX << 3,
+    IUAB_MODRM_REG_RCX = IUAB_REG_RCX << 3,
     IUAB_MODRM_REG_RBX = IUAB_REG_RBX << 3,
     IUAB_MODRM_REG_RSI = IUAB_REG_RSI << 3,
     IUAB_MODRM_REG_RDI = IUAB_REG_RDI << 3,
@@ -114,19 +164,39 @@ enum {
 
 // ModR/M byte `rm` field values.
 enum {
+    IUAB_MODRM_RM_DL = IUAB_REG_DL,
+
     IUAB_MODRM_RM_EAX = IUAB_REG_EAX,
     IUAB_MODRM_RM_RAX = IUAB_REG_RAX,
     IUAB_MODRM_RM_RBX = IUAB_REG_RBX,
+    IUAB_MODRM_RM_RSI = IUAB_REG_RSI,
     IUAB_MODRM_RM_RDI = IUAB_REG_RDI,
     IUAB_MODRM_RM_R12 = IUAB_REG_R12,
     IUAB_MODRM_RM_R13 = IUAB_REG_R13,
     IUAB_MODRM_RM_R14 = IUAB_REG_R14,
+    IUAB_MODRM_RM_SIB = 0x4,
+    // With `IUAB_MODRM_MOD_DISP0`, a 32-bit displacement from the address of
+    // the next instruction.
+    IUAB_MODRM_RM_RIP = 0x5,
+};
+
+// SIB byte field values.
+enum {
+    IUAB_SIB_SCALE_2 = 0x1 << 6,
+    IUAB_SIB_SCALE_4 = 0x2 << 6,
+    IUAB_SIB_SCALE_8 = 0x3 << 6,
+
+    IUAB_SIB_INDEX_RAX = IUAB_REG_RAX << 3,
+
+    IUAB_SIB_BASE_RAX = IUAB_REG_RAX,
+    IUAB_SIB_BASE_RBX = IUAB_REG_RBX,
+    IUAB_SIB_BASE_NONE = 0x5,
 };
 
 enum iuab_jit_x86_64_jump_target {
     IUAB_JUMP_RET_ERROR_DP_OUT_OF_BOUNDS,
     IUAB_JUMP_RET_ERROR_IO,
-    IUAB_JUMP_HANDLE_FGETC_EOF,
+    IUAB_JUMP_RET_ERROR,
     IUAB_JUMP_CALL_DEBUG_HANDLER,
 
     IUAB_NUM_JUMP_TARGETS,
@@ -137,37 +207,142 @@ struct iuab_jit_x86_64_jump {
     enum iuab_jit_x86_64_jump_target to;
 };
 
+// Kinds of fixups of the emitted code, applied when laying it out.
+enum iuab_jit_x86_64_fixup_kind {
+    // A jump with a 32-bit displacement, shortened to one with an 8-bit
+    // displacement if it fits.
+    IUAB_FIXUP_JUMP,
+    // An 8-bit displacement.
+    IUAB_FIXUP_REL8,
+    // A 32-bit displacement.
+    IUAB_FIXUP_REL32,
+    // Padding aligning the following code to `IUAB_JIT_X86_64_LOOP_ALIGNMENT`
+    // bytes.
+    IUAB_FIXUP_ALIGN,
+};
+
+// A fixup at offset `at` of the emitted code: the end of a displacement, or
+// the start of the code to align.
+struct iuab_jit_x86_64_fixup {
+    size_t at;
+    enum iuab_jit_x86_64_fixup_kind kind;
+};
+
 struct iuab_jit_x86_64_compiler {
-    struct iuab_lexer lexer;
-    struct iuab_token token;
+    const struct iuab_ir *ir;
+    const struct iuab_ir_node *node;
+    const struct iuab_ir_node *end;
+    bool is_memory_guarded;
     struct iuab_buffer jumps;
+    // The fixups of the emitted code, in order of offset.
+    struct iuab_buffer fixups;
     struct iuab_buffer loop_stack;
+    // Whether the value pointed to by the data pointer is cached in `dl`, in
+    // which case whether it differs from the one in memory and whether the
+    // flags were set by its last change.
+    bool is_cell_cached;
+    bool is_cell_dirty;
+    bool are_flags_of_cell;
+    // Whether `rax` holds the size of the output buffer, left by the code of
+    // the last `IUAB_IR_OP_WRITE` node for that of the next one.
+    bool is_out_size_in_rax;
+    // The number of bytes and of instructions removed by peephole
+    // optimizations of the emitted code.
+    size_t saved_size;
+    size_t saved_instructions;
     struct iuab_buffer *dst;
 };
 
 static enum iuab_error iuab_jit_x86_64_compiler_init(
     struct iuab_jit_x86_64_compiler *compiler,
-    FILE *src,
+    const struct iuab_ir *ir,
+    bool is_memory_guarded,
     struct iuab_buffer *dst
 ) {
+    compiler->ir = ir;
+    compiler->node = NULL;
+    compiler->end = iuab_ir_nodes(ir) + iuab_ir_size(ir);
+    compiler->is_memory_guarded = is_memory_guarded;
+    compiler->is_cell_cached = false;
+    compiler->is_cell_dirty = false;
+    compiler->are_flags_of_cell = false;
+    compiler->is_out_size_in_rax = false;
+    compiler->saved_size = 0;
+    compiler->saved_instructions = 0;
     compiler->dst = dst;
-    iuab_lexer_init(&compiler->lexer, src);
-    compiler->token = iuab_lexer_next_token(&compiler->lexer);
     enum iuab_error error = iuab_buffer_init(&compiler->jumps);
 
     if (error != IUAB_ERROR_SUCCESS) {
         return error;
     }
 
-    return iuab_buffer_init(&compiler->loop_stack);
+    error = iuab_buffer_init(&compiler->fixups);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        iuab_buffer_fini(&compiler->jumps);
+        return error;
+    }
+
+    error = iuab_buffer_init(&compiler->loop_stack);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        iuab_buffer_fini(&compiler->jumps);
+        iuab_buffer_fini(&compiler->fixups);
+    }
+
+    return error;
 }
 
 static void
 iuab_jit_x86_64_compiler_fini(struct iuab_jit_x86_64_compiler *compiler) {
     iuab_buffer_fini(&compiler->jumps);
+    iuab_buffer_fini(&compiler->fixups);
     iuab_buffer_fini(&compiler->loop_stack);
 }
 
+// Counts `size` bytes and `instructions` instructions removed by a peephole
+// optimization of the emitted code.
+static void iuab_jit_x86_64_count_saved(
+    struct iuab_jit_x86_64_compiler *compiler,
+    size_t size,
+    size_t instructions
+) {
+    compiler->saved_size += size;
+    compiler->saved_instructions += instructions;
+}
+
+// Adds a fixup of the given kind at offset `at` of the emitted code, which
+// must not precede that of the last fixup added.
+static enum iuab_error iuab_jit_x86_64_add_fixup(
+    struct iuab_jit_x86_64_compiler *compiler,
+    size_t at,
+    enum iuab_jit_x86_64_fixup_kind kind
+) {
+    struct iuab_jit_x86_64_fixup fixup = { .at = at, .kind = kind };
+    return iuab_buffer_write(&compiler->fixups, &fixup, sizeof(fixup));
+}
+
+// Adds a jump to the given target of the footer, whose 32-bit displacement ends
+// at the end of the emitted code.
+static enum iuab_error iuab_jit_x86_64_add_jump(
+    struct iuab_jit_x86_64_compiler *compiler,
+    enum iuab_jit_x86_64_jump_target to,
+    enum iuab_jit_x86_64_fixup_kind kind
+) {
+    struct iuab_jit_x86_64_jump jump = {
+        .from = compiler->dst->size,
+        .to = to,
+    };
+    enum iuab_error error =
+        iuab_buffer_write(&compiler->jumps, &jump, sizeof(jump));
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    return iuab_jit_x86_64_add_fixup(compiler, jump.from, kind);
+}
+
 static enum iuab_error iuab_jit_x86_64_emit_header(struct iuab_buffer *dst) {
     uint8_t instrs[] = {
         // push rbx
@@ -188,26 +363,26 @@ static enum iuab_error iuab_jit_x86_64_emit_header(struct iuab_buffer *dst) {
         IUAB_REX_W,
         IUAB_OP_MOV_RM64_R64,
         IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_RDI | IUAB_MODRM_RM_RBX,
-        // mov r12, fgetc
+        // mov r12, iuab_context_read_input
         IUAB_REX_W | IUAB_REX_B,
         IUAB_OP_MOV_R64_IMM64 + IUAB_REG_R12,
-        IUAB_QWORD_TO_BYTES((int64_t) fgetc),
-        // mov r13, fputc
+        IUAB_QWORD_TO_BYTES((int64_t) iuab_context_read_input),
+        // mov r13, iuab_context_flush
         IUAB_REX_W | IUAB_REX_B,
         IUAB_OP_MOV_R64_IMM64 + IUAB_REG_R13,
-        IUAB_QWORD_TO_BYTES((int64_t) fputc),
+        IUAB_QWORD_TO_BYTES((int64_t) iuab_context_flush),
         // mov r14, QWORD PTR [rdi + offsetof(struct iuab_context, dp)]
         IUAB_REX_W | IUAB_REX_R,
         IUAB_OP_MOV_R64_RM64,
         IUAB_MODRM_MOD_DISP8 | IUAB_MODRM_REG_R14 | IUAB_MODRM_RM_RDI,
         offsetof(struct iuab_context, dp),
-        // lea r15, QWORD PTR [rdi + offsetof(struct iuab_context, memory)]
+        // mov r15, QWORD PTR [rdi + offsetof(struct iuab_context, memory)]
         IUAB_REX_W | IUAB_REX_R,
-        IUAB_OP_LEA_R64_M,
+        IUAB_OP_MOV_R64_RM64,
         IUAB_MODRM_MOD_DISP8 | IUAB_MODRM_REG_R15 | IUAB_MODRM_RM_RDI,
         offsetof(struct iuab_context, memory),
     };
-    return IUAB_BUFFER_WRITE_JIT(dst, instrs);
+    return IUAB_BUFFER_WRITE(dst, instrs);
 }
 
 static enum iuab_error
@@ -250,7 +425,7 @@ static enum iuab_error iuab_jit_x86_64_emit_ret_error_dp_out_of_bounds(
         IUAB_OP_JMP_REL8,
         0,
     };
-    enum iuab_error error = IUAB_BUFFER_WRITE_JIT(dst, instrs);
+    enum iuab_error error = IUAB_BUFFER_WRITE(dst, instrs);
 
     if (error != IUAB_ERROR_SUCCESS) {
         return error;
@@ -269,7 +444,7 @@ iuab_jit_x86_64_emit_ret_error_io(size_t exit_offset, struct iuab_buffer *dst) {
         IUAB_OP_JMP_REL8,
         0,
     };
-    enum iuab_error error = IUAB_BUFFER_WRITE_JIT(dst, instrs);
+    enum iuab_error error = IUAB_BUFFER_WRITE(dst, instrs);
 
     if (error != IUAB_ERROR_SUCCESS) {
         return error;
@@ -278,54 +453,15 @@ iuab_jit_x86_64_emit_ret_error_io(size_t exit_offset, struct iuab_buffer *dst) {
     return iuab_jit_x86_64_set_rel8(dst, dst->size, exit_offset);
 }
 
-static enum iuab_error iuab_jit_x86_64_emit_handle_fgetc_error(
-    size_t exit_offset,
-    struct iuab_buffer *dst
-) {
-    uint8_t ret_error_io_if_ferror[] = {
-        // mov rdi, QWORD PTR [rbx + offsetof(struct iuab_context, in)]
-        IUAB_REX_W,
-        IUAB_OP_MOV_R64_RM64,
-        IUAB_MODRM_MOD_DISP8 | IUAB_MODRM_REG_RDI | IUAB_MODRM_RM_RBX,
-        offsetof(struct iuab_context, in),
-        // mov rax, ferror
-        IUAB_REX_W,
-        IUAB_OP_MOV_R64_IMM64 + IUAB_REG_EAX,
-        IUAB_QWORD_TO_BYTES((int64_t) ferror),
-        // call rax
-        IUAB_OP_CALL_RM64,
-        IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_OP_CALL_RM | IUAB_MODRM_RM_RAX,
-        // cmp eax, 0
-        IUAB_OP_CMP_EAX_IMM32,
-        IUAB_DWORD_TO_BYTES(0),
-        // mov eax, IUAB_ERROR_IO
-        IUAB_OP_MOV_R32_IMM32 + IUAB_REG_EAX,
-        IUAB_DWORD_TO_BYTES(IUAB_ERROR_IO),
-        // jne .exit ; Offset written later.
-        IUAB_OP2_TO_BYTES(IUAB_OP2_JNE_REL8),
-        0,
-    };
-    enum iuab_error error = IUAB_BUFFER_WRITE_JIT(dst, ret_error_io_if_ferror);
-
-    if (error != IUAB_ERROR_SUCCESS) {
-        return error;
-    }
-
-    error = iuab_jit_x86_64_set_rel8(dst, dst->size, exit_offset);
-
-    if (error != IUAB_ERROR_SUCCESS) {
-        return error;
-    }
-
-    uint8_t ret_error_runtime_end_of_input_file[] = {
-        // mov eax, IUAB_ERROR_RUNTIME_END_OF_INPUT_FILE
-        IUAB_OP_MOV_R32_IMM32 + IUAB_REG_EAX,
-        IUAB_DWORD_TO_BYTES(IUAB_ERROR_RUNTIME_END_OF_INPUT_FILE),
-        // jmp .exit
+// Emits the return of the error in `eax`.
+static enum iuab_error
+iuab_jit_x86_64_emit_ret_error(size_t exit_offset, struct iuab_buffer *dst) {
+    uint8_t instr[] = {
+        // jmp .exit ; Offset written later.
         IUAB_OP_JMP_REL8,
         0,
     };
-    error = IUAB_BUFFER_WRITE_JIT(dst, ret_error_runtime_end_of_input_file);
+    enum iuab_error error = IUAB_BUFFER_WRITE(dst, instr);
 
     if (error != IUAB_ERROR_SUCCESS) {
         return error;
@@ -334,9 +470,11 @@ static enum iuab_error iuab_jit_x86_64_emit_handle_fgetc_error(
     return iuab_jit_x86_64_set_rel8(dst, dst->size, exit_offset);
 }
 
-static enum iuab_error
-iuab_jit_x86_64_emit_call_debug_handler(struct iuab_buffer *dst) {
-    uint8_t instrs[] = {
+static enum iuab_error iuab_jit_x86_64_emit_call_debug_handler(
+    size_t exit_offset,
+    struct iuab_buffer *dst
+) {
+    uint8_t flush[] = {
         // pop QWORD PTR [rbx]
         IUAB_REX_W,
         IUAB_OP_POP_RM64,
@@ -346,6 +484,34 @@ iuab_jit_x86_64_emit_call_debug_handler(struct iuab_buffer *dst) {
         IUAB_OP_MOV_RM64_R64,
         IUAB_MODRM_MOD_DISP8 | IUAB_MODRM_REG_R14 | IUAB_MODRM_RM_RBX,
         offsetof(struct iuab_context, dp),
+        // mov rdi, rbx
+        IUAB_REX_W,
+        IUAB_OP_MOV_RM64_R64,
+        IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_RBX | IUAB_MODRM_RM_RDI,
+        // call r13
+        IUAB_REX_B,
+        IUAB_OP_CALL_RM64,
+        IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_OP_CALL_RM | IUAB_MODRM_RM_R13,
+        // test eax, eax
+        IUAB_OP_TEST_RM32_R32,
+        IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_EAX | IUAB_MODRM_RM_EAX,
+        // jne .exit ; Offset written later.
+        IUAB_OP_JNE_REL8,
+        0,
+    };
+    enum iuab_error error = IUAB_BUFFER_WRITE(dst, flush);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    error = iuab_jit_x86_64_set_rel8(dst, dst->size, exit_offset);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    uint8_t call_debug_handler[] = {
         // mov rdi, rbx
         IUAB_REX_W,
         IUAB_OP_MOV_RM64_R64,
@@ -363,7 +529,7 @@ iuab_jit_x86_64_emit_call_debug_handler(struct iuab_buffer *dst) {
         IUAB_OP_JMP_RM64,
         IUAB_MODRM_MOD_DISP0 | IUAB_MODRM_REG_OP_JMP_RM | IUAB_MODRM_RM_RBX,
     };
-    return IUAB_BUFFER_WRITE_JIT(dst, instrs);
+    return IUAB_BUFFER_WRITE(dst, call_debug_handler);
 }
 
 static enum iuab_error iuab_jit_x86_64_emit_jump_target(
@@ -379,10 +545,10 @@ static enum iuab_error iuab_jit_x86_64_emit_jump_target(
         );
     case IUAB_JUMP_RET_ERROR_IO:
         return iuab_jit_x86_64_emit_ret_error_io(exit_offset, dst);
-    case IUAB_JUMP_HANDLE_FGETC_EOF:
-        return iuab_jit_x86_64_emit_handle_fgetc_error(exit_offset, dst);
+    case IUAB_JUMP_RET_ERROR:
+        return iuab_jit_x86_64_emit_ret_error(exit_offset, dst);
     case IUAB_JUMP_CALL_DEBUG_HANDLER:
-        return iuab_jit_x86_64_emit_call_debug_handler(dst);
+        return iuab_jit_x86_64_emit_call_debug_handler(exit_offset, dst);
     default: return IUAB_ERROR_COMPILER_INTERNAL;
     }
 }
@@ -396,7 +562,7 @@ static enum iuab_error iuab_jit_x86_64_emit_footer(
         IUAB_OP_XOR_RM32_R32,
         IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_EAX | IUAB_MODRM_RM_EAX,
     };
-    enum iuab_error error = IUAB_BUFFER_WRITE_JIT(dst, set_error_success);
+    enum iuab_error error = IUAB_BUFFER_WRITE(dst, set_error_success);
 
     if (error != IUAB_ERROR_SUCCESS) {
         return error;
@@ -404,6 +570,11 @@ static enum iuab_error iuab_jit_x86_64_emit_footer(
 
     size_t exit_offset = dst->size;
     uint8_t exit[] = {
+        // mov QWORD PTR [rbx + offsetof(struct iuab_context, dp)], r14
+        IUAB_REX_W | IUAB_REX_R,
+        IUAB_OP_MOV_RM64_R64,
+        IUAB_MODRM_MOD_DISP8 | IUAB_MODRM_REG_R14 | IUAB_MODRM_RM_RBX,
+        offsetof(struct iuab_context, dp),
         // pop r15
         IUAB_REX_B,
         IUAB_OP_POP_R64 + IUAB_REG_R15,
@@ -421,7 +592,7 @@ static enum iuab_error iuab_jit_x86_64_emit_footer(
         // ret
         IUAB_OP_RET_NEAR,
     };
-    error = IUAB_BUFFER_WRITE_JIT(dst, exit);
+    error = IUAB_BUFFER_WRITE(dst, exit);
 
     if (error != IUAB_ERROR_SUCCESS) {
         return error;
@@ -453,47 +624,309 @@ static enum iuab_error iuab_jit_x86_64_emit_footer(
     return IUAB_ERROR_SUCCESS;
 }
 
+// Emits code adding `value` to the data pointer, with an 8-bit immediate
+// operand if it fits.
+static enum iuab_error iuab_jit_x86_64_emit_add_r14(
+    struct iuab_jit_x86_64_compiler *compiler,
+    int32_t value
+) {
+    uint8_t modrm_reg = value < 0 ? IUAB_MODRM_REG_OP_SUB_RM_IMM
+                                  : IUAB_MODRM_REG_OP_ADD_RM_IMM;
+    int32_t operand = value < 0 ? -value : value;
+
+    if (operand > INT8_MAX) {
+        uint8_t instr[] = {
+            // (add|sub) r14, operand
+            IUAB_REX_W | IUAB_REX_B,
+            value < 0 ? IUAB_OP_SUB_RM64_IMM32 : IUAB_OP_ADD_RM64_IMM32,
+            IUAB_MODRM_MOD_DIRECT | modrm_reg | IUAB_MODRM_RM_R14,
+            IUAB_DWORD_TO_BYTES(operand),
+        };
+        return IUAB_BUFFER_WRITE(compiler->dst, instr);
+    }
+
+    uint8_t instr[] = {
+        // (add|sub) r14, operand
+        IUAB_REX_W | IUAB_REX_B,
+        value < 0 ? IUAB_OP_SUB_RM64_IMM8 : IUAB_OP_ADD_RM64_IMM8,
+        IUAB_MODRM_MOD_DIRECT | modrm_reg | IUAB_MODRM_RM_R14,
+        (uint8_t) operand,
+    };
+    return IUAB_BUFFER_WRITE(compiler->dst, instr);
+}
+
+// Emits code comparing `rax` with `imm`, with an 8-bit immediate operand if it
+// fits.
+static enum iuab_error iuab_jit_x86_64_emit_cmp_rax(
+    struct iuab_jit_x86_64_compiler *compiler,
+    int32_t imm
+) {
+    if (imm < INT8_MIN || imm > INT8_MAX) {
+        uint8_t instr[] = {
+            // cmp rax, imm
+            IUAB_REX_W,
+            IUAB_OP_CMP_RAX_IMM32,
+            IUAB_DWORD_TO_BYTES(imm),
+        };
+        return IUAB_BUFFER_WRITE(compiler->dst, instr);
+    }
+
+    uint8_t instr[] = {
+        // cmp rax, imm
+        IUAB_REX_W,
+        IUAB_OP_CMP_RM64_IMM8,
+        IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_OP_CMP_RM_IMM
+            | IUAB_MODRM_RM_RAX,
+        (uint8_t) imm,
+    };
+    return IUAB_BUFFER_WRITE(compiler->dst, instr);
+}
+
+static enum iuab_error
+iuab_jit_x86_64_emit_move_unchecked(struct iuab_jit_x86_64_compiler *compiler
+) {
+    return iuab_jit_x86_64_emit_add_r14(compiler, compiler->node->value);
+}
+
+// Encodes at `dst` the ModR/M byte with the given `reg` field and the
+// displacement of the memory operand `[r14 + offset]`, with the shortest
+// displacement. Returns the number of bytes written.
+static size_t iuab_jit_x86_64_encode_r14_operand(
+    uint8_t *dst,
+    uint8_t modrm_reg,
+    int32_t offset
+) {
+    if (offset == 0) {
+        dst[0] = IUAB_MODRM_MOD_DISP0 | modrm_reg | IUAB_MODRM_RM_R14;
+        return 1;
+    }
+
+    if (offset >= INT8_MIN && offset <= INT8_MAX) {
+        dst[0] = IUAB_MODRM_MOD_DISP8 | modrm_reg | IUAB_MODRM_RM_R14;
+        dst[1] = (uint8_t) offset;
+        return 2;
+    }
+
+    uint8_t disp32[] = { IUAB_DWORD_TO_BYTES(offset) };
+    dst[0] = IUAB_MODRM_MOD_DISP32 | modrm_reg | IUAB_MODRM_RM_R14;
+    memcpy(&dst[1], disp32, sizeof(disp32));
+    return 1 + sizeof(disp32);
+}
+
+// Emits an instruction with a memory operand `BYTE PTR [r14 + offset]` and an
+// 8-bit immediate operand.
+static enum iuab_error iuab_jit_x86_64_emit_r14_imm8(
+    struct iuab_buffer *dst,
+    uint8_t op,
+    uint8_t modrm_reg,
+    int32_t offset,
+    uint8_t imm8
+) {
+    // REX prefix, opcode, ModR/M byte, 32-bit displacement and immediate.
+    uint8_t instr[1 + 1 + 1 + 4 + 1] = { IUAB_REX_B, op };
+    size_t size = 2;
+    size += iuab_jit_x86_64_encode_r14_operand(&instr[size], modrm_reg, offset);
+    instr[size++] = imm8;
+    return iuab_buffer_write(dst, instr, size);
+}
+
+// Emits an instruction with the given REX prefix and opcode and a memory
+// operand `[r14 + offset]`, with the shortest displacement.
+static enum iuab_error iuab_jit_x86_64_emit_r14(
+    struct iuab_buffer *dst,
+    uint8_t rex,
+    uint8_t op,
+    uint8_t modrm_reg,
+    int32_t offset
+) {
+    // REX prefix, opcode, ModR/M byte and 32-bit displacement.
+    uint8_t instr[1 + 1 + 1 + 4] = { rex, op };
+    size_t size = 2;
+    size += iuab_jit_x86_64_encode_r14_operand(&instr[size], modrm_reg, offset);
+    return iuab_buffer_write(dst, instr, size);
+}
+
+// Emits code caching the value pointed to by the data pointer in `dl`, unless
+// it already is.
+static enum iuab_error
+iuab_jit_x86_64_load_cell(struct iuab_jit_x86_64_compiler *compiler) {
+    if (compiler->is_cell_cached) {
+        return IUAB_ERROR_SUCCESS;
+    }
+
+    uint8_t instr[] = {
+        // movzx edx, BYTE PTR [r14]
+        IUAB_REX_B,
+        IUAB_OP2_TO_BYTES(IUAB_OP2_MOVZX_R32_RM8),
+        IUAB_MODRM_MOD_DISP0 | IUAB_MODRM_REG_EDX | IUAB_MODRM_RM_R14,
+    };
+    compiler->is_cell_cached = true;
+    compiler->are_flags_of_cell = false;
+    return IUAB_BUFFER_WRITE(compiler->dst, instr);
+}
+
+// Emits code writing the value pointed to by the data pointer back to memory
+// if its cached value differs, keeping it cached. The flags are preserved.
+static enum iuab_error
+iuab_jit_x86_64_write_back_cell(struct iuab_jit_x86_64_compiler *compiler) {
+    if (!compiler->is_cell_dirty) {
+        return IUAB_ERROR_SUCCESS;
+    }
+
+    uint8_t instr[] = {
+        // mov BYTE PTR [r14], dl
+        IUAB_REX_B,
+        IUAB_OP_MOV_RM8_R8,
+        IUAB_MODRM_MOD_DISP0 | IUAB_MODRM_REG_DL | IUAB_MODRM_RM_R14,
+    };
+    compiler->is_cell_dirty = false;
+    return IUAB_BUFFER_WRITE(compiler->dst, instr);
+}
+
+// Emits code writing the value pointed to by the data pointer back to memory,
+// then stops caching it, before code moving the data pointer, calling
+// functions, or reached by jumps.
 static enum iuab_error
-iuab_jit_x86_64_emit_additive_p(struct iuab_jit_x86_64_compiler *compiler) {
-    struct iuab_lexer *lexer = &compiler->lexer;
-    enum iuab_token_type token_type = compiler->token.type;
+iuab_jit_x86_64_evict_cell(struct iuab_jit_x86_64_compiler *compiler) {
+    enum iuab_error error = iuab_jit_x86_64_write_back_cell(compiler);
+    compiler->is_cell_cached = false;
+    return error;
+}
+
+// Emits code setting the flags from the value pointed to by the data pointer,
+// unless they already are, before a jump depending on whether it is zero. The
+// value is evicted if `is_evicted` is true.
+static enum iuab_error iuab_jit_x86_64_emit_cell_test(
+    struct iuab_jit_x86_64_compiler *compiler,
+    bool is_evicted
+) {
+    if (!compiler->is_cell_cached) {
+        // cmp BYTE PTR [r14], 0
+        return iuab_jit_x86_64_emit_r14_imm8(
+            compiler->dst,
+            IUAB_OP_CMP_RM8_IMM8,
+            IUAB_MODRM_REG_OP_CMP_RM_IMM,
+            0,
+            0
+        );
+    }
+
+    if (!compiler->are_flags_of_cell) {
+        uint8_t instr[] = {
+            // test dl, dl
+            IUAB_OP_TEST_RM8_R8,
+            IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_DL | IUAB_MODRM_RM_DL,
+        };
+        enum iuab_error error = IUAB_BUFFER_WRITE(compiler->dst, instr);
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
+    }
 
-    uint16_t operand = 1;
-    struct iuab_token next_token;
+    return is_evicted ? iuab_jit_x86_64_evict_cell(compiler)
+                      : IUAB_ERROR_SUCCESS;
+}
 
-    while ((next_token = iuab_lexer_next_token(lexer)).type == token_type) {
-        if (operand == UINT16_MAX) {
-            compiler->token = next_token;
-            return IUAB_ERROR_DP_OUT_OF_BOUNDS;
+// Returns true if the code of the nodes following the current one accesses the
+// value at `offset` from the data pointer before moving it or doing I/O, so
+// that an access out of the bounds of guarded memory faults before any effect
+// visible outside of the memory.
+static bool iuab_jit_x86_64_is_accessed(
+    const struct iuab_jit_x86_64_compiler *compiler,
+    int32_t offset
+) {
+    for (const struct iuab_ir_node *node = compiler->node + 1;
+         node != compiler->end;
+         node++) {
+        switch (node->op) {
+        case IUAB_IR_OP_ADD:
+            if (node->offset == offset) {
+                return true;
+            }
+
+            break;
+        // The value pointed to by the data pointer is only set in `dl`.
+        case IUAB_IR_OP_SET:
+            if (node->offset == offset) {
+                return offset != 0;
+            }
+
+            break;
+        case IUAB_IR_OP_MULADD:
+            if (node->value != 0 && (offset == 0 || node->offset == offset)) {
+                return true;
+            }
+
+            break;
+        // The code of these nodes starts by reading the value pointed to by
+        // the data pointer.
+        case IUAB_IR_OP_SCAN:
+        case IUAB_IR_OP_WRITE:
+        case IUAB_IR_OP_LOOP: return offset == 0;
+        default: return false;
         }
+    }
+
+    return false;
+}
+
+// Emits code reading the value at `offset` from the data pointer if no
+// following code accesses it, so that it faults if it is out of the bounds of
+// guarded memory.
+static enum iuab_error iuab_jit_x86_64_emit_guard_probe(
+    struct iuab_jit_x86_64_compiler *compiler,
+    int32_t offset
+) {
+    if (iuab_jit_x86_64_is_accessed(compiler, offset)) {
+        return IUAB_ERROR_SUCCESS;
+    }
+
+    // cmp BYTE PTR [r14 + offset], 0
+    return iuab_jit_x86_64_emit_r14_imm8(
+        compiler->dst,
+        IUAB_OP_CMP_RM8_IMM8,
+        IUAB_MODRM_REG_OP_CMP_RM_IMM,
+        offset,
+        0
+    );
+}
+
+// Emits code moving the data pointer then probing its new value, for guarded
+// memory. The data pointer was within bounds and the guard regions are larger
+// than the largest movement, so a new value out of bounds is in a guard region.
+static enum iuab_error
+iuab_jit_x86_64_emit_guarded_move(struct iuab_jit_x86_64_compiler *compiler) {
+    enum iuab_error error = iuab_jit_x86_64_emit_move_unchecked(compiler);
 
-        operand++;
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    return iuab_jit_x86_64_emit_guard_probe(compiler, 0);
+}
+
+static enum iuab_error
+iuab_jit_x86_64_emit_move(struct iuab_jit_x86_64_compiler *compiler) {
+    if (compiler->is_memory_guarded) {
+        return iuab_jit_x86_64_emit_guarded_move(compiler);
     }
 
+    int32_t value = compiler->node->value;
+    uint16_t operand = (uint16_t) (value < 0 ? -value : value);
+
     uint16_t jcc_op;
-    uint8_t op;
-    uint8_t modrm_reg;
     int32_t cmp_bound;
 
-    switch (token_type) {
-    case IUAB_TOKEN_I:
+    if (value > 0) {
         jcc_op = IUAB_OP2_JAE_REL32;
-        op = IUAB_OP_ADD_RM64_IMM32;
-        modrm_reg = IUAB_MODRM_REG_OP_ADD_RM_IMM;
         cmp_bound = IUAB_CONTEXT_MEMORY_SIZE - operand;
-        break;
-    case IUAB_TOKEN_USE:
+    } else {
         jcc_op = IUAB_OP2_JB_REL32;
-        op = IUAB_OP_SUB_RM64_IMM32;
-        modrm_reg = IUAB_MODRM_REG_OP_SUB_RM_IMM;
         cmp_bound = operand;
-        break;
-    default: return IUAB_ERROR_COMPILER_INTERNAL;
     }
 
-    compiler->token = next_token;
-
-    uint8_t bounds_check[] = {
+    uint8_t dp_offset[] = {
         // mov rax, r14
         IUAB_REX_W | IUAB_REX_R,
         IUAB_OP_MOV_RM64_R64,
@@ -502,186 +935,898 @@ iuab_jit_x86_64_emit_additive_p(struct iuab_jit_x86_64_compiler *compiler) {
         IUAB_REX_W | IUAB_REX_R,
         IUAB_OP_SUB_RM64_R64,
         IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_R15 | IUAB_MODRM_RM_RAX,
+    };
+    enum iuab_error error = IUAB_BUFFER_WRITE(compiler->dst, dp_offset);
+
+    if (error == IUAB_ERROR_SUCCESS) {
         // cmp rax, cmp_bound
-        IUAB_REX_W,
-        IUAB_OP_CMP_RAX_IMM32,
-        IUAB_DWORD_TO_BYTES(cmp_bound),
+        error = iuab_jit_x86_64_emit_cmp_rax(compiler, cmp_bound);
+    }
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    uint8_t jcc[] = {
         // (jae|jb) .ret_dp_out_of_bounds ; Offset written later.
         IUAB_OP2_TO_BYTES(jcc_op),
         IUAB_DWORD_TO_BYTES(0),
     };
-    enum iuab_error error = IUAB_BUFFER_WRITE_JIT(compiler->dst, bounds_check);
+    error = IUAB_BUFFER_WRITE(compiler->dst, jcc);
 
     if (error != IUAB_ERROR_SUCCESS) {
         return error;
     }
 
-    struct iuab_jit_x86_64_jump jump_on_error = {
-        .from = compiler->dst->size,
-        .to = IUAB_JUMP_RET_ERROR_DP_OUT_OF_BOUNDS,
-    };
-    error = iuab_buffer_write(
-        &compiler->jumps,
-        &jump_on_error,
-        sizeof(jump_on_error)
+    error = iuab_jit_x86_64_add_jump(
+        compiler,
+        IUAB_JUMP_RET_ERROR_DP_OUT_OF_BOUNDS,
+        IUAB_FIXUP_JUMP
     );
 
     if (error != IUAB_ERROR_SUCCESS) {
         return error;
     }
 
-    uint8_t instr[] = {
-        // (add|sub) r14, operand
-        IUAB_REX_W | IUAB_REX_B,
-        op,
-        IUAB_MODRM_MOD_DIRECT | modrm_reg | IUAB_MODRM_RM_R14,
-        IUAB_DWORD_TO_BYTES(operand),
-    };
-    return IUAB_BUFFER_WRITE_JIT(compiler->dst, instr);
+    return iuab_jit_x86_64_emit_add_r14(compiler, value);
 }
 
 static enum iuab_error
-iuab_jit_x86_64_emit_additive_v(struct iuab_jit_x86_64_compiler *compiler) {
-    enum iuab_token_type token_type = compiler->token.type;
-    struct iuab_lexer *lexer = &compiler->lexer;
+iuab_jit_x86_64_emit_add(struct iuab_jit_x86_64_compiler *compiler) {
+    int32_t offset = compiler->node->offset;
+    int32_t value = compiler->node->value;
+    uint8_t operand = (uint8_t) (value < 0 ? -value : value);
 
     uint8_t op;
     uint8_t modrm_reg;
 
-    switch (token_type) {
-    case IUAB_TOKEN_ARCH:
+    if (value > 0) {
         op = IUAB_OP_ADD_RM8_IMM8;
         modrm_reg = IUAB_MODRM_REG_OP_ADD_RM_IMM;
-        break;
-    case IUAB_TOKEN_LINUX:
+    } else {
         op = IUAB_OP_SUB_RM8_IMM8;
         modrm_reg = IUAB_MODRM_REG_OP_SUB_RM_IMM;
-        break;
-    default: return IUAB_ERROR_COMPILER_INTERNAL;
     }
 
-    uint8_t operand = 1;
-    struct iuab_token next_token;
-
-    while ((next_token = iuab_lexer_next_token(lexer)).type == token_type) {
-        operand++;
+    if (offset != 0) {
+        compiler->are_flags_of_cell = false;
+        // (add|sub) BYTE PTR [r14 + offset], operand
+        return iuab_jit_x86_64_emit_r14_imm8(
+            compiler->dst,
+            op,
+            modrm_reg,
+            offset,
+            operand
+        );
     }
 
-    compiler->token = next_token;
+    enum iuab_error error = iuab_jit_x86_64_load_cell(compiler);
 
-    if (operand == 0) {
-        return IUAB_ERROR_SUCCESS;
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
     }
 
     uint8_t instr[] = {
-        // (add|sub) BYTE PTR [r14], operand
-        IUAB_REX_B,
+        // (add|sub) dl, operand
         op,
-        IUAB_MODRM_MOD_DISP0 | modrm_reg | IUAB_MODRM_RM_R14,
+        IUAB_MODRM_MOD_DIRECT | modrm_reg | IUAB_MODRM_RM_DL,
         operand,
     };
-    return IUAB_BUFFER_WRITE_JIT(compiler->dst, instr);
+    compiler->is_cell_dirty = true;
+    compiler->are_flags_of_cell = true;
+    return IUAB_BUFFER_WRITE(compiler->dst, instr);
 }
 
 static enum iuab_error
-iuab_jit_x86_64_emit_write(struct iuab_jit_x86_64_compiler *compiler) {
-    uint8_t instrs[] = {
-        // movzx edi, BYTE PTR [r14]
-        IUAB_REX_B,
-        IUAB_OP2_TO_BYTES(IUAB_OP2_MOVZX_R32_RM8),
-        IUAB_MODRM_MOD_DISP0 | IUAB_MODRM_REG_EDI | IUAB_MODRM_RM_R14,
-        // mov rsi, QWORD PTR [rbx + offsetof(struct iuab_context, out)]
-        IUAB_REX_W,
-        IUAB_OP_MOV_R64_RM64,
-        IUAB_MODRM_MOD_DISP8 | IUAB_MODRM_REG_RSI | IUAB_MODRM_RM_RBX,
-        offsetof(struct iuab_context, out),
-        // call r13
-        IUAB_REX_B,
-        IUAB_OP_CALL_RM64,
-        IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_OP_CALL_RM | IUAB_MODRM_RM_R13,
-        // cmp eax, -1
-        IUAB_OP_CMP_EAX_IMM32,
-        IUAB_DWORD_TO_BYTES((int32_t) -1),
-        // je .ret_error_io ; Offset written later.
-        IUAB_OP2_TO_BYTES(IUAB_OP2_JE_REL32),
-        IUAB_DWORD_TO_BYTES(0),
-    };
-    enum iuab_error error = IUAB_BUFFER_WRITE_JIT(compiler->dst, instrs);
-
-    if (error != IUAB_ERROR_SUCCESS) {
-        return error;
+iuab_jit_x86_64_emit_set(struct iuab_jit_x86_64_compiler *compiler) {
+    if (compiler->node->offset == 0) {
+        uint8_t instr[] = {
+            // mov dl, value
+            IUAB_OP_MOV_R8_IMM8 + IUAB_REG_DL,
+            (uint8_t) compiler->node->value,
+        };
+        compiler->is_cell_cached = true;
+        compiler->is_cell_dirty = true;
+        compiler->are_flags_of_cell = false;
+        return IUAB_BUFFER_WRITE(compiler->dst, instr);
     }
 
-    struct iuab_jit_x86_64_jump jump = {
-        .from = compiler->dst->size,
-        .to = IUAB_JUMP_RET_ERROR_IO,
+    // mov BYTE PTR [r14 + offset], value
+    return iuab_jit_x86_64_emit_r14_imm8(
+        compiler->dst,
+        IUAB_OP_MOV_RM8_IMM8,
+        IUAB_MODRM_REG_OP_MOV_RM_IMM,
+        compiler->node->offset,
+        (uint8_t) compiler->node->value
+    );
+}
+
+// Emits code returning an error if the values from `min` to `max` from the data
+// pointer are not all within the bounds of the memory.
+static enum iuab_error iuab_jit_x86_64_emit_bounds_check(
+    struct iuab_jit_x86_64_compiler *compiler,
+    int32_t min,
+    int32_t max
+) {
+    int32_t cmp_bound = IUAB_CONTEXT_MEMORY_SIZE - (max - min);
+    // lea rax, [r14 + min]
+    enum iuab_error error = iuab_jit_x86_64_emit_r14(
+        compiler->dst,
+        IUAB_REX_W | IUAB_REX_B,
+        IUAB_OP_LEA_R64_M,
+        IUAB_MODRM_REG_RAX,
+        min
+    );
+
+    uint8_t dp_offset[] = {
+        // sub rax, r15
+        IUAB_REX_W | IUAB_REX_R,
+        IUAB_OP_SUB_RM64_R64,
+        IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_R15 | IUAB_MODRM_RM_RAX,
+    };
+
+    if (error == IUAB_ERROR_SUCCESS) {
+        error = IUAB_BUFFER_WRITE(compiler->dst, dp_offset);
+    }
+
+    if (error == IUAB_ERROR_SUCCESS) {
+        // cmp rax, cmp_bound
+        error = iuab_jit_x86_64_emit_cmp_rax(compiler, cmp_bound);
+    }
+
+    uint8_t jcc[] = {
+        // jae .ret_dp_out_of_bounds ; Offset written later.
+        IUAB_OP2_TO_BYTES(IUAB_OP2_JAE_REL32),
+        IUAB_DWORD_TO_BYTES(0),
+    };
+
+    if (error == IUAB_ERROR_SUCCESS) {
+        error = IUAB_BUFFER_WRITE(compiler->dst, jcc);
+    }
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    return iuab_jit_x86_64_add_jump(
+        compiler,
+        IUAB_JUMP_RET_ERROR_DP_OUT_OF_BOUNDS,
+        IUAB_FIXUP_JUMP
+    );
+}
+
+// Emits code checking the range of offsets of a `IUAB_IR_OP_CHECK` node. With
+// guarded memory, only the lowest and highest offsets need to be probed, as
+// the range always contains the value pointed to by the data pointer.
+static enum iuab_error
+iuab_jit_x86_64_emit_check(struct iuab_jit_x86_64_compiler *compiler) {
+    int32_t min = compiler->node->offset;
+    int32_t max = compiler->node->value;
+    // The memory is up to date when the check fails.
+    enum iuab_error error = iuab_jit_x86_64_write_back_cell(compiler);
+    compiler->are_flags_of_cell = false;
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    if (!compiler->is_memory_guarded) {
+        return iuab_jit_x86_64_emit_bounds_check(compiler, min, max);
+    }
+
+    if (min != 0) {
+        error = iuab_jit_x86_64_emit_guard_probe(compiler, min);
+    }
+
+    if (error == IUAB_ERROR_SUCCESS && max != 0) {
+        error = iuab_jit_x86_64_emit_guard_probe(compiler, max);
+    }
+
+    return error;
+}
+
+// Emits code multiplying `eax` by the given factor, using `lea` for the factors
+// it can encode and `imul` for the others.
+static enum iuab_error
+iuab_jit_x86_64_emit_mul_eax(struct iuab_buffer *dst, uint8_t factor) {
+    uint8_t scale;
+
+    switch (factor) {
+    case 1: return IUAB_ERROR_SUCCESS;
+    case 2:
+    case 3: scale = IUAB_SIB_SCALE_2; break;
+    case 4:
+    case 5: scale = IUAB_SIB_SCALE_4; break;
+    case 8:
+    case 9: scale = IUAB_SIB_SCALE_8; break;
+    default: {
+        uint8_t instr[] = {
+            // imul eax, eax, factor
+            IUAB_OP_IMUL_R32_RM32_IMM8,
+            IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_EAX | IUAB_MODRM_RM_EAX,
+            factor,
+        };
+        return IUAB_BUFFER_WRITE(dst, instr);
+    }
+    }
+
+    if (factor % 2 == 0) {
+        uint8_t instr[] = {
+            // lea eax, [rax * scale]
+            IUAB_OP_LEA_R32_M,
+            IUAB_MODRM_MOD_DISP0 | IUAB_MODRM_REG_EAX | IUAB_MODRM_RM_SIB,
+            scale | IUAB_SIB_INDEX_RAX | IUAB_SIB_BASE_NONE,
+            IUAB_DWORD_TO_BYTES(0),
+        };
+        return IUAB_BUFFER_WRITE(dst, instr);
+    }
+
+    uint8_t instr[] = {
+        // lea eax, [rax + rax * scale]
+        IUAB_OP_LEA_R32_M,
+        IUAB_MODRM_MOD_DISP0 | IUAB_MODRM_REG_EAX | IUAB_MODRM_RM_SIB,
+        scale | IUAB_SIB_INDEX_RAX | IUAB_SIB_BASE_RAX,
+    };
+    return IUAB_BUFFER_WRITE(dst, instr);
+}
+
+static enum iuab_error
+iuab_jit_x86_64_emit_muladd(struct iuab_jit_x86_64_compiler *compiler) {
+    int32_t offset = compiler->node->offset;
+    uint8_t factor = (uint8_t) compiler->node->value;
+
+    if (factor == 0) {
+        return IUAB_ERROR_SUCCESS;
+    }
+
+    enum iuab_error error;
+    compiler->are_flags_of_cell = false;
+
+    if (compiler->is_cell_cached && offset != 0) {
+        uint8_t load[] = {
+            // movzx eax, dl
+            IUAB_OP2_TO_BYTES(IUAB_OP2_MOVZX_R32_RM8),
+            IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_EAX | IUAB_MODRM_RM_DL,
+        };
+        error = IUAB_BUFFER_WRITE(compiler->dst, load);
+    } else {
+        // Values added to the one pointed to by the data pointer are added in
+        // memory.
+        error = iuab_jit_x86_64_evict_cell(compiler);
+
+        uint8_t load[] = {
+            // movzx eax, BYTE PTR [r14]
+            IUAB_REX_B,
+            IUAB_OP2_TO_BYTES(IUAB_OP2_MOVZX_R32_RM8),
+            IUAB_MODRM_MOD_DISP0 | IUAB_MODRM_REG_EAX | IUAB_MODRM_RM_R14,
+        };
+
+        if (error == IUAB_ERROR_SUCCESS) {
+            error = IUAB_BUFFER_WRITE(compiler->dst, load);
+        }
+    }
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    error = iuab_jit_x86_64_emit_mul_eax(compiler->dst, factor);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    // add BYTE PTR [r14 + offset], al
+    return iuab_jit_x86_64_emit_r14(
+        compiler->dst,
+        IUAB_REX_B,
+        IUAB_OP_ADD_RM8_R8,
+        IUAB_MODRM_REG_AL,
+        offset
+    );
+}
+
+static enum iuab_error
+iuab_jit_x86_64_emit_scan(struct iuab_jit_x86_64_compiler *compiler) {
+    uint8_t skip_if_zero[] = {
+        // cmp BYTE PTR [r14], 0
+        IUAB_REX_B,
+        IUAB_OP_CMP_RM8_IMM8,
+        IUAB_MODRM_MOD_DISP0 | IUAB_MODRM_REG_OP_CMP_RM_IMM | IUAB_MODRM_RM_R14,
+        0,
+        // je .skip ; Offset written later.
+        IUAB_OP_JE_REL8,
+        0,
+    };
+    enum iuab_error error = IUAB_BUFFER_WRITE(compiler->dst, skip_if_zero);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    size_t skip_from = compiler->dst->size;
+    error = iuab_jit_x86_64_add_fixup(compiler, skip_from, IUAB_FIXUP_REL8);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    uint8_t call_scan[] = {
+        // mov rdi, rbx
+        IUAB_REX_W,
+        IUAB_OP_MOV_RM64_R64,
+        IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_RBX | IUAB_MODRM_RM_RDI,
+        // mov rsi, r14
+        IUAB_REX_W | IUAB_REX_R,
+        IUAB_OP_MOV_RM64_R64,
+        IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_R14 | IUAB_MODRM_RM_RSI,
+        // mov edx, stride
+        IUAB_OP_MOV_R32_IMM32 + IUAB_REG_EDX,
+        IUAB_DWORD_TO_BYTES(compiler->node->value),
+        // mov rax, iuab_context_scan
+        IUAB_REX_W,
+        IUAB_OP_MOV_R64_IMM64 + IUAB_REG_RAX,
+        IUAB_QWORD_TO_BYTES((int64_t) iuab_context_scan),
+        // call rax
+        IUAB_OP_CALL_RM64,
+        IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_OP_CALL_RM | IUAB_MODRM_RM_RAX,
+        // test rax, rax
+        IUAB_REX_W,
+        IUAB_OP_TEST_RM64_R64,
+        IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_RAX | IUAB_MODRM_RM_RAX,
+        // je .ret_dp_out_of_bounds ; Offset written later.
+        IUAB_OP2_TO_BYTES(IUAB_OP2_JE_REL32),
+        IUAB_DWORD_TO_BYTES(0),
+    };
+    error = IUAB_BUFFER_WRITE(compiler->dst, call_scan);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    error = iuab_jit_x86_64_add_jump(
+        compiler,
+        IUAB_JUMP_RET_ERROR_DP_OUT_OF_BOUNDS,
+        IUAB_FIXUP_JUMP
+    );
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    uint8_t move[] = {
+        // mov r14, rax
+        IUAB_REX_W | IUAB_REX_B,
+        IUAB_OP_MOV_RM64_R64,
+        IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_RAX | IUAB_MODRM_RM_R14,
+    };
+    error = IUAB_BUFFER_WRITE(compiler->dst, move);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    return iuab_jit_x86_64_set_rel8(
+        compiler->dst,
+        skip_from,
+        compiler->dst->size
+    );
+}
+
+// Returns true if the next node of the ones following the current one whose
+// code uses `rax` is a `IUAB_IR_OP_WRITE` node, and none of them is reached by
+// jumps, so that `rax` can keep the size of the output buffer for it.
+static bool iuab_jit_x86_64_is_out_size_kept(
+    const struct iuab_jit_x86_64_compiler *compiler
+) {
+    for (const struct iuab_ir_node *node = compiler->node + 1;
+         node != compiler->end;
+         node++) {
+        switch (node->op) {
+        case IUAB_IR_OP_WRITE: return true;
+        case IUAB_IR_OP_MOVE_UNCHECKED:
+        case IUAB_IR_OP_ADD:
+        case IUAB_IR_OP_SET: break;
+        // Bounds checks use `rax` without guarded memory.
+        case IUAB_IR_OP_MOVE:
+        case IUAB_IR_OP_CHECK:
+            if (!compiler->is_memory_guarded) {
+                return false;
+            }
+
+            break;
+        default: return false;
+        }
+    }
+
+    return false;
+}
+
+static enum iuab_error
+iuab_jit_x86_64_emit_write(struct iuab_jit_x86_64_compiler *compiler) {
+    // The value pointed to by the data pointer is written from `dl`, and the
+    // memory is up to date when flushing the buffer fails.
+    bool was_cell_cached = compiler->is_cell_cached;
+    enum iuab_error error = iuab_jit_x86_64_write_back_cell(compiler);
+
+    if (error == IUAB_ERROR_SUCCESS) {
+        error = iuab_jit_x86_64_load_cell(compiler);
+    }
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    if (was_cell_cached) {
+        // movzx edx, BYTE PTR [r14]
+        iuab_jit_x86_64_count_saved(compiler, 4, 1);
+    }
+
+    struct iuab_buffer *dst = compiler->dst;
+
+    if (compiler->is_out_size_in_rax) {
+        // mov rax, QWORD PTR [rbx + offsetof(struct iuab_context, out_size)],
+        // less the `xor eax, eax` the code of the last node emitted instead.
+        iuab_jit_x86_64_count_saved(compiler, 4 - 2, 1 - 1);
+    } else {
+        uint8_t load[] = {
+            // mov rax,
+            //     QWORD PTR [rbx + offsetof(struct iuab_context, out_size)]
+            IUAB_REX_W,
+            IUAB_OP_MOV_R64_RM64,
+            IUAB_MODRM_MOD_DISP8 | IUAB_MODRM_REG_RAX | IUAB_MODRM_RM_RBX,
+            offsetof(struct iuab_context, out_size),
+        };
+        error = IUAB_BUFFER_WRITE(dst, load);
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
+    }
+
+    uint8_t buffer_byte[] = {
+        // mov BYTE PTR [rbx + rax + offsetof(struct iuab_context, out_buffer)],
+        //     dl
+        IUAB_OP_MOV_RM8_R8,
+        IUAB_MODRM_MOD_DISP8 | IUAB_MODRM_REG_DL | IUAB_MODRM_RM_SIB,
+        IUAB_SIB_INDEX_RAX | IUAB_SIB_BASE_RBX,
+        offsetof(struct iuab_context, out_buffer),
+        // inc rax
+        IUAB_REX_W,
+        IUAB_OP_INC_RM64,
+        IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_OP_INC_RM | IUAB_MODRM_RM_RAX,
+        // mov QWORD PTR [rbx + offsetof(struct iuab_context, out_size)], rax
+        IUAB_REX_W,
+        IUAB_OP_MOV_RM64_R64,
+        IUAB_MODRM_MOD_DISP8 | IUAB_MODRM_REG_RAX | IUAB_MODRM_RM_RBX,
+        offsetof(struct iuab_context, out_size),
+        // cmp rax, IUAB_CONTEXT_OUTPUT_BUFFER_SIZE
+        IUAB_REX_W,
+        IUAB_OP_CMP_RAX_IMM32,
+        IUAB_DWORD_TO_BYTES(IUAB_CONTEXT_OUTPUT_BUFFER_SIZE),
+        // jne .done ; Offset written later.
+        IUAB_OP_JNE_REL8,
+        0,
+    };
+    error = IUAB_BUFFER_WRITE(dst, buffer_byte);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    size_t done_from = dst->size;
+    error = iuab_jit_x86_64_add_fixup(compiler, done_from, IUAB_FIXUP_REL8);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    // The buffer is flushed once full.
+    uint8_t flush[] = {
+        // mov rdi, rbx
+        IUAB_REX_W,
+        IUAB_OP_MOV_RM64_R64,
+        IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_RBX | IUAB_MODRM_RM_RDI,
+        // call r13
+        IUAB_REX_B,
+        IUAB_OP_CALL_RM64,
+        IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_OP_CALL_RM | IUAB_MODRM_RM_R13,
+        // test eax, eax
+        IUAB_OP_TEST_RM32_R32,
+        IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_EAX | IUAB_MODRM_RM_EAX,
+        // jne .ret_error_io ; Offset written later.
+        IUAB_OP2_TO_BYTES(IUAB_OP2_JNE_REL32),
+        IUAB_DWORD_TO_BYTES(0),
+    };
+    error = IUAB_BUFFER_WRITE(dst, flush);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    error = iuab_jit_x86_64_add_jump(
+        compiler,
+        IUAB_JUMP_RET_ERROR_IO,
+        IUAB_FIXUP_JUMP
+    );
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    // The call clobbers `dl`, and empties the buffer.
+    compiler->is_cell_cached = false;
+    compiler->are_flags_of_cell = false;
+    compiler->is_out_size_in_rax = iuab_jit_x86_64_is_out_size_kept(compiler);
+
+    if (compiler->is_out_size_in_rax) {
+        uint8_t instr[] = {
+            // xor eax, eax
+            IUAB_OP_XOR_RM32_R32,
+            IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_EAX | IUAB_MODRM_RM_EAX,
+        };
+        error = IUAB_BUFFER_WRITE(dst, instr);
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
+    }
+
+    return iuab_jit_x86_64_set_rel8(dst, done_from, dst->size);
+}
+
+// Emits the data of the current node, jumped over, and writes its offset at the
+// location pointed to by `offset_dst`.
+static enum iuab_error iuab_jit_x86_64_emit_data(
+    struct iuab_jit_x86_64_compiler *compiler,
+    size_t *offset_dst
+) {
+    uint32_t size = (uint32_t) compiler->node->value;
+    uint8_t instr[] = {
+        // jmp .after_data
+        IUAB_OP_JMP_REL32,
+        IUAB_DWORD_TO_BYTES(size),
+    };
+    enum iuab_error error = IUAB_BUFFER_WRITE(compiler->dst, instr);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    error = iuab_jit_x86_64_add_fixup(
+        compiler,
+        compiler->dst->size,
+        IUAB_FIXUP_JUMP
+    );
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    *offset_dst = compiler->dst->size;
+    const uint8_t *data = &compiler->ir->data.data[compiler->node->link];
+    return iuab_buffer_write(compiler->dst, data, size);
+}
+
+// Writes the displacement of the data at `offset` in the code from the end of
+// a RIP-relative `lea` instruction emitted next at the location pointed to by
+// `disp_dst`, and adds its fixup. Returns the error that occurred in the
+// process.
+static enum iuab_error iuab_jit_x86_64_lea_rip_disp(
+    struct iuab_jit_x86_64_compiler *compiler,
+    size_t offset,
+    int32_t *disp_dst
+) {
+    // REX prefix, opcode, ModR/M byte and 32-bit displacement.
+    size_t lea_end = compiler->dst->size + 1 + 1 + 1 + 4;
+    *disp_dst = (int32_t) -(ssize_t) (lea_end - offset);
+    return iuab_jit_x86_64_add_fixup(compiler, lea_end, IUAB_FIXUP_REL32);
+}
+
+static enum iuab_error
+iuab_jit_x86_64_emit_store_data(struct iuab_jit_x86_64_compiler *compiler) {
+    size_t offset;
+    enum iuab_error error = iuab_jit_x86_64_emit_data(compiler, &offset);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    int32_t disp;
+    error = iuab_jit_x86_64_lea_rip_disp(compiler, offset, &disp);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    uint8_t load_src[] = {
+        // lea rsi, [rip + data]
+        IUAB_REX_W,
+        IUAB_OP_LEA_R64_M,
+        IUAB_MODRM_MOD_DISP0 | IUAB_MODRM_REG_RSI | IUAB_MODRM_RM_RIP,
+        IUAB_DWORD_TO_BYTES(disp),
+    };
+    error = IUAB_BUFFER_WRITE(compiler->dst, load_src);
+
+    if (error == IUAB_ERROR_SUCCESS) {
+        // lea rdi, [r14 + offset]
+        error = iuab_jit_x86_64_emit_r14(
+            compiler->dst,
+            IUAB_REX_W | IUAB_REX_B,
+            IUAB_OP_LEA_R64_M,
+            IUAB_MODRM_REG_RDI,
+            compiler->node->offset
+        );
+    }
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    uint8_t copy[] = {
+        // mov ecx, size
+        IUAB_OP_MOV_R32_IMM32 + IUAB_REG_ECX,
+        IUAB_DWORD_TO_BYTES(compiler->node->value),
+        // rep movsb
+        IUAB_PREFIX_REP,
+        IUAB_OP_MOVS_M8_M8,
     };
-    return iuab_buffer_write(&compiler->jumps, &jump, sizeof(jump));
+    return IUAB_BUFFER_WRITE(compiler->dst, copy);
+}
+
+static enum iuab_error
+iuab_jit_x86_64_emit_write_data(struct iuab_jit_x86_64_compiler *compiler) {
+    size_t offset;
+    enum iuab_error error = iuab_jit_x86_64_emit_data(compiler, &offset);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    int32_t disp;
+    error = iuab_jit_x86_64_lea_rip_disp(compiler, offset, &disp);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    int32_t size = compiler->node->value;
+    uint8_t instrs[] = {
+        // lea rsi, [rip + data]
+        IUAB_REX_W,
+        IUAB_OP_LEA_R64_M,
+        IUAB_MODRM_MOD_DISP0 | IUAB_MODRM_REG_RSI | IUAB_MODRM_RM_RIP,
+        IUAB_DWORD_TO_BYTES(disp),
+        // mov rdi, rbx
+        IUAB_REX_W,
+        IUAB_OP_MOV_RM64_R64,
+        IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_RBX | IUAB_MODRM_RM_RDI,
+        // mov edx, size
+        IUAB_OP_MOV_R32_IMM32 + IUAB_REG_EDX,
+        IUAB_DWORD_TO_BYTES(size),
+        // mov rax, iuab_context_write_data
+        IUAB_REX_W,
+        IUAB_OP_MOV_R64_IMM64 + IUAB_REG_RAX,
+        IUAB_QWORD_TO_BYTES((int64_t) iuab_context_write_data),
+        // call rax
+        IUAB_OP_CALL_RM64,
+        IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_OP_CALL_RM | IUAB_MODRM_RM_RAX,
+        // test eax, eax
+        IUAB_OP_TEST_RM32_R32,
+        IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_EAX | IUAB_MODRM_RM_EAX,
+        // jne .ret_error_io ; Offset written later.
+        IUAB_OP2_TO_BYTES(IUAB_OP2_JNE_REL32),
+        IUAB_DWORD_TO_BYTES(0),
+    };
+    error = IUAB_BUFFER_WRITE(compiler->dst, instrs);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    return iuab_jit_x86_64_add_jump(
+        compiler,
+        IUAB_JUMP_RET_ERROR_IO,
+        IUAB_FIXUP_JUMP
+    );
 }
 
 static enum iuab_error
 iuab_jit_x86_64_emit_read(struct iuab_jit_x86_64_compiler *compiler) {
-    uint8_t call_fgetc[] = {
-        // mov rdi, QWORD PTR [rbx + offsetof(struct iuab_context, in)]
+    uint8_t load_if_buffered[] = {
+        // mov rax, QWORD PTR [rbx + offsetof(struct iuab_context, in_cursor)]
         IUAB_REX_W,
         IUAB_OP_MOV_R64_RM64,
-        IUAB_MODRM_MOD_DISP8 | IUAB_MODRM_REG_RDI | IUAB_MODRM_RM_RBX,
-        offsetof(struct iuab_context, in),
+        IUAB_MODRM_MOD_DISP8 | IUAB_MODRM_REG_RAX | IUAB_MODRM_RM_RBX,
+        offsetof(struct iuab_context, in_cursor),
+        // cmp rax, QWORD PTR [rbx + offsetof(struct iuab_context, in_end)]
+        IUAB_REX_W,
+        IUAB_OP_CMP_R64_RM64,
+        IUAB_MODRM_MOD_DISP8 | IUAB_MODRM_REG_RAX | IUAB_MODRM_RM_RBX,
+        offsetof(struct iuab_context, in_end),
+        // jb .load ; Offset written later.
+        IUAB_OP_JB_REL8,
+        0,
+    };
+    struct iuab_buffer *dst = compiler->dst;
+    enum iuab_error error = IUAB_BUFFER_WRITE(dst, load_if_buffered);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    size_t load_from = dst->size;
+    error = iuab_jit_x86_64_add_fixup(compiler, load_from, IUAB_FIXUP_REL8);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    // The input buffer is refilled once empty.
+    uint8_t refill[] = {
+        // mov rdi, rbx
+        IUAB_REX_W,
+        IUAB_OP_MOV_RM64_R64,
+        IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_RBX | IUAB_MODRM_RM_RDI,
         // call r12
         IUAB_REX_B,
         IUAB_OP_CALL_RM64,
         IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_OP_CALL_RM | IUAB_MODRM_RM_R12,
-        // cmp eax, -1
-        IUAB_OP_CMP_EAX_IMM32,
-        IUAB_DWORD_TO_BYTES((int32_t) -1),
-        // je .handle_fgetc_eof ; Offset written later.
-        IUAB_OP2_TO_BYTES(IUAB_OP2_JE_REL32),
+        // test eax, eax
+        IUAB_OP_TEST_RM32_R32,
+        IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_EAX | IUAB_MODRM_RM_EAX,
+        // jne .ret_error ; Offset written later.
+        IUAB_OP2_TO_BYTES(IUAB_OP2_JNE_REL32),
         IUAB_DWORD_TO_BYTES(0),
     };
-    enum iuab_error error = IUAB_BUFFER_WRITE_JIT(compiler->dst, call_fgetc);
+    error = IUAB_BUFFER_WRITE(dst, refill);
 
     if (error != IUAB_ERROR_SUCCESS) {
         return error;
     }
 
-    struct iuab_jit_x86_64_jump jump = {
-        .from = compiler->dst->size,
-        .to = IUAB_JUMP_HANDLE_FGETC_EOF,
+    error = iuab_jit_x86_64_add_jump(
+        compiler,
+        IUAB_JUMP_RET_ERROR,
+        IUAB_FIXUP_JUMP
+    );
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    uint8_t reload[] = {
+        // mov rax, QWORD PTR [rbx + offsetof(struct iuab_context, in_cursor)]
+        IUAB_REX_W,
+        IUAB_OP_MOV_R64_RM64,
+        IUAB_MODRM_MOD_DISP8 | IUAB_MODRM_REG_RAX | IUAB_MODRM_RM_RBX,
+        offsetof(struct iuab_context, in_cursor),
     };
-    error = iuab_buffer_write(&compiler->jumps, &jump, sizeof(jump));
+    error = IUAB_BUFFER_WRITE(dst, reload);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    error = iuab_jit_x86_64_set_rel8(dst, load_from, dst->size);
 
     if (error != IUAB_ERROR_SUCCESS) {
         return error;
     }
 
-    uint8_t write_returned_char_to_memory[] = {
-        // mov BYTE PTR [r14], al
+    uint8_t load[] = {
+        // movzx ecx, BYTE PTR [rax]
+        IUAB_OP2_TO_BYTES(IUAB_OP2_MOVZX_R32_RM8),
+        IUAB_MODRM_MOD_DISP0 | IUAB_MODRM_REG_ECX | IUAB_MODRM_RM_RAX,
+        // mov BYTE PTR [r14], cl
         IUAB_REX_B,
         IUAB_OP_MOV_RM8_R8,
-        IUAB_MODRM_MOD_DISP0 | IUAB_MODRM_REG_AL | IUAB_MODRM_RM_R14,
+        IUAB_MODRM_MOD_DISP0 | IUAB_MODRM_REG_CL | IUAB_MODRM_RM_R14,
+        // inc rax
+        IUAB_REX_W,
+        IUAB_OP_INC_RM64,
+        IUAB_MODRM_MOD_DIRECT | IUAB_MODRM_REG_OP_INC_RM | IUAB_MODRM_RM_RAX,
+        // mov QWORD PTR [rbx + offsetof(struct iuab_context, in_cursor)], rax
+        IUAB_REX_W,
+        IUAB_OP_MOV_RM64_R64,
+        IUAB_MODRM_MOD_DISP8 | IUAB_MODRM_REG_RAX | IUAB_MODRM_RM_RBX,
+        offsetof(struct iuab_context, in_cursor),
     };
-    return IUAB_BUFFER_WRITE_JIT(compiler->dst, write_returned_char_to_memory);
+    return IUAB_BUFFER_WRITE(dst, load);
+}
+
+// Returns true if the loop started by the current node contains no other loop
+// and runs more than once.
+static bool iuab_jit_x86_64_is_innermost_loop(
+    const struct iuab_jit_x86_64_compiler *compiler
+) {
+    const struct iuab_ir_node *end_loop =
+        &iuab_ir_nodes(compiler->ir)[compiler->node->link];
+
+    for (const struct iuab_ir_node *node = compiler->node + 1; node != end_loop;
+         node++) {
+        if (node->op == IUAB_IR_OP_LOOP) {
+            return false;
+        }
+    }
+
+    return !iuab_ir_is_loop_once(end_loop);
+}
+
+// Returns true if the loop started by the given node runs more than once and
+// its body neither moves the data pointer nor leaves the code of its nodes, so
+// that the value it points to stays cached across its iterations.
+static bool iuab_jit_x86_64_is_register_loop(
+    const struct iuab_ir *ir,
+    const struct iuab_ir_node *loop
+) {
+    const struct iuab_ir_node *end_loop = &iuab_ir_nodes(ir)[loop->link];
+
+    for (const struct iuab_ir_node *node = loop + 1; node != end_loop; node++) {
+        switch (node->op) {
+        case IUAB_IR_OP_CHECK:
+        case IUAB_IR_OP_ADD:
+        case IUAB_IR_OP_SET: break;
+        case IUAB_IR_OP_MULADD:
+            if (node->offset == 0) {
+                return false;
+            }
+
+            break;
+        default: return false;
+        }
+    }
+
+    return !iuab_ir_is_loop_once(end_loop);
 }
 
 static enum iuab_error
 iuab_jit_x86_64_begin_loop(struct iuab_jit_x86_64_compiler *compiler) {
-    uint8_t instrs[] = {
-        // cmp BYTE PTR [r14], 0
-        IUAB_REX_B,
-        IUAB_OP_CMP_RM8_IMM8,
-        IUAB_MODRM_MOD_DISP0 | IUAB_MODRM_REG_OP_CMP_RM_IMM | IUAB_MODRM_RM_R14,
-        0,
+    bool is_register_loop =
+        iuab_jit_x86_64_is_register_loop(compiler->ir, compiler->node);
+    enum iuab_error error = IUAB_ERROR_SUCCESS;
+
+    if (is_register_loop) {
+        error = iuab_jit_x86_64_load_cell(compiler);
+    }
+
+    if (error == IUAB_ERROR_SUCCESS) {
+        error = iuab_jit_x86_64_emit_cell_test(compiler, !is_register_loop);
+    }
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    uint8_t instr[] = {
         // je loop_end ; Offset written later.
         IUAB_OP2_TO_BYTES(IUAB_OP2_JE_REL32),
         IUAB_DWORD_TO_BYTES(0),
     };
-    enum iuab_error error = IUAB_BUFFER_WRITE_JIT(compiler->dst, instrs);
+    error = IUAB_BUFFER_WRITE(compiler->dst, instr);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    size_t loop_start = compiler->dst->size;
+    error = iuab_jit_x86_64_add_fixup(compiler, loop_start, IUAB_FIXUP_JUMP);
+
+    if (error == IUAB_ERROR_SUCCESS
+        && iuab_jit_x86_64_is_innermost_loop(compiler)) {
+        error =
+            iuab_jit_x86_64_add_fixup(compiler, loop_start, IUAB_FIXUP_ALIGN);
+    }
 
     if (error != IUAB_ERROR_SUCCESS) {
         return error;
     }
 
-    return iuab_buffer_write_size(&compiler->loop_stack, compiler->dst->size);
+    // The body of the loop starts with the value of its last iteration, which
+    // may differ from the one in memory.
+    compiler->is_cell_dirty = compiler->is_cell_cached;
+    compiler->are_flags_of_cell = false;
+    return iuab_buffer_write_size(&compiler->loop_stack, loop_start);
 }
 
 static enum iuab_error
@@ -690,38 +1835,73 @@ iuab_jit_x86_64_end_loop(struct iuab_jit_x86_64_compiler *compiler) {
         return IUAB_ERROR_COMPILER_UNEXPECTED_LOOP_END;
     }
 
-    uint8_t instrs[] = {
-        // cmp BYTE PTR [r14], 0
-        IUAB_REX_B,
-        IUAB_OP_CMP_RM8_IMM8,
-        IUAB_MODRM_MOD_DISP0 | IUAB_MODRM_REG_OP_CMP_RM_IMM | IUAB_MODRM_RM_R14,
-        0,
-        // jne loop_start ; Offset written later.
-        IUAB_OP2_TO_BYTES(IUAB_OP2_JNE_REL32),
-        IUAB_DWORD_TO_BYTES(0),
-    };
-    enum iuab_error error = IUAB_BUFFER_WRITE_JIT(compiler->dst, instrs);
-
-    if (error != IUAB_ERROR_SUCCESS) {
-        return error;
-    }
-
     size_t loop_start = iuab_buffer_pop_size(&compiler->loop_stack);
-    error = iuab_jit_x86_64_set_rel32(
-        compiler->dst,
-        compiler->dst->size,
-        loop_start
+    bool is_register_loop = iuab_jit_x86_64_is_register_loop(
+        compiler->ir,
+        &iuab_ir_nodes(compiler->ir)[compiler->node->link]
     );
 
-    if (error != IUAB_ERROR_SUCCESS) {
-        return error;
+    if (iuab_ir_is_loop_once(compiler->node)) {
+        enum iuab_error error = iuab_jit_x86_64_evict_cell(compiler);
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
+    } else {
+        enum iuab_error error =
+            iuab_jit_x86_64_emit_cell_test(compiler, !is_register_loop);
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
+
+        uint8_t instr[] = {
+            // jne loop_start ; Offset written later.
+            IUAB_OP2_TO_BYTES(IUAB_OP2_JNE_REL32),
+            IUAB_DWORD_TO_BYTES(0),
+        };
+        error = IUAB_BUFFER_WRITE(compiler->dst, instr);
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
+
+        error = iuab_jit_x86_64_add_fixup(
+            compiler,
+            compiler->dst->size,
+            IUAB_FIXUP_JUMP
+        );
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
+
+        error = iuab_jit_x86_64_set_rel32(
+            compiler->dst,
+            compiler->dst->size,
+            loop_start
+        );
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
     }
 
-    return iuab_jit_x86_64_set_rel32(
+    enum iuab_error error = iuab_jit_x86_64_set_rel32(
         compiler->dst,
         loop_start,
         compiler->dst->size
     );
+
+    if (error != IUAB_ERROR_SUCCESS || !is_register_loop) {
+        return error;
+    }
+
+    // Both the loop and the jump over it leave zero in `dl` and the flags set
+    // from it, which is written back once for both.
+    compiler->is_cell_dirty = true;
+    compiler->are_flags_of_cell = true;
+    return iuab_jit_x86_64_write_back_cell(compiler);
 }
 
 static enum iuab_error
@@ -731,82 +1911,480 @@ iuab_jit_x86_64_emit_debug(struct iuab_jit_x86_64_compiler *compiler) {
         IUAB_OP_CALL_REL32,
         IUAB_DWORD_TO_BYTES(0),
     };
-    enum iuab_error error = IUAB_BUFFER_WRITE_JIT(compiler->dst, instr);
+    enum iuab_error error = IUAB_BUFFER_WRITE(compiler->dst, instr);
 
     if (error != IUAB_ERROR_SUCCESS) {
         return error;
     }
 
-    struct iuab_jit_x86_64_jump jump = {
-        .from = compiler->dst->size,
-        .to = IUAB_JUMP_CALL_DEBUG_HANDLER,
-    };
-    return iuab_buffer_write(&compiler->jumps, &jump, sizeof(jump));
+    return iuab_jit_x86_64_add_jump(
+        compiler,
+        IUAB_JUMP_CALL_DEBUG_HANDLER,
+        IUAB_FIXUP_REL32
+    );
 }
 
 static enum iuab_error
 iuab_jit_x86_64_emit(struct iuab_jit_x86_64_compiler *compiler) {
-    enum iuab_error error;
+    switch (compiler->node->op) {
+    // The code of these nodes handles the cached value pointed to by the data
+    // pointer.
+    case IUAB_IR_OP_CHECK:
+    case IUAB_IR_OP_ADD:
+    case IUAB_IR_OP_SET:
+    case IUAB_IR_OP_MULADD:
+    case IUAB_IR_OP_WRITE:
+    case IUAB_IR_OP_LOOP:
+    case IUAB_IR_OP_END_LOOP: break;
+    default: {
+        enum iuab_error error = iuab_jit_x86_64_evict_cell(compiler);
 
-    switch (compiler->token.type) {
-    case IUAB_TOKEN_I:
-    case IUAB_TOKEN_USE: return iuab_jit_x86_64_emit_additive_p(compiler);
-    case IUAB_TOKEN_ARCH:
-    case IUAB_TOKEN_LINUX: return iuab_jit_x86_64_emit_additive_v(compiler);
-    case IUAB_TOKEN_BTW: error = iuab_jit_x86_64_emit_write(compiler); break;
-    case IUAB_TOKEN_BY: error = iuab_jit_x86_64_emit_read(compiler); break;
-    case IUAB_TOKEN_THE: error = iuab_jit_x86_64_begin_loop(compiler); break;
-    case IUAB_TOKEN_WAY: error = iuab_jit_x86_64_end_loop(compiler); break;
-    case IUAB_TOKEN_GENTOO: error = iuab_jit_x86_64_emit_debug(compiler); break;
-    default: return IUAB_ERROR_COMPILER_INVALID_TOKEN;
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
+    }
     }
 
-    if (error == IUAB_ERROR_SUCCESS) {
-        compiler->token = iuab_lexer_next_token(&compiler->lexer);
+    switch (compiler->node->op) {
+    case IUAB_IR_OP_MOVE: return iuab_jit_x86_64_emit_move(compiler);
+    case IUAB_IR_OP_MOVE_UNCHECKED:
+        return iuab_jit_x86_64_emit_move_unchecked(compiler);
+    case IUAB_IR_OP_CHECK: return iuab_jit_x86_64_emit_check(compiler);
+    case IUAB_IR_OP_ADD: return iuab_jit_x86_64_emit_add(compiler);
+    case IUAB_IR_OP_SET: return iuab_jit_x86_64_emit_set(compiler);
+    case IUAB_IR_OP_MULADD: return iuab_jit_x86_64_emit_muladd(compiler);
+    case IUAB_IR_OP_SCAN: return iuab_jit_x86_64_emit_scan(compiler);
+    case IUAB_IR_OP_WRITE: return iuab_jit_x86_64_emit_write(compiler);
+    case IUAB_IR_OP_READ: return iuab_jit_x86_64_emit_read(compiler);
+    case IUAB_IR_OP_LOOP: return iuab_jit_x86_64_begin_loop(compiler);
+    case IUAB_IR_OP_END_LOOP: return iuab_jit_x86_64_end_loop(compiler);
+    case IUAB_IR_OP_DEBUG: return iuab_jit_x86_64_emit_debug(compiler);
+    case IUAB_IR_OP_STORE_DATA:
+        return iuab_jit_x86_64_emit_store_data(compiler);
+    case IUAB_IR_OP_WRITE_DATA:
+        return iuab_jit_x86_64_emit_write_data(compiler);
+    default: return IUAB_ERROR_COMPILER_INTERNAL;
+    }
+}
+
+// The recommended no-op instructions of each size.
+static const uint8_t iuab_jit_x86_64_nops[][9] = {
+    // nop
+    { IUAB_OP_NOP },
+    // xchg ax, ax
+    { IUAB_PREFIX_OPERAND_SIZE, IUAB_OP_NOP },
+    // nop DWORD PTR [rax]
+    {
+        IUAB_OP2_TO_BYTES(IUAB_OP2_NOP_RM32),
+        IUAB_MODRM_MOD_DISP0 | IUAB_MODRM_REG_OP_NOP_RM | IUAB_MODRM_RM_RAX,
+    },
+    // nop DWORD PTR [rax + 0]
+    {
+        IUAB_OP2_TO_BYTES(IUAB_OP2_NOP_RM32),
+        IUAB_MODRM_MOD_DISP8 | IUAB_MODRM_REG_OP_NOP_RM | IUAB_MODRM_RM_RAX,
+        0,
+    },
+    // nop DWORD PTR [rax + rax * 1 + 0]
+    {
+        IUAB_OP2_TO_BYTES(IUAB_OP2_NOP_RM32),
+        IUAB_MODRM_MOD_DISP8 | IUAB_MODRM_REG_OP_NOP_RM | IUAB_MODRM_RM_SIB,
+        IUAB_SIB_INDEX_RAX | IUAB_SIB_BASE_RAX,
+        0,
+    },
+    // nop WORD PTR [rax + rax * 1 + 0]
+    {
+        IUAB_PREFIX_OPERAND_SIZE,
+        IUAB_OP2_TO_BYTES(IUAB_OP2_NOP_RM32),
+        IUAB_MODRM_MOD_DISP8 | IUAB_MODRM_REG_OP_NOP_RM | IUAB_MODRM_RM_SIB,
+        IUAB_SIB_INDEX_RAX | IUAB_SIB_BASE_RAX,
+        0,
+    },
+    // nop DWORD PTR [rax + 0]
+    {
+        IUAB_OP2_TO_BYTES(IUAB_OP2_NOP_RM32),
+        IUAB_MODRM_MOD_DISP32 | IUAB_MODRM_REG_OP_NOP_RM | IUAB_MODRM_RM_RAX,
+        IUAB_DWORD_TO_BYTES(0),
+    },
+    // nop DWORD PTR [rax + rax * 1 + 0]
+    {
+        IUAB_OP2_TO_BYTES(IUAB_OP2_NOP_RM32),
+        IUAB_MODRM_MOD_DISP32 | IUAB_MODRM_REG_OP_NOP_RM | IUAB_MODRM_RM_SIB,
+        IUAB_SIB_INDEX_RAX | IUAB_SIB_BASE_RAX,
+        IUAB_DWORD_TO_BYTES(0),
+    },
+    // nop WORD PTR [rax + rax * 1 + 0]
+    {
+        IUAB_PREFIX_OPERAND_SIZE,
+        IUAB_OP2_TO_BYTES(IUAB_OP2_NOP_RM32),
+        IUAB_MODRM_MOD_DISP32 | IUAB_MODRM_REG_OP_NOP_RM | IUAB_MODRM_RM_SIB,
+        IUAB_SIB_INDEX_RAX | IUAB_SIB_BASE_RAX,
+        IUAB_DWORD_TO_BYTES(0),
+    },
+};
+
+// Emits `size` bytes of no-op instructions, as few as possible.
+static enum iuab_error
+iuab_jit_x86_64_emit_nops(struct iuab_buffer *dst, size_t size) {
+    size_t max_size =
+        sizeof(iuab_jit_x86_64_nops) / sizeof(*iuab_jit_x86_64_nops);
+
+    while (size != 0) {
+        size_t nop_size = size < max_size ? size : max_size;
+        const uint8_t *nop = iuab_jit_x86_64_nops[nop_size - 1];
+        enum iuab_error error = iuab_buffer_write(dst, nop, nop_size);
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
+
+        size -= nop_size;
+    }
+
+    return IUAB_ERROR_SUCCESS;
+}
+
+// A layout of the emitted code, with short jumps where their displacement fits
+// in 8 bits and innermost loops aligned.
+struct iuab_jit_x86_64_layout {
+    const uint8_t *code;
+    const struct iuab_jit_x86_64_fixup *fixups;
+    size_t fixup_count;
+    // Whether the jump of each fixup keeps its 32-bit displacement.
+    bool *is_long;
+    // The difference between the offset of the code following each fixup in
+    // the laid out code and in the emitted code.
+    ssize_t *shifts;
+    // The number of bytes short jumps save and of bytes of padding aligning
+    // loops.
+    size_t saved_size;
+    size_t padding_size;
+};
+
+// Returns the size of the jump with a 32-bit displacement ending at `at` of
+// the given emitted code.
+static size_t iuab_jit_x86_64_long_jump_size(const uint8_t *code, size_t at) {
+    // Opcode and 32-bit displacement, or 2-byte opcode of a conditional jump
+    // and 32-bit displacement.
+    return code[at - 1 - 4] == IUAB_OP_JMP_REL32 ? 1 + 4 : 2 + 4;
+}
+
+// Returns the offset in the emitted code of the target of the displacement of
+// the given fixup.
+static size_t iuab_jit_x86_64_fixup_target(
+    const uint8_t *code,
+    const struct iuab_jit_x86_64_fixup *fixup
+) {
+    if (fixup->kind == IUAB_FIXUP_REL8) {
+        return (size_t) ((ssize_t) fixup->at + (int8_t) code[fixup->at - 1]);
+    }
+
+    int32_t rel32;
+    memcpy(&rel32, &code[fixup->at - sizeof(rel32)], sizeof(rel32));
+    return (size_t) ((ssize_t) fixup->at + rel32);
+}
+
+// Returns the offset in the given layout of the code at `offset` in the emitted
+// code, which is not within a jump.
+static size_t iuab_jit_x86_64_layout_offset(
+    const struct iuab_jit_x86_64_layout *layout,
+    size_t offset
+) {
+    // The code is shifted by the last fixup at or before it.
+    size_t lo = 0;
+    size_t hi = layout->fixup_count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (layout->fixups[mid].at <= offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo == 0 ? offset
+                   : (size_t) ((ssize_t) offset + layout->shifts[lo - 1]);
+}
+
+// Computes the shifts of the code of the given layout from the size of its
+// jumps and the padding aligning its loops.
+static void iuab_jit_x86_64_layout_shift(struct iuab_jit_x86_64_layout *layout
+) {
+    ssize_t shift = 0;
+    layout->saved_size = 0;
+    layout->padding_size = 0;
+
+    for (size_t i = 0; i < layout->fixup_count; i++) {
+        const struct iuab_jit_x86_64_fixup *fixup = &layout->fixups[i];
+
+        if (fixup->kind == IUAB_FIXUP_JUMP && !layout->is_long[i]) {
+            // Opcode and 8-bit displacement.
+            size_t size = 1 + 1;
+            size_t saved =
+                iuab_jit_x86_64_long_jump_size(layout->code, fixup->at) - size;
+            layout->saved_size += saved;
+            shift -= (ssize_t) saved;
+        } else if (fixup->kind == IUAB_FIXUP_ALIGN) {
+            size_t offset = (size_t) ((ssize_t) fixup->at + shift);
+            size_t padding = -offset % IUAB_JIT_X86_64_LOOP_ALIGNMENT;
+            layout->padding_size += padding;
+            shift += (ssize_t) padding;
+        }
+
+        layout->shifts[i] = shift;
+    }
+}
+
+// Makes the short jumps of the given layout whose displacement does not fit in
+// 8 bits long. Returns true if there were any, otherwise false.
+static bool
+iuab_jit_x86_64_layout_lengthen(struct iuab_jit_x86_64_layout *layout) {
+    bool has_lengthened = false;
+
+    for (size_t i = 0; i < layout->fixup_count; i++) {
+        const struct iuab_jit_x86_64_fixup *fixup = &layout->fixups[i];
+
+        if (fixup->kind != IUAB_FIXUP_JUMP || layout->is_long[i]) {
+            continue;
+        }
+
+        size_t from = (size_t) ((ssize_t) fixup->at + layout->shifts[i]);
+        size_t to = iuab_jit_x86_64_layout_offset(
+            layout,
+            iuab_jit_x86_64_fixup_target(layout->code, fixup)
+        );
+        ssize_t rel8 = (ssize_t) (to - from);
+
+        if (rel8 < INT8_MIN || rel8 > INT8_MAX) {
+            layout->is_long[i] = true;
+            has_lengthened = true;
+        }
+    }
+
+    return has_lengthened;
+}
+
+// Emits the jump of the given fixup of the given layout, with a displacement
+// written later.
+static enum iuab_error iuab_jit_x86_64_emit_layout_jump(
+    const struct iuab_jit_x86_64_layout *layout,
+    size_t index,
+    struct iuab_buffer *dst
+) {
+    size_t at = layout->fixups[index].at;
+    size_t size = iuab_jit_x86_64_long_jump_size(layout->code, at);
+    const uint8_t *jump = &layout->code[at - size];
+
+    if (layout->is_long[index]) {
+        return iuab_buffer_write(dst, jump, size);
+    }
+
+    // The condition code of conditional jumps is in the low 4 bits of their
+    // opcode, with an 8-bit or a 32-bit displacement.
+    uint8_t condition = jump[1] & 0x0F;
+    uint8_t instr[] = {
+        jump[0] == IUAB_OP_JMP_REL32 ? IUAB_OP_JMP_REL8
+                                     : IUAB_OP_JCC_REL8 + condition,
+        0,
+    };
+    return IUAB_BUFFER_WRITE(dst, instr);
+}
+
+// Emits the code of the given layout, then writes its displacements. Returns
+// the error that occurred in the process.
+static enum iuab_error iuab_jit_x86_64_emit_layout(
+    const struct iuab_jit_x86_64_layout *layout,
+    size_t code_size,
+    struct iuab_buffer *dst
+) {
+    size_t copied = 0;
+
+    for (size_t i = 0; i < layout->fixup_count; i++) {
+        const struct iuab_jit_x86_64_fixup *fixup = &layout->fixups[i];
+        size_t end = fixup->at;
+
+        if (fixup->kind == IUAB_FIXUP_JUMP) {
+            end -= iuab_jit_x86_64_long_jump_size(layout->code, fixup->at);
+        } else if (fixup->kind != IUAB_FIXUP_ALIGN) {
+            continue;
+        }
+
+        enum iuab_error error =
+            iuab_buffer_write(dst, &layout->code[copied], end - copied);
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
+
+        if (fixup->kind == IUAB_FIXUP_JUMP) {
+            error = iuab_jit_x86_64_emit_layout_jump(layout, i, dst);
+        } else {
+            error = iuab_jit_x86_64_emit_nops(
+                dst,
+                -dst->size % IUAB_JIT_X86_64_LOOP_ALIGNMENT
+            );
+        }
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
+
+        copied = fixup->at;
+    }
+
+    enum iuab_error error =
+        iuab_buffer_write(dst, &layout->code[copied], code_size - copied);
+
+    for (size_t i = 0; i < layout->fixup_count && error == IUAB_ERROR_SUCCESS;
+         i++) {
+        const struct iuab_jit_x86_64_fixup *fixup = &layout->fixups[i];
+
+        if (fixup->kind == IUAB_FIXUP_ALIGN) {
+            continue;
+        }
+
+        size_t from = (size_t) ((ssize_t) fixup->at + layout->shifts[i]);
+        size_t to = iuab_jit_x86_64_layout_offset(
+            layout,
+            iuab_jit_x86_64_fixup_target(layout->code, fixup)
+        );
+
+        if (fixup->kind == IUAB_FIXUP_REL8
+            || (fixup->kind == IUAB_FIXUP_JUMP && !layout->is_long[i])) {
+            error = iuab_jit_x86_64_set_rel8(dst, from, to);
+        } else {
+            error = iuab_jit_x86_64_set_rel32(dst, from, to);
+        }
+    }
+
+    return error;
+}
+
+// Lays out the emitted code pointed to by `code` with the given fixups, using
+// the short form of the jumps whose displacement fits in 8 bits, found by
+// lengthening the others until there are none left, and aligning innermost
+// loops. Writes the laid out code to the buffer pointed to by `dst` and the
+// number of bytes short jumps saved and of bytes of padding added in it at the
+// locations pointed to by `saved_size_dst` and `padding_size_dst`. Returns the
+// error that occurred in the process.
+static enum iuab_error iuab_jit_x86_64_relax(
+    const struct iuab_buffer *code,
+    const struct iuab_buffer *fixups,
+    struct iuab_buffer *dst,
+    size_t *saved_size_dst,
+    size_t *padding_size_dst
+) {
+    struct iuab_jit_x86_64_layout layout = {
+        .code = code->data,
+        .fixups = (const struct iuab_jit_x86_64_fixup *) fixups->data,
+        .fixup_count = fixups->size / sizeof(struct iuab_jit_x86_64_fixup),
+    };
+    // One more element avoids allocating none, which may fail.
+    layout.is_long = calloc(layout.fixup_count + 1, sizeof(bool));
+    layout.shifts = malloc((layout.fixup_count + 1) * sizeof(ssize_t));
+    enum iuab_error error = IUAB_ERROR_MALLOC;
+
+    if (layout.is_long && layout.shifts) {
+        do {
+            iuab_jit_x86_64_layout_shift(&layout);
+        } while (iuab_jit_x86_64_layout_lengthen(&layout));
+
+        error = iuab_jit_x86_64_emit_layout(&layout, code->size, dst);
+        *saved_size_dst = layout.saved_size;
+        *padding_size_dst = layout.padding_size;
     }
 
+    free(layout.is_long);
+    free(layout.shifts);
     return error;
 }
 
 enum iuab_error iuab_compile_jit_x86_64(
-    FILE *src,
+    const struct iuab_ir *ir,
+    bool is_memory_guarded,
     struct iuab_buffer *dst,
+    struct iuab_jit_x86_64_stats *stats_dst,
     struct iuab_token *last_token_dst
 ) {
+    // The code is emitted with long jumps and its jumps are patched in an
+    // ordinary buffer, then laid out and written at once to the executable
+    // one.
+    struct iuab_buffer code;
+    enum iuab_error error = iuab_buffer_init(&code);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
     struct iuab_jit_x86_64_compiler compiler;
-    enum iuab_error error = iuab_jit_x86_64_compiler_init(&compiler, src, dst);
+    error = iuab_jit_x86_64_compiler_init(
+        &compiler,
+        ir,
+        is_memory_guarded,
+        &code
+    );
 
     if (error != IUAB_ERROR_SUCCESS) {
-        *last_token_dst = compiler.token;
+        iuab_buffer_fini(&code);
         return error;
     }
 
-    error = iuab_jit_x86_64_emit_header(dst);
+    error = iuab_jit_x86_64_emit_header(&code);
 
     if (error != IUAB_ERROR_SUCCESS) {
-        *last_token_dst = compiler.token;
         iuab_jit_x86_64_compiler_fini(&compiler);
+        iuab_buffer_fini(&code);
         return error;
     }
 
-    while (compiler.token.type != IUAB_TOKEN_EOF) {
+    const struct iuab_ir_node *nodes = iuab_ir_nodes(ir);
+    size_t size = iuab_ir_size(ir);
+
+    for (size_t i = 0; i < size; i++) {
+        compiler.node = &nodes[i];
         error = iuab_jit_x86_64_emit(&compiler);
 
         if (error != IUAB_ERROR_SUCCESS) {
-            *last_token_dst = compiler.token;
+            *last_token_dst = nodes[i].token;
             iuab_jit_x86_64_compiler_fini(&compiler);
+            iuab_buffer_fini(&code);
             return error;
         }
     }
 
-    *last_token_dst = compiler.token;
+    error = iuab_jit_x86_64_evict_cell(&compiler);
 
-    if (compiler.loop_stack.size != 0) {
-        iuab_jit_x86_64_compiler_fini(&compiler);
-        return IUAB_ERROR_COMPILER_UNCLOSED_LOOPS;
+    if (error == IUAB_ERROR_SUCCESS) {
+        error = iuab_jit_x86_64_emit_footer(&compiler.jumps, &code);
+    }
+
+    struct iuab_buffer relaxed;
+
+    if (error == IUAB_ERROR_SUCCESS) {
+        error = iuab_buffer_init(&relaxed);
+    }
+
+    if (error == IUAB_ERROR_SUCCESS) {
+        error = iuab_jit_x86_64_relax(
+            &code,
+            &compiler.fixups,
+            &relaxed,
+            &stats_dst->relaxation_saved_size,
+            &stats_dst->alignment_padding_size
+        );
+
+        if (error == IUAB_ERROR_SUCCESS) {
+            stats_dst->peephole_saved_size = compiler.saved_size;
+            stats_dst->peephole_saved_instructions =
+                compiler.saved_instructions;
+            error = iuab_buffer_write_jit(dst, relaxed.data, relaxed.size);
+        }
+
+        iuab_buffer_fini(&relaxed);
     }
 
-    error = iuab_jit_x86_64_emit_footer(&compiler.jumps, dst);
     iuab_jit_x86_64_compiler_fini(&compiler);
+    iuab_buffer_fini(&code);
     return error;
 }
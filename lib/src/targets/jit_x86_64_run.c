@@ -1,12 +1,105 @@
 // Copyright (C) 2022 OverMighty
 // SPDX-License-Identifier: GPL-3.0-only
 
+// Needed for `REG_RIP`.
+#define _GNU_SOURCE
+
 #include "iuab/context.h"
 #include "iuab/errors.h"
 
-enum iuab_error iuab_run_jit_x86_64(struct iuab_context *ctx) {
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <ucontext.h>
+
+// A run of a JIT-compiled program from a context with guarded memory.
+struct iuab_jit_x86_64_guarded_run {
+    struct iuab_context *ctx;
+    sigjmp_buf fault_env;
+};
+
+// The guarded run of the current thread, if any.
+static __thread struct iuab_jit_x86_64_guarded_run *iuab_jit_x86_64_run;
+
+// The `SIGSEGV` action replaced by the fault handler, installed once for all
+// threads at the first guarded run, which chains to it.
+static struct sigaction iuab_jit_x86_64_prev_action;
+static pthread_once_t iuab_jit_x86_64_handler_once = PTHREAD_ONCE_INIT;
+
+// Handles a fault outside of the guard regions of the current guarded run, if
+// any, with the replaced action.
+static void
+iuab_jit_x86_64_chain_fault(int sig, siginfo_t *info, void *ucontext) {
+    const struct sigaction *prev = &iuab_jit_x86_64_prev_action;
+
+    if (prev->sa_flags & SA_SIGINFO) {
+        prev->sa_sigaction(sig, info, ucontext);
+    } else if (prev->sa_handler != SIG_DFL && prev->sa_handler != SIG_IGN) {
+        prev->sa_handler(sig);
+    } else {
+        // Faults cannot be ignored: the default action terminates the process
+        // when the faulting instruction runs again.
+        signal(sig, SIG_DFL);
+    }
+}
+
+static void
+iuab_jit_x86_64_handle_fault(int sig, siginfo_t *info, void *ucontext) {
+    struct iuab_jit_x86_64_guarded_run *run = iuab_jit_x86_64_run;
+
+    if (!run || !iuab_context_is_guard_address(run->ctx, info->si_addr)) {
+        iuab_jit_x86_64_chain_fault(sig, info, ucontext);
+        return;
+    }
+
+#if defined(__linux__) && defined(__x86_64__)
+    ucontext_t *uc = ucontext;
+    run->ctx->ip = (const uint8_t *) uc->uc_mcontext.gregs[REG_RIP];
+#else
+    (void) ucontext;
+#endif
+
+    siglongjmp(run->fault_env, 1);
+}
+
+static void iuab_jit_x86_64_install_handler(void) {
+    struct sigaction action = {
+        .sa_sigaction = iuab_jit_x86_64_handle_fault,
+        .sa_flags = SA_SIGINFO,
+    };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &iuab_jit_x86_64_prev_action);
+}
+
+static enum iuab_error iuab_jit_x86_64_call(struct iuab_context *ctx) {
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wpedantic"
     return ((enum iuab_error(*)(struct iuab_context *)) ctx->ip)(ctx);
 #pragma GCC diagnostic pop
 }
+
+enum iuab_error iuab_run_jit_x86_64(struct iuab_context *ctx) {
+    if (!iuab_context_is_guarded(ctx)) {
+        return iuab_context_end_run(ctx, iuab_jit_x86_64_call(ctx));
+    }
+
+    struct iuab_jit_x86_64_guarded_run run = { .ctx = ctx };
+    pthread_once(
+        &iuab_jit_x86_64_handler_once,
+        iuab_jit_x86_64_install_handler
+    );
+    iuab_jit_x86_64_run = &run;
+
+    enum iuab_error error;
+
+    if (sigsetjmp(run.fault_env, 1) == 0) {
+        error = iuab_jit_x86_64_call(ctx);
+    } else {
+        error = IUAB_ERROR_DP_OUT_OF_BOUNDS;
+    }
+
+    iuab_jit_x86_64_run = NULL;
+    return iuab_context_end_run(ctx, error);
+}
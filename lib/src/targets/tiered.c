@@ -0,0 +1,399 @@
+// Copyright (C) 2022 OverMighty
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "iuab/targets/tiered.h"
+
+#include "iuab/buffer.h"
+#include "iuab/context.h"
+#include "iuab/errors.h"
+#include "iuab/ir.h"
+#include "iuab/targets/bytecode.h"
+#include "iuab/targets/jit_x86_64.h"
+#include "iuab/token.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Loops are only JIT-compiled where the interpreter would use JIT compilation.
+#if defined(__x86_64__) && defined(IUAB_USE_JIT)
+    #define IUAB_TIERED_JIT
+#endif
+
+#ifdef IUAB_TIERED_JIT
+
+// A lifter of a loop of a bytecode program into intermediate representation.
+struct iuab_tiered_lifter {
+    struct iuab_ir *ir;
+    // The offsets of the ends of the loops being lifted, innermost last.
+    struct iuab_buffer loop_ends;
+};
+
+// Appends the node running the instruction with the given opcode, operands and
+// data. Returns false if the instruction cannot be lifted or an error occurred,
+// otherwise true.
+static bool iuab_tiered_lift_op(
+    struct iuab_tiered_lifter *lifter,
+    uint8_t op,
+    const int32_t *operands,
+    const uint8_t *data
+) {
+    struct iuab_ir_node node = { .op = IUAB_IR_OP_MOVE };
+    enum iuab_error error = IUAB_ERROR_SUCCESS;
+
+    switch (op) {
+    case IUAB_BYTECODE_OP_ADDP: node.value = operands[0]; break;
+    case IUAB_BYTECODE_OP_SUBP: node.value = -operands[0]; break;
+    case IUAB_BYTECODE_OP_ADDV:
+        node.op = IUAB_IR_OP_ADD;
+        node.value = operands[0];
+        break;
+    case IUAB_BYTECODE_OP_SUBV:
+        node.op = IUAB_IR_OP_ADD;
+        node.value = -operands[0];
+        break;
+    case IUAB_BYTECODE_OP_WRITE: node.op = IUAB_IR_OP_WRITE; break;
+    case IUAB_BYTECODE_OP_READ: node.op = IUAB_IR_OP_READ; break;
+    case IUAB_BYTECODE_OP_JMPZ:
+    case IUAB_BYTECODE_OP_JMPZ8:
+        node.op = IUAB_IR_OP_LOOP;
+        error =
+            iuab_buffer_write_size(&lifter->loop_ends, (size_t) operands[0]);
+        break;
+    case IUAB_BYTECODE_OP_JMPNZ:
+    case IUAB_BYTECODE_OP_JMPNZ8:
+        node.op = IUAB_IR_OP_END_LOOP;
+        iuab_buffer_pop_size(&lifter->loop_ends);
+        break;
+    case IUAB_BYTECODE_OP_SET:
+        node.op = IUAB_IR_OP_SET;
+        node.value = operands[0];
+        break;
+    case IUAB_BYTECODE_OP_MULADD:
+        node.op = IUAB_IR_OP_MULADD;
+        node.offset = operands[1];
+        node.value = operands[0];
+        break;
+    case IUAB_BYTECODE_OP_SCAN:
+        node.op = IUAB_IR_OP_SCAN;
+        node.value = operands[0];
+        break;
+    case IUAB_BYTECODE_OP_ADDVO:
+        node.op = IUAB_IR_OP_ADD;
+        node.offset = operands[1];
+        node.value = operands[0];
+        break;
+    case IUAB_BYTECODE_OP_SETO:
+        node.op = IUAB_IR_OP_SET;
+        node.offset = operands[1];
+        node.value = operands[0];
+        break;
+    case IUAB_BYTECODE_OP_CHECK:
+        node.op = IUAB_IR_OP_CHECK;
+        node.offset = operands[0];
+        node.value = operands[1];
+        break;
+    case IUAB_BYTECODE_OP_MOVP:
+        node.op = IUAB_IR_OP_MOVE_UNCHECKED;
+        node.value = operands[0];
+        break;
+    case IUAB_BYTECODE_OP_STORE:
+        node.op = IUAB_IR_OP_STORE_DATA;
+        node.offset = operands[0];
+        node.value = operands[1];
+        error = iuab_ir_append_data(
+            lifter->ir,
+            data,
+            (uint32_t) node.value,
+            &node.link
+        );
+        break;
+    case IUAB_BYTECODE_OP_WRITES:
+        node.op = IUAB_IR_OP_WRITE_DATA;
+        node.value = operands[0];
+        error = iuab_ir_append_data(
+            lifter->ir,
+            data,
+            (uint32_t) node.value,
+            &node.link
+        );
+        break;
+    // The debugging event handler expects the instruction pointer to be in
+    // the program.
+    default: return false;
+    }
+
+    return error == IUAB_ERROR_SUCCESS
+           && iuab_ir_append(lifter->ir, &node) == IUAB_ERROR_SUCCESS;
+}
+
+// Appends the end of each loop being lifted that ends at `offset` without a
+// jump back to the start of its body. Returns false if one of them may run more
+// than once as a loop of intermediate representation or an error occurred,
+// otherwise true.
+static bool
+iuab_tiered_lift_loop_ends(struct iuab_tiered_lifter *lifter, size_t offset) {
+    while (lifter->loop_ends.size != 0
+           && iuab_buffer_peek_size(&lifter->loop_ends) == offset) {
+        iuab_buffer_pop_size(&lifter->loop_ends);
+        struct iuab_ir_node node = { .op = IUAB_IR_OP_END_LOOP };
+
+        if (iuab_ir_append(lifter->ir, &node) != IUAB_ERROR_SUCCESS
+            || !iuab_ir_is_loop_once(
+                &iuab_ir_nodes(lifter->ir)[iuab_ir_size(lifter->ir) - 1]
+            )) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Lifts into the given empty intermediate representation the loop of the valid
+// program pointed to by `program` whose body starts at `start` and which ends
+// at `end` with a jump back to it. Returns false if it cannot be lifted or an
+// error occurred, otherwise true.
+static bool iuab_tiered_lift(
+    struct iuab_ir *ir,
+    const uint8_t *program,
+    size_t start,
+    size_t end
+) {
+    struct iuab_tiered_lifter lifter = { .ir = ir };
+    struct iuab_ir_node loop = { .op = IUAB_IR_OP_LOOP };
+
+    if (iuab_buffer_init(&lifter.loop_ends) != IUAB_ERROR_SUCCESS) {
+        return false;
+    }
+
+    bool is_lifted =
+        iuab_buffer_write_size(&lifter.loop_ends, end) == IUAB_ERROR_SUCCESS
+        && iuab_ir_append(ir, &loop) == IUAB_ERROR_SUCCESS;
+    struct iuab_bytecode_instr instr;
+
+    for (size_t offset = start; is_lifted && offset < end;
+         offset += instr.size) {
+        is_lifted = iuab_tiered_lift_loop_ends(&lifter, offset);
+        iuab_bytecode_decode(program, offset, &instr);
+        uint8_t first;
+        uint8_t second;
+
+        if (!iuab_bytecode_split(instr.op, &first, &second)) {
+            is_lifted = is_lifted
+                        && iuab_tiered_lift_op(
+                            &lifter,
+                            instr.op,
+                            instr.operands,
+                            instr.data
+                        );
+            continue;
+        }
+
+        is_lifted = is_lifted
+                    && iuab_tiered_lift_op(
+                        &lifter,
+                        first,
+                        instr.operands,
+                        instr.data
+                    )
+                    && iuab_tiered_lift_op(
+                        &lifter,
+                        second,
+                        &instr.operands[iuab_bytecode_operand_count(first)],
+                        instr.data
+                    );
+    }
+
+    is_lifted = is_lifted && lifter.loop_ends.size == 0
+                && iuab_ir_link_loops(ir) == IUAB_ERROR_SUCCESS;
+    iuab_buffer_fini(&lifter.loop_ends);
+    return is_lifted;
+}
+
+// A JIT-compiled loop of a program.
+struct iuab_tiered_loop {
+    // The code of the loop, which starts with its jump to its end.
+    struct iuab_buffer code;
+    // The offset of the end of the loop in the program.
+    size_t end;
+};
+
+// A tiered run of a program.
+struct iuab_tiered_run {
+    struct iuab_context *ctx;
+    // The number of times the program jumped back to each offset, up to
+    // `IUAB_TIERED_HOT_LOOP_THRESHOLD`.
+    uint32_t *counts;
+    // The index in `loops` of the loop whose body starts at each offset of the
+    // program, or `SIZE_MAX` if no loop compiled starts there.
+    size_t *loop_indices;
+    struct iuab_buffer loops;
+};
+
+static enum iuab_error iuab_tiered_run_init(
+    struct iuab_tiered_run *run,
+    struct iuab_context *ctx,
+    size_t program_size
+) {
+    run->ctx = ctx;
+    run->counts = calloc(program_size, sizeof(uint32_t));
+    run->loop_indices = malloc(program_size * sizeof(size_t));
+
+    if (!run->counts || !run->loop_indices
+        || iuab_buffer_init(&run->loops) != IUAB_ERROR_SUCCESS) {
+        free(run->counts);
+        free(run->loop_indices);
+        return IUAB_ERROR_MALLOC;
+    }
+
+    for (size_t i = 0; i < program_size; i++) {
+        run->loop_indices[i] = SIZE_MAX;
+    }
+
+    return IUAB_ERROR_SUCCESS;
+}
+
+static void iuab_tiered_run_fini(struct iuab_tiered_run *run) {
+    struct iuab_tiered_loop *loops =
+        (struct iuab_tiered_loop *) run->loops.data;
+    size_t loop_count = run->loops.size / sizeof(*loops);
+
+    for (size_t i = 0; i < loop_count; i++) {
+        iuab_buffer_fini_jit(&loops[i].code);
+    }
+
+    iuab_buffer_fini(&run->loops);
+    free(run->counts);
+    free(run->loop_indices);
+}
+
+// JIT-compiles the loop of the program whose body starts at `start` and which
+// ends with the jump back to it at `jump`, so that its code runs whenever its
+// body starts, unless it fails to compile.
+static void iuab_tiered_compile_loop(
+    struct iuab_tiered_run *run,
+    size_t start,
+    size_t jump
+) {
+    const uint8_t *program = run->ctx->program;
+    struct iuab_bytecode_instr instr;
+    iuab_bytecode_decode(program, jump, &instr);
+    struct iuab_tiered_loop loop = { .end = jump + instr.size };
+    struct iuab_ir ir;
+
+    if (iuab_ir_init(&ir) != IUAB_ERROR_SUCCESS) {
+        return;
+    }
+
+    bool is_lifted = iuab_tiered_lift(&ir, program, start, loop.end);
+
+    if (!is_lifted || iuab_buffer_init_jit(&loop.code) != IUAB_ERROR_SUCCESS) {
+        iuab_ir_fini(&ir);
+        return;
+    }
+
+    struct iuab_jit_x86_64_stats stats;
+    struct iuab_token last_token;
+    // The memory of the context may not be guarded.
+    enum iuab_error error = iuab_compile_jit_x86_64(
+        &ir,
+        false,
+        &loop.code,
+        &stats,
+        &last_token
+    );
+
+    if (error == IUAB_ERROR_SUCCESS) {
+        run->loop_indices[start] = run->loops.size / sizeof(loop);
+        error = iuab_buffer_write(&run->loops, &loop, sizeof(loop));
+    }
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        run->loop_indices[start] = SIZE_MAX;
+        iuab_buffer_fini_jit(&loop.code);
+    }
+
+    iuab_ir_fini(&ir);
+}
+
+// Runs the code of the loop compiled from the one whose body starts at `start`
+// and moves the instruction pointer of the context to its end. Returns the
+// error that occurred in the process.
+static enum iuab_error
+iuab_tiered_run_loop(struct iuab_tiered_run *run, size_t start) {
+    struct iuab_context *ctx = run->ctx;
+    const struct iuab_tiered_loop *loop = &(
+        (const struct iuab_tiered_loop *) run->loops.data
+    )[run->loop_indices[start]];
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+    enum iuab_error error =
+        ((enum iuab_error(*)(struct iuab_context *)) loop->code.data)(ctx);
+#pragma GCC diagnostic pop
+    ctx->ip = &ctx->program[error == IUAB_ERROR_SUCCESS ? loop->end : start];
+    return error;
+}
+
+// Runs the program, interpreting it until its loops get hot.
+static enum iuab_error iuab_tiered_run(struct iuab_tiered_run *run) {
+    struct iuab_context *ctx = run->ctx;
+
+    while (*ctx->ip != IUAB_BYTECODE_OP_RET) {
+        const uint8_t *ip = ctx->ip;
+        enum iuab_error error = iuab_bytecode_step(ctx);
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
+
+        size_t offset = (size_t) (ctx->ip - ctx->program);
+
+        // Only jumps at the end of loops go back, to the start of their body.
+        if (ctx->ip <= ip
+            && run->counts[offset] < IUAB_TIERED_HOT_LOOP_THRESHOLD
+            && ++run->counts[offset] == IUAB_TIERED_HOT_LOOP_THRESHOLD) {
+            iuab_tiered_compile_loop(run, offset, (size_t) (ip - ctx->program));
+        }
+
+        if (run->loop_indices[offset] != SIZE_MAX) {
+            error = iuab_tiered_run_loop(run, offset);
+
+            if (error != IUAB_ERROR_SUCCESS) {
+                return error;
+            }
+        }
+    }
+
+    return IUAB_ERROR_SUCCESS;
+}
+
+#endif
+
+enum iuab_error iuab_run_tiered(struct iuab_context *ctx) {
+    size_t program_size = iuab_bytecode_measure(ctx->program);
+    enum iuab_error error = iuab_bytecode_verify(ctx->program, program_size);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+#ifdef IUAB_TIERED_JIT
+    if (!iuab_bytecode_can_run(ctx)) {
+        return IUAB_ERROR_DP_OUT_OF_BOUNDS;
+    }
+
+    struct iuab_tiered_run run;
+    error = iuab_tiered_run_init(&run, ctx, program_size);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    error = iuab_tiered_run(&run);
+    iuab_tiered_run_fini(&run);
+    return iuab_context_end_run(ctx, error);
+#else
+    return iuab_run_verified_bytecode(ctx);
+#endif
+}
@@ -0,0 +1,162 @@
+// Copyright (C) 2022 OverMighty
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Checks that bytecode files with headers describing sections out of their
+// bounds are rejected, and that the prepared program of loaded files can be run
+// more than once.
+
+#include "iuab/buffer.h"
+#include "iuab/context.h"
+#include "iuab/errors.h"
+#include "iuab/targets/bytecode.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// A header field of a bytecode file and the value a crafted file sets it to.
+struct crafted_file {
+    const char *name;
+    size_t field_offset;
+    uint64_t value;
+};
+
+static const struct crafted_file crafted_files[] = {
+    // The program and its padding would wrap around the end of the address
+    // space.
+    {
+        "program size wrapping around with the padding",
+        offsetof(struct iuab_bytecode_file_header, program_size),
+        UINT64_MAX - IUAB_BYTECODE_FILE_PADDING + 1,
+    },
+    {
+        "program size past the end of the file",
+        offsetof(struct iuab_bytecode_file_header, program_size),
+        UINT64_MAX / 2,
+    },
+    {
+        "program offset past the end of the file",
+        offsetof(struct iuab_bytecode_file_header, program_offset),
+        UINT64_MAX - IUAB_BYTECODE_ALIGNMENT + 1,
+    },
+    {
+        "source map offset past the end of the file",
+        offsetof(struct iuab_bytecode_file_header, source_map_offset),
+        UINT64_MAX - IUAB_BYTECODE_ALIGNMENT + 1,
+    },
+};
+
+#define NUM_CRAFTED_FILES (sizeof(crafted_files) / sizeof(crafted_files[0]))
+
+// Writes to the file pointed to by `out` a valid bytecode file storing a
+// program made of a single `IUAB_BYTECODE_OP_RET` instruction. Returns the
+// error that occurred in the process.
+static enum iuab_error write_file(FILE *out) {
+    struct iuab_buffer program;
+    enum iuab_error error = iuab_buffer_init(&program);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    error = iuab_buffer_write_u8(&program, IUAB_BYTECODE_OP_RET);
+
+    if (error == IUAB_ERROR_SUCCESS) {
+        error = iuab_bytecode_save(&program, NULL, out);
+    }
+
+    iuab_buffer_fini(&program);
+    return error;
+}
+
+// Loads the bytecode file open as the file pointed to by `in` and runs its
+// prepared program twice. Returns the error that occurred in the process.
+static enum iuab_error load_file(FILE *in) {
+    struct iuab_bytecode_file file;
+    enum iuab_error error = iuab_bytecode_load(&file, in);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    struct iuab_context *ctx = malloc(sizeof(*ctx));
+
+    if (!ctx) {
+        error = IUAB_ERROR_MALLOC;
+    }
+
+    for (int i = 0; i < 2 && error == IUAB_ERROR_SUCCESS; i++) {
+        iuab_context_init(ctx, file.program, stdin, stdout, NULL);
+        error = iuab_run_prepared_bytecode(ctx, &file.prepared);
+        iuab_context_fini(ctx);
+    }
+
+    free(ctx);
+    iuab_bytecode_unload(&file);
+    return error;
+}
+
+// Checks that the bytecode file open as the file pointed to by `file` is
+// rejected once the given header field is set. Returns false if it is not.
+static bool check_crafted_file(FILE *file, const struct crafted_file *crafted) {
+    enum iuab_error error = IUAB_ERROR_IO;
+
+    if (fseek(file, (long) crafted->field_offset, SEEK_SET) == 0
+        && fwrite(&crafted->value, sizeof(crafted->value), 1, file) == 1
+        && fflush(file) == 0) {
+        error = load_file(file);
+    }
+
+    if (error != IUAB_ERROR_BYTECODE_INVALID_FILE) {
+        fprintf(
+            stderr,
+            "error: %s: expected \"%s\", got \"%s\"\n",
+            crafted->name,
+            iuab_strerror(IUAB_ERROR_BYTECODE_INVALID_FILE),
+            iuab_strerror(error)
+        );
+        return false;
+    }
+
+    return true;
+}
+
+int main(void) {
+    bool is_ok = true;
+
+    for (size_t i = 0; i < NUM_CRAFTED_FILES; i++) {
+        FILE *file = tmpfile();
+
+        if (!file) {
+            perror("error: failed to create temporary file");
+            return EXIT_FAILURE;
+        }
+
+        enum iuab_error error = write_file(file);
+
+        if (error == IUAB_ERROR_SUCCESS && fflush(file) != 0) {
+            error = IUAB_ERROR_IO;
+        }
+
+        if (error == IUAB_ERROR_SUCCESS) {
+            error = load_file(file);
+        }
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            fprintf(
+                stderr,
+                "error: failed to write and load bytecode file: %s\n",
+                iuab_strerror(error)
+            );
+            fclose(file);
+            return EXIT_FAILURE;
+        }
+
+        is_ok = check_crafted_file(file, &crafted_files[i]) && is_ok;
+        fclose(file);
+    }
+
+    return is_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
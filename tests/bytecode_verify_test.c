@@ -0,0 +1,422 @@
+// Copyright (C) 2022 OverMighty
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Checks that crafted bytecode programs with invalid operands or memory
+// accesses not proven within the bounds of the memory are rejected by the
+// verifier, and that the programs compiled from the source files given as
+// arguments at each optimization level are not.
+
+#include "iuab/buffer.h"
+#include "iuab/context.h"
+#include "iuab/errors.h"
+#include "iuab/ir.h"
+#include "iuab/targets.h"
+#include "iuab/token.h"
+#include "iuab/targets/bytecode.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_CRAFTED_INSTRS 8
+
+// An instruction of a crafted program with its operands, the offsets of jumps
+// being given as the index of the instruction they jump to.
+struct crafted_instr {
+    uint8_t op;
+    int32_t operands[2];
+};
+
+// A crafted program, ending with its first `IUAB_BYTECODE_OP_RET`
+// instruction, and the error verifying it is expected to return.
+struct crafted_program {
+    const char *name;
+    struct crafted_instr instrs[MAX_CRAFTED_INSTRS];
+    enum iuab_error expected;
+};
+
+static const struct crafted_program crafted_programs[] = {
+    {
+        "valid scans and check",
+        {
+            { IUAB_BYTECODE_OP_SCAN, { 1 } },
+            { IUAB_BYTECODE_OP_SCAN, { -4 } },
+            { IUAB_BYTECODE_OP_SCAN, { IUAB_CONTEXT_MEMORY_SIZE } },
+            { IUAB_BYTECODE_OP_CHECK, { -2, 2 } },
+            { IUAB_BYTECODE_OP_RET },
+        },
+        IUAB_ERROR_SUCCESS,
+    },
+    {
+        "scan by 0",
+        { { IUAB_BYTECODE_OP_SCAN, { 0 } }, { IUAB_BYTECODE_OP_RET } },
+        IUAB_ERROR_BYTECODE_INVALID_OPERAND,
+    },
+    {
+        "scan by INT32_MIN",
+        { { IUAB_BYTECODE_OP_SCAN, { INT32_MIN } }, { IUAB_BYTECODE_OP_RET } },
+        IUAB_ERROR_BYTECODE_INVALID_OPERAND,
+    },
+    {
+        "scan by a stride that is not a power of two",
+        { { IUAB_BYTECODE_OP_SCAN, { 3 } }, { IUAB_BYTECODE_OP_RET } },
+        IUAB_ERROR_BYTECODE_INVALID_OPERAND,
+    },
+    {
+        "scan by more than the size of the memory",
+        {
+            { IUAB_BYTECODE_OP_SCAN, { 2 * IUAB_CONTEXT_MEMORY_SIZE } },
+            { IUAB_BYTECODE_OP_RET },
+        },
+        IUAB_ERROR_BYTECODE_INVALID_OPERAND,
+    },
+    {
+        "check with offsets out of order",
+        { { IUAB_BYTECODE_OP_CHECK, { 1, -1 } }, { IUAB_BYTECODE_OP_RET } },
+        IUAB_ERROR_BYTECODE_INVALID_OPERAND,
+    },
+    {
+        "unchecked move to the end of the memory from its start",
+        {
+            { IUAB_BYTECODE_OP_MOVP, { IUAB_CONTEXT_MEMORY_SIZE - 1 } },
+            { IUAB_BYTECODE_OP_SETO, { 65, -1 } },
+            { IUAB_BYTECODE_OP_RET },
+        },
+        IUAB_ERROR_SUCCESS,
+    },
+    {
+        "unchecked move before the start of the memory",
+        {
+            { IUAB_BYTECODE_OP_MOVP, { -200000 } },
+            { IUAB_BYTECODE_OP_SET, { 65 } },
+            { IUAB_BYTECODE_OP_RET },
+        },
+        IUAB_ERROR_BYTECODE_UNCHECKED_ACCESS,
+    },
+    {
+        "unchecked move past the end of the memory",
+        {
+            { IUAB_BYTECODE_OP_MOVP, { 100000000 } },
+            { IUAB_BYTECODE_OP_SET, { 65 } },
+            { IUAB_BYTECODE_OP_RET },
+        },
+        IUAB_ERROR_BYTECODE_UNCHECKED_ACCESS,
+    },
+    {
+        "checked accesses and moves",
+        {
+            { IUAB_BYTECODE_OP_SCAN, { 1 } },
+            { IUAB_BYTECODE_OP_CHECK, { -3, 4 } },
+            { IUAB_BYTECODE_OP_MOVP, { 4 } },
+            { IUAB_BYTECODE_OP_ADDP, { 1 } },
+            { IUAB_BYTECODE_OP_MULADD, { 2, -8 } },
+            { IUAB_BYTECODE_OP_STORE, { -8, 9 } },
+            { IUAB_BYTECODE_OP_RET },
+        },
+        IUAB_ERROR_SUCCESS,
+    },
+    {
+        "store past the checked values",
+        {
+            { IUAB_BYTECODE_OP_SCAN, { 1 } },
+            { IUAB_BYTECODE_OP_CHECK, { 0, 3 } },
+            { IUAB_BYTECODE_OP_STORE, { 0, 5 } },
+            { IUAB_BYTECODE_OP_RET },
+        },
+        IUAB_ERROR_BYTECODE_UNCHECKED_ACCESS,
+    },
+    {
+        "unchecked access after a checked move",
+        {
+            { IUAB_BYTECODE_OP_SCAN, { 1 } },
+            { IUAB_BYTECODE_OP_CHECK, { 0, 1 } },
+            { IUAB_BYTECODE_OP_SUBP, { 1 } },
+            { IUAB_BYTECODE_OP_ADDVO, { 1, 3 } },
+            { IUAB_BYTECODE_OP_RET },
+        },
+        IUAB_ERROR_BYTECODE_UNCHECKED_ACCESS,
+    },
+    {
+        "unchecked access after a call of the debugging event handler",
+        {
+            { IUAB_BYTECODE_OP_DEBUG, { 0 } },
+            { IUAB_BYTECODE_OP_ADDVO, { 1, 1 } },
+            { IUAB_BYTECODE_OP_RET },
+        },
+        IUAB_ERROR_BYTECODE_UNCHECKED_ACCESS,
+    },
+    {
+        "unchecked access at the start of the body of a loop",
+        {
+            { IUAB_BYTECODE_OP_CHECK, { 0, 1 } },
+            { IUAB_BYTECODE_OP_JMPZ, { 4 } },
+            { IUAB_BYTECODE_OP_SETO, { 0, 1 } },
+            { IUAB_BYTECODE_OP_JMPNZ, { 2 } },
+            { IUAB_BYTECODE_OP_RET },
+        },
+        IUAB_ERROR_BYTECODE_UNCHECKED_ACCESS,
+    },
+    {
+        "unchecked access after a loop running at most once",
+        {
+            { IUAB_BYTECODE_OP_SCAN, { 1 } },
+            { IUAB_BYTECODE_OP_JMPZ, { 3 } },
+            { IUAB_BYTECODE_OP_CHECK, { 0, 1 } },
+            { IUAB_BYTECODE_OP_ADDVO, { 1, 1 } },
+            { IUAB_BYTECODE_OP_RET },
+        },
+        IUAB_ERROR_BYTECODE_UNCHECKED_ACCESS,
+    },
+};
+
+#define NUM_CRAFTED_PROGRAMS \
+    (sizeof(crafted_programs) / sizeof(crafted_programs[0]))
+
+// Writes the `size` bytes of the given operand after padding aligning it to
+// its size. Returns the error that occurred in the process.
+static enum iuab_error
+write_operand(struct iuab_buffer *dst, const void *operand, size_t size) {
+    while (dst->size % size != 0) {
+        enum iuab_error error = iuab_buffer_write_u8(dst, 0);
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
+    }
+
+    return iuab_buffer_write(dst, operand, size);
+}
+
+// Writes the offset from the end of the jump being written, whose offset of
+// size `size` is next, to the instruction at `target` in the program, of which
+// `offsets` are those of the instructions. Returns the error that occurred in
+// the process.
+static enum iuab_error write_jump_offset(
+    struct iuab_buffer *dst,
+    const size_t *offsets,
+    int32_t target,
+    size_t size
+) {
+    size_t end = (dst->size + size - 1) / size * size + size;
+    int32_t offset = (int32_t) offsets[target] - (int32_t) end;
+
+    if (size == sizeof(int8_t)) {
+        return iuab_buffer_write_u8(dst, (uint8_t) (int8_t) offset);
+    }
+
+    return write_operand(dst, &offset, size);
+}
+
+// Writes the given instruction, of which the jumps use the offsets of the
+// instructions of the program given by `offsets`. Returns the error that
+// occurred in the process.
+static enum iuab_error write_instr(
+    struct iuab_buffer *dst,
+    const struct crafted_instr *instr,
+    const size_t *offsets
+) {
+    enum iuab_error error = iuab_buffer_write_u8(dst, instr->op);
+    int32_t a = instr->operands[0];
+    int32_t b = instr->operands[1];
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    switch (instr->op) {
+    case IUAB_BYTECODE_OP_ADDP:
+    case IUAB_BYTECODE_OP_SUBP: {
+        uint16_t value = (uint16_t) a;
+        return write_operand(dst, &value, sizeof(value));
+    }
+    case IUAB_BYTECODE_OP_ADDV:
+    case IUAB_BYTECODE_OP_SUBV:
+    case IUAB_BYTECODE_OP_SET: return iuab_buffer_write_u8(dst, (uint8_t) a);
+    case IUAB_BYTECODE_OP_JMPZ:
+    case IUAB_BYTECODE_OP_JMPNZ:
+        return write_jump_offset(dst, offsets, a, sizeof(int32_t));
+    case IUAB_BYTECODE_OP_JMPZ8:
+    case IUAB_BYTECODE_OP_JMPNZ8:
+        return write_jump_offset(dst, offsets, a, sizeof(int8_t));
+    case IUAB_BYTECODE_OP_MULADD:
+    case IUAB_BYTECODE_OP_ADDVO:
+    case IUAB_BYTECODE_OP_SETO: {
+        int16_t offset = (int16_t) b;
+        error = iuab_buffer_write_u8(dst, (uint8_t) a);
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
+
+        return write_operand(dst, &offset, sizeof(offset));
+    }
+    case IUAB_BYTECODE_OP_SCAN:
+    case IUAB_BYTECODE_OP_MOVP: return write_operand(dst, &a, sizeof(a));
+    case IUAB_BYTECODE_OP_CHECK: {
+        int16_t min = (int16_t) a;
+        int16_t max = (int16_t) b;
+        error = write_operand(dst, &min, sizeof(min));
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            return error;
+        }
+
+        return iuab_buffer_write(dst, &max, sizeof(max));
+    }
+    case IUAB_BYTECODE_OP_STORE: {
+        // The data are zeros.
+        uint32_t size = (uint32_t) b;
+        error = write_operand(dst, &a, sizeof(a));
+
+        if (error == IUAB_ERROR_SUCCESS) {
+            error = iuab_buffer_write(dst, &size, sizeof(size));
+        }
+
+        for (uint32_t i = 0; error == IUAB_ERROR_SUCCESS && i < size; i++) {
+            error = iuab_buffer_write_u8(dst, 0);
+        }
+
+        return error;
+    }
+    default: return IUAB_ERROR_SUCCESS;
+    }
+}
+
+// Assembles the given crafted program into the given buffer, followed by
+// `IUAB_BYTECODE_FILE_PADDING` zeros, and writes its size at the location
+// pointed to by `size_dst`. Returns the error that occurred in the process.
+static enum iuab_error assemble(
+    struct iuab_buffer *dst,
+    const struct crafted_program *program,
+    size_t *size_dst
+) {
+    size_t offsets[MAX_CRAFTED_INSTRS] = { 0 };
+    enum iuab_error error = IUAB_ERROR_SUCCESS;
+
+    // Instructions are the same size whatever the offsets of jumps, which are
+    // only known after a first pass.
+    for (int pass = 0; pass < 2 && error == IUAB_ERROR_SUCCESS; pass++) {
+        dst->size = 0;
+
+        for (size_t i = 0; error == IUAB_ERROR_SUCCESS; i++) {
+            offsets[i] = dst->size;
+            error = write_instr(dst, &program->instrs[i], offsets);
+
+            if (program->instrs[i].op == IUAB_BYTECODE_OP_RET) {
+                break;
+            }
+        }
+    }
+
+    static const uint8_t padding[IUAB_BYTECODE_FILE_PADDING];
+    *size_dst = dst->size;
+    return error == IUAB_ERROR_SUCCESS
+               ? iuab_buffer_write(dst, padding, sizeof(padding))
+               : error;
+}
+
+// Checks that verifying the given crafted program returns the expected error.
+// Returns false if it does not.
+static bool check_crafted_program(const struct crafted_program *program) {
+    struct iuab_buffer buffer;
+    size_t size;
+    enum iuab_error error = iuab_buffer_init(&buffer);
+
+    if (error == IUAB_ERROR_SUCCESS) {
+        error = assemble(&buffer, program, &size);
+
+        if (error == IUAB_ERROR_SUCCESS) {
+            error = iuab_bytecode_verify(buffer.data, size);
+        }
+
+        iuab_buffer_fini(&buffer);
+    }
+
+    if (error != program->expected) {
+        fprintf(
+            stderr,
+            "error: %s: expected \"%s\", got \"%s\"\n",
+            program->name,
+            iuab_strerror(program->expected),
+            iuab_strerror(error)
+        );
+        return false;
+    }
+
+    return true;
+}
+
+// Checks that the programs compiled from the given source file at each
+// optimization level, if it compiles, are valid. Returns false if they are not.
+static bool check_file(const char *filename) {
+    FILE *file = fopen(filename, "rb");
+
+    if (!file) {
+        perror(filename);
+        return false;
+    }
+
+    bool is_ok = true;
+
+    for (enum iuab_opt_level level = IUAB_OPT_LEVEL_0;
+         level <= IUAB_OPT_LEVEL_2;
+         level++) {
+        struct iuab_compile_options opts;
+        iuab_compile_options_init(&opts);
+        opts.opt_level = level;
+
+        struct iuab_buffer program;
+        struct iuab_token last_token;
+        enum iuab_error error = iuab_buffer_init(&program);
+
+        if (error == IUAB_ERROR_SUCCESS) {
+            rewind(file);
+            error = iuab_compile(
+                IUAB_TARGET_BYTECODE,
+                file,
+                &opts,
+                &program,
+                &last_token
+            );
+
+            // Compilation errors are checked by the examples.
+            if (error == IUAB_ERROR_SUCCESS) {
+                error = iuab_bytecode_verify(program.data, program.size);
+            } else {
+                error = IUAB_ERROR_SUCCESS;
+            }
+
+            iuab_buffer_fini(&program);
+        }
+
+        if (error != IUAB_ERROR_SUCCESS) {
+            fprintf(
+                stderr,
+                "error: %s: -O%d: %s\n",
+                filename,
+                (int) level,
+                iuab_strerror(error)
+            );
+            is_ok = false;
+        }
+    }
+
+    fclose(file);
+    return is_ok;
+}
+
+int main(int argc, const char *argv[]) {
+    bool is_ok = true;
+
+    for (size_t i = 0; i < NUM_CRAFTED_PROGRAMS; i++) {
+        is_ok = check_crafted_program(&crafted_programs[i]) && is_ok;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        is_ok = check_file(argv[i]) && is_ok;
+    }
+
+    return is_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
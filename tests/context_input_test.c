@@ -0,0 +1,185 @@
+// Copyright (C) 2022 OverMighty
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Checks that programs read the input of input files without a file descriptor
+// and that buffered in the stream of input files, and give back the input they
+// read ahead.
+
+#include "iuab/buffer.h"
+#include "iuab/context.h"
+#include "iuab/errors.h"
+#include "iuab/targets.h"
+#include "iuab/token.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Reads two characters and writes them.
+static const char src[] = "by btw by btw";
+
+// Compiles the source code and runs the program from a context with the files
+// pointed to by `in` and `out` as input and output files. Returns the error
+// that occurred in the process.
+static enum iuab_error run(FILE *in, FILE *out) {
+    struct iuab_buffer program;
+    struct iuab_token last_token;
+    enum iuab_error error = iuab_buffer_init(&program);
+
+    if (error != IUAB_ERROR_SUCCESS) {
+        return error;
+    }
+
+    error = iuab_compile_mem(
+        IUAB_TARGET_BYTECODE,
+        src,
+        sizeof(src) - 1,
+        NULL,
+        &program,
+        &last_token
+    );
+
+    if (error == IUAB_ERROR_SUCCESS) {
+        struct iuab_context *ctx = malloc(sizeof(*ctx));
+
+        if (!ctx) {
+            error = IUAB_ERROR_MALLOC;
+        } else {
+            iuab_context_init(ctx, program.data, in, out, NULL);
+            error = iuab_run(IUAB_TARGET_BYTECODE, ctx);
+            iuab_context_fini(ctx);
+            free(ctx);
+        }
+    }
+
+    iuab_buffer_fini(&program);
+    return error;
+}
+
+// Checks that the program run with the file pointed to by `in` as input file
+// returns `expected_error` and writes `expected_output`, and that the next
+// character of the input file is `expected_next`. `name` identifies the input
+// file in error messages. Returns false if it does not.
+static bool check_run(
+    const char *name,
+    FILE *in,
+    enum iuab_error expected_error,
+    const char *expected_output,
+    int expected_next
+) {
+    char output[16] = { 0 };
+    FILE *out = tmpfile();
+
+    if (!out) {
+        perror("error: failed to create temporary file");
+        return false;
+    }
+
+    enum iuab_error error = run(in, out);
+    rewind(out);
+    size_t size = fread(output, 1, sizeof(output) - 1, out);
+    fclose(out);
+    int next = fgetc(in);
+
+    if (error != expected_error || strlen(expected_output) != size
+        || memcmp(output, expected_output, size) != 0
+        || next != expected_next) {
+        fprintf(
+            stderr,
+            "error: %s: expected \"%s\", output \"%s\" and next character %d, "
+            "got \"%s\", output \"%s\" and next character %d\n",
+            name,
+            iuab_strerror(expected_error),
+            expected_output,
+            expected_next,
+            iuab_strerror(error),
+            output,
+            next
+        );
+        return false;
+    }
+
+    return true;
+}
+
+// Checks like `check_run()` a run with a memory stream of the given input,
+// which has no file descriptor, as input file.
+static bool check_memory_stream(
+    const char *name,
+    const char *input,
+    enum iuab_error expected_error,
+    const char *expected_output,
+    int expected_next
+) {
+    char buffer[16];
+    size_t size = strlen(input);
+    memcpy(buffer, input, size);
+    FILE *in = fmemopen(buffer, size, "r");
+
+    if (!in) {
+        perror("error: failed to open memory stream");
+        return false;
+    }
+
+    bool is_ok =
+        check_run(name, in, expected_error, expected_output, expected_next);
+    fclose(in);
+    return is_ok;
+}
+
+// Checks like `check_run()` a run with a file of which the first character was
+// read through its stream, which buffers the others, as input file.
+static bool check_buffered_file(void) {
+    FILE *in = tmpfile();
+
+    if (!in || fputs("xhello", in) < 0 || fflush(in) != 0
+        || fseek(in, 0, SEEK_SET) != 0 || fgetc(in) != 'x') {
+        perror("error: failed to create temporary file");
+
+        if (in) {
+            fclose(in);
+        }
+
+        return false;
+    }
+
+    bool is_ok = check_run(
+        "file with buffered input",
+        in,
+        IUAB_ERROR_SUCCESS,
+        "he",
+        'l'
+    );
+    fclose(in);
+    return is_ok;
+}
+
+int main(void) {
+    bool is_ok = check_memory_stream(
+        "memory stream",
+        "hi",
+        IUAB_ERROR_SUCCESS,
+        "hi",
+        EOF
+    );
+    is_ok = check_memory_stream(
+                "memory stream read ahead",
+                "hello",
+                IUAB_ERROR_SUCCESS,
+                "he",
+                'l'
+            )
+            && is_ok;
+    is_ok = check_memory_stream(
+                "memory stream ending early",
+                "h",
+                IUAB_ERROR_RUNTIME_END_OF_INPUT_FILE,
+                "h",
+                EOF
+            )
+            && is_ok;
+    is_ok = check_buffered_file() && is_ok;
+    return is_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,260 @@
+// Copyright (C) 2022 OverMighty
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Checks that each lexer instruction set supported by the running CPU produces
+// the same tokens as the scalar one, from the source files given as arguments
+// and from randomly generated source code.
+
+#include "iuab/lexer.h"
+#include "iuab/token.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_GENERATED_SOURCES 2000
+#define MAX_GENERATED_PIECES 300
+#define MAX_LONG_PIECE_SIZE (3 * IUAB_LEXER_BLOCK_SIZE)
+
+static const char *const isa_names[] = { "scalar", "sse2", "avx2" };
+
+// Pieces of generated source code: keywords, invalid tokens, separators and
+// comments.
+static const char *const pieces[] = {
+    "i", "use", "arch", "linux", "btw", "by", "the", "way", "gentoo",
+    "iuse", "archi", "x", "btww", "ga", "\x80",
+    " ", "  ", "\t", "\n", "\r\n", "\r", "\n\n",
+    ";", ";;\n", "; i use arch btw\n",
+};
+
+#define NUM_PIECES (sizeof(pieces) / sizeof(pieces[0]))
+
+struct tokens {
+    struct iuab_token *data;
+    size_t size;
+    size_t cap;
+};
+
+// The tokens produced by the scalar instruction set and by the one checked.
+static struct tokens expected;
+static struct tokens actual;
+
+static uint64_t rng_state = 0x2545f4914f6cdd1d;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// Lexes the `size` bytes of source code pointed to by `src` with the given
+// instruction set into the given tokens, up to and including the end of file
+// token. Returns false if memory allocation fails.
+static bool lex(
+    const char *src,
+    size_t size,
+    enum iuab_lexer_isa isa,
+    struct tokens *tokens
+) {
+    struct iuab_lexer lexer;
+    iuab_lexer_init_mem(&lexer, src, size);
+    iuab_lexer_set_isa(&lexer, isa);
+    tokens->size = 0;
+
+    for (;;) {
+        if (tokens->size == tokens->cap) {
+            size_t cap = tokens->cap != 0 ? tokens->cap * 2 : 256;
+            struct iuab_token *data =
+                realloc(tokens->data, cap * sizeof(*data));
+
+            if (!data) {
+                iuab_lexer_fini(&lexer);
+                return false;
+            }
+
+            tokens->data = data;
+            tokens->cap = cap;
+        }
+
+        struct iuab_token token = iuab_lexer_next_token(&lexer);
+        tokens->data[tokens->size++] = token;
+
+        if (token.type == IUAB_TOKEN_EOF) {
+            break;
+        }
+    }
+
+    iuab_lexer_fini(&lexer);
+    return true;
+}
+
+static void print_token(const char *label, const struct iuab_token *token) {
+    const char *type;
+
+    switch (token->type) {
+    case IUAB_TOKEN_EOF: type = "end of file"; break;
+    case IUAB_TOKEN_INVALID: type = "invalid token"; break;
+    default: type = iuab_token_type_name(token->type); break;
+    }
+
+    fprintf(
+        stderr,
+        "  %s: %s at line %zu, col %zu\n",
+        label,
+        type,
+        token->line,
+        token->col
+    );
+}
+
+// Checks that each supported instruction set produces the same tokens from the
+// given source code as the scalar one. `name` identifies the source code in
+// error messages. Returns false if they do not, or if memory allocation fails.
+static bool check_source(const char *name, const char *src, size_t size) {
+    if (!lex(src, size, IUAB_LEXER_ISA_SCALAR, &expected)) {
+        fprintf(stderr, "error: out of memory\n");
+        return false;
+    }
+
+    for (enum iuab_lexer_isa isa = IUAB_LEXER_ISA_SCALAR + 1;
+         isa <= iuab_lexer_best_isa();
+         isa++) {
+        if (!lex(src, size, isa, &actual)) {
+            fprintf(stderr, "error: out of memory\n");
+            return false;
+        }
+
+        for (size_t i = 0; i < expected.size && i < actual.size; i++) {
+            const struct iuab_token *a = &expected.data[i];
+            const struct iuab_token *b = &actual.data[i];
+
+            if (a->type != b->type || a->line != b->line || a->col != b->col) {
+                fprintf(
+                    stderr,
+                    "error: %s: token %zu differs with %s:\n",
+                    name,
+                    i,
+                    isa_names[isa]
+                );
+                print_token(isa_names[IUAB_LEXER_ISA_SCALAR], a);
+                print_token(isa_names[isa], b);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static bool check_file(const char *filename) {
+    FILE *file = fopen(filename, "rb");
+
+    if (!file) {
+        perror(filename);
+        return false;
+    }
+
+    char *src = NULL;
+    size_t size = 0;
+    size_t cap = 0;
+    size_t n;
+
+    do {
+        if (size == cap) {
+            cap = cap != 0 ? cap * 2 : 4096;
+            char *new_src = realloc(src, cap);
+
+            if (!new_src) {
+                fprintf(stderr, "error: out of memory\n");
+                free(src);
+                fclose(file);
+                return false;
+            }
+
+            src = new_src;
+        }
+
+        n = fread(&src[size], 1, cap - size, file);
+        size += n;
+    } while (n != 0);
+
+    bool is_ok = !ferror(file);
+
+    if (!is_ok) {
+        perror(filename);
+    }
+
+    fclose(file);
+    is_ok = is_ok && check_source(filename, src, size);
+    free(src);
+    return is_ok;
+}
+
+// Generates source code into the given buffer, of which the size must be at
+// least `MAX_GENERATED_PIECES * MAX_LONG_PIECE_SIZE`. Returns its size.
+static size_t generate_source(char *src) {
+    size_t num_pieces = rng_next() % MAX_GENERATED_PIECES;
+    size_t size = 0;
+
+    for (size_t i = 0; i < num_pieces; i++) {
+        uint64_t r = rng_next();
+
+        switch (r % 16) {
+        case 0: {
+            // A long run of the same character, which tokens or separators may
+            // span blocks with.
+            static const char chars[] = { 'i', ' ', '\n', ';' };
+            size_t n = (size_t) (r >> 8) % MAX_LONG_PIECE_SIZE;
+            memset(&src[size], chars[(r >> 4) % sizeof(chars)], n);
+            size += n;
+            break;
+        }
+        case 1:
+            // Any byte, including null characters.
+            src[size++] = (char) (r >> 8);
+            break;
+        default: {
+            const char *piece = pieces[(r >> 4) % NUM_PIECES];
+            size_t n = strlen(piece);
+            memcpy(&src[size], piece, n);
+            size += n;
+            break;
+        }
+        }
+    }
+
+    return size;
+}
+
+int main(int argc, const char *argv[]) {
+    enum iuab_lexer_isa best_isa = iuab_lexer_best_isa();
+    bool is_ok = true;
+
+    printf("Checking instruction sets up to %s\n", isa_names[best_isa]);
+
+    for (int i = 1; i < argc; i++) {
+        is_ok = check_file(argv[i]) && is_ok;
+    }
+
+    char *src = malloc(MAX_GENERATED_PIECES * MAX_LONG_PIECE_SIZE);
+
+    if (!src) {
+        fprintf(stderr, "error: out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < NUM_GENERATED_SOURCES; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "generated source %zu", i);
+        is_ok = check_source(name, src, generate_source(src)) && is_ok;
+    }
+
+    free(src);
+    free(expected.data);
+    free(actual.data);
+    return is_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}